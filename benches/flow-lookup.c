@@ -0,0 +1,313 @@
+/* Flow lookup micro benchmark: old vs hot/cold split Flow layout.
+ *
+ * Standalone model of the flow hash lookup and per packet update path
+ * (FlowGetFlowFromHash / FlowCompare / FlowHandlePacketUpdate) with the
+ * Flow member order before and after the split. Both layouts have the same
+ * members, only the order (and so the padding) and the allocation alignment
+ * differ.
+ *
+ * Build & run:
+ *   gcc -O2 -o flow-lookup flow-lookup.c -lpthread
+ *   ./flow-lookup [flows] [hash rows] [lookups]
+ *
+ * NewFlow is a copy of the Flow member order of src/flow.h. In a
+ * configured tree, build with
+ *   gcc -O2 -DFLOW_H_CHECK -DHAVE_CONFIG_H -I../src -o flow-lookup \
+ *       flow-lookup.c -lpthread
+ * to check at compile time that its offsets and sizes still match.
+ *
+ * Defaults: 1M flows in a 64k row hash (so ~16 flows per row, like a busy
+ * sensor with a small hash), 20M lookups.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define CLS 64
+
+typedef struct Addr_ {
+    uint32_t a[4];
+} Addr;
+
+/* old order: header, lastts, state, tenant/proto detect, flags, lock,
+ * protoctx ... hnext far from the header, counters at the very end */
+typedef struct OldFlow_ {
+    Addr src, dst;
+    uint16_t sp, dp;
+    uint8_t proto, recursion_level;
+    uint16_t vlan_id[2];
+    uint16_t input_id;
+    uint32_t flow_hash;
+    struct timeval lastts;
+    unsigned short flow_state;
+    unsigned short use_cnt;
+    uint32_t tenant_id;
+    uint32_t probing_parser_toserver_alproto_masks;
+    uint32_t probing_parser_toclient_alproto_masks;
+    uint32_t flags;
+    uint16_t file_flags, protodetect_dp;
+    pthread_mutex_t m;
+    void *protoctx;
+    uint8_t protomap, flow_end_flags;
+    uint16_t alproto, alproto_ts, alproto_tc, alproto_orig, alproto_expect;
+    uint32_t de_ctx_version;
+    uint16_t thread_id;
+    uint8_t min_ttl_toserver, max_ttl_toserver;
+    uint8_t min_ttl_toclient, max_ttl_toclient;
+    void *alparser, *alstate;
+    const void *sgh_toclient, *sgh_toserver;
+    void *flowvar;
+    struct OldFlow_ *hnext, *hprev;
+    void *fb;
+    void *lnext, *lprev;
+    struct timeval startts;
+    uint32_t todstpktcnt, tosrcpktcnt;
+    uint64_t todstbytecnt, tosrcbytecnt;
+    uint64_t elephant_win_ms, elephant_win_bytes;
+} OldFlow;
+
+/* new order: see src/flow.h */
+typedef struct NewFlow_ {
+    Addr src, dst;
+    uint16_t sp, dp;
+    uint8_t proto, recursion_level;
+    uint16_t vlan_id[2];
+    uint16_t input_id;
+    uint32_t flags;
+    uint32_t flow_hash;
+    struct NewFlow_ *hnext;
+
+    struct timeval lastts;
+    unsigned short flow_state;
+    unsigned short use_cnt;
+    uint32_t todstpktcnt, tosrcpktcnt;
+    uint64_t todstbytecnt, tosrcbytecnt;
+    void *protoctx;
+    uint8_t min_ttl_toserver, max_ttl_toserver;
+    uint8_t min_ttl_toclient, max_ttl_toclient;
+    uint8_t protomap;
+    uint16_t thread_id;
+
+    pthread_mutex_t m;
+    uint16_t alproto, alproto_ts, alproto_tc;
+    void *alparser, *alstate;
+    uint32_t de_ctx_version;
+    const void *sgh_toclient, *sgh_toserver;
+    void *flowvar;
+    struct NewFlow_ *hprev;
+    void *fb;
+    void *lnext, *lprev;
+
+    struct timeval startts;
+    uint64_t elephant_win_ms, elephant_win_bytes;
+    uint32_t tenant_id;
+    uint32_t probing_parser_toserver_alproto_masks;
+    uint32_t probing_parser_toclient_alproto_masks;
+    uint16_t file_flags, protodetect_dp;
+    uint16_t alproto_orig, alproto_expect;
+    uint8_t flow_end_flags;
+} NewFlow;
+
+#ifdef FLOW_H_CHECK
+/* NewFlow has to match src/flow.h. Checked at compile time when built
+ * in a configured tree with FLOW_H_CHECK, see the top of the file. */
+#include "suricata-common.h"
+#include "flow.h"
+
+#define CHECK(name, expr) typedef char flow_h_check_##name[(expr) ? 1 : -1]
+#define CHECK_AS(m, fm) CHECK(m, offsetof(NewFlow, m) == offsetof(Flow, fm) && \
+        sizeof(((NewFlow *)0)->m) == sizeof(((Flow *)0)->fm))
+#define CHECK_MEMBER(m) CHECK_AS(m, m)
+
+CHECK_MEMBER(src); CHECK_MEMBER(dst); CHECK_MEMBER(sp); CHECK_MEMBER(dp);
+CHECK_MEMBER(proto); CHECK_MEMBER(recursion_level); CHECK_MEMBER(vlan_id);
+CHECK_MEMBER(input_id); CHECK_MEMBER(flags); CHECK_MEMBER(flow_hash);
+CHECK_MEMBER(hnext);
+CHECK_MEMBER(lastts); CHECK_AS(flow_state, flow_state_sc_atomic__);
+CHECK_AS(use_cnt, use_cnt_sc_atomic__);
+CHECK_MEMBER(todstpktcnt); CHECK_MEMBER(tosrcpktcnt);
+CHECK_MEMBER(todstbytecnt); CHECK_MEMBER(tosrcbytecnt);
+CHECK_MEMBER(protoctx); CHECK_MEMBER(min_ttl_toserver);
+CHECK_MEMBER(max_ttl_toserver); CHECK_MEMBER(min_ttl_toclient);
+CHECK_MEMBER(max_ttl_toclient); CHECK_MEMBER(protomap);
+CHECK_MEMBER(thread_id);
+CHECK_MEMBER(m); CHECK_MEMBER(alproto); CHECK_MEMBER(alproto_ts);
+CHECK_MEMBER(alproto_tc); CHECK_MEMBER(alparser); CHECK_MEMBER(alstate);
+CHECK_MEMBER(de_ctx_version); CHECK_MEMBER(sgh_toclient);
+CHECK_MEMBER(sgh_toserver); CHECK_MEMBER(flowvar); CHECK_MEMBER(hprev);
+CHECK_MEMBER(fb); CHECK_MEMBER(lnext); CHECK_MEMBER(lprev);
+CHECK_MEMBER(startts); CHECK_MEMBER(elephant_win_ms);
+CHECK_MEMBER(elephant_win_bytes); CHECK_MEMBER(tenant_id);
+CHECK_MEMBER(probing_parser_toserver_alproto_masks);
+CHECK_MEMBER(probing_parser_toclient_alproto_masks);
+CHECK_MEMBER(file_flags); CHECK_MEMBER(protodetect_dp);
+CHECK_MEMBER(alproto_orig); CHECK_MEMBER(alproto_expect);
+CHECK_MEMBER(flow_end_flags);
+CHECK(size, sizeof(NewFlow) == sizeof(Flow));
+#endif /* FLOW_H_CHECK */
+
+typedef struct Key_ {
+    Addr src, dst;
+    uint16_t sp, dp;
+    uint8_t proto;
+    uint32_t hash;
+    uint32_t len;
+} Key;
+
+static uint32_t rnd_state = 2463534242U;
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static uint32_t hash_key(const Key *k)
+{
+    uint32_t h = k->src.a[0] ^ k->dst.a[0] ^ ((uint32_t)k->sp << 16 | k->dp) ^ k->proto;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* generates Setup/Lookup for one layout, both the same code */
+#define BENCH(T, align)                                                     \
+static T **T##_hash;                                                        \
+static T *T##_flows;                                                        \
+                                                                            \
+static void T##Setup(const Key *keys, const uint32_t *perm,                 \
+        uint32_t nflows, uint32_t rows)                                     \
+{                                                                           \
+    uint32_t i;                                                             \
+    T##_hash = calloc(rows, sizeof(T *));                                   \
+    if ((align)) {                                                          \
+        if (posix_memalign((void **)&T##_flows, CLS, nflows * sizeof(T)) != 0) \
+            exit(EXIT_FAILURE);                                             \
+    } else {                                                                \
+        /* malloc alignment as with the old FlowAlloc */                    \
+        T##_flows = (T *)((char *)malloc(nflows * sizeof(T) + 16) + 16);    \
+    }                                                                       \
+    memset(T##_flows, 0, nflows * sizeof(T));                               \
+    /* flows were allocated over time, so they are spread over the \
+     * allocation in random order */                                      \
+    for (i = 0; i < nflows; i++) {                                          \
+        T *f = &T##_flows[perm[i]];                                         \
+        f->src = keys[i].src; f->dst = keys[i].dst;                         \
+        f->sp = keys[i].sp; f->dp = keys[i].dp;                             \
+        f->proto = keys[i].proto;                                           \
+        f->flow_hash = keys[i].hash;                                        \
+        pthread_mutex_init(&f->m, NULL);                                    \
+        uint32_t r = keys[i].hash % rows;                                   \
+        f->hnext = T##_hash[r];                                             \
+        T##_hash[r] = f;                                                    \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static uint64_t T##Lookup(const Key *k, struct timeval *ts, uint32_t rows) \
+{                                                                           \
+    T *f = T##_hash[k->hash % rows];                                        \
+    for ( ; f != NULL; f = f->hnext) {                                      \
+        if (f->src.a[0] == k->src.a[0] && f->dst.a[0] == k->dst.a[0] &&     \
+            f->sp == k->sp && f->dp == k->dp && f->proto == k->proto &&     \
+            f->recursion_level == 0 && f->vlan_id[0] == 0 &&                \
+            f->vlan_id[1] == 0 && f->input_id == 0 &&                       \
+            !(f->flags & 0x1))                                              \
+            break;                                                          \
+    }                                                                       \
+    if (f == NULL)                                                          \
+        return 0;                                                           \
+    f->use_cnt++;                                                           \
+    pthread_mutex_lock(&f->m);                                              \
+    if (f->flow_state != 4)                                                 \
+        f->lastts = *ts;                                                    \
+    f->todstpktcnt++;                                                       \
+    f->todstbytecnt += k->len;                                              \
+    f->flags |= 0x2;                                                        \
+    if (f->min_ttl_toserver == 0 || f->min_ttl_toserver > 64)               \
+        f->min_ttl_toserver = 64;                                           \
+    uint64_t r = (uintptr_t)f->protoctx + f->thread_id;                     \
+    pthread_mutex_unlock(&f->m);                                            \
+    f->use_cnt--;                                                           \
+    return r + 1;                                                           \
+}
+
+BENCH(OldFlow, 0)
+BENCH(NewFlow, 1)
+
+int main(int argc, char *argv[])
+{
+    uint32_t nflows = argc > 1 ? (uint32_t)atoi(argv[1]) : 1000000;
+    uint32_t rows = argc > 2 ? (uint32_t)atoi(argv[2]) : 65536;
+    uint32_t nlookups = argc > 3 ? (uint32_t)atoi(argv[3]) : 20000000;
+    uint32_t i;
+
+    printf("sizeof(OldFlow) %u, sizeof(NewFlow) %u\n",
+            (unsigned)sizeof(OldFlow), (unsigned)sizeof(NewFlow));
+    printf("%u flows, %u hash rows, %u lookups\n", nflows, rows, nlookups);
+
+    Key *keys = calloc(nflows, sizeof(Key));
+    uint32_t *perm = malloc(nflows * sizeof(uint32_t));
+    uint32_t *order = malloc(nlookups * sizeof(uint32_t));
+    if (keys == NULL || perm == NULL || order == NULL)
+        exit(EXIT_FAILURE);
+
+    for (i = 0; i < nflows; i++) {
+        keys[i].src.a[0] = 0x0a000000 | (i >> 8);
+        keys[i].dst.a[0] = 0xc0a80000 | (rnd() & 0xffff);
+        keys[i].sp = 1024 + (i & 0xff) * 64 + (rnd() & 0x3f);
+        keys[i].dp = (rnd() & 1) ? 80 : 443;
+        keys[i].proto = 6;
+        keys[i].hash = hash_key(&keys[i]);
+        keys[i].len = 64 + (rnd() & 0x3ff);
+    }
+    for (i = 0; i < nflows; i++)
+        perm[i] = i;
+    for (i = nflows - 1; i > 0; i--) {
+        uint32_t j = rnd() % (i + 1);
+        uint32_t t = perm[i];
+        perm[i] = perm[j];
+        perm[j] = t;
+    }
+    for (i = 0; i < nlookups; i++)
+        order[i] = rnd() % nflows;
+
+    OldFlowSetup(keys, perm, nflows, rows);
+    NewFlowSetup(keys, perm, nflows, rows);
+
+    struct timeval ts = { 1, 0 };
+    uint64_t sum = 0;
+    double t0, t1, t2;
+    int run;
+
+    for (run = 0; run < 3; run++) {
+        t0 = now();
+        for (i = 0; i < nlookups; i++)
+            sum += OldFlowLookup(&keys[order[i]], &ts, rows);
+        t1 = now();
+        for (i = 0; i < nlookups; i++)
+            sum += NewFlowLookup(&keys[order[i]], &ts, rows);
+        t2 = now();
+
+        printf("run %d: old %.1f ns/pkt, new %.1f ns/pkt\n", run,
+                (t1 - t0) * 1e9 / nlookups, (t2 - t1) * 1e9 / nlookups);
+    }
+    printf("(checksum %llu)\n", (unsigned long long)sum);
+
+    exit(0);
+}
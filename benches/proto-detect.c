@@ -0,0 +1,335 @@
+/* Protocol detection micro benchmark: pattern confirmation per new flow.
+ *
+ * Models the pattern part of AppLayerProtoDetectGetProto for the first
+ * toserver payload of a TCP flow: a multi pattern prefilter over the first
+ * max depth bytes, then a confirmation of each signature that was hit
+ * against its depth/offset window. The old confirmation did a SPM scan of
+ * the window for every signature and kept going after the first protocol.
+ * The new one compares anchored patterns (window == pattern) at their
+ * offset, only scans the others, and stops at the first confirmed protocol.
+ * The prefilter is the same for both, so the difference is what the
+ * confirmation costs.
+ *
+ * The patterns are the TCP toserver ones the parsers register. The
+ * payloads are recorded first payloads of common protocols plus some that
+ * don't match anything; files given on the command line are used instead,
+ * one first payload per file.
+ *
+ * Build & run:
+ *   gcc -O2 -o proto-detect proto-detect.c
+ *   ./proto-detect [rounds] [payload file ...]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+typedef struct Sig_ {
+    int alproto;
+    const char *name;
+    const uint8_t *content;
+    uint16_t content_len;
+    uint16_t depth;
+    uint16_t offset;
+    int nocase;
+    int anchored;
+} Sig;
+
+#define S(p, n, c, d, o, ci) { p, n, (const uint8_t *)c, sizeof(c) - 1, d, o, ci, 0 }
+
+static Sig sigs[] = {
+    S(1, "http", "GET ", 4, 0, 1), S(1, "http", "GET\t", 4, 0, 1),
+    S(1, "http", "POST ", 5, 0, 1), S(1, "http", "POST\t", 5, 0, 1),
+    S(1, "http", "HEAD ", 5, 0, 1), S(1, "http", "PUT ", 4, 0, 1),
+    S(1, "http", "OPTIONS ", 8, 0, 1), S(1, "http", "CONNECT ", 8, 0, 1),
+    S(2, "ftp", "FEAT", 4, 0, 1), S(2, "ftp", "USER ", 5, 0, 1),
+    S(2, "ftp", "PASS ", 5, 0, 1), S(2, "ftp", "PORT ", 5, 0, 1),
+    S(3, "smtp", "EHLO", 4, 0, 1), S(3, "smtp", "HELO", 4, 0, 1),
+    S(3, "smtp", "QUIT", 4, 0, 1),
+    S(4, "ssh", "SSH-", 4, 0, 1),
+    S(5, "tls", "\x01\x00\x02", 5, 2, 0), S(5, "tls", "\x01\x03\x00", 3, 0, 0),
+    S(5, "tls", "\x16\x03\x00", 3, 0, 0), S(5, "tls", "\x01\x03\x01", 3, 0, 0),
+    S(5, "tls", "\x16\x03\x01", 3, 0, 0), S(5, "tls", "\x01\x03\x02", 3, 0, 0),
+    S(5, "tls", "\x16\x03\x02", 3, 0, 0), S(5, "tls", "\x01\x03\x03", 3, 0, 0),
+    S(5, "tls", "\x16\x03\x03", 3, 0, 0),
+    S(6, "smb", "\xff" "SMB", 8, 4, 0), S(7, "smb2", "\xfe" "SMB", 8, 4, 0),
+    S(8, "dcerpc", "\x05\x00", 2, 0, 0),
+    S(9, "imap", "1 capability", 12, 0, 0),
+    S(10, "msn", "msn", 10, 6, 0),
+};
+#define NSIGS (sizeof(sigs) / sizeof(sigs[0]))
+
+typedef struct Payload_ {
+    uint8_t *buf;
+    uint16_t len;
+} Payload;
+
+#define P(s) { (uint8_t *)s, sizeof(s) - 1 }
+
+static Payload default_payloads[] = {
+    P("GET /index.html HTTP/1.1\r\nHost: www.example.com\r\nUser-Agent: curl/7.52\r\n\r\n"),
+    P("POST /api/v1/upload HTTP/1.1\r\nHost: api.example.com\r\nContent-Length: 12\r\n\r\n"),
+    P("\x16\x03\x01\x02\x00\x01\x00\x01\xfc\x03\x03\x8a\x1e\x5f\x92\x4b\x33\x01\x7d"),
+    P("\x00\x00\x00\x85\xff" "SMBr\x00\x00\x00\x00\x18\x53\xc8\x00\x00\x00\x00\x00"),
+    P("\x00\x00\x00\x66\xfe" "SMB\x40\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01\x00"),
+    P("SSH-2.0-OpenSSH_7.4p1 Debian-10+deb9u2\r\n"),
+    P("EHLO mail.example.com\r\n"),
+    P("USER anonymous\r\n"),
+    P("\x05\x00\x0b\x03\x10\x00\x00\x00\x48\x00\x00\x00\x01\x00\x00\x00\xb8\x10"),
+    P("1 capability\r\n"),
+    P("\x13" "BitTorrent protocol\x00\x00\x00\x00\x00\x10\x00\x05"),
+    P("\x00\x1c\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00\x03www\x07" "example"),
+    P("xx GET / HTTP/1.0 (not http, the method is not at the start)\r\n"),
+    P("\x4a\x52\x4d\x49\x00\x02\x4b\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"),
+};
+#define NDEFAULT (sizeof(default_payloads) / sizeof(default_payloads[0]))
+
+/* prefilter: signatures bucketed by (lowercased) first pattern byte */
+static int bucket[256][NSIGS + 1];
+static uint16_t max_len = 0;
+
+static void Prepare(void)
+{
+    for (uint32_t i = 0; i < NSIGS; i++) {
+        Sig *s = &sigs[i];
+        s->anchored = (s->depth - s->offset == s->content_len);
+        if (s->depth > max_len)
+            max_len = s->depth;
+
+        int c = s->content[0];
+        int cs[2] = { s->nocase ? tolower(c) : c, s->nocase ? toupper(c) : c };
+        for (int k = 0; k < (cs[0] == cs[1] ? 1 : 2); k++) {
+            int *b = bucket[cs[k]];
+            while (*b)
+                b++;
+            *b = i + 1;
+        }
+    }
+}
+
+static int Cmp(const Sig *s, const uint8_t *buf)
+{
+    if (!s->nocase)
+        return memcmp(s->content, buf, s->content_len);
+    for (uint16_t u = 0; u < s->content_len; u++) {
+        if (tolower(s->content[u]) != tolower(buf[u]))
+            return 1;
+    }
+    return 0;
+}
+
+/* sigs hit anywhere in the first max_len bytes, unique, in hit order */
+static uint32_t Prefilter(const uint8_t *buf, uint16_t len, uint8_t *hit, int *hits)
+{
+    uint32_t nhits = 0;
+    if (len > max_len)
+        len = max_len;
+    memset(hit, 0, NSIGS);
+    for (uint16_t i = 0; i < len; i++) {
+        for (const int *b = bucket[buf[i]]; *b; b++) {
+            const Sig *s = &sigs[*b - 1];
+            if (hit[*b - 1] || i + s->content_len > len)
+                continue;
+            if (Cmp(s, buf + i) == 0) {
+                hit[*b - 1] = 1;
+                hits[nhits++] = *b - 1;
+            }
+        }
+    }
+    return nhits;
+}
+
+/* the spm: Horspool scan of the window for the pattern, called through
+ * a pointer like SpmScan calls the matcher */
+static uint8_t skip[NSIGS][256];
+
+static void PrepareScan(void)
+{
+    for (uint32_t i = 0; i < NSIGS; i++) {
+        const Sig *s = &sigs[i];
+        memset(skip[i], s->content_len, 256);
+        for (uint16_t u = 0; u + 1 < s->content_len; u++) {
+            uint8_t c = s->content[u];
+            skip[i][c] = s->content_len - 1 - u;
+            if (s->nocase) {
+                skip[i][tolower(c)] = s->content_len - 1 - u;
+                skip[i][toupper(c)] = s->content_len - 1 - u;
+            }
+        }
+    }
+}
+
+static int __attribute__((noinline)) Horspool(const Sig *s, const uint8_t *buf, uint16_t len)
+{
+    const uint8_t *sk = skip[s - sigs];
+    uint16_t i = 0;
+    while (i + s->content_len <= len) {
+        if (Cmp(s, buf + i) == 0)
+            return 1;
+        i += sk[buf[i + s->content_len - 1]];
+    }
+    return 0;
+}
+
+static int (* volatile ScanFunc)(const Sig *, const uint8_t *, uint16_t) = Horspool;
+
+static int Scan(const Sig *s, const uint8_t *buf, uint16_t len)
+{
+    return ScanFunc(s, buf, len);
+}
+
+static int ConfirmOld(const int *hits, uint32_t nhits, const uint8_t *buf, uint16_t len)
+{
+    int first = 0;
+    uint8_t seen[16] = { 0 };
+    for (uint32_t i = 0; i < nhits; i++) {
+        const Sig *s = &sigs[hits[i]];
+        if (s->offset > len || s->depth > len)
+            continue;
+        if (Scan(s, buf + s->offset, s->depth - s->offset) && !seen[s->alproto]) {
+            seen[s->alproto] = 1;
+            if (first == 0)
+                first = s->alproto;
+        }
+    }
+    return first;
+}
+
+static int ConfirmNew(const int *hits, uint32_t nhits, const uint8_t *buf, uint16_t len)
+{
+    for (uint32_t i = 0; i < nhits; i++) {
+        const Sig *s = &sigs[hits[i]];
+        if (s->offset > len || s->depth > len)
+            continue;
+        int r = s->anchored ? (Cmp(s, buf + s->offset) == 0) :
+                              Scan(s, buf + s->offset, s->depth - s->offset);
+        if (r)
+            return s->alproto;
+    }
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile int sink;
+
+typedef struct Hits_ {
+    int hits[NSIGS];
+    uint32_t nhits;
+} Hits;
+
+static double RunPrefilter(const Payload *p, uint32_t np, uint32_t rounds, Hits *h)
+{
+    uint8_t hit[NSIGS];
+
+    double start = now();
+    for (uint32_t r = 0; r < rounds; r++) {
+        for (uint32_t i = 0; i < np; i++) {
+            h[i].nhits = Prefilter(p[i].buf, p[i].len, hit, h[i].hits);
+            sink += h[i].nhits;
+        }
+    }
+    return (now() - start) * 1e9 / ((double)rounds * np);
+}
+
+static double RunConfirm(int (*Confirm)(const int *, uint32_t, const uint8_t *, uint16_t),
+        const Payload *p, const Hits *h, uint32_t np, uint32_t rounds, int *results)
+{
+    double start = now();
+    for (uint32_t r = 0; r < rounds; r++) {
+        for (uint32_t i = 0; i < np; i++) {
+            uint16_t len = p[i].len > max_len ? max_len : p[i].len;
+            int alproto = h[i].nhits ? Confirm(h[i].hits, h[i].nhits, p[i].buf, len) : 0;
+            results[i] = alproto;
+            sink += alproto;
+        }
+    }
+    return (now() - start) * 1e9 / ((double)rounds * np);
+}
+
+static const char *Name(int alproto)
+{
+    for (uint32_t i = 0; i < NSIGS; i++) {
+        if (sigs[i].alproto == alproto)
+            return sigs[i].name;
+    }
+    return "unknown";
+}
+
+static int Load(const char *path, Payload *p)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+    p->buf = malloc(65535);
+    if (p->buf == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    p->len = (uint16_t)fread(p->buf, 1, 65535, fp);
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t rounds = argc > 1 ? (uint32_t)atoi(argv[1]) : 200000;
+    Payload *payloads = default_payloads;
+    uint32_t np = NDEFAULT;
+
+    if (argc > 2) {
+        np = argc - 2;
+        payloads = calloc(np, sizeof(*payloads));
+        if (payloads == NULL)
+            exit(1);
+        for (uint32_t i = 0; i < np; i++) {
+            if (Load(argv[i + 2], &payloads[i]) < 0) {
+                fprintf(stderr, "can't read %s\n", argv[i + 2]);
+                exit(1);
+            }
+        }
+    }
+
+    Prepare();
+    PrepareScan();
+
+    int *old_res = calloc(np, sizeof(int));
+    int *new_res = calloc(np, sizeof(int));
+    Hits *hits = calloc(np, sizeof(Hits));
+    if (old_res == NULL || new_res == NULL || hits == NULL)
+        exit(1);
+
+    /* best of 3, alternating, so neither side gets the warm caches */
+    double pf_ns = 0, old_ns = 0, new_ns = 0;
+    for (int i = 0; i < 3; i++) {
+        double t = RunPrefilter(payloads, np, rounds, hits);
+        pf_ns = (i == 0 || t < pf_ns) ? t : pf_ns;
+        t = RunConfirm(ConfirmOld, payloads, hits, np, rounds, old_res);
+        old_ns = (i == 0 || t < old_ns) ? t : old_ns;
+        t = RunConfirm(ConfirmNew, payloads, hits, np, rounds, new_res);
+        new_ns = (i == 0 || t < new_ns) ? t : new_ns;
+    }
+
+    for (uint32_t i = 0; i < np; i++) {
+        printf("payload %2u: %-8s%s\n", i, Name(new_res[i]),
+                old_res[i] != new_res[i] ? " MISMATCH" : "");
+    }
+    printf("%u payloads, %u rounds: prefilter %6.1f ns/flow\n", np, rounds, pf_ns);
+    printf("  spm confirm of every hit:               %6.1f ns/flow (%6.1f total)\n",
+            old_ns, pf_ns + old_ns);
+    printf("  anchored compare, stop at first proto:  %6.1f ns/flow (%6.1f total)\n",
+            new_ns, pf_ns + new_ns);
+
+    free(hits);
+    free(old_res);
+    free(new_res);
+    exit(0);
+}
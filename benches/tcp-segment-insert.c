@@ -0,0 +1,470 @@
+/* TCP segment insert stress benchmark: list walk vs segment tree.
+ *
+ * Inserts heavily reordered segments into a stream's segment store and
+ * reports the insert latency, with the linked list walk DoInsertSegment
+ * used to do and with the red-black tree index it uses now. The tree
+ * code is a copy of the one in src/stream-tcp-list.c, the segment and
+ * stream structures are cut down to what the insert touches.
+ *
+ * Build & run:
+ *   gcc -O2 -o tcp-segment-insert tcp-segment-insert.c
+ *   ./tcp-segment-insert [segments] [rounds]
+ *
+ * Each round inserts 'segments' 100 byte segments in random order, and
+ * with every other segment first and then the gaps in order, like on a
+ * lossy satellite link or in an evasion attempt. Defaults: 1000, 5000
+ * and 20000 segments.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define SEQ_LT(a,b)  ((int32_t)((a) - (b)) <  0)
+#define SEQ_GT(a,b)  ((int32_t)((a) - (b)) >  0)
+#define SEQ_GEQ(a,b) ((int32_t)((a) - (b)) >= 0)
+
+typedef struct TcpSegment_ {
+    uint16_t payload_len;
+    uint32_t seq;
+    uint8_t tree_color;
+    struct TcpSegment_ *next;
+    struct TcpSegment_ *prev;
+    struct TcpSegment_ *tree_left;
+    struct TcpSegment_ *tree_right;
+    struct TcpSegment_ *tree_parent;
+} TcpSegment;
+
+typedef struct TcpStream_ {
+    TcpSegment *seg_list;
+    TcpSegment *seg_list_tail;
+    TcpSegment *seg_tree;
+} TcpStream;
+
+#define TCP_SEG_LEN(seg)        (seg)->payload_len
+#define SEG_SEQ_RIGHT_EDGE(seg) ((seg)->seq + TCP_SEG_LEN((seg)))
+
+/* copied from src/stream-tcp-list.c */
+
+#define SEG_TREE_BLACK  0
+#define SEG_TREE_RED    1
+
+#define SEG_TREE_IS_RED(seg) ((seg) != NULL && (seg)->tree_color == SEG_TREE_RED)
+
+/** \internal
+ *  \brief put 'new' in the place of 'old' in old's parent, or at the root */
+static inline void SegTreeReplaceChild(TcpStream *stream, TcpSegment *parent,
+        TcpSegment *old, TcpSegment *new)
+{
+    if (parent == NULL)
+        stream->seg_tree = new;
+    else if (parent->tree_left == old)
+        parent->tree_left = new;
+    else
+        parent->tree_right = new;
+}
+
+static void SegTreeRotateLeft(TcpStream *stream, TcpSegment *x)
+{
+    TcpSegment *y = x->tree_right;
+
+    x->tree_right = y->tree_left;
+    if (y->tree_left != NULL)
+        y->tree_left->tree_parent = x;
+
+    y->tree_parent = x->tree_parent;
+    SegTreeReplaceChild(stream, x->tree_parent, x, y);
+
+    y->tree_left = x;
+    x->tree_parent = y;
+}
+
+static void SegTreeRotateRight(TcpStream *stream, TcpSegment *x)
+{
+    TcpSegment *y = x->tree_left;
+
+    x->tree_left = y->tree_right;
+    if (y->tree_right != NULL)
+        y->tree_right->tree_parent = x;
+
+    y->tree_parent = x->tree_parent;
+    SegTreeReplaceChild(stream, x->tree_parent, x, y);
+
+    y->tree_right = x;
+    x->tree_parent = y;
+}
+
+/** \internal
+ *  \brief find the first segment with a seq beyond 'seq'
+ *
+ *  \param parent set to the node to attach a new segment with this seq to
+ *
+ *  \retval seg segment to insert before, or NULL to append
+ */
+static TcpSegment *SegTreeFindNext(const TcpStream *stream, uint32_t seq,
+        TcpSegment **parent)
+{
+    TcpSegment *node = stream->seg_tree;
+    TcpSegment *next = NULL;
+
+    *parent = NULL;
+    while (node != NULL) {
+        *parent = node;
+        if (SEQ_LT(seq, node->seq)) {
+            next = node;
+            node = node->tree_left;
+        } else {
+            node = node->tree_right;
+        }
+    }
+    return next;
+}
+
+/** \internal
+ *  \brief add a segment to the tree below 'parent', as returned by
+ *         SegTreeFindNext, and rebalance */
+static void SegTreeInsert(TcpStream *stream, TcpSegment *seg, TcpSegment *parent)
+{
+    seg->tree_left = seg->tree_right = NULL;
+    seg->tree_parent = parent;
+    seg->tree_color = SEG_TREE_RED;
+
+    if (parent == NULL)
+        stream->seg_tree = seg;
+    else if (SEQ_LT(seg->seq, parent->seq))
+        parent->tree_left = seg;
+    else
+        parent->tree_right = seg;
+
+    while ((parent = seg->tree_parent) != NULL && parent->tree_color == SEG_TREE_RED) {
+        /* parent is red so it is not the root */
+        TcpSegment *gparent = parent->tree_parent;
+
+        if (parent == gparent->tree_left) {
+            TcpSegment *uncle = gparent->tree_right;
+            if (SEG_TREE_IS_RED(uncle)) {
+                uncle->tree_color = SEG_TREE_BLACK;
+                parent->tree_color = SEG_TREE_BLACK;
+                gparent->tree_color = SEG_TREE_RED;
+                seg = gparent;
+                continue;
+            }
+            if (seg == parent->tree_right) {
+                SegTreeRotateLeft(stream, parent);
+                seg = parent;
+                parent = seg->tree_parent;
+            }
+            parent->tree_color = SEG_TREE_BLACK;
+            gparent->tree_color = SEG_TREE_RED;
+            SegTreeRotateRight(stream, gparent);
+        } else {
+            TcpSegment *uncle = gparent->tree_left;
+            if (SEG_TREE_IS_RED(uncle)) {
+                uncle->tree_color = SEG_TREE_BLACK;
+                parent->tree_color = SEG_TREE_BLACK;
+                gparent->tree_color = SEG_TREE_RED;
+                seg = gparent;
+                continue;
+            }
+            if (seg == parent->tree_left) {
+                SegTreeRotateRight(stream, parent);
+                seg = parent;
+                parent = seg->tree_parent;
+            }
+            parent->tree_color = SEG_TREE_BLACK;
+            gparent->tree_color = SEG_TREE_RED;
+            SegTreeRotateLeft(stream, gparent);
+        }
+    }
+    stream->seg_tree->tree_color = SEG_TREE_BLACK;
+}
+
+/** \internal
+ *  \brief restore the red-black properties after removing a black node
+ *
+ *  \param x node that took the removed node's place, may be NULL
+ *  \param parent parent of x
+ */
+static void SegTreeRemoveFixup(TcpStream *stream, TcpSegment *x, TcpSegment *parent)
+{
+    while (x != stream->seg_tree && !SEG_TREE_IS_RED(x)) {
+        if (x == parent->tree_left) {
+            TcpSegment *w = parent->tree_right;
+            if (w->tree_color == SEG_TREE_RED) {
+                w->tree_color = SEG_TREE_BLACK;
+                parent->tree_color = SEG_TREE_RED;
+                SegTreeRotateLeft(stream, parent);
+                w = parent->tree_right;
+            }
+            if (!SEG_TREE_IS_RED(w->tree_left) && !SEG_TREE_IS_RED(w->tree_right)) {
+                w->tree_color = SEG_TREE_RED;
+                x = parent;
+                parent = x->tree_parent;
+            } else {
+                if (!SEG_TREE_IS_RED(w->tree_right)) {
+                    w->tree_left->tree_color = SEG_TREE_BLACK;
+                    w->tree_color = SEG_TREE_RED;
+                    SegTreeRotateRight(stream, w);
+                    w = parent->tree_right;
+                }
+                w->tree_color = parent->tree_color;
+                parent->tree_color = SEG_TREE_BLACK;
+                w->tree_right->tree_color = SEG_TREE_BLACK;
+                SegTreeRotateLeft(stream, parent);
+                x = stream->seg_tree;
+                break;
+            }
+        } else {
+            TcpSegment *w = parent->tree_left;
+            if (w->tree_color == SEG_TREE_RED) {
+                w->tree_color = SEG_TREE_BLACK;
+                parent->tree_color = SEG_TREE_RED;
+                SegTreeRotateRight(stream, parent);
+                w = parent->tree_left;
+            }
+            if (!SEG_TREE_IS_RED(w->tree_left) && !SEG_TREE_IS_RED(w->tree_right)) {
+                w->tree_color = SEG_TREE_RED;
+                x = parent;
+                parent = x->tree_parent;
+            } else {
+                if (!SEG_TREE_IS_RED(w->tree_left)) {
+                    w->tree_right->tree_color = SEG_TREE_BLACK;
+                    w->tree_color = SEG_TREE_RED;
+                    SegTreeRotateLeft(stream, w);
+                    w = parent->tree_left;
+                }
+                w->tree_color = parent->tree_color;
+                parent->tree_color = SEG_TREE_BLACK;
+                w->tree_left->tree_color = SEG_TREE_BLACK;
+                SegTreeRotateRight(stream, parent);
+                x = stream->seg_tree;
+                break;
+            }
+        }
+    }
+    if (x != NULL)
+        x->tree_color = SEG_TREE_BLACK;
+}
+
+/** \internal
+ *  \brief remove a segment from the tree and rebalance */
+static void SegTreeRemove(TcpStream *stream, TcpSegment *seg)
+{
+    TcpSegment *child, *parent;
+    uint8_t color;
+
+    if (seg->tree_left != NULL && seg->tree_right != NULL) {
+        /* two children: the in order successor takes seg's place */
+        TcpSegment *next = seg->tree_right;
+        while (next->tree_left != NULL)
+            next = next->tree_left;
+
+        child = next->tree_right;
+        color = next->tree_color;
+
+        if (next->tree_parent == seg) {
+            parent = next;
+        } else {
+            parent = next->tree_parent;
+            parent->tree_left = child;
+            if (child != NULL)
+                child->tree_parent = parent;
+            next->tree_right = seg->tree_right;
+            seg->tree_right->tree_parent = next;
+        }
+
+        next->tree_parent = seg->tree_parent;
+        SegTreeReplaceChild(stream, seg->tree_parent, seg, next);
+        next->tree_left = seg->tree_left;
+        seg->tree_left->tree_parent = next;
+        next->tree_color = seg->tree_color;
+    } else {
+        child = seg->tree_left != NULL ? seg->tree_left : seg->tree_right;
+        parent = seg->tree_parent;
+        color = seg->tree_color;
+
+        if (child != NULL)
+            child->tree_parent = parent;
+        SegTreeReplaceChild(stream, parent, seg, child);
+    }
+
+    if (color == SEG_TREE_BLACK)
+        SegTreeRemoveFixup(stream, child, parent);
+
+    seg->tree_left = seg->tree_right = seg->tree_parent = NULL;
+}
+
+/* the list insert as DoInsertSegment did it before the tree */
+static void ListInsert(TcpStream *stream, TcpSegment *seg)
+{
+    if (stream->seg_list == NULL) {
+        stream->seg_list = stream->seg_list_tail = seg;
+        return;
+    }
+    if (SEQ_GEQ(seg->seq, SEG_SEQ_RIGHT_EDGE(stream->seg_list_tail))) {
+        stream->seg_list_tail->next = seg;
+        seg->prev = stream->seg_list_tail;
+        stream->seg_list_tail = seg;
+        return;
+    }
+    TcpSegment *list_seg;
+    for (list_seg = stream->seg_list; list_seg != NULL; list_seg = list_seg->next) {
+        if (SEQ_LT(seg->seq, list_seg->seq)) {
+            if (list_seg->prev != NULL)
+                list_seg->prev->next = seg;
+            else
+                stream->seg_list = seg;
+            seg->prev = list_seg->prev;
+            seg->next = list_seg;
+            list_seg->prev = seg;
+            return;
+        }
+    }
+    seg->prev = stream->seg_list_tail;
+    stream->seg_list_tail->next = seg;
+    stream->seg_list_tail = seg;
+}
+
+/* the tree insert as DoInsertSegment does it now */
+static void TreeInsert(TcpStream *stream, TcpSegment *seg)
+{
+    TcpSegment *parent;
+    TcpSegment *list_seg;
+    if (stream->seg_list_tail != NULL && SEQ_GEQ(seg->seq, stream->seg_list_tail->seq)) {
+        list_seg = NULL;
+        parent = stream->seg_list_tail;
+    } else {
+        list_seg = SegTreeFindNext(stream, seg->seq, &parent);
+    }
+    SegTreeInsert(stream, seg, parent);
+
+    if (list_seg == NULL) {
+        seg->prev = stream->seg_list_tail;
+        if (stream->seg_list_tail != NULL)
+            stream->seg_list_tail->next = seg;
+        else
+            stream->seg_list = seg;
+        stream->seg_list_tail = seg;
+        return;
+    }
+    if (list_seg->prev != NULL)
+        list_seg->prev->next = seg;
+    else
+        stream->seg_list = seg;
+    seg->prev = list_seg->prev;
+    seg->next = list_seg;
+    list_seg->prev = seg;
+}
+
+static uint32_t rnd_state = 2463534242U;
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double Run(void (*Insert)(TcpStream *, TcpSegment *),
+        TcpSegment *segs, const uint32_t *order, uint32_t nsegs, uint32_t rounds)
+{
+    double total = 0;
+    uint32_t r, i;
+
+    for (r = 0; r < rounds; r++) {
+        TcpStream stream;
+        memset(&stream, 0, sizeof(stream));
+        memset(segs, 0, nsegs * sizeof(TcpSegment));
+
+        /* isn close to wrapping, like the unittests do */
+        const uint32_t isn = UINT32_MAX - 1000;
+        double t0 = now();
+        for (i = 0; i < nsegs; i++) {
+            TcpSegment *seg = &segs[i];
+            seg->seq = isn + order[i] * 100;
+            seg->payload_len = 100;
+            Insert(&stream, seg);
+        }
+        total += now() - t0;
+
+        /* sanity check the result */
+        TcpSegment *seg;
+        for (seg = stream.seg_list; seg != NULL && seg->next != NULL; seg = seg->next) {
+            if (SEQ_GT(seg->seq, seg->next->seq)) {
+                printf("list out of order\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (stream.seg_tree != NULL) {
+            for (seg = stream.seg_list; seg != NULL; seg = seg->next)
+                SegTreeRemove(&stream, seg);
+            if (stream.seg_tree != NULL) {
+                printf("tree not empty\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    return total * 1e9 / ((double)nsegs * rounds);
+}
+
+static void Bench(uint32_t nsegs, uint32_t rounds)
+{
+    TcpSegment *segs = malloc(nsegs * sizeof(TcpSegment));
+    uint32_t *order = malloc(nsegs * sizeof(uint32_t));
+    uint32_t i;
+
+    if (segs == NULL || order == NULL)
+        exit(EXIT_FAILURE);
+
+    for (i = 0; i < nsegs; i++)
+        order[i] = i;
+    for (i = nsegs - 1; i > 0; i--) {
+        uint32_t j = rnd() % (i + 1);
+        uint32_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    double list_ns = Run(ListInsert, segs, order, nsegs, rounds);
+    double tree_ns = Run(TreeInsert, segs, order, nsegs, rounds);
+    printf("%6u segments, random order: list %9.1f ns/insert, tree %6.1f ns/insert\n",
+            nsegs, list_ns, tree_ns);
+
+    /* every other segment first, then the gaps in order: each gap
+     * insert walks the list up to the gap */
+    for (i = 0; i < nsegs / 2; i++) {
+        order[i] = i * 2 + 1;
+        order[nsegs / 2 + i] = i * 2;
+    }
+    list_ns = Run(ListInsert, segs, order, nsegs / 2 * 2, rounds);
+    tree_ns = Run(TreeInsert, segs, order, nsegs / 2 * 2, rounds);
+    printf("%6u segments, gaps filled:  list %9.1f ns/insert, tree %6.1f ns/insert\n",
+            nsegs, list_ns, tree_ns);
+
+    free(segs);
+    free(order);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1) {
+        uint32_t nsegs = (uint32_t)atoi(argv[1]);
+        uint32_t rounds = argc > 2 ? (uint32_t)atoi(argv[2]) : 10;
+        Bench(nsegs, rounds);
+    } else {
+        Bench(1000, 50);
+        Bench(5000, 10);
+        Bench(20000, 2);
+    }
+
+    exit(0);
+}
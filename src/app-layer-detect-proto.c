@@ -23,6 +23,7 @@
  */
 
 #include "suricata-common.h"
+#include "suricata.h"
 #include "debug.h"
 #include "decode.h"
 #include "threads.h"
@@ -113,6 +114,9 @@ typedef struct AppLayerProtoDetectPMSignature_ {
     SigIntId id;
     /* \todo Change this into a non-pointer */
     DetectContentData *cd;
+    /* the depth/offset window is exactly the pattern, so a mpm hit is
+     * confirmed with a compare at the offset instead of a spm scan */
+    uint8_t anchored;
     struct AppLayerProtoDetectPMSignature_ *next;
 } AppLayerProtoDetectPMSignature;
 
@@ -151,6 +155,12 @@ typedef struct AppLayerProtoDetectCtx_ {
 
     AppLayerProtoDetectProbingParser *ctx_pp;
 
+    /* Port to probing parsers table per ip_proto, built from ctx_pp by
+     * AppLayerProtoDetectPrepareState. Entry 'port' points to what
+     * AppLayerProtoDetectGetProbingParsers returns for that port. NULL
+     * until built, or after a probing parser was added. */
+    AppLayerProtoDetectProbingParserPort **pp_port_map[FLOW_PROTO_DEFAULT];
+
     /* Indicates the protocols that have registered themselves
      * for protocol detection.  This table is independent of the
      * ipproto. */
@@ -165,6 +175,8 @@ struct AppLayerProtoDetectThreadCtx_ {
     /* The value 2 is for direction(0 - toserver, 1 - toclient). */
     MpmThreadCtx mpm_tctx[FLOW_PROTO_DEFAULT][2];
     SpmThreadCtx *spm_thread_ctx;
+    /* for the probing counters, may be NULL */
+    ThreadVars *tv;
 };
 
 /* The global app layer proto detection context. */
@@ -196,6 +208,15 @@ static AppProto AppLayerProtoDetectPMMatchSignature(const AppLayerProtoDetectPMS
     }
 
     uint8_t *sbuf = buf + s->cd->offset;
+    if (s->anchored) {
+        const int r = (s->cd->flags & DETECT_CONTENT_NOCASE) ?
+            SCMemcmpLowercase(s->cd->content, sbuf, s->cd->content_len) :
+            SCMemcmp(s->cd->content, sbuf, s->cd->content_len);
+        if (r == 0)
+            proto = s->alproto;
+        goto end;
+    }
+
     uint16_t sbuflen = s->cd->depth - s->cd->offset;
     SCLogDebug("s->co->offset (%"PRIu16") s->cd->depth (%"PRIu16")",
                s->cd->offset, s->cd->depth);
@@ -210,13 +231,15 @@ static AppProto AppLayerProtoDetectPMMatchSignature(const AppLayerProtoDetectPMS
 
 /** \internal
  *  \brief Run Pattern Sigs against buffer
- *  \param pm_results[out] AppProto array of size ALPROTO_MAX */
-static AppProto AppLayerProtoDetectPMGetProto(AppLayerProtoDetectThreadCtx *tctx,
-                                              Flow *f,
-                                              uint8_t *buf, uint16_t buflen,
-                                              uint8_t direction,
-                                              uint8_t ipproto,
-                                              AppProto *pm_results)
+ *  \param pm_results[out] AppProto array of size ALPROTO_MAX
+ *  \param pm_results_max stop after this many protocols are confirmed */
+static AppProto AppLayerProtoDetectPMSearch(AppLayerProtoDetectThreadCtx *tctx,
+                                            Flow *f,
+                                            uint8_t *buf, uint16_t buflen,
+                                            uint8_t direction,
+                                            uint8_t ipproto,
+                                            AppProto *pm_results,
+                                            uint16_t pm_results_max)
 {
     SCEnter();
 
@@ -274,6 +297,8 @@ static AppProto AppLayerProtoDetectPMGetProto(AppLayerProtoDetectThreadCtx *tctx
             {
                 pm_results[pm_matches++] = proto;
                 pm_results_bf[proto / 8] |= 1 << (proto % 8);
+                if (pm_matches >= pm_results_max)
+                    goto end;
             }
             s = s->next;
         }
@@ -314,6 +339,29 @@ static AppLayerProtoDetectProbingParserPort *AppLayerProtoDetectGetProbingParser
     SCReturnPtr(pp_port, "AppLayerProtoDetectProbingParserPort *");
 }
 
+/** \internal
+ *  \brief get the probing parsers for a port, from the port table if it
+ *         is built */
+static inline const AppLayerProtoDetectProbingParserPort *
+AppLayerProtoDetectLookupProbingParsers(uint8_t ipproto, uint16_t port)
+{
+    const uint8_t ipproto_map = FlowGetProtoMapping(ipproto);
+
+    if (ipproto_map < FLOW_PROTO_DEFAULT && alpd_ctx.pp_port_map[ipproto_map] != NULL)
+        return alpd_ctx.pp_port_map[ipproto_map][port];
+
+    return AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, ipproto, port);
+}
+
+/** \internal
+ *  \brief count a probing parser run for its protocol */
+static inline void AppLayerProtoDetectPPCount(const AppLayerProtoDetectThreadCtx *tctx,
+        uint8_t ipproto, AppProto alproto)
+{
+    if (tctx != NULL && tctx->tv != NULL)
+        AppLayerIncProbingCounter(tctx->tv, ipproto, alproto);
+}
+
 /**
  * \brief Call the probing parser if it exists for this flow.
  *
@@ -321,7 +369,8 @@ static AppLayerProtoDetectProbingParserPort *AppLayerProtoDetectGetProbingParser
  * lead to a PP, we try the sp.
  *
  */
-static AppProto AppLayerProtoDetectPPGetProto(Flow *f,
+static AppProto AppLayerProtoDetectPPGetProto(const AppLayerProtoDetectThreadCtx *tctx,
+                                              Flow *f,
                                               uint8_t *buf, uint32_t buflen,
                                               uint8_t ipproto, uint8_t direction)
 {
@@ -339,7 +388,7 @@ static AppProto AppLayerProtoDetectPPGetProto(Flow *f,
 
     if (direction & STREAM_TOSERVER) {
         /* first try the destination port */
-        pp_port_dp = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, ipproto, dp);
+        pp_port_dp = AppLayerProtoDetectLookupProbingParsers(ipproto, dp);
         alproto_masks = &f->probing_parser_toserver_alproto_masks;
         if (pp_port_dp != NULL) {
             SCLogDebug("toserver - Probing parser found for destination port %"PRIu16, dp);
@@ -350,7 +399,7 @@ static AppProto AppLayerProtoDetectPPGetProto(Flow *f,
             SCLogDebug("toserver - No probing parser registered for dest port %"PRIu16, dp);
         }
 
-        pp_port_sp = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, ipproto, sp);
+        pp_port_sp = AppLayerProtoDetectLookupProbingParsers(ipproto, sp);
         if (pp_port_sp != NULL) {
             SCLogDebug("toserver - Probing parser found for source port %"PRIu16, sp);
 
@@ -361,7 +410,7 @@ static AppProto AppLayerProtoDetectPPGetProto(Flow *f,
         }
     } else {
         /* first try the destination port */
-        pp_port_dp = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, ipproto, dp);
+        pp_port_dp = AppLayerProtoDetectLookupProbingParsers(ipproto, dp);
         alproto_masks = &f->probing_parser_toclient_alproto_masks;
         if (pp_port_dp != NULL) {
             SCLogDebug("toclient - Probing parser found for destination port %"PRIu16, dp);
@@ -372,7 +421,7 @@ static AppProto AppLayerProtoDetectPPGetProto(Flow *f,
             SCLogDebug("toclient - No probing parser registered for dest port %"PRIu16, dp);
         }
 
-        pp_port_sp = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, ipproto, sp);
+        pp_port_sp = AppLayerProtoDetectLookupProbingParsers(ipproto, sp);
         if (pp_port_sp != NULL) {
             SCLogDebug("toclient - Probing parser found for source port %"PRIu16, sp);
 
@@ -399,8 +448,10 @@ static AppProto AppLayerProtoDetectPPGetProto(Flow *f,
         }
 
         if (direction & STREAM_TOSERVER && pe->ProbingParserTs != NULL) {
+            AppLayerProtoDetectPPCount(tctx, ipproto, pe->alproto);
             alproto = pe->ProbingParserTs(buf, buflen, NULL);
         } else if (pe->ProbingParserTc != NULL) {
+            AppLayerProtoDetectPPCount(tctx, ipproto, pe->alproto);
             alproto = pe->ProbingParserTc(buf, buflen, NULL);
         }
         if (alproto != ALPROTO_UNKNOWN && alproto != ALPROTO_FAILED)
@@ -420,8 +471,10 @@ static AppProto AppLayerProtoDetectPPGetProto(Flow *f,
         }
 
         if (direction & STREAM_TOSERVER && pe->ProbingParserTs != NULL) {
+            AppLayerProtoDetectPPCount(tctx, ipproto, pe->alproto);
             alproto = pe->ProbingParserTs(buf, buflen, NULL);
         } else if (pe->ProbingParserTc != NULL) {
+            AppLayerProtoDetectPPCount(tctx, ipproto, pe->alproto);
             alproto = pe->ProbingParserTc(buf, buflen, NULL);
         }
         if (alproto != ALPROTO_UNKNOWN && alproto != ALPROTO_FAILED)
@@ -1082,6 +1135,7 @@ static int AppLayerProtoDetectPMSetContentIDs(AppLayerProtoDetectPMCtx *ctx)
     typedef struct TempContainer_ {
         PatIntId id;
         uint16_t content_len;
+        uint8_t nocase;
         uint8_t *content;
     } TempContainer;
 
@@ -1116,9 +1170,11 @@ static int AppLayerProtoDetectPMSetContentIDs(AppLayerProtoDetectPMCtx *ctx)
         TempContainer *tcdup = (TempContainer *)ahb;
         content = s->cd->content;
         content_len = s->cd->content_len;
+        const uint8_t nocase = (s->cd->flags & DETECT_CONTENT_NOCASE) ? 1 : 0;
 
         for (; tcdup != struct_offset; tcdup++) {
             if (tcdup->content_len != content_len ||
+                tcdup->nocase != nocase ||
                 SCMemcmp(tcdup->content, content, tcdup->content_len) != 0)
             {
                 continue;
@@ -1132,6 +1188,7 @@ static int AppLayerProtoDetectPMSetContentIDs(AppLayerProtoDetectPMCtx *ctx)
         }
 
         struct_offset->content_len = content_len;
+        struct_offset->nocase = nocase;
         struct_offset->content = content_offset;
         content_offset += content_len;
         memcpy(struct_offset->content, content, content_len);
@@ -1170,7 +1227,8 @@ static int AppLayerProtoDetectPMMapSignatures(AppLayerProtoDetectPMCtx *ctx)
     for (s = ctx->head; s != NULL; ) {
         next_s = s->next;
         s->id = id++;
-        SCLogDebug("s->id %u", s->id);
+        s->anchored = (s->cd->depth - s->cd->offset == s->cd->content_len);
+        SCLogDebug("s->id %u anchored %u", s->id, s->anchored);
 
         if (s->cd->flags & DETECT_CONTENT_NOCASE) {
             mpm_ret = MpmAddPatternCI(&ctx->mpm_ctx,
@@ -1272,7 +1330,11 @@ static int AppLayerProtoDetectPMRegisterPattern(uint8_t ipproto, AppProto alprot
     cd->depth = depth;
     cd->offset = offset;
     if (!is_cs) {
-        /* Rebuild as nocase */
+        /* Rebuild as nocase. The content is kept in lowercase so that
+         * anchored patterns can be confirmed with SCMemcmpLowercase. */
+        uint16_t u;
+        for (u = 0; u < cd->content_len; u++)
+            cd->content[u] = u8_tolower(cd->content[u]);
         SpmDestroyCtx(cd->spm_ctx);
         cd->spm_ctx = SpmInitCtx(cd->content, cd->content_len, 1,
                                  alpd_ctx.spm_global_thread_ctx);
@@ -1318,11 +1380,12 @@ AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
     uint16_t pm_matches;
 
     if (!FLOW_IS_PM_DONE(f, direction)) {
-        pm_matches = AppLayerProtoDetectPMGetProto(tctx, f,
-                                                   buf, buflen,
-                                                   direction,
-                                                   ipproto,
-                                                   pm_results);
+        /* only the first confirmed protocol is used, so stop there */
+        pm_matches = AppLayerProtoDetectPMSearch(tctx, f,
+                                                 buf, buflen,
+                                                 direction,
+                                                 ipproto,
+                                                 pm_results, 1);
         if (pm_matches > 0) {
             alproto = pm_results[0];
             goto end;
@@ -1330,7 +1393,7 @@ AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
     }
 
     if (!FLOW_IS_PP_DONE(f, direction))
-        alproto = AppLayerProtoDetectPPGetProto(f, buf, buflen, ipproto, direction);
+        alproto = AppLayerProtoDetectPPGetProto(tctx, f, buf, buflen, ipproto, direction);
 
  end:
     SCReturnUInt(alproto);
@@ -1357,6 +1420,56 @@ static void AppLayerProtoDetectFreeProbingParsers(AppLayerProtoDetectProbingPars
 
 /***** State Preparation *****/
 
+static void AppLayerProtoDetectPPFreePortMaps(void)
+{
+    for (int i = 0; i < FLOW_PROTO_DEFAULT; i++) {
+        if (alpd_ctx.pp_port_map[i] != NULL) {
+            SCFree(alpd_ctx.pp_port_map[i]);
+            alpd_ctx.pp_port_map[i] = NULL;
+        }
+    }
+}
+
+/** \internal
+ *  \brief build the port tables from the probing parser lists
+ *
+ *  A port gets the first entry of its ip_proto's list that is registered
+ *  for it or for any port (0), like AppLayerProtoDetectGetProbingParsers
+ *  finds it. Once an 'any port' entry is seen, all ports are set.
+ */
+static int AppLayerProtoDetectPPBuildPortMaps(void)
+{
+    const AppLayerProtoDetectProbingParser *pp;
+
+    AppLayerProtoDetectPPFreePortMaps();
+
+    for (pp = alpd_ctx.ctx_pp; pp != NULL; pp = pp->next) {
+        const uint8_t ipproto_map = FlowGetProtoMapping(pp->ipproto);
+        if (ipproto_map >= FLOW_PROTO_DEFAULT || alpd_ctx.pp_port_map[ipproto_map] != NULL)
+            continue;
+
+        AppLayerProtoDetectProbingParserPort **map = SCCalloc(65536, sizeof(*map));
+        if (unlikely(map == NULL))
+            return -1;
+
+        AppLayerProtoDetectProbingParserPort *pp_port;
+        for (pp_port = pp->port; pp_port != NULL; pp_port = pp_port->next) {
+            if (pp_port->port != 0) {
+                if (map[pp_port->port] == NULL)
+                    map[pp_port->port] = pp_port;
+                continue;
+            }
+            for (uint32_t port = 0; port < 65536; port++) {
+                if (map[port] == NULL)
+                    map[port] = pp_port;
+            }
+            break;
+        }
+        alpd_ctx.pp_port_map[ipproto_map] = map;
+    }
+    return 0;
+}
+
 int AppLayerProtoDetectPrepareState(void)
 {
     SCEnter();
@@ -1382,6 +1495,9 @@ int AppLayerProtoDetectPrepareState(void)
         }
     }
 
+    if (AppLayerProtoDetectPPBuildPortMaps() < 0)
+        goto error;
+
 #ifdef DEBUG
     if (SCLogDebugEnabled()) {
         AppLayerProtoDetectPrintProbingParsers(alpd_ctx.ctx_pp);
@@ -1411,6 +1527,9 @@ void AppLayerProtoDetectPPRegister(uint8_t ipproto,
 {
     SCEnter();
 
+    /* the port tables are rebuilt by AppLayerProtoDetectPrepareState */
+    AppLayerProtoDetectPPFreePortMaps();
+
     DetectPort *head = NULL;
     DetectPortParse(NULL,&head, portstr);
     DetectPort *temp_dp = head;
@@ -1602,6 +1721,7 @@ int AppLayerProtoDetectDeSetup(void)
 
     SpmDestroyGlobalThreadCtx(alpd_ctx.spm_global_thread_ctx);
 
+    AppLayerProtoDetectPPFreePortMaps();
     AppLayerProtoDetectFreeProbingParsers(alpd_ctx.ctx_pp);
 
     SCReturnInt(0);
@@ -1795,6 +1915,12 @@ AppLayerProtoDetectThreadCtx *AppLayerProtoDetectGetCtxThread(void)
     SCReturnPtr(alpd_tctx, "AppLayerProtoDetectThreadCtx");
 }
 
+void AppLayerProtoDetectSetCtxThreadVars(AppLayerProtoDetectThreadCtx *alpd_tctx,
+                                         ThreadVars *tv)
+{
+    alpd_tctx->tv = tv;
+}
+
 void AppLayerProtoDetectDestroyCtxThread(AppLayerProtoDetectThreadCtx *alpd_tctx)
 {
     SCEnter();
@@ -1831,6 +1957,16 @@ void AppLayerProtoDetectSupportedIpprotos(AppProto alproto, uint8_t *ipprotos)
     SCReturn;
 }
 
+int AppLayerProtoDetectPPIsRegistered(uint8_t ipproto, AppProto alproto)
+{
+    uint8_t ipprotos[256 / 8];
+
+    memset(ipprotos, 0, sizeof(ipprotos));
+    AppLayerProtoDetectPPGetIpprotos(alproto, ipprotos);
+
+    return (ipprotos[ipproto / 8] & (1 << (ipproto % 8))) ? 1 : 0;
+}
+
 AppProto AppLayerProtoDetectGetProtoByName(const char *alproto_name)
 {
     SCEnter();
@@ -1891,6 +2027,20 @@ void AppLayerProtoDetectUnittestCtxRestore(void)
     SCReturn;
 }
 
+/** \internal
+ *  \brief Run Pattern Sigs against buffer, returning all the protocols
+ *  \param pm_results[out] AppProto array of size ALPROTO_MAX */
+static AppProto AppLayerProtoDetectPMGetProto(AppLayerProtoDetectThreadCtx *tctx,
+                                              Flow *f,
+                                              uint8_t *buf, uint16_t buflen,
+                                              uint8_t direction,
+                                              uint8_t ipproto,
+                                              AppProto *pm_results)
+{
+    return AppLayerProtoDetectPMSearch(tctx, f, buf, buflen, direction,
+                                       ipproto, pm_results, ALPROTO_MAX);
+}
+
 static int AppLayerProtoDetectTest01(void)
 {
     AppLayerProtoDetectUnittestCtxBackup();
@@ -3739,6 +3889,125 @@ static int AppLayerProtoDetectTest19(void)
     return result;
 }
 
+/**
+ * \test the port tables return the same probing parsers as walking
+ *       the per ipproto port lists.
+ */
+static int AppLayerProtoDetectTest20(void)
+{
+    AppLayerProtoDetectUnittestCtxBackup();
+    AppLayerProtoDetectSetup();
+
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "80", ALPROTO_HTTP,
+                                  5, 8, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting, NULL);
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "[139,445]", ALPROTO_SMB,
+                                  5, 6, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting, NULL);
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "0", ALPROTO_FTP,
+                                  7, 10, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting, NULL);
+    AppLayerProtoDetectPPRegister(IPPROTO_UDP, "53", ALPROTO_DNS,
+                                  12, 0, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting, NULL);
+    AppLayerProtoDetectPPRegister(IPPROTO_UDP, "[5000:5010]", ALPROTO_DNP3,
+                                  5, 8, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting, NULL);
+
+    AppLayerProtoDetectPrepareState();
+    FAIL_IF_NULL(alpd_ctx.pp_port_map[FLOW_PROTO_TCP]);
+    FAIL_IF_NULL(alpd_ctx.pp_port_map[FLOW_PROTO_UDP]);
+    FAIL_IF_NOT_NULL(alpd_ctx.pp_port_map[FLOW_PROTO_ICMP]);
+
+    uint32_t port;
+    for (port = 0; port < 65536; port++) {
+        FAIL_IF(AppLayerProtoDetectLookupProbingParsers(IPPROTO_TCP, port) !=
+                AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, IPPROTO_TCP, port));
+        FAIL_IF(AppLayerProtoDetectLookupProbingParsers(IPPROTO_UDP, port) !=
+                AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, IPPROTO_UDP, port));
+    }
+    FAIL_IF_NULL(AppLayerProtoDetectLookupProbingParsers(IPPROTO_TCP, 1234));
+    FAIL_IF_NOT_NULL(AppLayerProtoDetectLookupProbingParsers(IPPROTO_UDP, 1234));
+
+    FAIL_IF_NOT(AppLayerProtoDetectPPIsRegistered(IPPROTO_UDP, ALPROTO_DNS));
+    FAIL_IF(AppLayerProtoDetectPPIsRegistered(IPPROTO_TCP, ALPROTO_DNS));
+
+    /* registering a new parser drops the tables until the next prepare */
+    AppLayerProtoDetectPPRegister(IPPROTO_UDP, "1234", ALPROTO_NTP,
+                                  5, 8, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting, NULL);
+    FAIL_IF_NOT_NULL(alpd_ctx.pp_port_map[FLOW_PROTO_TCP]);
+    FAIL_IF_NULL(AppLayerProtoDetectLookupProbingParsers(IPPROTO_UDP, 1234));
+
+    AppLayerProtoDetectDeSetup();
+    AppLayerProtoDetectUnittestCtxRestore();
+    PASS;
+}
+
+/**
+ * \test anchored patterns are confirmed at their offset only, others
+ *       anywhere in their depth/offset window, and the search stops at
+ *       the requested number of protocols.
+ */
+static int AppLayerProtoDetectTest21(void)
+{
+    AppLayerProtoDetectUnittestCtxBackup();
+    AppLayerProtoDetectSetup();
+
+    Flow f;
+    AppProto pm_results[ALPROTO_MAX];
+
+    memset(&f, 0x00, sizeof(f));
+    f.protomap = FlowGetProtoMapping(IPPROTO_TCP);
+
+    AppLayerProtoDetectPMRegisterPatternCI(IPPROTO_TCP, ALPROTO_HTTP, "GET", 3, 0, STREAM_TOSERVER);
+    AppLayerProtoDetectPMRegisterPatternCS(IPPROTO_TCP, ALPROTO_SMB, "|ff|SMB", 8, 4, STREAM_TOSERVER);
+    AppLayerProtoDetectPMRegisterPatternCS(IPPROTO_TCP, ALPROTO_MSN, "MSNP", 10, 0, STREAM_TOSERVER);
+    AppLayerProtoDetectPrepareState();
+    AppLayerProtoDetectThreadCtx *alpd_tctx = AppLayerProtoDetectGetCtxThread();
+    FAIL_IF_NULL(alpd_tctx);
+
+    uint8_t buf1[] = "gEt / HTTP/1.0\r\n\r\n";
+    uint32_t cnt = AppLayerProtoDetectPMGetProto(alpd_tctx, &f, buf1, sizeof(buf1) - 1,
+                                                 STREAM_TOSERVER, IPPROTO_TCP, pm_results);
+    FAIL_IF_NOT(cnt == 1 && pm_results[0] == ALPROTO_HTTP);
+
+    /* mpm hit, but not at the anchor */
+    uint8_t buf2[] = " GET / HTTP/1.0\r\n\r\n";
+    cnt = AppLayerProtoDetectPMGetProto(alpd_tctx, &f, buf2, sizeof(buf2) - 1,
+                                        STREAM_TOSERVER, IPPROTO_TCP, pm_results);
+    FAIL_IF_NOT(cnt == 0);
+
+    uint8_t buf3[] = "\x00\x00\x00\x2f\xffSMBr\x00\x00\x00\x00";
+    cnt = AppLayerProtoDetectPMGetProto(alpd_tctx, &f, buf3, sizeof(buf3) - 1,
+                                        STREAM_TOSERVER, IPPROTO_TCP, pm_results);
+    FAIL_IF_NOT(cnt == 1 && pm_results[0] == ALPROTO_SMB);
+
+    uint8_t buf4[] = "\x00\x00\x00\x2f\xfesmbr\x00\x00\x00\x00";
+    cnt = AppLayerProtoDetectPMGetProto(alpd_tctx, &f, buf4, sizeof(buf4) - 1,
+                                        STREAM_TOSERVER, IPPROTO_TCP, pm_results);
+    FAIL_IF_NOT(cnt == 0);
+
+    /* not anchored, confirmed by the spm */
+    uint8_t buf5[] = "xxMSNP yyyyyyyy";
+    cnt = AppLayerProtoDetectPMGetProto(alpd_tctx, &f, buf5, sizeof(buf5) - 1,
+                                        STREAM_TOSERVER, IPPROTO_TCP, pm_results);
+    FAIL_IF_NOT(cnt == 1 && pm_results[0] == ALPROTO_MSN);
+
+    uint8_t buf6[] = "GET MSNP yyyyyyy";
+    cnt = AppLayerProtoDetectPMGetProto(alpd_tctx, &f, buf6, sizeof(buf6) - 1,
+                                        STREAM_TOSERVER, IPPROTO_TCP, pm_results);
+    FAIL_IF_NOT(cnt == 2);
+    cnt = AppLayerProtoDetectPMSearch(alpd_tctx, &f, buf6, sizeof(buf6) - 1,
+                                      STREAM_TOSERVER, IPPROTO_TCP, pm_results, 1);
+    FAIL_IF_NOT(cnt == 1);
+
+    AppLayerProtoDetectDestroyCtxThread(alpd_tctx);
+    AppLayerProtoDetectDeSetup();
+    AppLayerProtoDetectUnittestCtxRestore();
+    PASS;
+}
+
 void AppLayerProtoDetectUnittestsRegister(void)
 {
     SCEnter();
@@ -3762,6 +4031,8 @@ void AppLayerProtoDetectUnittestsRegister(void)
     UtRegisterTest("AppLayerProtoDetectTest17", AppLayerProtoDetectTest17);
     UtRegisterTest("AppLayerProtoDetectTest18", AppLayerProtoDetectTest18);
     UtRegisterTest("AppLayerProtoDetectTest19", AppLayerProtoDetectTest19);
+    UtRegisterTest("AppLayerProtoDetectTest20", AppLayerProtoDetectTest20);
+    UtRegisterTest("AppLayerProtoDetectTest21", AppLayerProtoDetectTest21);
 
     SCReturn;
 }
@@ -173,9 +173,16 @@ AppLayerProtoDetectThreadCtx *AppLayerProtoDetectGetCtxThread(void);
  */
 void AppLayerProtoDetectDestroyCtxThread(AppLayerProtoDetectThreadCtx *tctx);
 
+/**
+ * \brief Sets the thread vars the probing parser counters are updated in.
+ */
+void AppLayerProtoDetectSetCtxThreadVars(AppLayerProtoDetectThreadCtx *tctx,
+                                         ThreadVars *tv);
+
 /***** Utility *****/
 
 void AppLayerProtoDetectSupportedIpprotos(AppProto alproto, uint8_t *ipprotos);
+int AppLayerProtoDetectPPIsRegistered(uint8_t ipproto, AppProto alproto);
 AppProto AppLayerProtoDetectGetProtoByName(const char *alproto_name);
 const char *AppLayerProtoDetectGetProtoName(AppProto alproto);
 void AppLayerProtoDetectSupportedAppProtocols(AppProto *alprotos);
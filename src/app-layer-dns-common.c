@@ -214,6 +214,40 @@ void *DNSGetTx(void *alstate, uint64_t tx_id)
     return NULL;
 }
 
+/** \brief tx iterator: walks the tx list once, keeping the next tx to
+ *         look at in the iterator state */
+AppLayerGetTxIterTuple DNSGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto, void *alstate, uint64_t min_tx_id,
+        uint64_t max_tx_id, AppLayerGetTxIterState *state)
+{
+    DNSState *dns_state = (DNSState *)alstate;
+    AppLayerGetTxIterTuple no_tuple = { NULL, 0, false };
+
+    if (dns_state == NULL)
+        return no_tuple;
+
+    DNSTransaction *tx = state->un.ptr;
+    if (tx == NULL)
+        tx = TAILQ_FIRST(&dns_state->tx_list);
+
+    /* tx_num is the tx id + 1 */
+    for ( ; tx != NULL; tx = TAILQ_NEXT(tx, next)) {
+        if (tx->tx_num <= min_tx_id)
+            continue;
+        if (tx->tx_num > max_tx_id)
+            break;
+
+        state->un.ptr = TAILQ_NEXT(tx, next);
+        AppLayerGetTxIterTuple tuple = {
+            .tx_ptr = tx,
+            .tx_id = tx->tx_num - 1,
+            .has_next = (state->un.ptr != NULL),
+        };
+        return tuple;
+    }
+    return no_tuple;
+}
+
 uint64_t DNSGetTxCnt(void *alstate)
 {
     DNSState *dns_state = (DNSState *)alstate;
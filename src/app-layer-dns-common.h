@@ -265,6 +265,9 @@ int DNSStateGetEventInfo(const char *event_name,
 void DNSAppLayerRegisterGetEventInfo(uint8_t ipproto, AppProto alproto);
 
 void *DNSGetTx(void *alstate, uint64_t tx_id);
+AppLayerGetTxIterTuple DNSGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto, void *alstate, uint64_t min_tx_id,
+        uint64_t max_tx_id, AppLayerGetTxIterState *state);
 uint64_t DNSGetTxCnt(void *alstate);
 void DNSSetTxLogged(void *alstate, void *tx, uint32_t logger);
 int DNSGetTxLogged(void *alstate, void *tx, uint32_t logger);
@@ -118,6 +118,32 @@ int HtpBodyAppendChunk(const HTPCfgDir *hcfg, HtpBody *body,
     SCReturnInt(0);
 }
 
+/**
+ * \brief Get the body data from 'offset' on
+ *
+ * The body's buffer may be shared with the file the body is stored to,
+ * which adds the data past the body limit. That part is left out.
+ *
+ * \retval 1 data available
+ * \retval 0 no data
+ */
+int HtpBodyGetDataAtOffset(const HtpBody *body, const uint8_t **data,
+                           uint32_t *data_len, uint64_t offset)
+{
+    *data = NULL;
+    *data_len = 0;
+
+    if (body->sb == NULL || offset >= body->content_len_so_far)
+        return 0;
+
+    if (StreamingBufferGetDataAtOffset(body->sb, data, data_len, offset) == 0)
+        return 0;
+
+    if (offset + *data_len > body->content_len_so_far)
+        *data_len = (uint32_t)(body->content_len_so_far - offset);
+    return 1;
+}
+
 /**
  * \brief Print the information and chunks of a Body
  * \param body pointer to the HtpBody holding the list
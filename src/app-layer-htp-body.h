@@ -32,5 +32,6 @@ int HtpBodyAppendChunk(const HTPCfgDir *, HtpBody *, const uint8_t *, uint32_t);
 void HtpBodyPrint(HtpBody *);
 void HtpBodyFree(HtpBody *);
 void HtpBodyPrune(HtpState *, HtpBody *, int);
+int HtpBodyGetDataAtOffset(const HtpBody *, const uint8_t **, uint32_t *, uint64_t);
 
 #endif /* __APP_LAYER_HTP_BODY_H__ */
@@ -66,6 +66,7 @@
  *         of data if any.
  *
  *  \param s http state
+ *  \param sb buffer holding the file data to share, or NULL
  *  \param filename name of the file
  *  \param filename_len length of the name
  *  \param data data chunk (if any)
@@ -76,7 +77,8 @@
  *  \retval -1 error
  *  \retval -2 not handling files on this flow
  */
-int HTPFileOpen(HtpState *s, const uint8_t *filename, uint16_t filename_len,
+int HTPFileOpenWithBuffer(HtpState *s, StreamingBuffer *sb,
+        const uint8_t *filename, uint16_t filename_len,
         const uint8_t *data, uint32_t data_len,
         uint64_t txid, uint8_t direction)
 {
@@ -165,7 +167,7 @@ int HTPFileOpen(HtpState *s, const uint8_t *filename, uint16_t filename_len,
         }
     }
 
-    if (FileOpenFile(files, sbcfg, filename, filename_len,
+    if (FileOpenFileWithBuffer(files, sbcfg, sb, filename, filename_len,
                 data, data_len, flags) == NULL)
     {
         retval = -1;
@@ -178,6 +180,18 @@ end:
     SCReturnInt(retval);
 }
 
+/**
+ *  \brief Open the file with "filename" and pass the first chunk
+ *         of data if any. The file keeps its own copy of the data.
+ */
+int HTPFileOpen(HtpState *s, const uint8_t *filename, uint16_t filename_len,
+        const uint8_t *data, uint32_t data_len,
+        uint64_t txid, uint8_t direction)
+{
+    return HTPFileOpenWithBuffer(s, NULL, filename, filename_len,
+            data, data_len, txid, direction);
+}
+
 /**
  *  \brief Store a chunk of data in the flow
  *
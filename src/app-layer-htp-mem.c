@@ -35,12 +35,14 @@
 #include "conf.h"
 #include "util-mem.h"
 #include "util-misc.h"
+#include "util-memcap.h"
 
 #include "app-layer-htp-mem.h"
 
 uint64_t htp_config_memcap = 0;
 
-SC_ATOMIC_DECLARE(uint64_t, htp_memuse);
+/* Memory use counter, see util-memcap.c */
+static MemcapCounter htp_memuse;
 SC_ATOMIC_DECLARE(uint64_t, htp_memcap);
 
 void HTPParseMemcap()
@@ -62,26 +64,25 @@ void HTPParseMemcap()
         htp_config_memcap = 0;
     }
 
-    SC_ATOMIC_INIT(htp_memuse);
+    MemcapCounterInit(&htp_memuse, "http", &htp_config_memcap);
     SC_ATOMIC_INIT(htp_memcap);
 }
 
 static void HTPIncrMemuse(uint64_t size)
 {
-    (void) SC_ATOMIC_ADD(htp_memuse, size);
+    MemcapCounterIncr(&htp_memuse, size);
     return;
 }
 
 static void HTPDecrMemuse(uint64_t size)
 {
-    (void) SC_ATOMIC_SUB(htp_memuse, size);
+    MemcapCounterDecr(&htp_memuse, size);
     return;
 }
 
 uint64_t HTPMemuseGlobalCounter(void)
 {
-    uint64_t tmpval = SC_ATOMIC_GET(htp_memuse);
-    return tmpval;
+    return MemcapCounterGet(&htp_memuse);
 }
 
 uint64_t HTPMemcapGlobalCounter(void)
@@ -98,7 +99,7 @@ uint64_t HTPMemcapGlobalCounter(void)
  */
 static int HTPCheckMemcap(uint64_t size)
 {
-    if (htp_config_memcap == 0 || size + SC_ATOMIC_GET(htp_memuse) <= htp_config_memcap)
+    if (MemcapCounterCheck(&htp_memuse, size))
         return 1;
     (void) SC_ATOMIC_ADD(htp_memcap, 1);
     return 0;
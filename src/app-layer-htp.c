@@ -1651,7 +1651,16 @@ static int HtpResponseBodyHandle(HtpState *hstate, HtpTxUserData *htud,
         }
 
         if (filename != NULL) {
-            result = HTPFileOpen(hstate, filename, (uint32_t)filename_len,
+            /* if the file starts with the body, it reads its data from
+             * the body's buffer instead of keeping a second copy */
+            StreamingBuffer *sb = NULL;
+            if (htud->response_body.body_parsed == 0 &&
+                    htud->response_body.sb != NULL &&
+                    htud->response_body.sb->stream_offset == 0)
+            {
+                sb = htud->response_body.sb;
+            }
+            result = HTPFileOpenWithBuffer(hstate, sb, filename, (uint32_t)filename_len,
                     data, data_len, hstate->transaction_cnt, STREAM_TOCLIENT);
             SCLogDebug("result %d", result);
             if (result == -1) {
@@ -1804,6 +1813,28 @@ end:
     SCReturnInt(HTP_OK);
 }
 
+/**
+ *  \internal
+ *  \brief Tell the stream engine nothing looks at the rest of the response
+ *
+ *  Called once the body is past the response-body-limit. Only for a body
+ *  that runs until the connection is closed, nothing follows it. libhtp
+ *  has to see all of a Content-Length or chunked body to find the next
+ *  response, so those are left alone.
+ */
+static void HTPResponseBodyNotNeeded(HtpState *hstate, htp_tx_t *tx)
+{
+    if (tx->response_transfer_coding != HTP_CODING_IDENTITY ||
+            tx->response_content_length != -1)
+        return;
+    if (hstate->f == NULL || hstate->f->alparser == NULL)
+        return;
+
+    SCLogDebug("body until close not needed, stop reassembly");
+    AppLayerParserStateSetStreamDepthRemaining(hstate->f->alparser,
+            STREAM_TOCLIENT, 0);
+}
+
 /**
  * \brief Function callback to append chunks for Responses
  * \param d pointer to the htp_tx_data_t structure (a chunk from htp lib)
@@ -1871,6 +1902,7 @@ static int HTPCallbackResponseBodyData(htp_tx_data_t *d)
             (void)HTPFileClose(hstate, NULL, 0, FILE_TRUNCATED, STREAM_TOCLIENT);
             tx_ud->tcflags &= ~HTP_FILENAME_SET;
         }
+        HTPResponseBodyNotNeeded(hstate, d->tx);
     }
 
     /* set the new chunk flag */
@@ -2267,7 +2299,8 @@ static void HTPConfigSetDefaultsPhase2(const char *name, HTPCfgRec *cfg_prec)
 
     htp_config_register_request_line(cfg_prec->cfg, HTPCallbackRequestLine);
 
-    cfg_prec->request.sbcfg.flags = 0;
+    cfg_prec->request.sbcfg.flags = cfg_prec->body_buffer_regions ?
+                                    STREAMING_BUFFER_REGIONS : 0;
     cfg_prec->request.sbcfg.buf_size = cfg_prec->request.inspect_window ?
                                        cfg_prec->request.inspect_window : 256;
     cfg_prec->request.sbcfg.buf_slide = 0;
@@ -2276,7 +2309,8 @@ static void HTPConfigSetDefaultsPhase2(const char *name, HTPCfgRec *cfg_prec)
     cfg_prec->request.sbcfg.Realloc = HTPRealloc;
     cfg_prec->request.sbcfg.Free = HTPFree;
 
-    cfg_prec->response.sbcfg.flags = 0;
+    cfg_prec->response.sbcfg.flags = cfg_prec->body_buffer_regions ?
+                                     STREAMING_BUFFER_REGIONS : 0;
     cfg_prec->response.sbcfg.buf_size = cfg_prec->response.inspect_window ?
                                         cfg_prec->response.inspect_window : 256;
     cfg_prec->response.sbcfg.buf_slide = 0;
@@ -2515,6 +2549,8 @@ static void HTPConfigParseParameters(HTPCfgRec *cfg_prec, ConfNode *s,
                 exit(EXIT_FAILURE);
             }
             cfg_prec->randomize_range = range;
+        } else if (strcasecmp("body-buffer-regions", p->name) == 0) {
+            cfg_prec->body_buffer_regions = ConfValIsTrue(p->val);
         } else if (strcasecmp("http-body-inline", p->name) == 0) {
             if (ConfValIsTrue(p->val)) {
                 cfg_prec->http_body_inline = 1;
@@ -151,6 +151,8 @@ typedef struct HTPCfgRec_ {
     int                 randomize;
     int                 randomize_range;
     int                 http_body_inline;
+    /** keep bodies and files in STREAMING_BUFFER_REGIONS mode */
+    int                 body_buffer_regions;
 
     HTPCfgDir request;
     HTPCfgDir response;
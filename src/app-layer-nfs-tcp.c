@@ -253,6 +253,13 @@ void RegisterNFSTCPParsers(void)
      * the configuration file then it will be enabled by default. */
     if (AppLayerProtoDetectConfProtoDetectionEnabled("tcp", proto_name)) {
 
+        /* large transfers can store the file data in regions, so pruning
+         * it doesn't move the rest around */
+        int regions = 0;
+        if (ConfGetBool("app-layer.protocols.nfs.file-buffer-regions",
+                    &regions) == 1 && regions) {
+            sbcfg.flags |= STREAMING_BUFFER_REGIONS;
+        }
         rs_nfs3_init(&sfc);
 
         SCLogDebug("NFSTCP TCP protocol detection enabled.");
@@ -258,6 +258,13 @@ void RegisterNFSUDPParsers(void)
      * the configuration file then it will be enabled by default. */
     if (AppLayerProtoDetectConfProtoDetectionEnabled("udp", proto_name)) {
 
+        /* large transfers can store the file data in regions, so pruning
+         * it doesn't move the rest around */
+        int regions = 0;
+        if (ConfGetBool("app-layer.protocols.nfs.file-buffer-regions",
+                    &regions) == 1 && regions) {
+            sbcfg.flags |= STREAMING_BUFFER_REGIONS;
+        }
         rs_nfs3_init(&sfc);
 
         SCLogDebug("NFS UDP protocol detection enabled.");
@@ -67,6 +67,7 @@
 
 #include "conf.h"
 #include "util-spm.h"
+#include "util-misc.h"
 
 #include "util-debug.h"
 #include "decode-events.h"
@@ -105,6 +106,7 @@ typedef struct AppLayerParserProtoCtx_
     int (*StateGetProgress)(void *alstate, uint8_t direction);
     uint64_t (*StateGetTxCnt)(void *alstate);
     void *(*StateGetTx)(void *alstate, uint64_t tx_id);
+    AppLayerGetTxIteratorFunc StateGetTxIterator;
     int (*StateGetProgressCompletionStatus)(uint8_t direction);
     int (*StateGetEventInfo)(const char *event_name,
                              int *event_id, AppLayerEventType *event_type);
@@ -122,6 +124,10 @@ typedef struct AppLayerParserProtoCtx_
     /* each app-layer has its own value */
     uint32_t stream_depth;
 
+    /* encrypted bytes to see before the flow is bypassed. Only used with
+     * APP_LAYER_PARSER_OPT_ENCRYPTION_BYPASS. */
+    uint64_t encryption_bypass;
+
     /* Indicates the direction the parser is ready to see the data
      * the first time for a flow.  Values accepted -
      * STREAM_TOSERVER, STREAM_TOCLIENT */
@@ -155,6 +161,13 @@ struct AppLayerParserState_ {
 
     /* Used to store decoder events. */
     AppLayerDecoderEvents *decoder_events;
+
+    /* Stream bytes the parser still needs past the data it was just
+     * handed. Per direction, set with APP_LAYER_PARSER_DEPTH_TS/TC. */
+    uint32_t depth_remaining[2];
+    /* Stream bytes right after the data it was just handed that the
+     * parser doesn't need. Per direction, 0 if none. */
+    uint32_t skip[2];
 };
 
 /* Static global version of the parser context.
@@ -516,6 +529,17 @@ void AppLayerParserRegisterGetTx(uint8_t ipproto, AppProto alproto,
     SCReturn;
 }
 
+void AppLayerParserRegisterGetTxIterator(uint8_t ipproto, AppProto alproto,
+                      AppLayerGetTxIteratorFunc Func)
+{
+    SCEnter();
+
+    alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto].
+        StateGetTxIterator = Func;
+
+    SCReturn;
+}
+
 void AppLayerParserRegisterGetStateProgressCompletionStatus(AppProto alproto,
     int (*StateGetProgressCompletionStatus)(uint8_t direction))
 {
@@ -661,16 +685,23 @@ void AppLayerParserSetTransactionInspectId(const Flow *f, AppLayerParserState *p
     const uint64_t total_txs = AppLayerParserGetTxCnt(f, alstate);
     uint64_t idx = AppLayerParserGetTransactionInspectId(pstate, flags);
     const int state_done_progress = AppLayerParserGetStateProgressCompletionStatus(f->alproto, flags);
-
-    for (; idx < total_txs; idx++) {
-        void *tx = AppLayerParserGetTx(f->proto, f->alproto, alstate, idx);
-        if (tx == NULL)
-            continue;
-        int state_progress = AppLayerParserGetStateProgress(f->proto, f->alproto, tx, flags);
-        if (state_progress >= state_done_progress)
-            continue;
-        else
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, f->alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
+    /* move up to the first live tx that isn't complete */
+    while (idx < total_txs) {
+        AppLayerGetTxIterTuple ires = IterFunc(f->proto, f->alproto, alstate,
+                idx, total_txs, &state);
+        if (ires.tx_ptr == NULL) {
+            idx = total_txs;
             break;
+        }
+        idx = ires.tx_id;
+        int state_progress = AppLayerParserGetStateProgress(f->proto, f->alproto, ires.tx_ptr, flags);
+        if (state_progress < state_done_progress)
+            break;
+        idx++;
     }
     pstate->inspect_id[direction] = idx;
 
@@ -811,19 +842,24 @@ static void AppLayerParserTransactionsCleanup(Flow *f)
 
     uint64_t min = MIN(tx_id_ts, tx_id_tc);
     if (min > 0) {
+        AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, f->alproto);
+        AppLayerGetTxIterState state;
+        memset(&state, 0, sizeof(state));
+
+        /* free all the live tx' up to and including min - 1 */
         uint64_t x = f->alparser->min_id;
-        for ( ; x < min - 1; x++) {
-            void *tx = AppLayerParserGetTx(f->proto, f->alproto, f->alstate, x);
-            if (tx != 0) {
-                SCLogDebug("while freeing %"PRIu64", also free TX at %"PRIu64, min - 1, x);
-                p->StateTransactionFree(f->alstate, x);
-            }
-        }
+        while (x < min) {
+            AppLayerGetTxIterTuple ires = IterFunc(f->proto, f->alproto,
+                    f->alstate, x, min, &state);
+            if (ires.tx_ptr == NULL)
+                break;
 
-        SCLogDebug("freeing %"PRIu64" %p", min - 1, p->StateTransactionFree);
+            SCLogDebug("freeing TX at %"PRIu64" (up to %"PRIu64")", ires.tx_id, min - 1);
+            p->StateTransactionFree(f->alstate, ires.tx_id);
 
-        if ((AppLayerParserGetTx(f->proto, f->alproto, f->alstate, min - 1))) {
-            p->StateTransactionFree(f->alstate, min - 1);
+            if (!ires.has_next)
+                break;
+            x = ires.tx_id + 1;
         }
         f->alparser->min_id = min - 1;
         SCLogDebug("f->alparser->min_id %"PRIu64, f->alparser->min_id);
@@ -871,6 +907,46 @@ void *AppLayerParserGetTx(uint8_t ipproto, AppProto alproto, void *alstate, uint
     SCReturnPtr(r, "void *");
 }
 
+/** \internal
+ *  \brief tx iterator for parsers that don't register one: looks up each
+ *         id with StateGetTx, skipping the tx' that are gone
+ *
+ *  The state holds the id to continue from.
+ */
+static AppLayerGetTxIterTuple AppLayerDefaultGetTxIterator(
+        const uint8_t ipproto, const AppProto alproto,
+        void *alstate, uint64_t min_tx_id, uint64_t max_tx_id,
+        AppLayerGetTxIterState *state)
+{
+    uint64_t tx_id = MAX(min_tx_id, state->un.u64);
+
+    for ( ; tx_id < max_tx_id; tx_id++) {
+        void *tx_ptr = AppLayerParserGetTx(ipproto, alproto, alstate, tx_id);
+        if (tx_ptr != NULL) {
+            state->un.u64 = tx_id + 1;
+            AppLayerGetTxIterTuple tuple = {
+                .tx_ptr = tx_ptr,
+                .tx_id = tx_id,
+                .has_next = (tx_id + 1 < max_tx_id),
+            };
+            return tuple;
+        }
+    }
+
+    AppLayerGetTxIterTuple no_tuple = { NULL, 0, false };
+    return no_tuple;
+}
+
+/** \brief get the tx iterator of a parser, or the default one that uses
+ *         StateGetTx */
+AppLayerGetTxIteratorFunc AppLayerGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto)
+{
+    AppLayerGetTxIteratorFunc Func =
+        alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto].StateGetTxIterator;
+    return Func ? Func : AppLayerDefaultGetTxIterator;
+}
+
 int AppLayerParserGetStateProgressCompletionStatus(AppProto alproto,
                                                    uint8_t direction)
 {
@@ -981,6 +1057,46 @@ int AppLayerParserSetTxMpmIDs(uint8_t ipproto, AppProto alproto, void *tx, uint6
 
 /***** General *****/
 
+/** \internal
+ *  \brief hand the depth the parser declared to the stream engine
+ *
+ *  The data the parser was just handed is not yet part of the app
+ *  progress of its direction, so it's added to the remaining bytes.
+ */
+static void AppLayerParserApplyStreamDepth(TcpSession *ssn,
+        AppLayerParserState *pstate, uint8_t flags, uint32_t input_len)
+{
+    if (pstate->flags & APP_LAYER_PARSER_DEPTH_TS) {
+        uint64_t remaining = pstate->depth_remaining[0];
+        if (flags & STREAM_TOSERVER)
+            remaining += input_len;
+        StreamTcpSetStreamDepthRemaining(ssn, STREAM_TOSERVER, remaining);
+    }
+    if (pstate->flags & APP_LAYER_PARSER_DEPTH_TC) {
+        uint64_t remaining = pstate->depth_remaining[1];
+        if (flags & STREAM_TOCLIENT)
+            remaining += input_len;
+        StreamTcpSetStreamDepthRemaining(ssn, STREAM_TOCLIENT, remaining);
+    }
+}
+
+/** \internal
+ *  \brief hand the part of the stream the parser wants to skip to the
+ *         stream engine
+ */
+static void AppLayerParserApplyStreamSkip(TcpSession *ssn,
+        AppLayerParserState *pstate, uint8_t flags, uint32_t input_len)
+{
+    if (pstate->skip[0] > 0) {
+        uint64_t offset = (flags & STREAM_TOSERVER) ? input_len : 0;
+        StreamTcpSetStreamSkip(ssn, STREAM_TOSERVER, offset, pstate->skip[0]);
+    }
+    if (pstate->skip[1] > 0) {
+        uint64_t offset = (flags & STREAM_TOCLIENT) ? input_len : 0;
+        StreamTcpSetStreamSkip(ssn, STREAM_TOCLIENT, offset, pstate->skip[1]);
+    }
+}
+
 int AppLayerParserParse(ThreadVars *tv, AppLayerParserThreadCtx *alp_tctx, Flow *f, AppProto alproto,
                         uint8_t flags, uint8_t *input, uint32_t input_len)
 {
@@ -1046,6 +1162,28 @@ int AppLayerParserParse(ThreadVars *tv, AppLayerParserThreadCtx *alp_tctx, Flow
         }
     }
 
+    /* limit the stream reassembly to what the parser still needs */
+    if (pstate->flags & (APP_LAYER_PARSER_DEPTH_TS|APP_LAYER_PARSER_DEPTH_TC)) {
+        if (f->proto == IPPROTO_TCP && f->protoctx != NULL) {
+            AppLayerParserApplyStreamDepth(f->protoctx, pstate, flags, input_len);
+        }
+        pstate->flags &= ~(APP_LAYER_PARSER_DEPTH_TS|APP_LAYER_PARSER_DEPTH_TC);
+    }
+    if (pstate->skip[0] > 0 || pstate->skip[1] > 0) {
+        if (f->proto == IPPROTO_TCP && f->protoctx != NULL) {
+            AppLayerParserApplyStreamSkip(f->protoctx, pstate, flags, input_len);
+        }
+        pstate->skip[0] = pstate->skip[1] = 0;
+    }
+
+    /* session is encrypted, start counting down to the bypass */
+    if (pstate->flags & APP_LAYER_PARSER_ENCRYPTED &&
+            p->flags & APP_LAYER_PARSER_OPT_ENCRYPTION_BYPASS &&
+            f->proto == IPPROTO_TCP && f->protoctx != NULL)
+    {
+        StreamTcpSetSessionEncryptionBypass(f->protoctx, p->encryption_bypass);
+    }
+
     /* set the packets to no inspection and reassembly if required */
     if (pstate->flags & APP_LAYER_PARSER_NO_INSPECTION) {
         AppLayerParserSetEOF(pstate);
@@ -1240,6 +1378,61 @@ uint32_t AppLayerParserGetStreamDepth(const Flow *f)
     SCReturnInt(alp_ctx.ctxs[f->protomap][f->alproto].stream_depth);
 }
 
+/**
+ *  \brief Set up the encryption bypass of a protocol from the config
+ *
+ *  Reads app-layer.protocols.<alproto_name>.encryption-bypass. If set,
+ *  flows of this protocol are bypassed once that many bytes have been
+ *  seen after the parser flagged the session as encrypted.
+ */
+void AppLayerParserConfEncryptionBypass(uint8_t ipproto, AppProto alproto,
+        const char *alproto_name)
+{
+    char param[100];
+    const char *val = NULL;
+    uint64_t bytes = 0;
+
+    int r = snprintf(param, sizeof(param), "%s%s%s", "app-layer.protocols.",
+            alproto_name, ".encryption-bypass");
+    if (r < 0 || r >= (int)sizeof(param))
+        return;
+
+    if (ConfGet(param, &val) != 1 || val == NULL)
+        return;
+
+    if (ParseSizeStringU64(val, &bytes) < 0) {
+        SCLogError(SC_ERR_SIZE_PARSE, "invalid value for %s: %s", param, val);
+        return;
+    }
+    AppLayerParserSetEncryptionBypass(ipproto, alproto, bytes);
+    SCLogConfig("%s: bypassing flows after %"PRIu64" encrypted bytes",
+            alproto_name, bytes);
+}
+
+void AppLayerParserSetEncryptionBypass(uint8_t ipproto, AppProto alproto, uint64_t bytes)
+{
+    SCEnter();
+
+    AppLayerParserProtoCtx *ctx = &alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto];
+    ctx->encryption_bypass = bytes;
+    ctx->flags |= APP_LAYER_PARSER_OPT_ENCRYPTION_BYPASS;
+
+    SCReturn;
+}
+
+/**
+ *  \retval 1 if the protocol has an encryption bypass, \a bytes is set
+ *  \retval 0 if not
+ */
+int AppLayerParserGetEncryptionBypass(uint8_t ipproto, AppProto alproto, uint64_t *bytes)
+{
+    const AppLayerParserProtoCtx *ctx = &alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto];
+    if (!(ctx->flags & APP_LAYER_PARSER_OPT_ENCRYPTION_BYPASS))
+        return 0;
+    *bytes = ctx->encryption_bypass;
+    return 1;
+}
+
 /***** Cleanup *****/
 
 void AppLayerParserStateCleanup(const Flow *f, void *alstate,
@@ -1422,6 +1615,55 @@ int AppLayerParserStateIssetFlag(AppLayerParserState *pstate, uint8_t flag)
     SCReturnInt(pstate->flags & flag);
 }
 
+/**
+ *  \brief Declare how much more of the TCP stream the parser needs
+ *
+ *  Called from a parser. After the parser returns the stream engine
+ *  stops reassembling the direction(s) once \a remaining bytes past
+ *  the data that was just parsed have been added.
+ *
+ *  \param direction STREAM_TOSERVER and/or STREAM_TOCLIENT
+ *  \param remaining bytes still needed, 0 if the parser is done
+ */
+void AppLayerParserStateSetStreamDepthRemaining(AppLayerParserState *pstate,
+        uint8_t direction, uint32_t remaining)
+{
+    SCEnter();
+    if (direction & STREAM_TOSERVER) {
+        pstate->depth_remaining[0] = remaining;
+        pstate->flags |= APP_LAYER_PARSER_DEPTH_TS;
+    }
+    if (direction & STREAM_TOCLIENT) {
+        pstate->depth_remaining[1] = remaining;
+        pstate->flags |= APP_LAYER_PARSER_DEPTH_TC;
+    }
+    SCReturn;
+}
+
+/**
+ *  \brief Declare a part of the TCP stream the parser doesn't need
+ *
+ *  Called from a parser. After the parser returns the stream engine
+ *  doesn't reassemble the next \a len bytes past the data that was
+ *  just parsed, and doesn't hand them to the parser either. The parser
+ *  has to account for them as if it had consumed them already.
+ *
+ *  \param direction STREAM_TOSERVER or STREAM_TOCLIENT
+ *  \param len bytes to skip
+ */
+void AppLayerParserStateSetStreamSkip(AppLayerParserState *pstate,
+        uint8_t direction, uint32_t len)
+{
+    SCEnter();
+    if (direction & STREAM_TOSERVER) {
+        pstate->skip[0] = len;
+    }
+    if (direction & STREAM_TOCLIENT) {
+        pstate->skip[1] = len;
+    }
+    SCReturn;
+}
+
 
 void AppLayerParserStreamTruncated(uint8_t ipproto, AppProto alproto, void *alstate,
                                    uint8_t direction)
@@ -36,9 +36,13 @@
 #define APP_LAYER_PARSER_NO_REASSEMBLY          BIT_U8(2)
 #define APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD  BIT_U8(3)
 #define APP_LAYER_PARSER_BYPASS_READY           BIT_U8(4)
+#define APP_LAYER_PARSER_DEPTH_TS               BIT_U8(5)
+#define APP_LAYER_PARSER_DEPTH_TC               BIT_U8(6)
+#define APP_LAYER_PARSER_ENCRYPTED              BIT_U8(7)
 
 /* Flags for AppLayerParserProtoCtx. */
 #define APP_LAYER_PARSER_OPT_ACCEPT_GAPS        BIT_U64(0)
+#define APP_LAYER_PARSER_OPT_ENCRYPTION_BYPASS  BIT_U64(1)
 
 int AppLayerParserProtoIsRegistered(uint8_t ipproto, AppProto alproto);
 
@@ -109,6 +113,34 @@ typedef int (*AppLayerParserFPtr)(Flow *f, void *protocol_state,
         uint8_t *buf, uint32_t buf_len,
         void *local_storage);
 
+/** \brief tx returned by a tx iterator */
+typedef struct AppLayerGetTxIterTuple {
+    void *tx_ptr;               /**< tx or NULL if there are no more */
+    uint64_t tx_id;
+    bool has_next;              /**< there may be more tx' after this one */
+} AppLayerGetTxIterTuple;
+
+/** \brief cursor of a tx iterator, zeroed by the caller before the
+ *         first call. What it holds is up to the iterator. */
+typedef struct AppLayerGetTxIterState {
+    union {
+        void *ptr;
+        uint64_t u64;
+    } un;
+} AppLayerGetTxIterState;
+
+/** \brief Prototype for tx iterators
+ *
+ *  Returns the first live tx with an id in [min_tx_id, max_tx_id), and
+ *  updates 'state' so that the next call with a higher min_tx_id doesn't
+ *  have to start over. 'min_tx_id' may not go down between calls with
+ *  the same state, and tx' beyond the returned one may not be freed.
+ */
+typedef AppLayerGetTxIterTuple (*AppLayerGetTxIteratorFunc)
+       (const uint8_t ipproto, const AppProto alproto,
+        void *alstate, uint64_t min_tx_id, uint64_t max_tx_id,
+        AppLayerGetTxIterState *state);
+
 /***** Parser related registration *****/
 
 /**
@@ -151,6 +183,8 @@ void AppLayerParserRegisterGetTxCnt(uint8_t ipproto, AppProto alproto,
                          uint64_t (*StateGetTxCnt)(void *alstate));
 void AppLayerParserRegisterGetTx(uint8_t ipproto, AppProto alproto,
                       void *(StateGetTx)(void *alstate, uint64_t tx_id));
+void AppLayerParserRegisterGetTxIterator(uint8_t ipproto, AppProto alproto,
+                      AppLayerGetTxIteratorFunc Func);
 void AppLayerParserRegisterGetStateProgressCompletionStatus(AppProto alproto,
     int (*StateGetStateProgressCompletionStatus)(uint8_t direction));
 void AppLayerParserRegisterGetEventInfo(uint8_t ipproto, AppProto alproto,
@@ -196,6 +230,8 @@ int AppLayerParserGetStateProgress(uint8_t ipproto, AppProto alproto,
                         void *alstate, uint8_t direction);
 uint64_t AppLayerParserGetTxCnt(const Flow *, void *alstate);
 void *AppLayerParserGetTx(uint8_t ipproto, AppProto alproto, void *alstate, uint64_t tx_id);
+AppLayerGetTxIteratorFunc AppLayerGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto);
 int AppLayerParserGetStateProgressCompletionStatus(AppProto alproto, uint8_t direction);
 int AppLayerParserGetEventInfo(uint8_t ipproto, AppProto alproto, const char *event_name,
                     int *event_id, AppLayerEventType *event_type);
@@ -228,6 +264,10 @@ int AppLayerParserProtocolHasLogger(uint8_t ipproto, AppProto alproto);
 void AppLayerParserTriggerRawStreamReassembly(Flow *f, int direction);
 void AppLayerParserSetStreamDepth(uint8_t ipproto, AppProto alproto, uint32_t stream_depth);
 uint32_t AppLayerParserGetStreamDepth(const Flow *f);
+void AppLayerParserConfEncryptionBypass(uint8_t ipproto, AppProto alproto,
+        const char *alproto_name);
+void AppLayerParserSetEncryptionBypass(uint8_t ipproto, AppProto alproto, uint64_t bytes);
+int AppLayerParserGetEncryptionBypass(uint8_t ipproto, AppProto alproto, uint64_t *bytes);
 
 /***** Cleanup *****/
 
@@ -238,6 +278,10 @@ void AppLayerParserRegisterProtocolParsers(void);
 
 void AppLayerParserStateSetFlag(AppLayerParserState *pstate, uint8_t flag);
 int AppLayerParserStateIssetFlag(AppLayerParserState *pstate, uint8_t flag);
+void AppLayerParserStateSetStreamDepthRemaining(AppLayerParserState *pstate,
+        uint8_t direction, uint32_t remaining);
+void AppLayerParserStateSetStreamSkip(AppLayerParserState *pstate,
+        uint8_t direction, uint32_t len);
 
 void AppLayerParserStreamTruncated(uint8_t ipproto, AppProto alproto, void *alstate,
                         uint8_t direction);
@@ -838,14 +838,25 @@ static uint32_t SMBParseByteCount(Flow *f, void *smb_state,
                 input_len -= (uint32_t)sres;
                 (void)input_len; /* for scan-build */
             } else { /* Did not Validate as DCERPC over SMB */
-                while (sstate->bytecount.bytecountleft-- && input_len--) {
-                    SCLogDebug("0x%02x bytecount %"PRIu16"/%"PRIu16" input_len %"PRIu32, *p,
-                            sstate->bytecount.bytecountleft,
-                            sstate->bytecount.bytecount, input_len);
-                    p++;
+                /* file data, nothing parses it */
+                uint32_t len = MIN(input_len, (uint32_t)sstate->bytecount.bytecountleft);
+                sstate->bytecount.bytecountleft -= len;
+                sstate->bytesprocessed += len;
+                SCLogDebug("bytecount %"PRIu16"/%"PRIu16" input_len %"PRIu32,
+                        sstate->bytecount.bytecountleft,
+                        sstate->bytecount.bytecount, input_len);
+
+                /* the rest of the data is past this input, so the stream
+                 * engine can skip it */
+                if (len == input_len && sstate->bytecount.bytecountleft > 0) {
+                    uint8_t dir = (sstate->smb.flags & SMB_FLAGS_SERVER_TO_REDIR) ?
+                        STREAM_TOCLIENT : STREAM_TOSERVER;
+                    AppLayerParserStateSetStreamSkip(pstate, dir,
+                            sstate->bytecount.bytecountleft);
+                    sstate->bytesprocessed += sstate->bytecount.bytecountleft;
+                    sstate->bytecount.bytecountleft = 0;
                 }
-                sstate->bytesprocessed += (p - input);
-                SCReturnUInt((p - input));
+                SCReturnUInt(parsed + len);
             }
         }
         SCReturnUInt(ures);
@@ -1560,6 +1560,40 @@ static void *SMTPStateGetTx(void *state, uint64_t id)
 
 }
 
+/** \internal
+ *  \brief tx iterator: walks the tx list once, keeping the next tx to
+ *         look at in the iterator state */
+static AppLayerGetTxIterTuple SMTPGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto, void *alstate, uint64_t min_tx_id,
+        uint64_t max_tx_id, AppLayerGetTxIterState *state)
+{
+    SMTPState *smtp_state = alstate;
+    AppLayerGetTxIterTuple no_tuple = { NULL, 0, false };
+
+    if (smtp_state == NULL)
+        return no_tuple;
+
+    SMTPTransaction *tx = state->un.ptr;
+    if (tx == NULL)
+        tx = TAILQ_FIRST(&smtp_state->tx_list);
+
+    for ( ; tx != NULL; tx = TAILQ_NEXT(tx, next)) {
+        if (tx->tx_id < min_tx_id)
+            continue;
+        if (tx->tx_id >= max_tx_id)
+            break;
+
+        state->un.ptr = TAILQ_NEXT(tx, next);
+        AppLayerGetTxIterTuple tuple = {
+            .tx_ptr = tx,
+            .tx_id = tx->tx_id,
+            .has_next = (state->un.ptr != NULL),
+        };
+        return tuple;
+    }
+    return no_tuple;
+}
+
 static void SMTPStateSetTxLogged(void *state, void *vtx, uint32_t logger)
 {
     SMTPTransaction *tx = vtx;
@@ -1672,6 +1706,8 @@ void RegisterSMTPParsers(void)
         AppLayerParserRegisterGetStateProgressFunc(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetAlstateProgress);
         AppLayerParserRegisterGetTxCnt(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetTxCnt);
         AppLayerParserRegisterGetTx(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetTx);
+        AppLayerParserRegisterGetTxIterator(IPPROTO_TCP, ALPROTO_SMTP,
+                SMTPGetTxIterator);
         AppLayerParserRegisterLoggerFuncs(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetTxLogged,
                                           SMTPStateSetTxLogged);
         AppLayerParserRegisterGetStateProgressCompletionStatus(ALPROTO_SMTP,
@@ -5143,6 +5179,47 @@ static int SMTPProcessDataChunkTest05(void){
     PASS;
 }
 
+/**
+ * \test the tx iterator skips freed tx' and stops at the max id.
+ */
+static int SMTPGetTxIteratorTest01(void)
+{
+    SMTPState *smtp_state = SMTPStateAlloc();
+    FAIL_IF_NULL(smtp_state);
+
+    for (int i = 0; i < 6; i++) {
+        SMTPTransaction *tx = SMTPTransactionCreate();
+        FAIL_IF_NULL(tx);
+        TAILQ_INSERT_TAIL(&smtp_state->tx_list, tx, next);
+        tx->tx_id = smtp_state->tx_cnt++;
+        smtp_state->curr_tx = tx;
+    }
+    SMTPStateTransactionFree(smtp_state, 0);
+    SMTPStateTransactionFree(smtp_state, 2);
+    SMTPStateTransactionFree(smtp_state, 3);
+
+    /* live: 1, 4, 5 */
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+    AppLayerGetTxIterTuple ires = SMTPGetTxIterator(IPPROTO_TCP, ALPROTO_SMTP,
+            smtp_state, 0, 5, &state);
+    FAIL_IF_NULL(ires.tx_ptr);
+    FAIL_IF(ires.tx_id != 1);
+    FAIL_IF(!ires.has_next);
+    ires = SMTPGetTxIterator(IPPROTO_TCP, ALPROTO_SMTP,
+            smtp_state, ires.tx_id + 1, 5, &state);
+    FAIL_IF_NULL(ires.tx_ptr);
+    FAIL_IF(ires.tx_id != 4);
+    FAIL_IF(ires.tx_ptr != SMTPStateGetTx(smtp_state, 4));
+    /* 5 is beyond the max */
+    ires = SMTPGetTxIterator(IPPROTO_TCP, ALPROTO_SMTP,
+            smtp_state, ires.tx_id + 1, 5, &state);
+    FAIL_IF_NOT_NULL(ires.tx_ptr);
+
+    SMTPStateFree(smtp_state);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SMTPParserRegisterTests(void)
@@ -5167,6 +5244,7 @@ void SMTPParserRegisterTests(void)
     UtRegisterTest("SMTPProcessDataChunkTest03", SMTPProcessDataChunkTest03);
     UtRegisterTest("SMTPProcessDataChunkTest04", SMTPProcessDataChunkTest04);
     UtRegisterTest("SMTPProcessDataChunkTest05", SMTPProcessDataChunkTest05);
+    UtRegisterTest("SMTPGetTxIteratorTest01", SMTPGetTxIteratorTest01);
 #endif /* UNITTESTS */
 
     return;
@@ -435,6 +435,7 @@ static int SSHParseRequest(Flow *f, void *state, AppLayerParserState *pstate,
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_INSPECTION);
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_REASSEMBLY);
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_BYPASS_READY);
+        AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_ENCRYPTED);
     }
 
     SCReturnInt(r);
@@ -460,6 +461,7 @@ static int SSHParseResponse(Flow *f, void *state, AppLayerParserState *pstate,
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_INSPECTION);
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_REASSEMBLY);
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_BYPASS_READY);
+        AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_ENCRYPTED);
     }
 
     SCReturnInt(r);
@@ -652,6 +654,8 @@ void RegisterSSHParsers(void)
 
         AppLayerParserRegisterGetStateProgressCompletionStatus(ALPROTO_SSH,
                                                                SSHGetAlstateProgressCompletionStatus);
+
+        AppLayerParserConfEncryptionBypass(IPPROTO_TCP, ALPROTO_SSH, proto_name);
     } else {
 //        SCLogInfo("Parsed disabled for %s protocol. Protocol detection"
 //                  "still on.", proto_name);
@@ -32,6 +32,7 @@
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
 #include "stream-tcp.h"
+#include "stream-tcp-util.h"
 #include "stream.h"
 
 #include "app-layer.h"
@@ -1149,6 +1150,7 @@ static int SSLv2Decode(uint8_t direction, SSLState *ssl_state,
                         (ssl_state->flags & SSL_AL_FLAG_SSL_SERVER_SSN_ENCRYPTED)) {
                     AppLayerParserStateSetFlag(pstate,
                             APP_LAYER_PARSER_NO_INSPECTION);
+                    AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_ENCRYPTED);
                     if (ssl_config.no_reassemble == 1) {
                         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_REASSEMBLY);
                         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_BYPASS_READY);
@@ -1260,6 +1262,7 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
                 */
                 AppLayerParserStateSetFlag(pstate,
                         APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD);
+                AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_ENCRYPTED);
             }
 
             /* if we see (encrypted) aplication data, then this means the
@@ -1362,6 +1365,19 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
     } else {
         parsed += input_len;
         ssl_state->curr_connp->bytes_processed += input_len;
+
+        /* nothing looks at the rest of an encrypted record, so have the
+         * stream engine skip it and expect the next record header */
+        if (ssl_state->curr_connp->content_type == SSLV3_APPLICATION_PROTOCOL &&
+                (ssl_state->flags & SSL_AL_FLAG_CLIENT_CHANGE_CIPHER_SPEC) &&
+                (ssl_state->flags & SSL_AL_FLAG_SERVER_CHANGE_CIPHER_SPEC)) {
+            uint32_t skip = ssl_state->curr_connp->record_length +
+                SSLV3_RECORD_HDR_LEN - ssl_state->curr_connp->bytes_processed;
+            SCLogDebug("skipping %u bytes of encrypted data", skip);
+            AppLayerParserStateSetStreamSkip(pstate,
+                    direction == 0 ? STREAM_TOSERVER : STREAM_TOCLIENT, skip);
+            SSLParserReset(ssl_state);
+        }
         return parsed;
     }
 
@@ -1870,6 +1886,8 @@ void RegisterSSLParsers(void)
         AppLayerParserRegisterGetStateProgressCompletionStatus(ALPROTO_TLS,
                                                                SSLGetAlstateProgressCompletionStatus);
 
+        AppLayerParserConfEncryptionBypass(IPPROTO_TCP, ALPROTO_TLS, proto_name);
+
         /* Get the value of no reassembly option from the config file */
         if (ConfGetNode("app-layer.protocols.tls.no-reassemble") == NULL) {
             if (ConfGetBool("tls.no-reassemble", &ssl_config.no_reassemble) != 1)
@@ -4314,6 +4332,85 @@ static int SSLParserTest26(void)
     PASS;
 }
 
+/** \test the stream engine skips the rest of an encrypted record */
+static int SSLParserTest27(void)
+{
+    Flow f;
+    TcpSession ssn;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    uint8_t record1[] = { 0x17, 0x03, 0x01, 0x00, 0x01, 0x00 };
+    /* header of a 256 byte record and the first 11 bytes of it */
+    uint8_t record2[] = {
+        0x17, 0x03, 0x01, 0x01, 0x00, 0x01, 0x02, 0x03,
+        0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b };
+    uint8_t payload[100] = { 0 };
+
+    memset(&tv, 0, sizeof(tv));
+    memset(&f, 0, sizeof(f));
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.server, 100);
+    StreamTcpUTSetupStream(&ssn.client, 100);
+
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.alproto = ALPROTO_TLS;
+
+    FLOWLOCK_WRLOCK(&f);
+    int r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_TLS,
+                                STREAM_TOSERVER, record1, sizeof(record1));
+    FLOWLOCK_UNLOCK(&f);
+    FAIL_IF(r != 0);
+    ssn.client.app_progress_rel += sizeof(record1);
+
+    SSLState *ssl_state = f.alstate;
+    FAIL_IF_NULL(ssl_state);
+    FAIL_IF(ssn.client.skip_until != 0);
+
+    ssl_state->flags |= SSL_AL_FLAG_CLIENT_CHANGE_CIPHER_SPEC |
+        SSL_AL_FLAG_SERVER_CHANGE_CIPHER_SPEC;
+
+    FLOWLOCK_WRLOCK(&f);
+    r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_TLS,
+                            STREAM_TOSERVER, record2, sizeof(record2));
+    FLOWLOCK_UNLOCK(&f);
+    FAIL_IF(r != 0);
+    ssn.client.app_progress_rel += sizeof(record2);
+
+    /* 245 bytes of the record are left, next is a record header */
+    FAIL_IF(ssn.client.skip_until != 6 + 16 + 245);
+    FAIL_IF(ssl_state->client_connp.bytes_processed != 0);
+    FAIL_IF(ssn.server.skip_until != 0);
+
+    /* the rest of the record isn't reassembled */
+    r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 123,
+                              payload, sizeof(payload));
+    FAIL_IF(r != 0);
+    r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 223,
+                              payload, sizeof(payload));
+    FAIL_IF(r != 0);
+    FAIL_IF_NOT_NULL(ssn.client.seg_list);
+
+    /* the data with the next record is */
+    r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 323,
+                              payload, sizeof(payload));
+    FAIL_IF(r != 0);
+    FAIL_IF_NULL(ssn.client.seg_list);
+    FAIL_IF(ssn.client.seg_list->seq != 323);
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    FLOW_DESTROY(&f);
+
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SSLParserRegisterTests(void)
@@ -4347,6 +4444,7 @@ void SSLParserRegisterTests(void)
     UtRegisterTest("SSLParserTest24", SSLParserTest24);
     UtRegisterTest("SSLParserTest25", SSLParserTest25);
     UtRegisterTest("SSLParserTest26", SSLParserTest26);
+    UtRegisterTest("SSLParserTest27", SSLParserTest27);
 
     UtRegisterTest("SSLParserMultimsgTest01", SSLParserMultimsgTest01);
     UtRegisterTest("SSLParserMultimsgTest02", SSLParserMultimsgTest02);
@@ -72,11 +72,17 @@ struct AppLayerThreadCtx_ {
 typedef struct AppLayerCounterNames_ {
     char name[MAX_COUNTER_SIZE];
     char tx_name[MAX_COUNTER_SIZE];
+    char bypassed_pkts_name[MAX_COUNTER_SIZE];
+    char bypassed_bytes_name[MAX_COUNTER_SIZE];
+    char probing_name[MAX_COUNTER_SIZE];
 } AppLayerCounterNames;
 
 typedef struct AppLayerCounters_ {
     uint16_t counter_id;
     uint16_t counter_tx_id;
+    uint16_t counter_bypassed_pkts_id;
+    uint16_t counter_bypassed_bytes_id;
+    uint16_t counter_probing_id;
 } AppLayerCounters;
 
 /* counter names. Only used at init. */
@@ -109,6 +115,30 @@ void AppLayerIncTxCounter(ThreadVars *tv, Flow *f, uint64_t step)
     }
 }
 
+/** \brief account a packet of a flow that the encryption bypass
+ *         bypassed locally */
+void AppLayerIncBypassedCounters(ThreadVars *tv, const Flow *f, const Packet *p)
+{
+    const AppLayerCounters *c = &applayer_counters[f->protomap][f->alproto];
+    if (likely(tv) && c->counter_bypassed_pkts_id > 0) {
+        StatsIncr(tv, c->counter_bypassed_pkts_id);
+        StatsAddUI64(tv, c->counter_bypassed_bytes_id, GET_PKT_LEN(p));
+    }
+}
+
+/** \brief account a probing parser run during protocol detection */
+void AppLayerIncProbingCounter(ThreadVars *tv, uint8_t ipproto, AppProto alproto)
+{
+    const uint8_t ipproto_map = FlowGetProtoMapping(ipproto);
+    if (ipproto_map >= FLOW_PROTO_APPLAYER_MAX || alproto >= ALPROTO_MAX)
+        return;
+
+    const uint16_t id = applayer_counters[ipproto_map][alproto].counter_probing_id;
+    if (likely(tv) && id > 0) {
+        StatsIncr(tv, id);
+    }
+}
+
 /* in IDS mode protocol detection is done in reverse order:
  * when TCP data is ack'd. We want to flag the correct packet,
  * so in this case we set a flag in the flow so that the first
@@ -778,6 +808,7 @@ AppLayerThreadCtx *AppLayerGetCtxThread(ThreadVars *tv)
 
     if ((app_tctx->alpd_tctx = AppLayerProtoDetectGetCtxThread()) == NULL)
         goto error;
+    AppLayerProtoDetectSetCtxThreadVars(app_tctx->alpd_tctx, tv);
     if ((app_tctx->alp_tctx = AppLayerParserThreadCtxAlloc()) == NULL)
         goto error;
 
@@ -873,6 +904,34 @@ void AppLayerSetupCounters()
                         sizeof(applayer_counter_names[ipproto_map][alproto].name),
                         "%s%s%s", str, "failed", ipproto_suffix);
             }
+
+            uint64_t bypass_bytes;
+            if (alprotos[alproto] == 1 &&
+                    AppLayerParserGetEncryptionBypass(ipprotos[ipproto], alproto, &bypass_bytes))
+            {
+                const char *alproto_str = AppLayerGetProtoName(alproto);
+                snprintf(applayer_counter_names[ipproto_map][alproto].bypassed_pkts_name,
+                        sizeof(applayer_counter_names[ipproto_map][alproto].bypassed_pkts_name),
+                        "app_layer.bypassed_pkts.%s", alproto_str);
+                snprintf(applayer_counter_names[ipproto_map][alproto].bypassed_bytes_name,
+                        sizeof(applayer_counter_names[ipproto_map][alproto].bypassed_bytes_name),
+                        "app_layer.bypassed_bytes.%s", alproto_str);
+            }
+
+            if (alprotos[alproto] == 1 &&
+                    AppLayerProtoDetectPPIsRegistered(ipprotos[ipproto], alproto))
+            {
+                const char *alproto_str = AppLayerGetProtoName(alproto);
+                if (AppLayerProtoDetectPPIsRegistered(other_ipproto, alproto)) {
+                    snprintf(applayer_counter_names[ipproto_map][alproto].probing_name,
+                            sizeof(applayer_counter_names[ipproto_map][alproto].probing_name),
+                            "app_layer.probing.%s%s", alproto_str, ipproto_suffix);
+                } else {
+                    snprintf(applayer_counter_names[ipproto_map][alproto].probing_name,
+                            sizeof(applayer_counter_names[ipproto_map][alproto].probing_name),
+                            "app_layer.probing.%s", alproto_str);
+                }
+            }
         }
     }
 }
@@ -902,6 +961,18 @@ void AppLayerRegisterThreadCounters(ThreadVars *tv)
                 applayer_counters[ipproto_map][alproto].counter_id =
                     StatsRegisterCounter(applayer_counter_names[ipproto_map][alproto].name, tv);
             }
+
+            if (applayer_counter_names[ipproto_map][alproto].bypassed_pkts_name[0] != '\0') {
+                applayer_counters[ipproto_map][alproto].counter_bypassed_pkts_id =
+                    StatsRegisterCounter(applayer_counter_names[ipproto_map][alproto].bypassed_pkts_name, tv);
+                applayer_counters[ipproto_map][alproto].counter_bypassed_bytes_id =
+                    StatsRegisterCounter(applayer_counter_names[ipproto_map][alproto].bypassed_bytes_name, tv);
+            }
+
+            if (applayer_counter_names[ipproto_map][alproto].probing_name[0] != '\0') {
+                applayer_counters[ipproto_map][alproto].counter_probing_id =
+                    StatsRegisterCounter(applayer_counter_names[ipproto_map][alproto].probing_name, tv);
+            }
         }
     }
 }
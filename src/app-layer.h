@@ -144,5 +144,7 @@ void AppLayerUnittestsRegister(void);
 #endif
 
 void AppLayerIncTxCounter(ThreadVars *tv, Flow *f, uint64_t step);
+void AppLayerIncBypassedCounters(ThreadVars *tv, const Flow *f, const Packet *p);
+void AppLayerIncProbingCounter(ThreadVars *tv, uint8_t ipproto, AppProto alproto);
 
 #endif
@@ -66,6 +66,7 @@
 
 #include "output.h"
 #include "output-flow.h"
+#include "defrag-hash.h"
 
 int DecodeTunnel(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
         uint8_t *pkt, uint16_t len, PacketQueue *pq, enum DecodeTunnelProto proto)
@@ -282,6 +283,7 @@ Packet *PacketTunnelPktSetup(ThreadVars *tv, DecodeThreadVars *dtv, Packet *pare
     p->ts.tv_usec = parent->ts.tv_usec;
     p->datalink = DLT_RAW;
     p->tenant_id = parent->tenant_id;
+    p->input_id = parent->input_id;
 
     /* set the root ptr to the lowest layer */
     if (parent->root != NULL)
@@ -356,6 +358,7 @@ Packet *PacketDefragPktSetup(Packet *parent, uint8_t *pkt, uint16_t len, uint8_t
     p->ts.tv_usec = parent->ts.tv_usec;
     p->datalink = DLT_RAW;
     p->tenant_id = parent->tenant_id;
+    p->input_id = parent->input_id;
     /* tell new packet it's part of a tunnel */
     SET_TUNNEL_PKT(p);
     p->vlan_id[0] = parent->vlan_id[0];
@@ -531,6 +534,9 @@ void DecodeThreadVarsFree(ThreadVars *tv, DecodeThreadVars *dtv)
         if (dtv->output_flow_thread_data != NULL)
             OutputFlowLogThreadDeinit(tv, dtv->output_flow_thread_data);
 
+        if (dtv->defrag_trackers != NULL)
+            DefragThreadTrackersFree(dtv->defrag_trackers);
+
         SCFree(dtv);
     }
 }
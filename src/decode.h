@@ -588,6 +588,11 @@ typedef struct Packet_
     /** tenant id for this packet, if any. If 0 then no tenant was assigned. */
     uint32_t tenant_id;
 
+    /** id of the input (e.g. pcap file) this packet was read from, for
+     *  runs that read several inputs at once. Part of the flow key, so
+     *  flows from different inputs never get mixed up. 0 by default. */
+    uint16_t input_id;
+
     /* The Packet pool from which this packet was allocated. Used when returning
      * the packet to its owner's stack. If NULL, then allocated with malloc.
      */
@@ -692,6 +697,12 @@ typedef struct DecodeThreadVars_
      * flow recycle during lookups */
     void *output_flow_thread_data;
 
+    /** flow table of this worker, NULL if the global flow hash is used */
+    struct FlowShard_ *flow_shard;
+
+    /** defrag trackers of this thread, with "defrag.thread-local" */
+    struct DefragThreadTrackers_ *defrag_trackers;
+
 #ifdef __SC_CUDA_SUPPORT__
     CudaThreadVars cuda_vars;
 #endif
@@ -831,6 +842,7 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
         PACKET_RESET_CHECKSUMS((p));            \
         PACKET_PROFILING_RESET((p));            \
         p->tenant_id = 0;                       \
+        p->input_id = 0;                        \
     } while (0)
 
 #define PACKET_RECYCLE(p) do { \
@@ -1135,6 +1147,9 @@ void DecodeGlobalConfig(void);
 
 #define PKT_PSEUDO_DETECTLOG_FLUSH      (1<<27)     /**< Detect/log flush for protocol upgrade */
 
+/** Packet is counted in its autofp flow slot until it leaves the queue */
+#define PKT_AUTOFP_SLOT                 (1<<28)
+
 
 /** \brief return 1 if the packet is a pseudo packet */
 #define PKT_IS_PSEUDOPKT(p) \
@@ -24,6 +24,8 @@
 #include "util-byte.h"
 #include "util-misc.h"
 #include "util-hash-lookup3.h"
+#include "util-cpu.h"
+#include "tm-threads.h"
 
 static DefragTracker *DefragTrackerGetUsedDefragTracker(void);
 
@@ -95,12 +97,14 @@ static void DefragTrackerInit(DefragTracker *dt, Packet *p)
     dt->proto = IP_GET_IPPROTO(p);
     dt->vlan_id[0] = p->vlan_id[0];
     dt->vlan_id[1] = p->vlan_id[1];
+    dt->input_id = p->input_id;
     dt->policy = DefragGetOsPolicy(p);
     dt->host_timeout = DefragPolicyGetHostTimeout(p);
     dt->remove = 0;
     dt->seen_last = 0;
 
     TAILQ_INIT(&dt->frags);
+    dt->frag_tree = NULL;
     (void) DefragTrackerIncrUsecnt(dt);
 }
 
@@ -173,6 +177,16 @@ void DefragInitConfig(char quiet)
             WarnInvalidConfEntry("defrag.trackers", "%"PRIu32, defrag_config.prealloc);
         }
     }
+    int thread_local = 0;
+    if (ConfGetBool("defrag.thread-local", &thread_local) == 1 && thread_local) {
+        defrag_config.thread_trackers = 1;
+
+        /* the trackers are spread over the decode threads */
+        uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
+        defrag_config.thread_hash_size = defrag_config.hash_size / (ncpus ? ncpus : 1);
+        if (defrag_config.thread_hash_size < 256)
+            defrag_config.thread_hash_size = 256;
+    }
     SCLogDebug("DefragTracker config from suricata.yaml: memcap: %"PRIu64", hash-size: "
                "%"PRIu32", prealloc: %"PRIu32, defrag_config.memcap,
                defrag_config.hash_size, defrag_config.prealloc);
@@ -345,7 +359,7 @@ typedef struct DefragHashKey6_ {
  *  id
  *  vlan_id
  */
-static inline uint32_t DefragHashGetKey(Packet *p)
+static inline uint32_t DefragHashGetHash(Packet *p)
 {
     uint32_t key;
 
@@ -362,8 +376,7 @@ static inline uint32_t DefragHashGetKey(Packet *p)
         dhk.vlan_id[0] = p->vlan_id[0];
         dhk.vlan_id[1] = p->vlan_id[1];
 
-        uint32_t hash = hashword(dhk.u32, 4, defrag_config.hash_rand);
-        key = hash % defrag_config.hash_size;
+        key = hashword(dhk.u32, 4, defrag_config.hash_rand);
     } else if (p->ip6h != NULL) {
         DefragHashKey6 dhk;
         if (DefragHashRawAddressIPv6GtU32(p->src.addr_data32, p->dst.addr_data32)) {
@@ -389,14 +402,18 @@ static inline uint32_t DefragHashGetKey(Packet *p)
         dhk.vlan_id[0] = p->vlan_id[0];
         dhk.vlan_id[1] = p->vlan_id[1];
 
-        uint32_t hash = hashword(dhk.u32, 10, defrag_config.hash_rand);
-        key = hash % defrag_config.hash_size;
+        key = hashword(dhk.u32, 10, defrag_config.hash_rand);
     } else
         key = 0;
 
     return key;
 }
 
+static inline uint32_t DefragHashGetKey(Packet *p)
+{
+    return DefragHashGetHash(p) % defrag_config.hash_size;
+}
+
 /* Since two or more trackers can have the same hash key, we need to compare
  * the tracker with the current tracker key. */
 #define CMP_DEFRAGTRACKER(d1,d2,id) \
@@ -407,7 +424,8 @@ static inline uint32_t DefragHashGetKey(Packet *p)
      (d1)->proto == IP_GET_IPPROTO(d2) &&   \
      (d1)->id == (id) && \
      (d1)->vlan_id[0] == (d2)->vlan_id[0] && \
-     (d1)->vlan_id[1] == (d2)->vlan_id[1])
+     (d1)->vlan_id[1] == (d2)->vlan_id[1] && \
+     (d1)->input_id == (d2)->input_id)
 
 static inline int DefragTrackerCompare(DefragTracker *t, Packet *p)
 {
@@ -713,4 +731,285 @@ static DefragTracker *DefragTrackerGetUsedDefragTracker(void)
     return NULL;
 }
 
+/** thread tables, so the flow manager can find their owners */
+static DefragThreadTrackers *defrag_thread_trackers_list = NULL;
+static SCMutex defrag_thread_trackers_list_m = SCMUTEX_INITIALIZER;
+
+/** \brief get the tracker table of a decode thread
+ *
+ *  \param tv owner of the table, woken up to time out its trackers when
+ *            it is idle. Can be NULL, in which case the table is not
+ *            registered.
+ *
+ *  \retval dtt table or NULL if it doesn't fit in the memcap
+ */
+DefragThreadTrackers *DefragThreadTrackersNew(ThreadVars *tv)
+{
+    uint64_t size = defrag_config.thread_hash_size * sizeof(DefragTracker *);
+    if (!(DEFRAG_CHECK_MEMCAP(sizeof(DefragThreadTrackers) + size))) {
+        return NULL;
+    }
+
+    DefragThreadTrackers *dtt = SCCalloc(1, sizeof(*dtt));
+    if (unlikely(dtt == NULL))
+        return NULL;
+    dtt->rows = SCCalloc(defrag_config.thread_hash_size, sizeof(DefragTracker *));
+    if (unlikely(dtt->rows == NULL)) {
+        SCFree(dtt);
+        return NULL;
+    }
+    dtt->size = defrag_config.thread_hash_size;
+    SC_ATOMIC_INIT(dtt->cnt);
+    dtt->owner = tv;
+
+    if (tv != NULL) {
+        SCMutexLock(&defrag_thread_trackers_list_m);
+        dtt->next = defrag_thread_trackers_list;
+        defrag_thread_trackers_list = dtt;
+        SCMutexUnlock(&defrag_thread_trackers_list_m);
+    }
+
+    (void) SC_ATOMIC_ADD(defrag_memuse, sizeof(DefragThreadTrackers) + size);
+    return dtt;
+}
+
+/** \brief free a thread's tracker table, its trackers go to the spare queue
+ *  \warning the owner must no longer use it */
+void DefragThreadTrackersFree(DefragThreadTrackers *dtt)
+{
+    if (dtt == NULL)
+        return;
+
+    if (dtt->owner != NULL) {
+        SCMutexLock(&defrag_thread_trackers_list_m);
+        DefragThreadTrackers **pdtt = &defrag_thread_trackers_list;
+        while (*pdtt != NULL && *pdtt != dtt)
+            pdtt = &(*pdtt)->next;
+        if (*pdtt != NULL)
+            *pdtt = dtt->next;
+        SCMutexUnlock(&defrag_thread_trackers_list_m);
+    }
+
+    for (uint32_t u = 0; u < dtt->size; u++) {
+        DefragTracker *dt = dtt->rows[u];
+        while (dt != NULL) {
+            DefragTracker *n = dt->hnext;
+            dt->hnext = NULL;
+            DefragTrackerClearMemory(dt);
+            DefragTrackerMoveToSpare(dt);
+            dt = n;
+        }
+    }
+    (void) SC_ATOMIC_SUB(defrag_memuse, sizeof(DefragThreadTrackers) +
+            dtt->size * sizeof(DefragTracker *));
+    SC_ATOMIC_DESTROY(dtt->cnt);
+    SCFree(dtt->rows);
+    SCFree(dtt);
+}
+
+/** \internal
+ *  \brief check if a tracker of a thread table is done, like
+ *         DefragTrackerTimedOut does for the global hash */
+static inline int DefragThreadTrackerTimedOut(const DefragTracker *dt,
+        const struct timeval *ts)
+{
+    return (dt->remove || !timercmp(&dt->timeout, ts, >));
+}
+
+/** \internal
+ *  \brief unlink a tracker from a thread table and move it to the
+ *         spare queue
+ *
+ *  The owner is the only user of its trackers, so their use_cnt is 0 here.
+ */
+static inline void DefragThreadTrackersRemove(DefragThreadTrackers *dtt,
+        DefragTracker **pdt)
+{
+    DefragTracker *dt = *pdt;
+
+    *pdt = dt->hnext;
+    dt->hnext = NULL;
+    DefragTrackerClearMemory(dt);
+    DefragTrackerMoveToSpare(dt);
+    (void) SC_ATOMIC_SUB(dtt->cnt, 1);
+}
+
+/** \internal
+ *  \brief remove the timed out trackers of a row
+ *
+ *  \retval cnt number of trackers timed out
+ */
+static uint32_t DefragThreadTrackersTimeoutRow(DefragThreadTrackers *dtt,
+        DefragTracker **row, const struct timeval *ts)
+{
+    DefragTracker **pdt = row;
+    uint32_t cnt = 0;
+
+    while (*pdt != NULL) {
+        if (DefragThreadTrackerTimedOut(*pdt, ts)) {
+            DefragThreadTrackersRemove(dtt, pdt);
+            cnt++;
+        } else {
+            pdt = &(*pdt)->hnext;
+        }
+    }
+    return cnt;
+}
+
+/** \brief check that the runmode supports thread local trackers
+ *
+ *  An idle owner times out its trackers from the pseudo packet its
+ *  capture loop injects, which only reaches the owner's own flow worker
+ *  if decode and flow worker run in the same thread. That is the case
+ *  in the workers runmode only, others fall back to the global hash.
+ *
+ *  Called before the threads are created.
+ */
+void DefragThreadTrackersCheckRunmode(const char *runmode)
+{
+    if (!defrag_config.thread_trackers)
+        return;
+
+    if (runmode == NULL || strcasecmp(runmode, "workers") != 0) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "defrag.thread-local is only "
+                "supported in the workers runmode, using the global "
+                "defrag hash for runmode %s", runmode ? runmode : "(null)");
+        defrag_config.thread_trackers = 0;
+    }
+}
+
+/** \brief ask the owners of thread tables with trackers in them to time
+ *         them out
+ *
+ *  Called by the flow manager. An owner that doesn't see fragments
+ *  anymore would otherwise keep its trackers, and their memcap, until
+ *  the next fragment. The capture loop of the owner injects a pseudo
+ *  packet, from which its flow worker calls DefragThreadTrackersTimeout.
+ */
+void DefragThreadTrackersWakeup(void)
+{
+    SCMutexLock(&defrag_thread_trackers_list_m);
+    for (DefragThreadTrackers *dtt = defrag_thread_trackers_list;
+            dtt != NULL; dtt = dtt->next)
+    {
+        if (SC_ATOMIC_GET(dtt->cnt) > 0)
+            TmThreadsSetFlag(dtt->owner, THV_CAPTURE_INJECT_PKT);
+    }
+    SCMutexUnlock(&defrag_thread_trackers_list_m);
+}
+
+/** \brief time out the trackers of the table owned by a thread
+ *
+ *  \param tv calling thread, the owner of the table
+ *  \param ts current time
+ *
+ *  \retval cnt number of trackers timed out
+ */
+uint32_t DefragThreadTrackersTimeout(ThreadVars *tv, const struct timeval *ts)
+{
+    DefragThreadTrackers *dtt;
+    uint32_t cnt = 0;
+
+    SCMutexLock(&defrag_thread_trackers_list_m);
+    for (dtt = defrag_thread_trackers_list; dtt != NULL; dtt = dtt->next) {
+        if (dtt->owner == tv)
+            break;
+    }
+    SCMutexUnlock(&defrag_thread_trackers_list_m);
+
+    /* only the owner itself frees or changes its table */
+    if (dtt == NULL || SC_ATOMIC_GET(dtt->cnt) == 0)
+        return 0;
+
+    for (uint32_t u = 0; u < dtt->size; u++) {
+        cnt += DefragThreadTrackersTimeoutRow(dtt, &dtt->rows[u], ts);
+    }
+    return cnt;
+}
+
+#define DEFRAG_THREAD_PRUNE_ROWS 4
+
+/** \internal
+ *  \brief take a tracker from the thread's own table when the memcap
+ *         is reached, the counterpart of DefragTrackerGetUsedDefragTracker
+ *
+ *  \retval dt cleared, unlinked and *unlocked* tracker or NULL
+ */
+static DefragTracker *DefragThreadTrackersGetUsed(DefragThreadTrackers *dtt)
+{
+    for (uint32_t cnt = 0; cnt < dtt->size; cnt++) {
+        uint32_t idx = (dtt->prune_idx + cnt) % dtt->size;
+        DefragTracker **pdt = &dtt->rows[idx];
+
+        if (*pdt == NULL)
+            continue;
+
+        /* the tail of the row is the least recently used one */
+        while ((*pdt)->hnext != NULL)
+            pdt = &(*pdt)->hnext;
+
+        DefragTracker *dt = *pdt;
+        *pdt = NULL;
+        DefragTrackerClearMemory(dt);
+        (void) SC_ATOMIC_SUB(dtt->cnt, 1);
+        dtt->prune_idx = idx + 1;
+        return dt;
+    }
+    return NULL;
+}
+
+/** \brief look up the tracker for a fragment in the thread's own table
+ *
+ *  Like DefragGetTrackerFromHash, but without the row locks. The tracker
+ *  is still locked and its use_cnt incremented, so DefragTrackerRelease
+ *  applies to both.
+ *
+ *  \retval dt *LOCKED* tracker or NULL
+ */
+DefragTracker *DefragGetTrackerFromThread(DefragThreadTrackers *dtt, Packet *p)
+{
+    /* time out a few rows per fragment, nobody else does it for us */
+    for (int i = 0; i < DEFRAG_THREAD_PRUNE_ROWS; i++) {
+        DefragThreadTrackersTimeoutRow(dtt, &dtt->rows[dtt->prune_idx], &p->ts);
+        if (++dtt->prune_idx >= dtt->size)
+            dtt->prune_idx = 0;
+    }
+
+    DefragTracker **row = &dtt->rows[DefragHashGetHash(p) % dtt->size];
+    DefragTracker **pdt = row;
+    DefragTracker *dt;
 
+    while ((dt = *pdt) != NULL) {
+        if (DefragThreadTrackerTimedOut(dt, &p->ts)) {
+            DefragThreadTrackersRemove(dtt, pdt);
+            continue;
+        }
+
+        if (DefragTrackerCompare(dt, p) != 0) {
+            /* put it on top of the row -- this rewards active trackers */
+            *pdt = dt->hnext;
+            dt->hnext = *row;
+            *row = dt;
+
+            SCMutexLock(&dt->lock);
+            (void) DefragTrackerIncrUsecnt(dt);
+            return dt;
+        }
+        pdt = &dt->hnext;
+    }
+
+    dt = DefragTrackerGetNew(p);
+    if (dt == NULL) {
+        dt = DefragThreadTrackersGetUsed(dtt);
+        if (dt == NULL)
+            return NULL;
+        SCMutexLock(&dt->lock);
+    }
+
+    /* tracker is locked */
+    DefragTrackerInit(dt, p);
+    dt->hnext = *row;
+    *row = dt;
+    (void) SC_ATOMIC_ADD(dtt->cnt, 1);
+    return dt;
+}
@@ -72,8 +72,31 @@ typedef struct DefragConfig_ {
     uint32_t hash_rand;
     uint32_t hash_size;
     uint32_t prealloc;
+    uint8_t thread_trackers;    /**< "defrag.thread-local" */
+    uint32_t thread_hash_size;
 } DefragConfig;
 
+/** \brief defrag trackers owned by a single decode thread
+ *
+ *  With "defrag.thread-local" each decode thread keeps the trackers of
+ *  the fragments it sees in a table of its own, so the lookups take no
+ *  row locks. This is only correct if the capture method sends all
+ *  fragments of a datagram to the same thread. The defrag timeout code
+ *  doesn't walk these tables: the owner times out its trackers itself,
+ *  on lookup and a few rows per fragment. When the owner sees no more
+ *  fragments, the flow manager wakes it up so that its flow worker
+ *  times them out from the pseudo packet the capture loop injects. So
+ *  this is only supported in the workers runmode.
+ */
+typedef struct DefragThreadTrackers_ {
+    DefragTracker **rows;
+    uint32_t size;
+    uint32_t prune_idx;         /**< next row to time out */
+    SC_ATOMIC_DECLARE(uint32_t, cnt);   /**< trackers in the table */
+    ThreadVars *owner;
+    struct DefragThreadTrackers_ *next; /**< next registered table */
+} DefragThreadTrackers;
+
 /** \brief check if a memory alloc would fit in the memcap
  *
  *  \param size memory allocation size to check
@@ -94,6 +117,12 @@ void DefragHashShutdown(void);
 
 DefragTracker *DefragLookupTrackerFromHash (Packet *);
 DefragTracker *DefragGetTrackerFromHash (Packet *);
+DefragThreadTrackers *DefragThreadTrackersNew(ThreadVars *);
+void DefragThreadTrackersFree(DefragThreadTrackers *);
+DefragTracker *DefragGetTrackerFromThread(DefragThreadTrackers *, Packet *);
+void DefragThreadTrackersCheckRunmode(const char *runmode);
+void DefragThreadTrackersWakeup(void);
+uint32_t DefragThreadTrackersTimeout(ThreadVars *, const struct timeval *);
 void DefragTrackerRelease(DefragTracker *);
 void DefragTrackerClearMemory(DefragTracker *);
 void DefragTrackerMoveToSpare(DefragTracker *);
@@ -56,6 +56,7 @@
 #include "defrag-config.h"
 
 #include "tmqh-packetpool.h"
+#include "tm-threads.h"
 #include "decode.h"
 
 #ifdef UNITTESTS
@@ -96,6 +97,15 @@ enum defrag_policies {
 
 static int default_policy = DEFRAG_POLICY_BSD;
 
+#ifdef UNITTESTS
+/** visit the fragments like before the fragment tree, by walking the
+ *  whole list, so that tests can compare the two */
+static int defrag_list_walk = 0;
+#define DEFRAG_LIST_WALK defrag_list_walk
+#else
+#define DEFRAG_LIST_WALK 0
+#endif
+
 /** The global DefragContext so all threads operate from the same
  * context. */
 static DefragContext *defrag_context;
@@ -161,10 +171,211 @@ DefragTrackerFreeFrags(DefragTracker *tracker)
         DefragFragReset(frag);
         PoolReturn(defrag_context->frag_pool, frag);
     }
+    tracker->frag_tree = NULL;
 
     SCMutexUnlock(&defrag_context->frag_pool_lock);
 }
 
+/*
+ *  Fragment tree
+ *
+ *  The fragments of a tracker are indexed by a red-black tree keyed on
+ *  their offset. Each node also holds the highest end (offset + data_len)
+ *  of its subtree, which makes it an interval tree: the first fragment,
+ *  in offset order, that ends at or after a given offset is found in
+ *  O(log n). The list stays the way to iterate the fragments in order.
+ *  Fragments with the same offset are ordered by insert time in both.
+ *
+ *  Fragments are only ever removed all at once, so there is no removal
+ *  from the tree.
+ */
+
+#define FRAG_TREE_BLACK 0
+#define FRAG_TREE_RED   1
+
+#define FRAG_TREE_IS_RED(frag) ((frag) != NULL && (frag)->tree_color == FRAG_TREE_RED)
+
+#define FRAG_END(frag) ((uint32_t)(frag)->offset + (frag)->data_len)
+
+static inline void DefragFragTreeUpdateMaxEnd(Frag *frag)
+{
+    uint32_t max_end = FRAG_END(frag);
+
+    if (frag->tree_left != NULL && frag->tree_left->tree_max_end > max_end)
+        max_end = frag->tree_left->tree_max_end;
+    if (frag->tree_right != NULL && frag->tree_right->tree_max_end > max_end)
+        max_end = frag->tree_right->tree_max_end;
+    frag->tree_max_end = max_end;
+}
+
+/** \internal
+ *  \brief put 'new' in the place of 'old' in old's parent, or at the root */
+static inline void DefragFragTreeReplaceChild(DefragTracker *tracker,
+        Frag *parent, Frag *old, Frag *new)
+{
+    if (parent == NULL)
+        tracker->frag_tree = new;
+    else if (parent->tree_left == old)
+        parent->tree_left = new;
+    else
+        parent->tree_right = new;
+}
+
+static void DefragFragTreeRotateLeft(DefragTracker *tracker, Frag *x)
+{
+    Frag *y = x->tree_right;
+
+    x->tree_right = y->tree_left;
+    if (y->tree_left != NULL)
+        y->tree_left->tree_parent = x;
+
+    y->tree_parent = x->tree_parent;
+    DefragFragTreeReplaceChild(tracker, x->tree_parent, x, y);
+
+    y->tree_left = x;
+    x->tree_parent = y;
+
+    DefragFragTreeUpdateMaxEnd(x);
+    DefragFragTreeUpdateMaxEnd(y);
+}
+
+static void DefragFragTreeRotateRight(DefragTracker *tracker, Frag *x)
+{
+    Frag *y = x->tree_left;
+
+    x->tree_left = y->tree_right;
+    if (y->tree_right != NULL)
+        y->tree_right->tree_parent = x;
+
+    y->tree_parent = x->tree_parent;
+    DefragFragTreeReplaceChild(tracker, x->tree_parent, x, y);
+
+    y->tree_right = x;
+    x->tree_parent = y;
+
+    DefragFragTreeUpdateMaxEnd(x);
+    DefragFragTreeUpdateMaxEnd(y);
+}
+
+/** \internal
+ *  \brief find the first fragment with an offset beyond 'offset'
+ *
+ *  \param parent set to the node to attach a new fragment with this
+ *                offset to
+ *
+ *  \retval frag fragment to insert before, or NULL to append
+ */
+static Frag *DefragFragTreeFindNext(const DefragTracker *tracker,
+        uint16_t offset, Frag **parent)
+{
+    Frag *node = tracker->frag_tree;
+    Frag *next = NULL;
+
+    *parent = NULL;
+    while (node != NULL) {
+        *parent = node;
+        if (offset < node->offset) {
+            next = node;
+            node = node->tree_left;
+        } else {
+            node = node->tree_right;
+        }
+    }
+    return next;
+}
+
+/** \internal
+ *  \brief find the first fragment, in offset order, that ends at or
+ *         after 'offset'
+ *
+ *  Fragments before it end before 'offset' and can't overlap data
+ *  starting there.
+ *
+ *  \retval frag or NULL if all fragments end before 'offset'
+ */
+static Frag *DefragFragTreeFirstEnding(const DefragTracker *tracker,
+        uint32_t offset)
+{
+    Frag *node = tracker->frag_tree;
+
+    while (node != NULL && node->tree_max_end >= offset) {
+        if (node->tree_left != NULL && node->tree_left->tree_max_end >= offset)
+            node = node->tree_left;
+        else if (FRAG_END(node) >= offset)
+            return node;
+        else
+            node = node->tree_right;
+    }
+    return NULL;
+}
+
+/** \internal
+ *  \brief add a fragment to the tree below 'parent', as returned by
+ *         DefragFragTreeFindNext, and rebalance */
+static void DefragFragTreeInsert(DefragTracker *tracker, Frag *frag, Frag *parent)
+{
+    frag->tree_left = frag->tree_right = NULL;
+    frag->tree_parent = parent;
+    frag->tree_color = FRAG_TREE_RED;
+    frag->tree_max_end = FRAG_END(frag);
+
+    if (parent == NULL)
+        tracker->frag_tree = frag;
+    else if (frag->offset < parent->offset)
+        parent->tree_left = frag;
+    else
+        parent->tree_right = frag;
+
+    /* the new end may raise the max of the subtrees it was added to */
+    for (Frag *node = parent; node != NULL; node = node->tree_parent) {
+        if (node->tree_max_end >= frag->tree_max_end)
+            break;
+        node->tree_max_end = frag->tree_max_end;
+    }
+
+    while ((parent = frag->tree_parent) != NULL && parent->tree_color == FRAG_TREE_RED) {
+        /* parent is red so it is not the root */
+        Frag *gparent = parent->tree_parent;
+
+        if (parent == gparent->tree_left) {
+            Frag *uncle = gparent->tree_right;
+            if (FRAG_TREE_IS_RED(uncle)) {
+                uncle->tree_color = FRAG_TREE_BLACK;
+                parent->tree_color = FRAG_TREE_BLACK;
+                gparent->tree_color = FRAG_TREE_RED;
+                frag = gparent;
+                continue;
+            }
+            if (frag == parent->tree_right) {
+                DefragFragTreeRotateLeft(tracker, parent);
+                frag = parent;
+                parent = frag->tree_parent;
+            }
+            parent->tree_color = FRAG_TREE_BLACK;
+            gparent->tree_color = FRAG_TREE_RED;
+            DefragFragTreeRotateRight(tracker, gparent);
+        } else {
+            Frag *uncle = gparent->tree_left;
+            if (FRAG_TREE_IS_RED(uncle)) {
+                uncle->tree_color = FRAG_TREE_BLACK;
+                parent->tree_color = FRAG_TREE_BLACK;
+                gparent->tree_color = FRAG_TREE_RED;
+                frag = gparent;
+                continue;
+            }
+            if (frag == parent->tree_left) {
+                DefragFragTreeRotateRight(tracker, parent);
+                frag = parent;
+                parent = frag->tree_parent;
+            }
+            parent->tree_color = FRAG_TREE_BLACK;
+            gparent->tree_color = FRAG_TREE_RED;
+            DefragFragTreeRotateLeft(tracker, gparent);
+        }
+    }
+    tracker->frag_tree->tree_color = FRAG_TREE_BLACK;
+}
+
 /**
  * \brief Create a new DefragContext.
  *
@@ -607,8 +818,18 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
     Frag *prev = NULL, *next;
     int overlap = 0;
     ltrim = 0;
+    /* Fragments ending before this one starts and fragments starting
+     * beyond its end never match one of the policy checks below, so only
+     * the ones in between are visited. The visiting order is unchanged. */
     if (!TAILQ_EMPTY(&tracker->frags)) {
-        TAILQ_FOREACH(prev, &tracker->frags, next) {
+        if (DEFRAG_LIST_WALK)
+            prev = TAILQ_FIRST(&tracker->frags);
+        else
+            prev = DefragFragTreeFirstEnding(tracker, frag_offset);
+        for ( ; prev != NULL; prev = TAILQ_NEXT(prev, next)) {
+            if (prev->offset > frag_end && !DEFRAG_LIST_WALK) {
+                break;
+            }
             if (prev->skip) {
                 continue;
             }
@@ -811,11 +1032,15 @@ insert:
     new->pcap_cnt = pcap_cnt;
 #endif
 
-    Frag *frag;
-    TAILQ_FOREACH(frag, &tracker->frags, next) {
-        if (new->offset < frag->offset)
-            break;
+    Frag *parent;
+    Frag *frag = DefragFragTreeFindNext(tracker, new->offset, &parent);
+    if (DEFRAG_LIST_WALK) {
+        TAILQ_FOREACH(frag, &tracker->frags, next) {
+            if (new->offset < frag->offset)
+                break;
+        }
     }
+    DefragFragTreeInsert(tracker, new, parent);
     if (frag == NULL) {
         TAILQ_INSERT_TAIL(&tracker->frags, new, next);
     }
@@ -950,6 +1175,12 @@ DefragGetOsPolicy(Packet *p)
 static DefragTracker *
 DefragGetTracker(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
 {
+    if (defrag_config.thread_trackers && dtv != NULL) {
+        if (dtv->defrag_trackers == NULL)
+            dtv->defrag_trackers = DefragThreadTrackersNew(tv);
+        if (dtv->defrag_trackers != NULL)
+            return DefragGetTrackerFromThread(dtv->defrag_trackers, p);
+    }
     return DefragGetTrackerFromHash(p);
 }
 
@@ -2424,6 +2655,245 @@ static int DefragTestJeremyLinux(void)
     PASS;
 }
 
+/**
+ * Check the fragment tree against a walk of the list: after each insert
+ * the list stays in offset order and DefragFragTreeFirstEnding returns
+ * the first fragment in the list ending at or after the offset.
+ */
+static int DefragFragTreeTest(void)
+{
+    DefragTracker tracker;
+    Frag frags[64];
+    uint32_t i, off;
+
+    memset(&tracker, 0, sizeof(tracker));
+    memset(frags, 0, sizeof(frags));
+    TAILQ_INIT(&tracker.frags);
+
+    for (i = 0; i < 64; i++) {
+        Frag *new = &frags[i];
+        new->offset = ((i * 37) % 64) * 8;
+        new->data_len = 8 + ((i * 13) % 5) * 40;
+
+        Frag *parent;
+        Frag *nfrag = DefragFragTreeFindNext(&tracker, new->offset, &parent);
+        DefragFragTreeInsert(&tracker, new, parent);
+        if (nfrag == NULL)
+            TAILQ_INSERT_TAIL(&tracker.frags, new, next);
+        else
+            TAILQ_INSERT_BEFORE(nfrag, new, next);
+
+        FAIL_IF(tracker.frag_tree->tree_color != FRAG_TREE_BLACK);
+        FAIL_IF(tracker.frag_tree->tree_parent != NULL);
+
+        Frag *frag, *prev = NULL;
+        TAILQ_FOREACH(frag, &tracker.frags, next) {
+            FAIL_IF(prev != NULL && prev->offset > frag->offset);
+            prev = frag;
+        }
+
+        for (off = 0; off < 700; off += 4) {
+            Frag *expect = NULL;
+            TAILQ_FOREACH(frag, &tracker.frags, next) {
+                if (FRAG_END(frag) >= off) {
+                    expect = frag;
+                    break;
+                }
+            }
+            FAIL_IF(DefragFragTreeFirstEnding(&tracker, off) != expect);
+        }
+    }
+
+    PASS;
+}
+
+/**
+ * Feed random sequences of overlapping and zero-length fragments to two
+ * trackers, one using the fragment tree and one walking the whole list
+ * like before the tree was added. For each policy the fragment lists
+ * and the reassembled packets have to be the same.
+ */
+static int DefragTreeEquivalenceTest(void)
+{
+    static const int policies[] = { DEFRAG_POLICY_BSD, DEFRAG_POLICY_LINUX,
+        DEFRAG_POLICY_WINDOWS, DEFRAG_POLICY_SOLARIS, DEFRAG_POLICY_FIRST,
+        DEFRAG_POLICY_LAST };
+    uint32_t rnd = 12345;
+    uint16_t id = 1000;
+    int pi, seq, k;
+
+    DefragInit();
+
+    for (pi = 0; pi < (int)(sizeof(policies) / sizeof(policies[0])); pi++) {
+        default_policy = policies[pi];
+
+        for (seq = 0; seq < 50; seq++) {
+            uint16_t ids[2] = { id, id + 1 };
+            id += 2;
+
+            for (k = 0; k < 16; k++) {
+                rnd = rnd * 1103515245 + 12345;
+                uint16_t off = (rnd >> 8) % 16;
+                int len = ((rnd >> 16) % 5) * 8;
+                int mf = ((rnd >> 24) % 6) != 0;
+                if (!mf)
+                    len += (rnd >> 4) % 8;
+
+                Packet *p[2], *r[2];
+                DefragTracker *t[2];
+                int i;
+                for (i = 0; i < 2; i++) {
+                    p[i] = BuildTestPacket(IPPROTO_ICMP, ids[i], off, mf,
+                            'A' + k, len);
+                    FAIL_IF_NULL(p[i]);
+                    defrag_list_walk = i;
+                    r[i] = Defrag(NULL, NULL, p[i], NULL);
+                }
+                defrag_list_walk = 0;
+
+                FAIL_IF((r[0] == NULL) != (r[1] == NULL));
+                if (r[0] != NULL) {
+                    FAIL_IF(GET_PKT_LEN(r[0]) != GET_PKT_LEN(r[1]));
+                    FAIL_IF(memcmp(GET_PKT_DATA(r[0]) + 20,
+                                GET_PKT_DATA(r[1]) + 20,
+                                GET_PKT_LEN(r[0]) - 20) != 0);
+                    SCFree(r[0]);
+                    SCFree(r[1]);
+                    SCFree(p[0]);
+                    SCFree(p[1]);
+                    break;
+                }
+
+                t[0] = DefragLookupTrackerFromHash(p[0]);
+                t[1] = DefragLookupTrackerFromHash(p[1]);
+                FAIL_IF((t[0] == NULL) != (t[1] == NULL));
+                if (t[0] != NULL) {
+                    Frag *a = TAILQ_FIRST(&t[0]->frags);
+                    Frag *b = TAILQ_FIRST(&t[1]->frags);
+                    while (a != NULL && b != NULL) {
+                        FAIL_IF(a->offset != b->offset);
+                        FAIL_IF(a->data_len != b->data_len);
+                        FAIL_IF(a->ltrim != b->ltrim);
+                        FAIL_IF(a->skip != b->skip);
+                        a = TAILQ_NEXT(a, next);
+                        b = TAILQ_NEXT(b, next);
+                    }
+                    FAIL_IF(a != NULL || b != NULL);
+                    DefragTrackerRelease(t[0]);
+                    DefragTrackerRelease(t[1]);
+                }
+                SCFree(p[0]);
+                SCFree(p[1]);
+            }
+        }
+    }
+
+    DefragDestroy();
+    PASS;
+}
+
+/**
+ * With "defrag.thread-local" the fragments are tracked in the decode
+ * thread's own table and not in the global hash.
+ */
+static int DefragThreadLocalTest(void)
+{
+    Packet *p1 = NULL, *p2 = NULL, *p3 = NULL;
+    Packet *reassembled = NULL;
+    DecodeThreadVars dtv;
+    int id = 12;
+    int i;
+
+    memset(&dtv, 0, sizeof(dtv));
+    DefragInit();
+    defrag_config.thread_trackers = 1;
+    defrag_config.thread_hash_size = 256;
+
+    p1 = BuildTestPacket(IPPROTO_ICMP, id, 0, 1, 'A', 8);
+    FAIL_IF_NULL(p1);
+    p2 = BuildTestPacket(IPPROTO_ICMP, id, 1, 1, 'B', 8);
+    FAIL_IF_NULL(p2);
+    p3 = BuildTestPacket(IPPROTO_ICMP, id, 2, 0, 'C', 3);
+    FAIL_IF_NULL(p3);
+
+    FAIL_IF(Defrag(NULL, &dtv, p3, NULL) != NULL);
+    FAIL_IF(Defrag(NULL, &dtv, p2, NULL) != NULL);
+    FAIL_IF_NULL(dtv.defrag_trackers);
+
+    /* nothing in the global hash */
+    FAIL_IF(DefragLookupTrackerFromHash(p1) != NULL);
+
+    reassembled = Defrag(NULL, &dtv, p1, NULL);
+    FAIL_IF_NULL(reassembled);
+    FAIL_IF(IPV4_GET_IPLEN(reassembled) != 39);
+    for (i = 20; i < 20 + 8; i++) {
+        FAIL_IF(GET_PKT_DATA(reassembled)[i] != 'A');
+    }
+    for (i = 28; i < 28 + 8; i++) {
+        FAIL_IF(GET_PKT_DATA(reassembled)[i] != 'B');
+    }
+    for (i = 36; i < 36 + 3; i++) {
+        FAIL_IF(GET_PKT_DATA(reassembled)[i] != 'C');
+    }
+
+    DefragThreadTrackersFree(dtv.defrag_trackers);
+    FAIL_IF(defrag_context->frag_pool->outstanding != 0);
+
+    SCFree(p1);
+    SCFree(p2);
+    SCFree(p3);
+    SCFree(reassembled);
+
+    DefragDestroy();
+    PASS;
+}
+
+/**
+ * Thread local trackers of an idle thread are timed out from the pseudo
+ * packet path after the flow manager woke the thread up.
+ */
+static int DefragThreadLocalTimeoutTest(void)
+{
+    Packet *p1 = NULL;
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    struct timeval ts;
+
+    memset(&tv, 0, sizeof(tv));
+    memset(&dtv, 0, sizeof(dtv));
+    DefragInit();
+    defrag_config.thread_trackers = 1;
+    defrag_config.thread_hash_size = 256;
+
+    p1 = BuildTestPacket(IPPROTO_ICMP, 1, 0, 1, 'A', 8);
+    FAIL_IF_NULL(p1);
+    FAIL_IF(Defrag(&tv, &dtv, p1, NULL) != NULL);
+    FAIL_IF_NULL(dtv.defrag_trackers);
+    FAIL_IF(SC_ATOMIC_GET(dtv.defrag_trackers->cnt) != 1);
+
+    DefragThreadTrackersWakeup();
+    FAIL_IF_NOT(TmThreadsCheckFlag(&tv, THV_CAPTURE_INJECT_PKT));
+
+    /* not timed out yet */
+    ts = p1->ts;
+    FAIL_IF(DefragThreadTrackersTimeout(&tv, &ts) != 0);
+
+    ts.tv_sec += defrag_context->timeout + 1;
+    FAIL_IF(DefragThreadTrackersTimeout(&tv, &ts) != 1);
+    FAIL_IF(SC_ATOMIC_GET(dtv.defrag_trackers->cnt) != 0);
+    FAIL_IF(defrag_context->frag_pool->outstanding != 0);
+
+    /* only the owner's table is swept */
+    FAIL_IF(DefragThreadTrackersTimeout(NULL, &ts) != 0);
+
+    DefragThreadTrackersFree(dtv.defrag_trackers);
+
+    SCFree(p1);
+
+    DefragDestroy();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DefragRegisterTests(void)
@@ -2468,5 +2938,11 @@ void DefragRegisterTests(void)
     UtRegisterTest("DefragTestBadProto", DefragTestBadProto);
 
     UtRegisterTest("DefragTestJeremyLinux", DefragTestJeremyLinux);
+
+    UtRegisterTest("DefragFragTreeTest", DefragFragTreeTest);
+    UtRegisterTest("DefragTreeEquivalenceTest", DefragTreeEquivalenceTest);
+    UtRegisterTest("DefragThreadLocalTest", DefragThreadLocalTest);
+    UtRegisterTest("DefragThreadLocalTimeoutTest",
+                   DefragThreadLocalTimeoutTest);
 #endif /* UNITTESTS */
 }
@@ -69,6 +69,14 @@ typedef struct Frag_ {
 #endif
 
     TAILQ_ENTRY(Frag_) next;    /**< Pointer to next fragment for tailq. */
+
+    /* interval tree on the fragment offsets, see DefragInsertFrag */
+    struct Frag_ *tree_left;
+    struct Frag_ *tree_right;
+    struct Frag_ *tree_parent;
+    uint32_t tree_max_end;      /**< Highest offset + data_len in this
+                                 * subtree. */
+    uint8_t tree_color;
 } Frag;
 
 /**
@@ -80,6 +88,7 @@ typedef struct DefragTracker_ {
                            * this tracker. */
 
     uint16_t vlan_id[2]; /**< VLAN ID tracker applies to. */
+    uint16_t input_id; /**< Input (see Packet::input_id) tracker applies to. */
 
     uint32_t id; /**< IP ID for this tracker.  32 bits for IPv6, 16
                   * for IPv4. */
@@ -105,6 +114,7 @@ typedef struct DefragTracker_ {
     SC_ATOMIC_DECLARE(unsigned int, use_cnt);
 
     TAILQ_HEAD(frag_tailq, Frag_) frags; /**< Head of list of fragments. */
+    Frag *frag_tree; /**< Root of the interval tree indexing frags. */
 
     /** hash pointers, protected by hash row mutex/spin */
     struct DefragTracker_ *hnext;
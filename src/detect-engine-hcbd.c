@@ -58,6 +58,7 @@
 #include "util-unittest-helper.h"
 #include "app-layer.h"
 #include "app-layer-htp.h"
+#include "app-layer-htp-body.h"
 #include "app-layer-protos.h"
 
 #include "conf.h"
@@ -197,7 +198,7 @@ static const uint8_t *DetectEngineHCBDGetBufferForTX(htp_tx_t *tx, uint64_t tx_i
         }
     }
 
-    StreamingBufferGetDataAtOffset(htud->request_body.sb,
+    HtpBodyGetDataAtOffset(&htud->request_body,
             &det_ctx->hcbd[index].buffer, &det_ctx->hcbd[index].buffer_len,
             offset);
     det_ctx->hcbd[index].offset = offset;
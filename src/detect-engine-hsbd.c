@@ -58,6 +58,7 @@
 #include "util-unittest-helper.h"
 #include "app-layer.h"
 #include "app-layer-htp.h"
+#include "app-layer-htp-body.h"
 #include "app-layer-htp-mem.h"
 #include "app-layer-protos.h"
 
@@ -202,7 +203,7 @@ static const uint8_t *DetectEngineHSBDGetBufferForTX(htp_tx_t *tx, uint64_t tx_i
         }
     }
 
-    StreamingBufferGetDataAtOffset(htud->response_body.sb,
+    HtpBodyGetDataAtOffset(&htud->response_body,
             &det_ctx->hsbd[index].buffer, &det_ctx->hsbd[index].buffer_len,
             offset);
     det_ctx->hsbd[index].offset = offset;
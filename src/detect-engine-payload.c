@@ -53,6 +53,22 @@ struct StreamMpmData {
     const MpmCtx *mpm_ctx;
 };
 
+/** \internal
+ *  \brief get the raw stream data of the packet
+ *
+ *  The spans are looked up once per packet and then used by the
+ *  stream mpm and every signature that inspects the stream.
+ */
+static const StreamRawSpans *GetRawSpans(DetectEngineThreadCtx *det_ctx,
+        TcpSession *ssn, const Packet *p)
+{
+    if (!det_ctx->raw_spans_valid) {
+        StreamReassembleRawSpans(ssn, p, &det_ctx->raw_spans);
+        det_ctx->raw_spans_valid = true;
+    }
+    return &det_ctx->raw_spans;
+}
+
 static int StreamMpmFunc(void *cb_data, const uint8_t *data, const uint32_t data_len)
 {
     struct StreamMpmData *smd = cb_data;
@@ -78,9 +94,12 @@ static void PrefilterPktStream(DetectEngineThreadCtx *det_ctx,
     /* for established packets inspect any stream we may have queued up */
     if (p->flags & PKT_DETECT_HAS_STREAMDATA) {
         struct StreamMpmData stream_mpm_data = { det_ctx, mpm_ctx };
-        StreamReassembleRaw(p->flow->protoctx, p,
-                StreamMpmFunc, &stream_mpm_data,
-                &det_ctx->raw_stream_progress);
+        const StreamRawSpans *spans = GetRawSpans(det_ctx, p->flow->protoctx, p);
+        uint32_t i;
+        for (i = 0; i < spans->cnt; i++) {
+            StreamMpmFunc(&stream_mpm_data, spans->span[i].data, spans->span[i].data_len);
+        }
+        det_ctx->raw_stream_progress = spans->progress;
         SCLogDebug("det_ctx->raw_stream_progress %"PRIu64,
                 det_ctx->raw_stream_progress);
     } else {
@@ -268,12 +287,15 @@ int DetectEngineInspectStreamPayload(DetectEngineCtx *de_ctx,
 {
     SCEnter();
 
-    uint64_t unused;
     struct StreamContentInspectData inspect_data = { de_ctx, det_ctx, s, f };
-    int r = StreamReassembleRaw(f->protoctx, p,
-            StreamContentInspectFunc, &inspect_data,
-            &unused);
-    return r;
+    const StreamRawSpans *spans = GetRawSpans(det_ctx, f->protoctx, p);
+    uint32_t i;
+    for (i = 0; i < spans->cnt; i++) {
+        if (StreamContentInspectFunc(&inspect_data,
+                    spans->span[i].data, spans->span[i].data_len) == 1)
+            return 1;
+    }
+    return 0;
 }
 
 struct StreamContentInspectEngineData {
@@ -339,11 +361,16 @@ int DetectEngineInspectStream(ThreadVars *tv,
     if (det_ctx->stream_already_inspected)
         return det_ctx->stream_last_result;
 
-    uint64_t unused;
     struct StreamContentInspectEngineData inspect_data = { de_ctx, det_ctx, s, smd, f };
-    int match = StreamReassembleRaw(f->protoctx, p,
-            StreamContentInspectEngineFunc, &inspect_data,
-            &unused);
+    const StreamRawSpans *spans = GetRawSpans(det_ctx, f->protoctx, p);
+    int match = 0;
+    uint32_t i;
+    for (i = 0; i < spans->cnt; i++) {
+        match = StreamContentInspectEngineFunc(&inspect_data,
+                spans->span[i].data, spans->span[i].data_len);
+        if (match == 1)
+            break;
+    }
 
     bool is_last = false;
     if (flags & STREAM_TOSERVER) {
@@ -745,74 +745,88 @@ void DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
     const uint64_t total_txs = AppLayerParserGetTxCnt(f, alstate);
     const int end_progress = AppLayerParserGetStateProgressCompletionStatus(alproto, flags);
 
-    for ( ; inspect_tx_id < total_txs; inspect_tx_id++) {
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
+    AppLayerGetTxIterTuple ires = IterFunc(f->proto, alproto, alstate,
+            inspect_tx_id, total_txs, &state);
+    while (ires.tx_ptr != NULL) {
         bool inspect_tx_inprogress = false;
-        void *inspect_tx = AppLayerParserGetTx(f->proto, alproto, alstate, inspect_tx_id);
-        if (inspect_tx != NULL) {
-            bool next_tx_no_progress = false;
+        void *inspect_tx = ires.tx_ptr;
+        inspect_tx_id = ires.tx_id;
+
+        /* the next live tx, also needed below to decide about adding a
+         * sig to the 'no inspect array' */
+        AppLayerGetTxIterTuple next = { NULL, 0, false };
+        if (ires.has_next) {
+            next = IterFunc(f->proto, alproto, alstate,
+                    inspect_tx_id + 1, total_txs, &state);
+        }
 
-            const int tx_progress = AppLayerParserGetStateProgress(f->proto, alproto, inspect_tx, flags);
-            if (end_progress < tx_progress) {
-                inspect_tx_inprogress = true;
-            }
-            SCLogDebug("tx %"PRIu64" (%"PRIu64") => %s", inspect_tx_id, total_txs,
-                    inspect_tx_inprogress ? "in progress" : "done");
+        bool next_tx_no_progress = false;
 
-            DetectEngineState *tx_de_state = AppLayerParserGetTxDetectState(f->proto, alproto, inspect_tx);
-            if (tx_de_state == NULL) {
-                SCLogDebug("NO STATE tx %"PRIu64" (%"PRIu64")", inspect_tx_id, total_txs);
-                continue;
-            }
-            DetectEngineStateDirection *tx_dir_state = &tx_de_state->dir_state[direction];
-            DeStateStore *tx_store = tx_dir_state->head;
-
-            SCLogDebug("tx_dir_state->filestore_cnt %u", tx_dir_state->filestore_cnt);
-
-            /* see if we need to consider the next tx in our decision to add
-             * a sig to the 'no inspect array'. */
-            if (!TxIsLast(inspect_tx_id, total_txs)) {
-                void *next_inspect_tx = AppLayerParserGetTx(f->proto, alproto, alstate, inspect_tx_id+1);
-                if (next_inspect_tx != NULL) {
-                    int c = AppLayerParserGetStateProgress(f->proto, alproto, next_inspect_tx, flags);
-                    if (c == 0) {
-                        next_tx_no_progress = true;
-                    }
-                }
+        const int tx_progress = AppLayerParserGetStateProgress(f->proto, alproto, inspect_tx, flags);
+        if (end_progress < tx_progress) {
+            inspect_tx_inprogress = true;
+        }
+        SCLogDebug("tx %"PRIu64" (%"PRIu64") => %s", inspect_tx_id, total_txs,
+                inspect_tx_inprogress ? "in progress" : "done");
+
+        DetectEngineState *tx_de_state = AppLayerParserGetTxDetectState(f->proto, alproto, inspect_tx);
+        if (tx_de_state == NULL) {
+            SCLogDebug("NO STATE tx %"PRIu64" (%"PRIu64")", inspect_tx_id, total_txs);
+            goto next_tx;
+        }
+        DetectEngineStateDirection *tx_dir_state = &tx_de_state->dir_state[direction];
+        DeStateStore *tx_store = tx_dir_state->head;
+
+        SCLogDebug("tx_dir_state->filestore_cnt %u", tx_dir_state->filestore_cnt);
+
+        /* see if we need to consider the next tx in our decision to add
+         * a sig to the 'no inspect array'. */
+        if (next.tx_ptr != NULL && next.tx_id == inspect_tx_id + 1) {
+            int c = AppLayerParserGetStateProgress(f->proto, alproto, next.tx_ptr, flags);
+            if (c == 0) {
+                next_tx_no_progress = true;
             }
+        }
+
+        /* Loop through stored 'items' (stateful rules) and inspect them */
+        SigIntId state_cnt = 0;
+        for (; tx_store != NULL; tx_store = tx_store->next) {
+            SCLogDebug("tx_store %p", tx_store);
 
-            /* Loop through stored 'items' (stateful rules) and inspect them */
-            SigIntId state_cnt = 0;
-            for (; tx_store != NULL; tx_store = tx_store->next) {
-                SCLogDebug("tx_store %p", tx_store);
-
-                SigIntId store_cnt = 0;
-                for (store_cnt = 0;
-                        store_cnt < DE_STATE_CHUNK_SIZE && state_cnt < tx_dir_state->cnt;
-                        store_cnt++, state_cnt++)
-                {
-                    uint16_t file_no_match = 0; // TODO looks like we're just ignoring this
-                    DeStateStoreItem *item = &tx_store->store[store_cnt];
-                    int r = DoInspectItem(tv, de_ctx, det_ctx,
-                            item, tx_dir_state->flags,
-                            p, f, alproto, flags,
-                            inspect_tx_id, total_txs,
-                            &file_no_match, inspect_tx_inprogress, next_tx_no_progress);
-                    if (r < 0) {
-                        SCLogDebug("failed");
-                        goto end;
-                    }
+            SigIntId store_cnt = 0;
+            for (store_cnt = 0;
+                    store_cnt < DE_STATE_CHUNK_SIZE && state_cnt < tx_dir_state->cnt;
+                    store_cnt++, state_cnt++)
+            {
+                uint16_t file_no_match = 0; // TODO looks like we're just ignoring this
+                DeStateStoreItem *item = &tx_store->store[store_cnt];
+                int r = DoInspectItem(tv, de_ctx, det_ctx,
+                        item, tx_dir_state->flags,
+                        p, f, alproto, flags,
+                        inspect_tx_id, total_txs,
+                        &file_no_match, inspect_tx_inprogress, next_tx_no_progress);
+                if (r < 0) {
+                    SCLogDebug("failed");
+                    goto end;
                 }
             }
-
-            tx_dir_state->flags &=
-                ~(DETECT_ENGINE_STATE_FLAG_FILE_TS_NEW|DETECT_ENGINE_STATE_FLAG_FILE_TC_NEW);
         }
+
+        tx_dir_state->flags &=
+            ~(DETECT_ENGINE_STATE_FLAG_FILE_TS_NEW|DETECT_ENGINE_STATE_FLAG_FILE_TC_NEW);
+
         /* if the current tx is in progress, we won't advance to any newer
          * tx' just yet. */
         if (inspect_tx_inprogress) {
             SCLogDebug("break out");
             break;
         }
+next_tx:
+        ires = next;
     }
 
 end:
@@ -33,6 +33,7 @@
 #include "conf-yaml-loader.h"
 
 #include "app-layer-htp.h"
+#include "app-layer-parser.h"
 
 #include "detect-parse.h"
 #include "detect-engine-sigorder.h"
@@ -58,6 +59,8 @@
 
 #include "detect-engine-loader.h"
 
+#include "stream-tcp.h"
+
 #include "util-classification-config.h"
 #include "util-reference-config.h"
 #include "util-threshold-config.h"
@@ -370,6 +373,9 @@ typedef struct DetectBufferType_ {
     _Bool packet; /**< compat to packet matches */
     void (*SetupCallback)(Signature *);
     _Bool (*ValidateCallback)(const Signature *);
+    _Bool cache; /**< inspection buffers are cached per tx */
+    char *counter_cache_hits;
+    char *counter_cache_misses;
 } DetectBufferType;
 
 static DetectBufferType **g_buffer_type_map = NULL;
@@ -404,6 +410,10 @@ static void DetectBufferTypeFreeFunc(void *data)
 {
     DetectBufferType *map = (DetectBufferType *)data;
     if (map != NULL) {
+        if (map->counter_cache_hits != NULL)
+            SCFree(map->counter_cache_hits);
+        if (map->counter_cache_misses != NULL)
+            SCFree(map->counter_cache_misses);
         SCFree(map);
     }
 }
@@ -487,6 +497,20 @@ void DetectBufferTypeSupportsMpm(const char *name)
     SCLogDebug("%p %s -- %d supports mpm", exists, name, exists->id);
 }
 
+/** \brief enable the per tx inspection buffer cache for a buffer type
+ *
+ *  Keywords of the type get their buffers through InspectionBufferGet().
+ */
+void DetectBufferTypeSupportsCache(const char *name)
+{
+    BUG_ON(g_buffer_type_reg_closed);
+    DetectBufferTypeRegister(name);
+    DetectBufferType *exists = DetectBufferTypeLookupByName(name);
+    BUG_ON(!exists);
+    exists->cache = TRUE;
+    SCLogDebug("%p %s -- %d supports cache", exists, name, exists->id);
+}
+
 int DetectBufferTypeGetByName(const char *name)
 {
     DetectBufferType *exists = DetectBufferTypeLookupByName(name);
@@ -612,6 +636,18 @@ void DetectBufferTypeFinalizeRegistration(void)
     while (b) {
         DetectBufferType *map = HashListTableGetListData(b);
         g_buffer_type_map[map->id] = map;
+        if (map->cache) {
+            char name[256];
+            snprintf(name, sizeof(name), "detect.buffer_cache.%s.hits", map->string);
+            map->counter_cache_hits = SCStrdup(name);
+            snprintf(name, sizeof(name), "detect.buffer_cache.%s.misses", map->string);
+            map->counter_cache_misses = SCStrdup(name);
+            if (map->counter_cache_hits == NULL || map->counter_cache_misses == NULL) {
+                SCLogError(SC_ERR_MEM_ALLOC, "failed to set up the %s buffer "
+                        "cache, it will be disabled", map->string);
+                map->cache = FALSE;
+            }
+        }
         SCLogDebug("name %s id %d mpm %s packet %s -- %s. "
                 "Callbacks: Setup %p Validate %p", map->string, map->id,
                 map->mpm ? "true" : "false", map->packet ? "true" : "false",
@@ -1704,6 +1740,87 @@ error:
     return TM_ECODE_FAILED;
 }
 
+/** \internal
+ *  \brief register the hit and miss counters of the cached buffer types
+ *
+ *  Registering an existing counter returns its id, so this can be
+ *  done again when setting up the caches.
+ */
+static void InspectionBufferCacheRegisterCounters(ThreadVars *tv)
+{
+    if (g_buffer_type_map == NULL)
+        return;
+
+    for (int i = 0; i < g_buffer_type_id; i++) {
+        const DetectBufferType *map = g_buffer_type_map[i];
+        if (map == NULL || !map->cache)
+            continue;
+        (void)StatsRegisterCounter(map->counter_cache_hits, tv);
+        (void)StatsRegisterCounter(map->counter_cache_misses, tv);
+    }
+}
+
+static void InspectionBufferCacheFreeBuffers(InspectionBufferCache *cache)
+{
+    for (int s = 0; s < INSPECTION_BUFFER_CACHE_SETS; s++) {
+        for (int w = 0; w < INSPECTION_BUFFER_CACHE_WAYS; w++) {
+            if (cache->sets[s][w].buf != NULL)
+                SCFree(cache->sets[s][w].buf);
+        }
+    }
+}
+
+static void InspectionBufferCacheFree(DetectEngineThreadCtx *det_ctx)
+{
+    if (det_ctx->buffer_caches == NULL)
+        return;
+
+    for (int i = 0; i < det_ctx->buffer_caches_size; i++) {
+        InspectionBufferCache *caches = det_ctx->buffer_caches[i];
+        if (caches == NULL)
+            continue;
+        for (int d = 0; d < 2; d++) {
+            InspectionBufferCacheFreeBuffers(&caches[d]);
+        }
+        SCFree(caches);
+    }
+    SCFree(det_ctx->buffer_caches);
+    det_ctx->buffer_caches = NULL;
+    det_ctx->buffer_caches_size = 0;
+}
+
+static int InspectionBufferCacheInit(DetectEngineThreadCtx *det_ctx)
+{
+    if (g_buffer_type_map == NULL)
+        return 0;
+
+    det_ctx->buffer_caches = SCCalloc(g_buffer_type_id, sizeof(InspectionBufferCache *));
+    if (det_ctx->buffer_caches == NULL)
+        return -1;
+    det_ctx->buffer_caches_size = g_buffer_type_id;
+
+    for (int i = 0; i < g_buffer_type_id; i++) {
+        const DetectBufferType *map = g_buffer_type_map[i];
+        if (map == NULL || !map->cache)
+            continue;
+
+        /* one cache per direction */
+        InspectionBufferCache *caches = SCCalloc(2, sizeof(InspectionBufferCache));
+        if (caches == NULL) {
+            InspectionBufferCacheFree(det_ctx);
+            return -1;
+        }
+        for (int d = 0; d < 2; d++) {
+            caches[d].counter_hits = StatsRegisterCounter(map->counter_cache_hits,
+                    det_ctx->tv);
+            caches[d].counter_misses = StatsRegisterCounter(map->counter_cache_misses,
+                    det_ctx->tv);
+        }
+        det_ctx->buffer_caches[i] = caches;
+    }
+    return 0;
+}
+
 /** \internal
  *  \brief Helper for DetectThread setup functions
  */
@@ -1766,6 +1883,10 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
         det_ctx->base64_decoded_len = 0;
     }
 
+    if (InspectionBufferCacheInit(det_ctx) != 0) {
+        return TM_ECODE_FAILED;
+    }
+
     DetectEngineThreadCtxInitKeywords(de_ctx, det_ctx);
     DetectEngineThreadCtxInitGlobalKeywords(det_ctx);
 #ifdef PROFILING
@@ -1800,6 +1921,7 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
     /* first register the counter. In delayed detect mode we exit right after if the
      * rules haven't been loaded yet. */
     uint16_t counter_alerts = StatsRegisterCounter("detect.alert", tv);
+    InspectionBufferCacheRegisterCounters(tv);
 #ifdef PROFILING
     uint16_t counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     uint16_t counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -1927,6 +2049,8 @@ static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
         det_ctx->tenant_array = NULL;
     }
 
+    StreamRawSpansFree(&det_ctx->raw_spans);
+
 #ifdef PROFILING
     SCProfilingRuleThreadCleanup(det_ctx);
     SCProfilingKeywordThreadCleanup(det_ctx);
@@ -1982,6 +2106,8 @@ static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
         SCFree(det_ctx->base64_decoded);
     }
 
+    InspectionBufferCacheFree(det_ctx);
+
     DetectEngineThreadCtxDeinitGlobalKeywords(det_ctx);
     if (det_ctx->de_ctx != NULL) {
         DetectEngineThreadCtxDeinitKeywords(det_ctx->de_ctx, det_ctx);
@@ -2013,6 +2139,121 @@ TmEcode DetectEngineThreadCtxDeinit(ThreadVars *tv, void *data)
     return TM_ECODE_OK;
 }
 
+/** \internal
+ *  \brief look up the buffer of a tx in a cache
+ *
+ *  On a miss the least recently used buffer of the set is taken over
+ *  for the tx and returned empty.
+ */
+static InspectionBuffer *InspectionBufferCacheLookup(InspectionBufferCache *cache,
+        const Flow *f, const void *txv, const uint64_t tx_id, const int progress)
+{
+    const int64_t flow_id = FlowGetId(f);
+    const uint32_t key[3] = { (uint32_t)flow_id, (uint32_t)(flow_id >> 32),
+                              (uint32_t)tx_id };
+    InspectionBuffer *set =
+        cache->sets[hashword(key, 3, 0) % INSPECTION_BUFFER_CACHE_SETS];
+    InspectionBuffer *buffer = NULL;
+
+    cache->tick++;
+
+    for (int w = 0; w < INSPECTION_BUFFER_CACHE_WAYS; w++) {
+        InspectionBuffer *b = &set[w];
+        if (b->f == f && b->flow_id == flow_id &&
+                b->tx == txv && b->tx_id == tx_id)
+        {
+            buffer = b;
+            break;
+        }
+        if (buffer == NULL || b->last_use < buffer->last_use)
+            buffer = b;
+    }
+    buffer->last_use = cache->tick;
+
+    if (buffer->filled && buffer->f == f && buffer->flow_id == flow_id &&
+            buffer->tx == txv && buffer->tx_id == tx_id &&
+            buffer->progress == progress)
+    {
+        return buffer;
+    }
+
+    buffer->filled = false;
+    buffer->len = 0;
+    buffer->f = f;
+    buffer->flow_id = flow_id;
+    buffer->tx = txv;
+    buffer->tx_id = tx_id;
+    buffer->progress = progress;
+    return buffer;
+}
+
+/** \brief get the cached inspection buffer of a tx
+ *
+ *  The buffer stays valid for as long as the tx progress doesn't
+ *  change, so it can be reused by the mpm and all signatures, also
+ *  in later packets of the flow and with other flows inspected in
+ *  between.
+ *
+ *  If InspectionBuffer::filled is set the buffer can be used as is.
+ *  Otherwise it's empty and the caller should fill it and then set
+ *  InspectionBuffer::filled.
+ *
+ *  \param buffer_id buffer type id of a type that supports caching
+ *  \param flags STREAM_TOSERVER or STREAM_TOCLIENT
+ *
+ *  \retval buffer inspection buffer for the tx
+ *  \retval NULL if the buffer type isn't cached
+ */
+InspectionBuffer *InspectionBufferGet(DetectEngineThreadCtx *det_ctx,
+        const int buffer_id, const Flow *f, const uint8_t flags,
+        void *txv, const uint64_t tx_id)
+{
+    if (buffer_id < 0 || buffer_id >= det_ctx->buffer_caches_size ||
+            det_ctx->buffer_caches[buffer_id] == NULL)
+        return NULL;
+
+    InspectionBufferCache *cache =
+        &det_ctx->buffer_caches[buffer_id][(flags & STREAM_TOSERVER) ? 0 : 1];
+
+    const int progress = AppLayerParserGetStateProgress(f->proto, f->alproto,
+            txv, flags);
+    InspectionBuffer *buffer = InspectionBufferCacheLookup(cache, f, txv,
+            tx_id, progress);
+    if (buffer->filled)
+        StatsIncr(det_ctx->tv, cache->counter_hits);
+    else
+        StatsIncr(det_ctx->tv, cache->counter_misses);
+    return buffer;
+}
+
+#define INSPECTION_BUFFER_SIZE_STEP 512
+
+/** \brief make sure the buffer has room for size more bytes
+ *
+ *  \retval 0 ok
+ *  \retval -1 out of memory, the buffer is reset
+ */
+int InspectionBufferExpand(InspectionBuffer *buffer, uint32_t size)
+{
+    if (buffer->len + size <= buffer->size)
+        return 0;
+
+    uint32_t new_size = buffer->size + INSPECTION_BUFFER_SIZE_STEP;
+    while (new_size < buffer->len + size) {
+        new_size += INSPECTION_BUFFER_SIZE_STEP;
+    }
+    SCLogDebug("expanding buffer from %u to %u", buffer->size, new_size);
+
+    uint8_t *ptmp = SCRealloc(buffer->buf, new_size);
+    if (unlikely(ptmp == NULL)) {
+        buffer->len = 0;
+        return -1;
+    }
+    buffer->buf = ptmp;
+    buffer->size = new_size;
+    return 0;
+}
+
 void DetectEngineThreadCtxInfo(ThreadVars *t, DetectEngineThreadCtx *det_ctx)
 {
     /* XXX */
@@ -3306,6 +3547,53 @@ static int DetectEngineTest09(void)
     return result;
 }
 
+/**
+ * \test the inspection buffer cache keeps the buffers of interleaved
+ *       flows
+ */
+static int DetectEngineInspectionBufferCacheTest01(void)
+{
+    InspectionBufferCache *cache = SCCalloc(1, sizeof(*cache));
+    FAIL_IF_NULL(cache);
+    Flow flows[4];
+    int hits = 0, misses = 0;
+
+    memset(flows, 0, sizeof(flows));
+    for (int i = 0; i < 4; i++) {
+        flows[i].flow_hash = 1000 + i;
+        flows[i].startts.tv_sec = 1;
+    }
+
+    /* 4 rounds over 4 flows with 3 txs each, one flow after the other */
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 4; i++) {
+            for (uint64_t tx_id = 0; tx_id < 3; tx_id++) {
+                InspectionBuffer *buf = InspectionBufferCacheLookup(cache,
+                        &flows[i], &flows[i], tx_id, 1);
+                FAIL_IF_NULL(buf);
+                if (buf->filled) {
+                    hits++;
+                } else {
+                    misses++;
+                    buf->filled = true;
+                }
+            }
+        }
+    }
+    /* only the first round builds the buffers */
+    FAIL_IF_NOT(misses == 12);
+    FAIL_IF_NOT(hits == 36);
+
+    /* a new tx progress means a rebuild */
+    InspectionBuffer *buf = InspectionBufferCacheLookup(cache,
+            &flows[0], &flows[0], 0, 2);
+    FAIL_IF(buf->filled);
+
+    InspectionBufferCacheFreeBuffers(cache);
+    SCFree(cache);
+    PASS;
+}
+
 #endif
 
 void DetectEngineRegisterTests()
@@ -3317,6 +3605,8 @@ void DetectEngineRegisterTests()
     UtRegisterTest("DetectEngineTest04", DetectEngineTest04);
     UtRegisterTest("DetectEngineTest08", DetectEngineTest08);
     UtRegisterTest("DetectEngineTest09", DetectEngineTest09);
+    UtRegisterTest("DetectEngineInspectionBufferCacheTest01",
+                   DetectEngineInspectionBufferCacheTest01);
 #endif
     return;
 }
@@ -33,6 +33,7 @@ int DetectBufferTypeGetByName(const char *name);
 const char *DetectBufferTypeGetNameById(const int id);
 void DetectBufferTypeSupportsMpm(const char *name);
 void DetectBufferTypeSupportsPacket(const char *name);
+void DetectBufferTypeSupportsCache(const char *name);
 _Bool DetectBufferTypeSupportsMpmGetById(const int id);
 _Bool DetectBufferTypeSupportsPacketGetById(const int id);
 int DetectBufferTypeMaxId(void);
@@ -59,6 +60,11 @@ void *DetectThreadCtxGetGlobalKeywordThreadCtx(DetectEngineThreadCtx *det_ctx, i
 
 TmEcode DetectEngineThreadCtxInit(ThreadVars *, void *, void **);
 TmEcode DetectEngineThreadCtxDeinit(ThreadVars *, void *);
+
+InspectionBuffer *InspectionBufferGet(DetectEngineThreadCtx *det_ctx,
+        const int buffer_id, const Flow *f, const uint8_t flags,
+        void *txv, const uint64_t tx_id);
+int InspectionBufferExpand(InspectionBuffer *buffer, uint32_t size);
 //inline uint32_t DetectEngineGetMaxSigId(DetectEngineCtx *);
 /* faster as a macro than a inline function on my box -- VJ */
 #define DetectEngineGetMaxSigId(de_ctx) ((de_ctx)->signum)
@@ -43,7 +43,6 @@
 #include "detect-engine-content-inspection.h"
 #include "detect-content.h"
 #include "detect-pcre.h"
-#include "detect-http-header-common.h"
 #include "detect-http-header-names.h"
 
 #include "flow.h"
@@ -70,11 +69,6 @@
 #define BUFFER_NAME "http_header_names"
 #define BUFFER_DESC "http header names"
 static int g_buffer_id = 0;
-static int g_keyword_thread_id = 0;
-
-#define BUFFER_TX_STEP      4
-#define BUFFER_SIZE_STEP    256
-static HttpHeaderThreadDataConfig g_td_config = { BUFFER_TX_STEP, BUFFER_SIZE_STEP };
 
 static uint8_t *GetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
         DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx,
@@ -83,15 +77,14 @@ static uint8_t *GetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
 {
     *buffer_len = 0;
 
-    HttpHeaderThreadData *hdr_td = NULL;
-    HttpHeaderBuffer *buf = HttpHeaderGetBufferSpaceForTXID(det_ctx, f, flags,
-            tx_id, g_keyword_thread_id, &hdr_td);
+    InspectionBuffer *buf = InspectionBufferGet(det_ctx, g_buffer_id, f, flags,
+            tx, tx_id);
     if (unlikely(buf == NULL)) {
         return NULL;
-    } else if (buf->len > 0) {
+    } else if (buf->filled) {
         /* already filled buf, reuse */
         *buffer_len = buf->len;
-        return buf->buffer;
+        return buf->buf;
     }
 
     htp_table_t *headers;
@@ -122,32 +115,31 @@ static uint8_t *GetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
 
         SCLogDebug("size %"PRIuMAX" + buf->len %u vs buf->size %u",
                 (uintmax_t)size, buf->len, buf->size);
-        if (size + buf->len > buf->size) {
-            if (HttpHeaderExpandBuffer(hdr_td, buf, size) != 0) {
-                return NULL;
-            }
+        if (InspectionBufferExpand(buf, size) != 0) {
+            return NULL;
         }
 
         /* start with a \r\n */
         if (i == 0) {
-            buf->buffer[buf->len++] = '\r';
-            buf->buffer[buf->len++] = '\n';
+            buf->buf[buf->len++] = '\r';
+            buf->buf[buf->len++] = '\n';
         }
 
-        memcpy(buf->buffer + buf->len, bstr_ptr(h->name), bstr_size(h->name));
+        memcpy(buf->buf + buf->len, bstr_ptr(h->name), bstr_size(h->name));
         buf->len += bstr_size(h->name);
-        buf->buffer[buf->len++] = '\r';
-        buf->buffer[buf->len++] = '\n';
+        buf->buf[buf->len++] = '\r';
+        buf->buf[buf->len++] = '\n';
 
         /* end with an extra \r\n */
         if (i + 1 == no_of_headers) {
-            buf->buffer[buf->len++] = '\r';
-            buf->buffer[buf->len++] = '\n';
+            buf->buf[buf->len++] = '\r';
+            buf->buf[buf->len++] = '\n';
         }
     }
 
+    buf->filled = true;
     *buffer_len = buf->len;
-    return buf->buffer;
+    return buf->buf;
 }
 
 /** \brief HTTP Headers Mpm prefilter callback
@@ -403,11 +395,8 @@ void DetectHttpHeaderNamesRegister(void)
 
     g_buffer_id = DetectBufferTypeGetByName(BUFFER_NAME);
 
-    g_keyword_thread_id = DetectRegisterThreadCtxGlobalFuncs(KEYWORD_NAME,
-            HttpHeaderThreadDataInit, &g_td_config, HttpHeaderThreadDataFree);
+    DetectBufferTypeSupportsCache(BUFFER_NAME);
 
-    SCLogDebug("keyword %s registered. Thread id %d. "
-            "Buffer %s registered. Buffer id %d",
-            KEYWORD_NAME, g_keyword_thread_id,
-            BUFFER_NAME, g_buffer_id);
+    SCLogDebug("keyword %s registered. Buffer %s registered. Buffer id %d",
+            KEYWORD_NAME, BUFFER_NAME, g_buffer_id);
 }
@@ -60,18 +60,12 @@
 
 #include "app-layer-htp.h"
 #include "detect-http-header.h"
-#include "detect-http-header-common.h"
 #include "stream-tcp.h"
 
 static int DetectHttpHeaderSetup(DetectEngineCtx *, Signature *, const char *);
 static void DetectHttpHeaderRegisterTests(void);
 static void DetectHttpHeaderSetupCallback(Signature *);
 static int g_http_header_buffer_id = 0;
-static int g_keyword_thread_id = 0;
-
-#define BUFFER_TX_STEP      4
-#define BUFFER_SIZE_STEP    1024
-static HttpHeaderThreadDataConfig g_td_config = { BUFFER_TX_STEP, BUFFER_SIZE_STEP };
 
 static uint8_t *GetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
         DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx,
@@ -80,15 +74,14 @@ static uint8_t *GetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
 {
     *buffer_len = 0;
 
-    HttpHeaderThreadData *hdr_td = NULL;
-    HttpHeaderBuffer *buf = HttpHeaderGetBufferSpaceForTXID(det_ctx, f, flags,
-            tx_id, g_keyword_thread_id, &hdr_td);
+    InspectionBuffer *buf = InspectionBufferGet(det_ctx,
+            g_http_header_buffer_id, f, flags, tx, tx_id);
     if (unlikely(buf == NULL)) {
         return NULL;
-    } else if (buf->len > 0) {
+    } else if (buf->filled) {
         /* already filled buf, reuse */
         *buffer_len = buf->len;
-        return buf->buffer;
+        return buf->buf;
     }
 
     htp_table_t *headers;
@@ -128,30 +121,29 @@ static uint8_t *GetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
         if (i + 1 == no_of_headers)
             size += 2;
 #endif
-        if (size + buf->len > buf->size) {
-            if (HttpHeaderExpandBuffer(hdr_td, buf, size) != 0) {
-                return NULL;
-            }
+        if (InspectionBufferExpand(buf, size) != 0) {
+            return NULL;
         }
 
-        memcpy(buf->buffer + buf->len, bstr_ptr(h->name), bstr_size(h->name));
+        memcpy(buf->buf + buf->len, bstr_ptr(h->name), bstr_size(h->name));
         buf->len += bstr_size(h->name);
-        buf->buffer[buf->len++] = ':';
-        buf->buffer[buf->len++] = ' ';
-        memcpy(buf->buffer + buf->len, bstr_ptr(h->value), bstr_size(h->value));
+        buf->buf[buf->len++] = ':';
+        buf->buf[buf->len++] = ' ';
+        memcpy(buf->buf + buf->len, bstr_ptr(h->value), bstr_size(h->value));
         buf->len += bstr_size(h->value);
-        buf->buffer[buf->len++] = '\r';
-        buf->buffer[buf->len++] = '\n';
+        buf->buf[buf->len++] = '\r';
+        buf->buf[buf->len++] = '\n';
 #if 0 // looks like this breaks existing rules
         if (i + 1 == no_of_headers) {
-            buf->buffer[buf->len++] = '\r';
-            buf->buffer[buf->len++] = '\n';
+            buf->buf[buf->len++] = '\r';
+            buf->buf[buf->len++] = '\n';
         }
 #endif
     }
 
+    buf->filled = true;
     *buffer_len = buf->len;
-    return buf->buffer;
+    return buf->buf;
 }
 
 /** \brief HTTP Headers Mpm prefilter callback
@@ -406,8 +398,7 @@ void DetectHttpHeaderRegister(void)
 
     g_http_header_buffer_id = DetectBufferTypeGetByName("http_header");
 
-    g_keyword_thread_id = DetectRegisterThreadCtxGlobalFuncs("http_header",
-            HttpHeaderThreadDataInit, &g_td_config, HttpHeaderThreadDataFree);
+    DetectBufferTypeSupportsCache("http_header");
 }
 
 /************************************Unittests*********************************/
@@ -5606,6 +5597,110 @@ static int DetectEngineHttpHeaderTest34(void)
     PASS;
 }
 
+
+/** \test the http_header buffer is built once and reused until the
+ *        tx progress changes */
+static int DetectEngineHttpHeaderTest35(void)
+{
+    TcpSession ssn;
+    ThreadVars th_v;
+    DetectEngineCtx *de_ctx = NULL;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    Flow f;
+    uint8_t http_buf[] =
+        "POST /index.html HTTP/1.1\r\n"
+        "Host: www.openinfosecfoundation.org\r\n"
+        "Content-Length: 10\r\n"
+        "\r\n"
+        "12345";
+    uint8_t http2_buf[] =
+        "67890";
+    uint32_t http_len = sizeof(http_buf) - 1;
+    uint32_t http2_len = sizeof(http2_buf) - 1;
+
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    Packet *p = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+
+    p->flow = &f;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+    p->flowflags |= FLOW_PKT_ESTABLISHED;
+    p->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+    f.alproto = ALPROTO_HTTP;
+
+    StreamTcpInitConfig(TRUE);
+
+    de_ctx = DetectEngineCtxInit();
+    FAIL_IF(de_ctx == NULL);
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(content:\"openinfosec\"; http_header; sid:1;)");
+    FAIL_IF_NULL(s);
+    s = DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(content:\"Content-Length|3a| 10\"; http_header; sid:2;)");
+    FAIL_IF_NULL(s);
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    int r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_HTTP,
+                                STREAM_TOSERVER, http_buf, http_len);
+    FAIL_IF_NOT(r == 0);
+    FAIL_IF_NULL(f.alstate);
+
+    /* do detect */
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF_NOT(PacketAlertCheck(p, 1));
+    FAIL_IF_NOT(PacketAlertCheck(p, 2));
+
+    /* both sigs used the buffer, it is still there for the tx */
+    void *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, f.alstate, 0);
+    FAIL_IF_NULL(tx);
+    InspectionBuffer *buf = InspectionBufferGet(det_ctx,
+            g_http_header_buffer_id, &f, STREAM_TOSERVER, tx, 0);
+    FAIL_IF_NULL(buf);
+    FAIL_IF_NOT(buf->filled);
+    FAIL_IF(buf->len == 0);
+
+    /* a second lookup is served from the cache */
+    const uint8_t *data = buf->buf;
+    buf = InspectionBufferGet(det_ctx, g_http_header_buffer_id,
+            &f, STREAM_TOSERVER, tx, 0);
+    FAIL_IF_NULL(buf);
+    FAIL_IF_NOT(buf->filled);
+    FAIL_IF_NOT(buf->buf == data);
+
+    /* completing the body moves the tx progress, so the buffer
+     * has to be built again */
+    r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_HTTP,
+                            STREAM_TOSERVER, http2_buf, http2_len);
+    FAIL_IF_NOT(r == 0);
+    buf = InspectionBufferGet(det_ctx, g_http_header_buffer_id,
+            &f, STREAM_TOSERVER, tx, 0);
+    FAIL_IF_NULL(buf);
+    FAIL_IF(buf->filled);
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    UTHFreePackets(&p, 1);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DetectHttpHeaderRegisterTests(void)
@@ -5707,6 +5802,8 @@ void DetectHttpHeaderRegisterTests(void)
                    DetectEngineHttpHeaderTest33);
     UtRegisterTest("DetectEngineHttpHeaderTest34 -- Trailer",
                    DetectEngineHttpHeaderTest34);
+    UtRegisterTest("DetectEngineHttpHeaderTest35 -- Cache",
+                   DetectEngineHttpHeaderTest35);
 #endif /* UNITTESTS */
 
     return;
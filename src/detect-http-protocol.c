@@ -43,7 +43,6 @@
 #include "detect-engine-content-inspection.h"
 #include "detect-content.h"
 #include "detect-pcre.h"
-#include "detect-http-header-common.h"
 #include "detect-http-protocol.h"
 
 #include "flow.h"
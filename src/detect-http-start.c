@@ -43,7 +43,6 @@
 #include "detect-engine-content-inspection.h"
 #include "detect-content.h"
 #include "detect-pcre.h"
-#include "detect-http-header-common.h"
 #include "detect-http-start.h"
 
 #include "flow.h"
@@ -70,11 +69,6 @@
 #define BUFFER_NAME "http_start"
 #define BUFFER_DESC "http start: request/response line + headers"
 static int g_buffer_id = 0;
-static int g_keyword_thread_id = 0;
-
-#define BUFFER_TX_STEP      4
-#define BUFFER_SIZE_STEP    2048
-static HttpHeaderThreadDataConfig g_td_config = { BUFFER_TX_STEP, BUFFER_SIZE_STEP };
 
 static uint8_t *GetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
         DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx,
@@ -83,15 +77,14 @@ static uint8_t *GetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
 {
     *buffer_len = 0;
 
-    HttpHeaderThreadData *hdr_td = NULL;
-    HttpHeaderBuffer *buf = HttpHeaderGetBufferSpaceForTXID(det_ctx, f, flags,
-            tx_id, g_keyword_thread_id, &hdr_td);
+    InspectionBuffer *buf = InspectionBufferGet(det_ctx, g_buffer_id, f, flags,
+            tx, tx_id);
     if (unlikely(buf == NULL)) {
         return NULL;
-    } else if (buf->len > 0) {
+    } else if (buf->filled) {
         /* already filled buf, reuse */
         *buffer_len = buf->len;
-        return buf->buffer;
+        return buf->buf;
     }
 
     bstr *line = NULL;
@@ -113,15 +106,13 @@ static uint8_t *GetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
         return NULL;
 
     size_t line_size = bstr_len(line) + 2;
-    if (line_size + buf->len > buf->size) {
-        if (HttpHeaderExpandBuffer(hdr_td, buf, line_size) != 0) {
-            return NULL;
-        }
+    if (InspectionBufferExpand(buf, line_size) != 0) {
+        return NULL;
     }
-    memcpy(buf->buffer + buf->len, bstr_ptr(line), bstr_size(line));
+    memcpy(buf->buf + buf->len, bstr_ptr(line), bstr_size(line));
     buf->len += bstr_size(line);
-    buf->buffer[buf->len++] = '\r';
-    buf->buffer[buf->len++] = '\n';
+    buf->buf[buf->len++] = '\r';
+    buf->buf[buf->len++] = '\n';
 
     size_t i = 0;
     size_t no_of_headers = htp_table_size(headers);
@@ -145,28 +136,27 @@ static uint8_t *GetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
         size_t size = size1 + size2 + 4;
         if (i + 1 == no_of_headers)
             size += 2;
-        if (size + buf->len > buf->size) {
-            if (HttpHeaderExpandBuffer(hdr_td, buf, size) != 0) {
-                return NULL;
-            }
+        if (InspectionBufferExpand(buf, size) != 0) {
+            return NULL;
         }
 
-        memcpy(buf->buffer + buf->len, bstr_ptr(h->name), bstr_size(h->name));
+        memcpy(buf->buf + buf->len, bstr_ptr(h->name), bstr_size(h->name));
         buf->len += bstr_size(h->name);
-        buf->buffer[buf->len++] = ':';
-        buf->buffer[buf->len++] = ' ';
-        memcpy(buf->buffer + buf->len, bstr_ptr(h->value), bstr_size(h->value));
+        buf->buf[buf->len++] = ':';
+        buf->buf[buf->len++] = ' ';
+        memcpy(buf->buf + buf->len, bstr_ptr(h->value), bstr_size(h->value));
         buf->len += bstr_size(h->value);
-        buf->buffer[buf->len++] = '\r';
-        buf->buffer[buf->len++] = '\n';
+        buf->buf[buf->len++] = '\r';
+        buf->buf[buf->len++] = '\n';
         if (i + 1 == no_of_headers) {
-            buf->buffer[buf->len++] = '\r';
-            buf->buffer[buf->len++] = '\n';
+            buf->buf[buf->len++] = '\r';
+            buf->buf[buf->len++] = '\n';
         }
     }
 
+    buf->filled = true;
     *buffer_len = buf->len;
-    return buf->buffer;
+    return buf->buf;
 }
 
 /** \brief HTTP Start Mpm prefilter callback
@@ -327,11 +317,8 @@ void DetectHttpStartRegister(void)
 
     g_buffer_id = DetectBufferTypeGetByName(BUFFER_NAME);
 
-    g_keyword_thread_id = DetectRegisterThreadCtxGlobalFuncs(KEYWORD_NAME,
-            HttpHeaderThreadDataInit, &g_td_config, HttpHeaderThreadDataFree);
+    DetectBufferTypeSupportsCache(BUFFER_NAME);
 
-    SCLogDebug("keyword %s registered. Thread id %d. "
-            "Buffer %s registered. Buffer id %d",
-            KEYWORD_NAME, g_keyword_thread_id,
-            BUFFER_NAME, g_buffer_id);
+    SCLogDebug("keyword %s registered. Buffer %s registered. Buffer id %d",
+            KEYWORD_NAME, BUFFER_NAME, g_buffer_id);
 }
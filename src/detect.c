@@ -922,6 +922,7 @@ void SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineT
     det_ctx->filestore_cnt = 0;
     det_ctx->base64_decoded_len = 0;
     det_ctx->raw_stream_progress = 0;
+    det_ctx->raw_spans_valid = false;
 
 #ifdef DEBUG
     if (p->flags & PKT_STREAM_ADD) {
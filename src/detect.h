@@ -27,6 +27,7 @@
 #include <stdint.h>
 
 #include "flow.h"
+#include "stream.h"
 
 #include "detect-engine-proto.h"
 #include "detect-reference.h"
@@ -768,6 +769,35 @@ typedef struct FiledataReassembledBody_ {
     uint64_t offset;        /**< data offset */
 } FiledataReassembledBody;
 
+/** inspection buffer of a tx, built once and then shared by the mpm
+ *  and all signatures inspecting it */
+typedef struct InspectionBuffer_ {
+    uint8_t *buf;
+    uint32_t size;          /**< size of the buffer itself */
+    uint32_t len;           /**< data len in the buffer */
+    bool filled;            /**< buffer is complete for tx/progress */
+    int progress;           /**< tx progress the buffer was built at */
+    const Flow *f;
+    int64_t flow_id;
+    const void *tx;
+    uint64_t tx_id;
+    uint32_t last_use;      /**< cache tick of the last lookup */
+} InspectionBuffer;
+
+/** the cache is set associative: a (flow, tx) pair hashes to a set and
+ *  takes the least recently used buffer of it */
+#define INSPECTION_BUFFER_CACHE_SETS 32
+#define INSPECTION_BUFFER_CACHE_WAYS 4
+
+/** per buffer type and direction cache of inspection buffers, keyed
+ *  by flow and tx, so that interleaved flows don't evict each other */
+typedef struct InspectionBufferCache_ {
+    uint32_t tick;          /**< lookup counter for the lru */
+    uint16_t counter_hits;
+    uint16_t counter_misses;
+    InspectionBuffer sets[INSPECTION_BUFFER_CACHE_SETS][INSPECTION_BUFFER_CACHE_WAYS];
+} InspectionBufferCache;
+
 #define DETECT_FILESTORE_MAX 15
 
 typedef struct SignatureNonPrefilterStore_ {
@@ -805,6 +835,11 @@ typedef struct DetectEngineThreadCtx_ {
 
     uint64_t raw_stream_progress;
 
+    /** raw stream data of the current packet, looked up once and used
+     *  by the stream mpm and all signatures inspecting the stream */
+    StreamRawSpans raw_spans;
+    bool raw_spans_valid;
+
     /** offset into the payload of the last match by:
      *  content, pcre, etc */
     uint32_t buffer_offset;
@@ -829,6 +864,11 @@ typedef struct DetectEngineThreadCtx_ {
     uint16_t smtp_buffers_size;
     uint16_t smtp_buffers_list_len;
 
+    /** inspection buffer caches, indexed by buffer type id. Each
+     *  cached buffer type has one cache per direction. */
+    InspectionBufferCache **buffer_caches;
+    int buffer_caches_size;
+
     /** id for alert counter */
     uint16_t counter_alerts;
 #ifdef PROFILING
@@ -42,6 +42,7 @@
 #include "util-debug.h"
 
 #include "util-hash-lookup3.h"
+#include "util-toeplitz.h"
 
 #include "conf.h"
 #include "output.h"
@@ -104,6 +105,67 @@ typedef struct FlowHashKey6_ {
     };
 } FlowHashKey6;
 
+/** \brief Toeplitz hash over the tuple the NIC uses for RSS
+ *
+ *  Addresses and, for TCP and UDP, ports in network byte order. Used
+ *  with a symmetric key, so both directions get the same hash, see
+ *  "flow.hash-type". For ICMP errors the embedded packet is used, like
+ *  in FlowGetHash, so the error goes where the flow it belongs to goes.
+ *
+ *  Only used to pick the queue of a packet. The flow table rows stay
+ *  indexed by the seeded FlowGetHash: this hash takes no secret and has
+ *  few values for the symmetric keys, so it can't protect the table
+ *  against collisions.
+ *
+ *  \retval hash or 0 if "flow.hash-type" is not "toeplitz"
+ */
+uint32_t FlowGetRssHash(const Packet *p)
+{
+    uint8_t in[TOEPLITZ_INPUT_MAX];
+
+    if (flow_config.toeplitz == NULL)
+        return 0;
+
+    uint16_t len = 0;
+    uint16_t sp = 0, dp = 0;
+    int ports = (p->tcph != NULL || p->udph != NULL);
+
+    if (p->ip4h != NULL) {
+        uint32_t src = p->src.addr_data32[0];
+        uint32_t dst = p->dst.addr_data32[0];
+
+        if (ports) {
+            sp = p->sp;
+            dp = p->dp;
+        } else if (ICMPV4_DEST_UNREACH_IS_VALID(p)) {
+            src = IPV4_GET_RAW_IPSRC_U32(ICMPV4_GET_EMB_IPV4(p));
+            dst = IPV4_GET_RAW_IPDST_U32(ICMPV4_GET_EMB_IPV4(p));
+            sp = p->icmpv4vars.emb_sport;
+            dp = p->icmpv4vars.emb_dport;
+            ports = 1;
+        }
+        memcpy(in, &src, 4);
+        memcpy(in + 4, &dst, 4);
+        len = 8;
+    } else if (p->ip6h != NULL) {
+        memcpy(in, p->src.addr_data32, 16);
+        memcpy(in + 16, p->dst.addr_data32, 16);
+        len = 32;
+        sp = p->sp;
+        dp = p->dp;
+    } else {
+        return 0;
+    }
+
+    if (ports) {
+        in[len++] = sp >> 8;
+        in[len++] = sp & 0xff;
+        in[len++] = dp >> 8;
+        in[len++] = dp & 0xff;
+    }
+    return ToeplitzHash(flow_config.toeplitz, in, len);
+}
+
 /* calculate the hash key for this packet
  *
  * we're using:
@@ -222,7 +284,8 @@ static inline uint32_t FlowGetHash(const Packet *p)
      (f1)->proto == (f2)->proto && \
      (f1)->recursion_level == (f2)->recursion_level && \
      (f1)->vlan_id[0] == (f2)->vlan_id[0] && \
-     (f1)->vlan_id[1] == (f2)->vlan_id[1])
+     (f1)->vlan_id[1] == (f2)->vlan_id[1] && \
+     (f1)->input_id == (f2)->input_id)
 
 /**
  *  \brief See if a ICMP packet belongs to a flow by comparing the embedded
@@ -247,7 +310,8 @@ static inline int FlowCompareICMPv4(Flow *f, const Packet *p)
                 f->proto == ICMPV4_GET_EMB_PROTO(p) &&
                 f->recursion_level == p->recursion_level &&
                 f->vlan_id[0] == p->vlan_id[0] &&
-                f->vlan_id[1] == p->vlan_id[1])
+                f->vlan_id[1] == p->vlan_id[1] &&
+                f->input_id == p->input_id)
         {
             return 1;
 
@@ -260,7 +324,8 @@ static inline int FlowCompareICMPv4(Flow *f, const Packet *p)
                 f->proto == ICMPV4_GET_EMB_PROTO(p) &&
                 f->recursion_level == p->recursion_level &&
                 f->vlan_id[0] == p->vlan_id[0] &&
-                f->vlan_id[1] == p->vlan_id[1])
+                f->vlan_id[1] == p->vlan_id[1] &&
+                f->input_id == p->input_id)
         {
             return 1;
         }
@@ -280,6 +345,24 @@ void FlowSetupPacket(Packet *p)
     p->flow_hash = FlowGetHash(p);
 }
 
+/** \brief prefetch the hash row the packet's flow will be looked up in
+ *
+ *  Used when handling batches of packets, so that the row is likely
+ *  in the cache by the time FlowGetFlowFromHash gets to the packet.
+ *
+ *  \param dtv decode thread vars, for the worker flow table
+ *  \param p packet with PKT_WANTS_FLOW set
+ */
+void FlowHashPrefetch(const DecodeThreadVars *dtv, const Packet *p)
+{
+    const FlowBucket *fb;
+    if (dtv != NULL && dtv->flow_shard != NULL)
+        fb = &dtv->flow_shard->rows[p->flow_hash % dtv->flow_shard->size];
+    else
+        fb = &flow_hash[p->flow_hash % flow_config.hash_size];
+    __builtin_prefetch(fb, 1, 3);
+}
+
 int TcpSessionPacketSsnReuse(const Packet *p, const Flow *f, void *tcp_ssn);
 
 static inline int FlowCompare(Flow *f, const Packet *p)
@@ -447,44 +530,30 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
     FlowInit(f, p);
     f->flow_hash = hash;
     f->fb = fb;
+    FlowHashRowMarkDirty(fb);
 
     f->thread_id = thread_id;
     return f;
 }
 
-/** \brief Get Flow for packet
- *
- * Hash retrieval function for flows. Looks up the hash bucket containing the
- * flow pointer. Then compares the packet with the found flow to see if it is
- * the flow we need. If it isn't, walk the list until the right flow is found.
- *
- * If the flow is not found or the bucket was emtpy, a new flow is taken from
- * the queue. FlowDequeue() will alloc new flows as long as we stay within our
- * memcap limit.
- *
- * The p->flow pointer is updated to point to the flow.
+/** \internal
+ *  \brief get the flow for a packet from a hash row
  *
- *  \param tv thread vars
- *  \param dtv decode thread vars (for flow log api thread data)
+ *  The row must be locked by the caller, or be owned by this thread.
  *
  *  \retval f *LOCKED* flow or NULL
  */
-Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p, Flow **dest)
+static inline Flow *FlowGetFlowFromRow(ThreadVars *tv, DecodeThreadVars *dtv,
+        const Packet *p, Flow **dest, FlowBucket *fb, const uint32_t hash)
 {
     Flow *f = NULL;
 
-    /* get our hash bucket and lock it */
-    const uint32_t hash = p->flow_hash;
-    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
-    FBLOCK_LOCK(fb);
-
     SCLogDebug("fb %p fb->head %p", fb, fb->head);
 
     /* see if the bucket already has a flow */
     if (fb->head == NULL) {
         f = FlowGetNew(tv, dtv, p);
         if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
             return NULL;
         }
 
@@ -500,7 +569,6 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
 
         FlowReference(dest, f);
 
-        FBLOCK_UNLOCK(fb);
         return f;
     }
 
@@ -518,7 +586,6 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
             if (f == NULL) {
                 f = pf->hnext = FlowGetNew(tv, dtv, p);
                 if (f == NULL) {
-                    FBLOCK_UNLOCK(fb);
                     return NULL;
                 }
                 fb->tail = f;
@@ -535,7 +602,6 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
 
                 FlowReference(dest, f);
 
-                FBLOCK_UNLOCK(fb);
                 return f;
             }
 
@@ -562,14 +628,12 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
                 if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
                     f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
                     if (f == NULL) {
-                        FBLOCK_UNLOCK(fb);
                         return NULL;
                     }
                 }
 
                 FlowReference(dest, f);
 
-                FBLOCK_UNLOCK(fb);
                 return f;
             }
         }
@@ -580,13 +644,49 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
     if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
         f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
         if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
             return NULL;
         }
     }
 
     FlowReference(dest, f);
 
+    return f;
+}
+
+/** \brief Get Flow for packet
+ *
+ * Hash retrieval function for flows. Looks up the hash bucket containing the
+ * flow pointer. Then compares the packet with the found flow to see if it is
+ * the flow we need. If it isn't, walk the list until the right flow is found.
+ *
+ * If the flow is not found or the bucket was emtpy, a new flow is taken from
+ * the queue. FlowDequeue() will alloc new flows as long as we stay within our
+ * memcap limit.
+ *
+ * The p->flow pointer is updated to point to the flow.
+ *
+ *  \param tv thread vars
+ *  \param dtv decode thread vars (for flow log api thread data)
+ *
+ *  \retval f *LOCKED* flow or NULL
+ */
+Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p, Flow **dest)
+{
+    const uint32_t hash = p->flow_hash;
+
+    /* the rows of a worker's own table are not shared, no need to lock */
+    if (dtv != NULL && dtv->flow_shard != NULL) {
+        FlowShard *shard = dtv->flow_shard;
+        return FlowGetFlowFromRow(tv, dtv, p, dest,
+                &shard->rows[hash % shard->size], hash);
+    }
+
+    /* get our hash bucket and lock it */
+    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
+    FBLOCK_LOCK(fb);
+
+    Flow *f = FlowGetFlowFromRow(tv, dtv, p, dest, fb, hash);
+
     FBLOCK_UNLOCK(fb);
     return f;
 }
@@ -608,33 +708,40 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
  */
 static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
 {
-    uint32_t idx = SC_ATOMIC_GET(flow_prune_idx) % flow_config.hash_size;
-    uint32_t cnt = flow_config.hash_size;
+    /* with a worker flow table only flows of the own table are taken */
+    FlowShard *shard = dtv ? dtv->flow_shard : NULL;
+    FlowBucket *rows = shard ? shard->rows : flow_hash;
+    uint32_t size = shard ? shard->size : flow_config.hash_size;
+    uint32_t idx = (shard ? shard->prune_idx : SC_ATOMIC_GET(flow_prune_idx)) % size;
+    uint32_t cnt = size;
 
     while (cnt--) {
-        if (++idx >= flow_config.hash_size)
+        if (++idx >= size)
             idx = 0;
 
-        FlowBucket *fb = &flow_hash[idx];
+        FlowBucket *fb = &rows[idx];
 
-        if (FBLOCK_TRYLOCK(fb) != 0)
+        if (shard == NULL && FBLOCK_TRYLOCK(fb) != 0)
             continue;
 
         Flow *f = fb->tail;
         if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
+            if (shard == NULL)
+                FBLOCK_UNLOCK(fb);
             continue;
         }
 
         if (FLOWLOCK_TRYWRLOCK(f) != 0) {
-            FBLOCK_UNLOCK(fb);
+            if (shard == NULL)
+                FBLOCK_UNLOCK(fb);
             continue;
         }
 
         /** never prune a flow that is used by a packet or stream msg
          *  we are currently processing in one of the threads */
         if (SC_ATOMIC_GET(f->use_cnt) > 0) {
-            FBLOCK_UNLOCK(fb);
+            if (shard == NULL)
+                FBLOCK_UNLOCK(fb);
             FLOWLOCK_UNLOCK(f);
             continue;
         }
@@ -653,7 +760,8 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
         f->hprev = NULL;
         f->fb = NULL;
         SC_ATOMIC_SET(fb->next_ts, 0);
-        FBLOCK_UNLOCK(fb);
+        if (shard == NULL)
+            FBLOCK_UNLOCK(fb);
 
         int state = SC_ATOMIC_GET(f->flow_state);
         if (state == FLOW_STATE_NEW)
@@ -682,7 +790,10 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
 
         FLOWLOCK_UNLOCK(f);
 
-        (void) SC_ATOMIC_ADD(flow_prune_idx, (flow_config.hash_size - cnt));
+        if (shard != NULL)
+            shard->prune_idx = idx;
+        else
+            (void) SC_ATOMIC_ADD(flow_prune_idx, (flow_config.hash_size - cnt));
         return f;
     }
 
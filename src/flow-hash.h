@@ -54,6 +54,9 @@ typedef struct FlowBucket_ {
      *  flow state changes. The flow manager sets this to INT_MAX for
      *  empty buckets. */
     SC_ATOMIC_DECLARE(int32_t, next_ts);
+    /** second the row is scheduled for in the timer wheel of the flow
+     *  manager, 0 if not scheduled. Only used by the flow manager. */
+    uint32_t wheel_ts;
 } __attribute__((aligned(CLS))) FlowBucket;
 
 #ifdef FBLOCK_SPIN
@@ -72,9 +75,41 @@ typedef struct FlowBucket_ {
     #error Enable FBLOCK_SPIN or FBLOCK_MUTEX
 #endif
 
+/** \brief flow table owned by a single worker
+ *
+ *  With "flow.worker-tables" each worker of the workers runmode looks up
+ *  its flows in its own table, without taking the row locks. The flow
+ *  manager doesn't walk these tables: it hands the time to the owner
+ *  through 'timeout_ts' and the owner times out its flows itself.
+ *
+ *  The row locks are still set up and used by the shutdown code, which
+ *  only runs when the owner no longer does lookups.
+ */
+typedef struct FlowShard_ {
+    FlowBucket *rows;
+    uint32_t size;
+    uint16_t id;
+    int in_use;                 /**< owned by a worker, registry lock */
+    /** thread of the owner, registry lock. Woken up with a pseudo packet
+     *  when it is idle, so it still times out its flows. */
+    ThreadVars *owner;
+
+    /** time to time out the flows against, set by the flow manager */
+    SC_ATOMIC_DECLARE(uint32_t, timeout_ts);
+
+    /* owner only */
+    uint32_t sweep_ts;          /**< timeout_ts of the current sweep */
+    uint32_t sweep_idx;         /**< next row of the sweep */
+    uint32_t prune_idx;         /**< where to look for a flow to reuse */
+
+    struct FlowShard_ *next;
+} FlowShard;
+
 /* prototypes */
 
 Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *, Flow **);
+void FlowHashPrefetch(const DecodeThreadVars *dtv, const Packet *p);
+uint32_t FlowGetRssHash(const Packet *p);
 
 void FlowDisableTcpReuseHandling(void);
 
@@ -63,6 +63,7 @@
 
 #include "host-timeout.h"
 #include "defrag-timeout.h"
+#include "defrag-hash.h"
 #include "ippair-timeout.h"
 
 #include "output-flow.h"
@@ -478,6 +479,338 @@ next:
     return cnt;
 }
 
+/** timer wheel slots, one per second. Must be a power of 2. Rows that
+ *  time out further away are parked in the furthest slot and looked at
+ *  again when it comes up. */
+#define FLOW_WHEEL_SLOTS    4096
+#define FLOW_WHEEL_MASK     (FLOW_WHEEL_SLOTS - 1)
+
+typedef struct FlowWheelSlot_ {
+    uint32_t *rows;     /**< hash row indexes */
+    uint32_t len;
+    uint32_t size;
+} FlowWheelSlot;
+
+/** \brief timer wheel of the hash rows of a flow manager
+ *
+ *  Rows are scheduled for the second their first flow may time out, as
+ *  found when the row was last checked. Rows the workers changed since
+ *  are flagged in flow_hash_dirty. So only the rows that are due, or
+ *  that changed, are looked at instead of the whole hash.
+ *
+ *  A row is scheduled once: FlowBucket::wheel_ts holds its time, entries
+ *  left behind in other slots when a row is rescheduled are skipped.
+ */
+typedef struct FlowWheel_ {
+    FlowWheelSlot *slots;
+    uint32_t ts;        /**< last second the wheel was run for */
+} FlowWheel;
+
+/** \internal
+ *  \brief set up the wheel for a range of the hash
+ *
+ *  Flows may be in the hash already, so all rows of the range are
+ *  flagged to be checked on the first run.
+ */
+static int FlowWheelInit(FlowWheel *w, uint32_t hash_min, uint32_t hash_max)
+{
+    uint32_t idx;
+
+    w->slots = SCCalloc(FLOW_WHEEL_SLOTS, sizeof(FlowWheelSlot));
+    if (w->slots == NULL)
+        return -1;
+    w->ts = 0;
+
+    for (idx = hash_min; idx < hash_max; idx++) {
+        flow_hash[idx].wheel_ts = 0;
+        FlowHashRowMarkDirty(&flow_hash[idx]);
+    }
+    return 0;
+}
+
+static void FlowWheelFree(FlowWheel *w)
+{
+    uint32_t i;
+
+    if (w->slots == NULL)
+        return;
+    for (i = 0; i < FLOW_WHEEL_SLOTS; i++) {
+        if (w->slots[i].rows != NULL)
+            SCFree(w->slots[i].rows);
+    }
+    SCFree(w->slots);
+    w->slots = NULL;
+}
+
+/** \internal
+ *  \brief schedule a hash row to be checked at 'when'
+ *
+ *  Times that have passed are scheduled for the next second, times
+ *  beyond the wheel for its last slot.
+ */
+static void FlowWheelSchedule(FlowWheel *w, uint32_t idx, int32_t when)
+{
+    FlowBucket *fb = &flow_hash[idx];
+    uint32_t t;
+
+    if (when <= (int32_t)w->ts)
+        t = w->ts + 1;
+    else if ((uint32_t)when - w->ts >= FLOW_WHEEL_SLOTS)
+        t = w->ts + FLOW_WHEEL_SLOTS - 1;
+    else
+        t = (uint32_t)when;
+
+    if (fb->wheel_ts == t)
+        return;
+
+    FlowWheelSlot *slot = &w->slots[t & FLOW_WHEEL_MASK];
+    if (slot->len == slot->size) {
+        uint32_t size = slot->size ? slot->size * 2 : 64;
+        void *ptmp = SCRealloc(slot->rows, size * sizeof(uint32_t));
+        if (ptmp == NULL) {
+            /* no room in the wheel, have the row checked next run */
+            fb->wheel_ts = 0;
+            FlowHashRowMarkDirty(fb);
+            return;
+        }
+        slot->rows = ptmp;
+        slot->size = size;
+    }
+    slot->rows[slot->len++] = idx;
+    fb->wheel_ts = t;
+}
+
+/** \internal
+ *  \brief time out the flows of a hash row and schedule the row again
+ *
+ *  \retval cnt number of timed out flows
+ */
+static uint32_t FlowTimeoutRow(FlowWheel *w, uint32_t idx, struct timeval *ts,
+        FlowTimeoutCounters *counters)
+{
+    FlowBucket *fb = &flow_hash[idx];
+    uint32_t cnt = 0;
+
+    counters->rows_checked++;
+
+    /* before grabbing the row lock, make sure we have at least
+     * 9 packets in the pool */
+    PacketPoolWaitForN(9);
+
+    if (FBLOCK_TRYLOCK(fb) != 0) {
+        counters->rows_busy++;
+        FlowWheelSchedule(w, idx, (int32_t)ts->tv_sec + 1);
+        return 0;
+    }
+
+    /* flow hash bucket is now locked */
+
+    if (fb->tail == NULL) {
+        SC_ATOMIC_SET(fb->next_ts, INT_MAX);
+        counters->rows_empty++;
+    } else {
+        int32_t next_ts = 0;
+
+        cnt = FlowManagerHashRowTimeout(fb->tail, ts, 0, counters, &next_ts);
+
+        SC_ATOMIC_SET(fb->next_ts, next_ts);
+        if (fb->tail != NULL)
+            FlowWheelSchedule(w, idx, next_ts);
+    }
+
+    FBLOCK_UNLOCK(fb);
+    return cnt;
+}
+
+/** \internal
+ *  \brief check the rows flagged by the workers
+ *
+ *  \retval cnt number of timed out flows
+ */
+static uint32_t FlowTimeoutDirtyRows(FlowWheel *w, struct timeval *ts,
+        uint32_t hash_min, uint32_t hash_max, FlowTimeoutCounters *counters)
+{
+    uint32_t cnt = 0;
+    uint32_t i;
+
+    if (hash_min >= hash_max)
+        return 0;
+
+    for (i = hash_min / 64; i <= (hash_max - 1) / 64; i++) {
+        uint64_t mask = ~0ULL;
+
+        /* only our part of the first and last word */
+        if (i == hash_min / 64)
+            mask &= ~0ULL << (hash_min % 64);
+        if (i == (hash_max - 1) / 64 && (hash_max % 64) != 0)
+            mask &= ~0ULL >> (64 - (hash_max % 64));
+
+        if ((flow_hash_dirty[i] & mask) == 0)
+            continue;
+
+        /* clear the flags before looking at the rows, so workers
+         * flagging a row while we are at it have it checked again */
+        uint64_t bits = SCAtomicFetchAndAnd(&flow_hash_dirty[i], ~mask) & mask;
+        while (bits != 0) {
+            uint32_t idx = i * 64 + (uint32_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            cnt += FlowTimeoutRow(w, idx, ts, counters);
+        }
+    }
+
+    return cnt;
+}
+
+/**
+ *  \brief time out flows from the rows that are due or that changed
+ *
+ *  \param w timer wheel of this flow manager
+ *  \param ts timestamp
+ *  \param hash_min min hash index to consider
+ *  \param hash_max max hash index to consider
+ *  \param counters ptr to FlowTimeoutCounters structure
+ *
+ *  \retval cnt number of timed out flow
+ */
+static uint32_t FlowTimeoutWheel(FlowWheel *w, struct timeval *ts,
+        uint32_t hash_min, uint32_t hash_max,
+        FlowTimeoutCounters *counters)
+{
+    uint32_t now = (uint32_t)ts->tv_sec;
+    uint32_t cnt = 0;
+
+    /* time may go back a bit in offline mode, don't rewind the wheel */
+    uint32_t from = w->ts;
+    uint32_t to = (now > from) ? now : from;
+    uint32_t steps = to - from;
+    if (steps > FLOW_WHEEL_SLOTS)
+        steps = FLOW_WHEEL_SLOTS;
+    w->ts = to;
+
+    cnt += FlowTimeoutDirtyRows(w, ts, hash_min, hash_max, counters);
+
+    uint32_t s;
+    for (s = 0; s < steps; s++) {
+        uint32_t slot_id = (to - steps + 1 + s) & FLOW_WHEEL_MASK;
+        FlowWheelSlot *slot = &w->slots[slot_id];
+        /* rows scheduled while we run the slot can land in it again,
+         * they are for the next lap */
+        uint32_t len = slot->len;
+        uint32_t i;
+
+        for (i = 0; i < len; i++) {
+            uint32_t idx = slot->rows[i];
+            FlowBucket *fb = &flow_hash[idx];
+
+            /* rescheduled since, there is another entry for it */
+            if (fb->wheel_ts == 0 || (fb->wheel_ts & FLOW_WHEEL_MASK) != slot_id) {
+                counters->rows_skipped++;
+                continue;
+            }
+            fb->wheel_ts = 0;
+
+            /* parked or early, its time has not come */
+            if (SC_ATOMIC_GET(fb->next_ts) > (int32_t)now) {
+                counters->rows_skipped++;
+                FlowWheelSchedule(w, idx, SC_ATOMIC_GET(fb->next_ts));
+                continue;
+            }
+
+            cnt += FlowTimeoutRow(w, idx, ts, counters);
+        }
+
+        if (len < slot->len) {
+            memmove(slot->rows, slot->rows + len,
+                    (slot->len - len) * sizeof(uint32_t));
+        }
+        slot->len -= len;
+    }
+
+    return cnt;
+}
+
+/** rows of its flow table a worker checks per packet */
+#define FLOW_SHARD_SWEEP_ROWS   256
+
+/** \internal
+ *  \brief hand the time to a worker flow table
+ *
+ *  A busy owner sweeps its table from the packet path. An idle one only
+ *  runs when its capture loop times out, so ask it to push a pseudo
+ *  packet through the pipeline then. Busy capture loops don't time out,
+ *  so for them the flag is not acted upon.
+ */
+static void FlowShardSetTimeout(FlowShard *shard, void *data)
+{
+    const struct timeval *ts = data;
+    SC_ATOMIC_SET(shard->timeout_ts, (uint32_t)ts->tv_sec);
+
+    if (shard->in_use && shard->owner != NULL)
+        TmThreadsSetFlag(shard->owner, THV_CAPTURE_INJECT_PKT);
+}
+
+/**
+ *  \brief time out flows of a worker flow table, by its owner
+ *
+ *  Each time the flow manager hands a new time to the table, the owner
+ *  goes over all rows again, FLOW_SHARD_SWEEP_ROWS rows per call. The
+ *  rows are not locked, only the owner changes them.
+ *
+ *  \retval cnt number of timed out flows
+ */
+uint32_t FlowShardTimeout(FlowShard *shard)
+{
+    uint32_t timeout_ts = SC_ATOMIC_GET(shard->timeout_ts);
+    if (timeout_ts == 0)
+        return 0;
+    if (timeout_ts != shard->sweep_ts) {
+        shard->sweep_ts = timeout_ts;
+        shard->sweep_idx = 0;
+    }
+    if (shard->sweep_idx >= shard->size)
+        return 0;
+
+    struct timeval ts = { timeout_ts, 0 };
+    int emergency = (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY) ? 1 : 0;
+    FlowTimeoutCounters counters = { 0, 0, 0, 0, 0,0,0,0,0,0,0,0,0,0,0};
+    uint32_t cnt = 0;
+
+    uint32_t end = shard->sweep_idx + FLOW_SHARD_SWEEP_ROWS;
+    if (end > shard->size)
+        end = shard->size;
+
+    for ( ; shard->sweep_idx < end; shard->sweep_idx++) {
+        FlowBucket *fb = &shard->rows[shard->sweep_idx];
+        if (fb->tail == NULL)
+            continue;
+        if (!emergency && SC_ATOMIC_GET(fb->next_ts) > (int32_t)timeout_ts)
+            continue;
+
+        int32_t next_ts = 0;
+        cnt += FlowManagerHashRowTimeout(fb->tail, &ts, emergency, &counters, &next_ts);
+        SC_ATOMIC_SET(fb->next_ts, next_ts);
+    }
+
+    return cnt;
+}
+
+/**
+ *  \brief finish the sweep of a worker flow table, by its owner
+ *
+ *  Used by an idle owner, woken up by a pseudo packet.
+ *
+ *  \retval cnt number of timed out flows
+ */
+uint32_t FlowShardTimeoutAll(FlowShard *shard)
+{
+    uint32_t cnt = 0;
+    do {
+        cnt += FlowShardTimeout(shard);
+    } while (shard->sweep_ts != 0 && shard->sweep_idx < shard->size);
+    return cnt;
+}
+
 /**
  *  \internal
  *
@@ -539,12 +872,13 @@ static uint32_t FlowManagerHashRowCleanup(Flow *f)
  *
  *  \retval cnt number of removes out flows
  */
-static uint32_t FlowCleanupHash(void){
+static uint32_t FlowCleanupRows(FlowBucket *rows, uint32_t size)
+{
     uint32_t idx = 0;
     uint32_t cnt = 0;
 
-    for (idx = 0; idx < flow_config.hash_size; idx++) {
-        FlowBucket *fb = &flow_hash[idx];
+    for (idx = 0; idx < size; idx++) {
+        FlowBucket *fb = &rows[idx];
 
         FBLOCK_LOCK(fb);
 
@@ -559,6 +893,20 @@ static uint32_t FlowCleanupHash(void){
     return cnt;
 }
 
+static void FlowCleanupShard(FlowShard *shard, void *data)
+{
+    uint32_t *cnt = data;
+    *cnt += FlowCleanupRows(shard->rows, shard->size);
+}
+
+static uint32_t FlowCleanupHash(void){
+    uint32_t cnt = FlowCleanupRows(flow_hash, flow_config.hash_size);
+
+    /* the workers are gone, so are the lookups in their tables */
+    FlowShardForEach(FlowCleanupShard, &cnt);
+    return cnt;
+}
+
 extern int g_detect_disabled;
 
 typedef struct FlowManagerThreadData_ {
@@ -587,6 +935,7 @@ typedef struct FlowManagerThreadData_ {
     uint16_t flow_mgr_rows_busy;
     uint16_t flow_mgr_rows_maxlen;
 
+    FlowWheel wheel;
 } FlowManagerThreadData;
 
 static TmEcode FlowManagerThreadInit(ThreadVars *t, const void *initdata, void **data)
@@ -614,6 +963,11 @@ static TmEcode FlowManagerThreadInit(ThreadVars *t, const void *initdata, void *
 
     SCLogDebug("instance %u hash range %u %u", ftd->instance, ftd->min, ftd->max);
 
+    if (FlowWheelInit(&ftd->wheel, ftd->min, ftd->max) < 0) {
+        SCFree(ftd);
+        return TM_ECODE_FAILED;
+    }
+
     /* pass thread data back to caller */
     *data = ftd;
 
@@ -644,7 +998,10 @@ static TmEcode FlowManagerThreadInit(ThreadVars *t, const void *initdata, void *
 
 static TmEcode FlowManagerThreadDeinit(ThreadVars *t, void *data)
 {
+    FlowManagerThreadData *ftd = data;
+
     PacketPoolDestroy();
+    FlowWheelFree(&ftd->wheel);
     SCFree(data);
     return TM_ECODE_OK;
 }
@@ -708,11 +1065,22 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
 
         /* try to time out flows */
         FlowTimeoutCounters counters = { 0, 0, 0, 0, 0,0,0,0,0,0,0,0,0,0,0};
-        FlowTimeoutHash(&ts, 0 /* check all */, ftd->min, ftd->max, &counters);
+        if (emerg == TRUE) {
+            /* the timeouts are cut short, the wheel has the rows
+             * scheduled for the normal ones. Go over all rows. */
+            FlowTimeoutHash(&ts, 0 /* check all */, ftd->min, ftd->max, &counters);
+        } else {
+            FlowTimeoutWheel(&ftd->wheel, &ts, ftd->min, ftd->max, &counters);
+        }
+
 
+        /* the workers time out the flows of their own tables */
+        if (ftd->instance == 1)
+            FlowShardForEach(FlowShardSetTimeout, &ts);
 
         if (ftd->instance == 1) {
             DefragTimeoutHash(&ts);
+            DefragThreadTrackersWakeup();
             //uint32_t hosts_pruned =
             HostTimeoutHash(&ts);
             IPPairTimeoutHash(&ts);
@@ -1399,6 +1767,100 @@ static int FlowMgrTest05 (void)
     FlowShutdown();
     return result;
 }
+
+/**
+ *  \test  rows are scheduled once and only the last schedule counts
+ */
+static int FlowMgrTest06 (void)
+{
+    FlowWheel w;
+    struct timeval ts;
+
+    FlowInitConfig(FLOW_QUIET);
+    FAIL_IF(FlowWheelInit(&w, 0, flow_config.hash_size) != 0);
+    memset(flow_hash_dirty, 0, ((flow_config.hash_size + 63) / 64) * sizeof(uint64_t));
+    w.ts = 100;
+
+    FlowWheelSchedule(&w, 3, 150);
+    FAIL_IF(flow_hash[3].wheel_ts != 150);
+    FlowWheelSchedule(&w, 3, 150);
+    FAIL_IF(w.slots[150].len != 1);
+
+    FlowWheelSchedule(&w, 3, 120);
+    FAIL_IF(flow_hash[3].wheel_ts != 120);
+    FAIL_IF(w.slots[120].len != 1);
+
+    /* past and far away times */
+    FlowWheelSchedule(&w, 4, 50);
+    FAIL_IF(flow_hash[4].wheel_ts != 101);
+    FlowWheelSchedule(&w, 5, 100000);
+    FAIL_IF(flow_hash[5].wheel_ts != 100 + FLOW_WHEEL_SLOTS - 1);
+
+    /* rows 3 and 4 are due, the entry of 3 at 150 is stale */
+    memset(&ts, 0, sizeof(ts));
+    ts.tv_sec = 130;
+    FlowTimeoutCounters counters = { 0, 0, 0, 0, 0,0,0,0,0,0,0,0,0,0,0};
+    FlowTimeoutWheel(&w, &ts, 0, flow_config.hash_size, &counters);
+    FAIL_IF(counters.rows_checked != 2);
+    FAIL_IF(counters.rows_empty != 2);
+    FAIL_IF(flow_hash[3].wheel_ts != 0);
+
+    memset(&counters, 0, sizeof(counters));
+    ts.tv_sec = 200;
+    FlowTimeoutWheel(&w, &ts, 0, flow_config.hash_size, &counters);
+    FAIL_IF(counters.rows_checked != 0);
+    FAIL_IF(counters.rows_skipped != 1);
+    FAIL_IF(w.slots[150].len != 0);
+
+    /* a flagged row is checked on the next run */
+    FlowHashRowMarkDirty(&flow_hash[7]);
+    FAIL_IF(flow_hash_dirty[0] != (1ULL << 7));
+    memset(&counters, 0, sizeof(counters));
+    FlowTimeoutWheel(&w, &ts, 0, flow_config.hash_size, &counters);
+    FAIL_IF(counters.rows_checked != 1);
+    FAIL_IF(flow_hash_dirty[0] != 0);
+
+    FlowWheelFree(&w);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test  flows are timed out through the wheel
+ */
+static int FlowMgrTest07 (void)
+{
+    FlowWheel w;
+    struct timeval ts;
+
+    FlowInitConfig(FLOW_QUIET);
+    UTHBuildPacketOfFlows(0, 100, 0);
+
+    FAIL_IF(FlowWheelInit(&w, 0, flow_config.hash_size) != 0);
+    TimeGet(&ts);
+
+    /* first run checks all rows and schedules the used ones */
+    FlowTimeoutCounters counters = { 0, 0, 0, 0, 0,0,0,0,0,0,0,0,0,0,0};
+    FlowTimeoutWheel(&w, &ts, 0, flow_config.hash_size, &counters);
+    FAIL_IF(counters.rows_checked != flow_config.hash_size);
+    FAIL_IF(flow_recycle_q.len != 0);
+
+    /* nothing changed and nothing is due */
+    memset(&counters, 0, sizeof(counters));
+    FlowTimeoutWheel(&w, &ts, 0, flow_config.hash_size, &counters);
+    FAIL_IF(counters.rows_checked != 0);
+
+    TimeSetIncrementTime(2000);
+    TimeGet(&ts);
+    memset(&counters, 0, sizeof(counters));
+    FlowTimeoutWheel(&w, &ts, 0, flow_config.hash_size, &counters);
+    FAIL_IF(flow_recycle_q.len == 0);
+    FAIL_IF(counters.rows_checked >= flow_config.hash_size);
+
+    FlowWheelFree(&w);
+    FlowShutdown();
+    PASS;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -1417,5 +1879,9 @@ void FlowMgrRegisterTests (void)
                    FlowMgrTest04);
     UtRegisterTest("FlowMgrTest05 -- Test flow Allocations when it reach memcap",
                    FlowMgrTest05);
+    UtRegisterTest("FlowMgrTest06 -- Timer wheel scheduling",
+                   FlowMgrTest06);
+    UtRegisterTest("FlowMgrTest07 -- Timeout flows through the timer wheel",
+                   FlowMgrTest07);
 #endif /* UNITTESTS */
 }
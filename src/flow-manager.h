@@ -34,6 +34,8 @@ SCCtrlMutex flow_manager_ctrl_mutex;
 #define FlowWakeupFlowManagerThread() SCCtrlCondSignal(&flow_manager_ctrl_cond)
 
 void FlowManagerThreadSpawn(void);
+uint32_t FlowShardTimeout(struct FlowShard_ *shard);
+uint32_t FlowShardTimeoutAll(struct FlowShard_ *shard);
 void FlowDisableFlowManagerThread(void);
 void FlowMgrRegisterTests (void);
 
@@ -96,8 +96,31 @@ FlowQueue flow_recycle_q;
 FlowBucket *flow_hash;
 FlowConfig flow_config;
 
+/** bit per hash row, set by the workers when a row has to be looked
+ *  at by the flow manager before its scheduled time */
+uint64_t *flow_hash_dirty;
+
 /** flow memuse counter (atomic), for enforcing memcap limit */
 SC_ATOMIC_DECLARE(uint64_t, flow_memuse);
 
+/** \brief flag a hash row for the flow manager, e.g. after a flow was
+ *         added or changed state */
+static inline void FlowHashRowMarkDirty(const FlowBucket *fb)
+{
+    if (flow_hash_dirty == NULL)
+        return;
+    /* rows of the worker flow tables are not tracked */
+    if (fb < flow_hash || fb >= flow_hash + flow_config.hash_size)
+        return;
+
+    uint32_t idx = (uint32_t)(fb - flow_hash);
+    uint64_t bit = 1ULL << (idx & 63);
+    uint64_t *word = &flow_hash_dirty[idx >> 6];
+
+    /* avoid the locked op if the row is already flagged */
+    if (!(*word & bit))
+        (void)SCAtomicFetchAndOr(word, bit);
+}
+
 #endif /* __FLOW_PRIVATE_H__ */
 
@@ -82,6 +82,7 @@ static inline Packet *FlowForceReassemblyPseudoPacketSetup(Packet *p,
                                                            int dummy)
 {
     p->tenant_id = f->tenant_id;
+    p->input_id = f->input_id;
     p->datalink = DLT_RAW;
     p->proto = IPPROTO_TCP;
     FlowReference(&p->flow, f);
@@ -439,9 +440,10 @@ done:
  * - be robust in case of future changes
  * - locking overhead if neglectable when no other thread fights us
  *
- * \param q The queue to process flows from.
+ * \param rows hash rows to process flows from.
+ * \param size number of rows.
  */
-static inline void FlowForceReassemblyForHash(void)
+static inline void FlowForceReassemblyForRows(FlowBucket *rows, uint32_t size)
 {
     Flow *f;
     TcpSession *ssn;
@@ -449,8 +451,8 @@ static inline void FlowForceReassemblyForHash(void)
     int server_ok = 0;
     uint32_t idx = 0;
 
-    for (idx = 0; idx < flow_config.hash_size; idx++) {
-        FlowBucket *fb = &flow_hash[idx];
+    for (idx = 0; idx < size; idx++) {
+        FlowBucket *fb = &rows[idx];
 
         PacketPoolWaitForN(9);
         FBLOCK_LOCK(fb);
@@ -488,6 +490,20 @@ static inline void FlowForceReassemblyForHash(void)
     return;
 }
 
+/** \internal
+ *  \brief the workers don't do lookups anymore at this point, so the
+ *          rows of their tables can be walked like the hash */
+static void FlowForceReassemblyForShard(FlowShard *shard, void *data)
+{
+    FlowForceReassemblyForRows(shard->rows, shard->size);
+}
+
+static inline void FlowForceReassemblyForHash(void)
+{
+    FlowForceReassemblyForRows(flow_hash, flow_config.hash_size);
+    FlowShardForEach(FlowForceReassemblyForShard, NULL);
+}
+
 /**
  * \brief Force reassembly for all the flows that have unprocessed segments.
  */
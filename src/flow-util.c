@@ -39,11 +39,26 @@
 #include "detect.h"
 #include "detect-engine-state.h"
 
+/* compile time checks of the Flow layout, see flow.h: the lookup data
+ * has to fit in the first cache line, the per packet update data in the
+ * second, and the cold members stay out of both. Fails to compile with
+ * a negative array size otherwise. */
+#define FLOW_LAYOUT_CHECK(name, expr) \
+    typedef char flow_layout_check_##name[(expr) ? 1 : -1]
+
+FLOW_LAYOUT_CHECK(lookup, offsetof(Flow, hnext) + sizeof(struct Flow_ *) <= CLS);
+FLOW_LAYOUT_CHECK(update, offsetof(Flow, thread_id) + sizeof(FlowThreadId) <= 2 * CLS);
+FLOW_LAYOUT_CHECK(cold, offsetof(Flow, startts) >= 2 * CLS &&
+        offsetof(Flow, elephant_win_ms) >= 2 * CLS);
+
 /** \brief allocate a flow
  *
  *  We check against the memuse counter. If it passes that check we increment
  *  the counter first, then we try to alloc.
  *
+ *  The flow is cache line aligned so that the lookup and per packet update
+ *  members stay in the first two cache lines, see the Flow layout.
+ *
  *  \retval f the flow or NULL on out of memory
  */
 Flow *FlowAlloc(void)
@@ -57,7 +72,7 @@ Flow *FlowAlloc(void)
 
     (void) SC_ATOMIC_ADD(flow_memuse, size);
 
-    f = SCMalloc(size);
+    f = SCMallocAligned(size, CLS);
     if (unlikely(f == NULL)) {
         (void)SC_ATOMIC_SUB(flow_memuse, size);
         return NULL;
@@ -78,7 +93,7 @@ Flow *FlowAlloc(void)
 void FlowFree(Flow *f)
 {
     FLOW_DESTROY(f);
-    SCFree(f);
+    SCFreeAligned(f);
 
     size_t size = sizeof(Flow) + FlowStorageSize();
     (void) SC_ATOMIC_SUB(flow_memuse, size);
@@ -133,6 +148,7 @@ void FlowInit(Flow *f, const Packet *p)
     f->recursion_level = p->recursion_level;
     f->vlan_id[0] = p->vlan_id[0];
     f->vlan_id[1] = p->vlan_id[1];
+    f->input_id = p->input_id;
 
     if (PKT_IS_IPV4(p)) {
         FLOW_SET_IPV4_SRC_ADDR_FROM_PACKET(p, &f->src);
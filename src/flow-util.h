@@ -34,6 +34,8 @@
         (f)->tosrcpktcnt = 0; \
         (f)->todstbytecnt = 0; \
         (f)->tosrcbytecnt = 0; \
+        (f)->elephant_win_ms = 0; \
+        (f)->elephant_win_bytes = 0; \
     } while (0)
 
 #define FLOW_INITIALIZE(f) do { \
@@ -43,6 +43,12 @@
 #include "util-validate.h"
 
 #include "flow-util.h"
+#include "flow-hash.h"
+#include "flow-manager.h"
+#include "flow-private.h"
+#include "stream-tcp-reassemble.h"
+#include "defrag-hash.h"
+#include "util-time.h"
 
 typedef DetectEngineThreadCtx *DetectEngineThreadCtxPtr;
 
@@ -60,26 +66,87 @@ typedef struct FlowWorkerThreadData_ {
 
     PacketQueue pq;
 
+    uint16_t flow_shard_pruned;
+    uint16_t flow_elephant;
+
 } FlowWorkerThreadData;
 
+/** \brief apply flow.elephant.action to a flow that just became an
+ *         elephant flow */
+static void FlowWorkerElephant(Packet *p)
+{
+    Flow *f = p->flow;
+
+    if (flow_config.elephant_action == FLOW_ELEPHANT_ACTION_BYPASS) {
+        PacketBypassCallback(p);
+        return;
+    }
+
+    /* only headers are inspected from here on */
+    FlowSetNoPayloadInspectionFlag(f);
+    DecodeSetNoPayloadInspectionFlag(p);
+    if (f->proto == IPPROTO_TCP && f->protoctx != NULL) {
+        StreamTcpSetDisableRawReassemblyFlag(f->protoctx, 0);
+        StreamTcpSetDisableRawReassemblyFlag(f->protoctx, 1);
+    }
+}
+
 /** \brief handle flow for packet
  *
  *  Handle flow creation/lookup
  */
-static inline TmEcode FlowUpdate(Packet *p)
+static inline TmEcode FlowUpdate(ThreadVars *tv, FlowWorkerThreadData *fw, Packet *p)
 {
     FlowHandlePacketUpdate(p->flow, p);
 
+    if (FlowElephantUpdate(p->flow, p) == 1) {
+        StatsIncr(tv, fw->flow_elephant);
+        FlowWorkerElephant(p);
+    }
+
     int state = SC_ATOMIC_GET(p->flow->flow_state);
     switch (state) {
-        case FLOW_STATE_CAPTURE_BYPASSED:
         case FLOW_STATE_LOCAL_BYPASSED:
+            if (p->flow->flags & FLOW_ENCRYPTION_BYPASSED)
+                AppLayerIncBypassedCounters(tv, p->flow, p);
+            return TM_ECODE_DONE;
+        case FLOW_STATE_CAPTURE_BYPASSED:
             return TM_ECODE_DONE;
         default:
             return TM_ECODE_OK;
     }
 }
 
+/** \brief time out flows of the worker's own flow table, if it has one
+ *
+ *  Called after a packet is done with its flow. A pseudo packet without
+ *  a flow is pushed through by an idle capture loop, see
+ *  FlowShardSetTimeout and DefragThreadTrackersWakeup. It finishes the
+ *  sweep, as no packets may follow, and times out the thread's own
+ *  defrag trackers.
+ */
+static inline void FlowWorkerShardTimeout(ThreadVars *tv, FlowWorkerThreadData *fw,
+                                          const Packet *p)
+{
+    const int idle = (PKT_IS_PSEUDOPKT(p) && !(p->flags & PKT_HAS_FLOW));
+
+    if (fw->dtv->flow_shard != NULL) {
+        uint32_t pruned;
+        if (idle)
+            pruned = FlowShardTimeoutAll(fw->dtv->flow_shard);
+        else
+            pruned = FlowShardTimeout(fw->dtv->flow_shard);
+        if (pruned > 0)
+            StatsAddUI64(tv, fw->flow_shard_pruned, (uint64_t)pruned);
+    }
+
+    if (idle && defrag_config.thread_trackers) {
+        struct timeval ts;
+        TimeGet(&ts);
+        (void) DefragThreadTrackersTimeout(tv, &ts);
+    }
+}
+
 static TmEcode FlowWorkerThreadDeinit(ThreadVars *tv, void *data);
 
 static TmEcode FlowWorkerThreadInit(ThreadVars *tv, const void *initdata, void **data)
@@ -119,6 +186,14 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, const void *initdata, void *
         return TM_ECODE_FAILED;
     }
 
+    /* own flow table, if configured */
+    fw->dtv->flow_shard = FlowShardGet(tv);
+    if (fw->dtv->flow_shard != NULL) {
+        fw->flow_shard_pruned = StatsRegisterCounter("flow.worker_pruned", tv);
+    }
+
+    fw->flow_elephant = StatsRegisterCounter("flow.elephant", tv);
+
     DecodeRegisterPerfCounters(fw->dtv, tv);
     AppLayerRegisterThreadCounters(tv);
 
@@ -134,6 +209,10 @@ static TmEcode FlowWorkerThreadDeinit(ThreadVars *tv, void *data)
 {
     FlowWorkerThreadData *fw = data;
 
+    if (fw->dtv != NULL && fw->dtv->flow_shard != NULL) {
+        FlowShardRelease(fw->dtv->flow_shard);
+        fw->dtv->flow_shard = NULL;
+    }
     DecodeThreadVarsFree(tv, fw->dtv);
 
     /* free TCP */
@@ -180,8 +259,9 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *pr
         FlowHandlePacket(tv, fw->dtv, p);
         if (likely(p->flow != NULL)) {
             DEBUG_ASSERT_FLOW_LOCKED(p->flow);
-            if (FlowUpdate(p) == TM_ECODE_DONE) {
+            if (FlowUpdate(tv, fw, p) == TM_ECODE_DONE) {
                 FLOWLOCK_UNLOCK(p->flow);
+                FlowWorkerShardTimeout(tv, fw, p);
                 return TM_ECODE_OK;
             }
         }
@@ -274,9 +354,27 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *pr
         FLOWLOCK_UNLOCK(p->flow);
     }
 
+    FlowWorkerShardTimeout(tv, fw, p);
     return TM_ECODE_OK;
 }
 
+/** \brief prepare a batch of packets
+ *
+ *  Called by the threading code before FlowWorker is called for each
+ *  packet of the batch. Prefetches the flow hash rows so the flow
+ *  lookups of the batch don't each stall on a cache miss.
+ */
+static void FlowWorkerBatchPrepare(ThreadVars *tv, Packet **pkts, uint32_t cnt, void *data)
+{
+    FlowWorkerThreadData *fw = data;
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        if (pkts[i]->flags & PKT_WANTS_FLOW) {
+            FlowHashPrefetch(fw->dtv, pkts[i]);
+        }
+    }
+}
+
 void FlowWorkerReplaceDetectCtx(void *flow_worker, void *detect_ctx)
 {
     FlowWorkerThreadData *fw = flow_worker;
@@ -321,6 +419,7 @@ void TmModuleFlowWorkerRegister (void)
     tmm_modules[TMM_FLOWWORKER].name = "FlowWorker";
     tmm_modules[TMM_FLOWWORKER].ThreadInit = FlowWorkerThreadInit;
     tmm_modules[TMM_FLOWWORKER].Func = FlowWorker;
+    tmm_modules[TMM_FLOWWORKER].FuncBatchPrepare = FlowWorkerBatchPrepare;
     tmm_modules[TMM_FLOWWORKER].ThreadDeinit = FlowWorkerThreadDeinit;
     tmm_modules[TMM_FLOWWORKER].ThreadExitPrintStats = FlowWorkerExitPrintStats;
     tmm_modules[TMM_FLOWWORKER].cap_flags = 0;
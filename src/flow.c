@@ -33,6 +33,8 @@
 
 #include "util-random.h"
 #include "util-time.h"
+#include "util-cpu.h"
+#include "util-toeplitz.h"
 
 #include "flow.h"
 #include "flow-queue.h"
@@ -79,6 +81,11 @@
  *  free increased with every run. */
 SC_ATOMIC_DECLARE(unsigned int, flow_prune_idx);
 
+/** flow tables of the workers, see FlowShard */
+static FlowShard *flow_shards = NULL;
+static uint16_t flow_shards_cnt = 0;
+static SCMutex flow_shards_lock = SCMUTEX_INITIALIZER;
+
 /** atomic flags */
 SC_ATOMIC_DECLARE(unsigned int, flow_flags);
 
@@ -395,6 +402,61 @@ void FlowHandlePacket(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
     return;
 }
 
+/** default RSS key: symmetric, so both directions of a flow hash the same */
+static const uint8_t flow_toeplitz_default_key[40] = {
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+};
+
+/** \brief set up the flow hash function from "flow.hash-type" and
+ *         "flow.hash-key" */
+static void FlowInitHashType(void)
+{
+    const char *hash_type = NULL;
+    if (ConfGet("flow.hash-type", &hash_type) != 1 ||
+        strcasecmp(hash_type, "default") == 0)
+        return;
+
+    if (strcasecmp(hash_type, "toeplitz") != 0) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
+                   "for flow.hash-type in conf.  Killing engine.", hash_type);
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t key[TOEPLITZ_KEY_MAX];
+    uint16_t key_len = sizeof(flow_toeplitz_default_key);
+    memcpy(key, flow_toeplitz_default_key, key_len);
+
+    const char *key_str = NULL;
+    if (ConfGet("flow.hash-key", &key_str) == 1 &&
+        ToeplitzParseKey(key_str, key, &key_len) != 0) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid flow.hash-key "
+                   "\"%s\", expecting %d to %d hex bytes like \"6d:5a:...\". "
+                   "Killing engine.", key_str, TOEPLITZ_KEY_MIN, TOEPLITZ_KEY_MAX);
+        exit(EXIT_FAILURE);
+    }
+
+    flow_config.toeplitz = ToeplitzInit(key, key_len);
+    if (flow_config.toeplitz == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating the Toeplitz hash "
+                   "tables.  Killing engine.");
+        exit(EXIT_FAILURE);
+    }
+
+    /* both directions of a flow have to end up in the same bucket */
+    if (!ToeplitzIsSymmetric(flow_config.toeplitz)) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "flow.hash-key is not "
+                   "symmetric, use a key that is, like 6d:5a repeated.  "
+                   "Killing engine.");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogConfig("flow hash: toeplitz with a %u byte key", key_len);
+}
+
 /** \brief initialize the configuration
  *  \warning Not thread safe */
 void FlowInitConfig(char quiet)
@@ -457,6 +519,48 @@ void FlowInitConfig(char quiet)
             flow_config.prealloc = configval;
         }
     }
+    int worker_tables = 0;
+    if (ConfGetBool("flow.worker-tables", &worker_tables) == 1 && worker_tables) {
+        flow_config.worker_tables = 1;
+
+        /* the flows are spread over the workers */
+        uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
+        flow_config.worker_hash_size = flow_config.hash_size / (ncpus ? ncpus : 1);
+        if ((ConfGet("flow.worker-hash-size", &conf_val)) == 1)
+        {
+            if (ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                                        conf_val) > 0) {
+                flow_config.worker_hash_size = configval;
+            }
+        }
+        if (flow_config.worker_hash_size < 1024)
+            flow_config.worker_hash_size = 1024;
+    }
+    if ((ConfGet("flow.elephant.rate", &conf_val)) == 1)
+    {
+        if (ParseSizeStringU64(conf_val, &flow_config.elephant_rate) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing flow.elephant.rate "
+                       "from conf file - %s.  Killing engine",
+                       conf_val);
+            exit(EXIT_FAILURE);
+        }
+        if ((ConfGet("flow.elephant.action", &conf_val)) == 1) {
+            if (strcmp(conf_val, "bypass") == 0) {
+                flow_config.elephant_action = FLOW_ELEPHANT_ACTION_BYPASS;
+            } else if (strcmp(conf_val, "reduce") != 0) {
+                SCLogError(SC_ERR_INVALID_VALUE, "flow.elephant.action must be "
+                        "'reduce' or 'bypass', not '%s'. Using 'reduce'", conf_val);
+            }
+        }
+        if (quiet == FALSE && flow_config.elephant_rate > 0) {
+            SCLogConfig("elephant flows: above %"PRIu64" bytes/sec, action %s",
+                    flow_config.elephant_rate,
+                    flow_config.elephant_action == FLOW_ELEPHANT_ACTION_BYPASS ?
+                    "bypass" : "reduce");
+        }
+    }
+    FlowInitHashType();
+
     SCLogDebug("Flow config from suricata.yaml: memcap: %"PRIu64", hash-size: "
                "%"PRIu32", prealloc: %"PRIu32, flow_config.memcap,
                flow_config.hash_size, flow_config.prealloc);
@@ -486,6 +590,14 @@ void FlowInitConfig(char quiet)
     }
     (void) SC_ATOMIC_ADD(flow_memuse, (flow_config.hash_size * sizeof(FlowBucket)));
 
+    uint32_t dirty_size = ((flow_config.hash_size + 63) / 64) * sizeof(uint64_t);
+    flow_hash_dirty = SCMallocAligned(dirty_size, CLS);
+    if (unlikely(flow_hash_dirty == NULL)) {
+        SCLogError(SC_ERR_FATAL, "Fatal error encountered in FlowInitConfig. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    memset(flow_hash_dirty, 0, dirty_size);
+
     if (quiet == FALSE) {
         SCLogConfig("allocated %"PRIu64" bytes of memory for the flow hash... "
                   "%" PRIu32 " buckets of size %" PRIuMAX "",
@@ -531,12 +643,130 @@ static void FlowPrintStats (void)
     return;
 }
 
+/**
+ *  \brief get a flow table for a worker
+ *
+ *  Only in the workers runmode, where all packets of a flow are handled by
+ *  one thread. Tables of workers that are gone are reused, with the flows
+ *  that are still in them.
+ *
+ *  \param tv thread of the worker, NULL in unittests
+ *
+ *  \retval shard table or NULL if the global flow hash should be used
+ */
+FlowShard *FlowShardGet(ThreadVars *tv)
+{
+    if (flow_config.worker_tables == 0)
+        return NULL;
+
+    const char *runmode = RunmodeGetActive();
+    if (!RunmodeIsUnittests() &&
+            (runmode == NULL || strcmp(runmode, "workers") != 0)) {
+        SCLogDebug("flow.worker-tables only applies to the workers runmode");
+        return NULL;
+    }
+
+    SCMutexLock(&flow_shards_lock);
+    FlowShard *shard = flow_shards;
+    while (shard != NULL && shard->in_use)
+        shard = shard->next;
+
+    if (shard == NULL) {
+        uint64_t size = flow_config.worker_hash_size * sizeof(FlowBucket);
+        if (!(FLOW_CHECK_MEMCAP(size))) {
+            SCLogError(SC_ERR_FLOW_INIT, "allocating worker flow table failed: "
+                    "max flow memcap reached. Memcap %"PRIu64", table size "
+                    "%"PRIu64, flow_config.memcap, size);
+            goto error;
+        }
+        shard = SCMalloc(sizeof(FlowShard));
+        if (unlikely(shard == NULL))
+            goto error;
+        memset(shard, 0, sizeof(FlowShard));
+        shard->rows = SCMallocAligned(size, CLS);
+        if (unlikely(shard->rows == NULL)) {
+            SCFree(shard);
+            goto error;
+        }
+        memset(shard->rows, 0, size);
+
+        uint32_t u;
+        for (u = 0; u < flow_config.worker_hash_size; u++) {
+            FBLOCK_INIT(&shard->rows[u]);
+            SC_ATOMIC_INIT(shard->rows[u].next_ts);
+        }
+        shard->size = flow_config.worker_hash_size;
+        shard->id = flow_shards_cnt++;
+        SC_ATOMIC_INIT(shard->timeout_ts);
+        (void) SC_ATOMIC_ADD(flow_memuse, size);
+
+        shard->next = flow_shards;
+        flow_shards = shard;
+
+        SCLogDebug("worker flow table %u: %u rows", shard->id, shard->size);
+    }
+    shard->in_use = 1;
+    shard->owner = tv;
+    SCMutexUnlock(&flow_shards_lock);
+    return shard;
+
+error:
+    SCMutexUnlock(&flow_shards_lock);
+    return NULL;
+}
+
+/** \brief give up a worker flow table, its flows stay in it */
+void FlowShardRelease(FlowShard *shard)
+{
+    SCMutexLock(&flow_shards_lock);
+    shard->in_use = 0;
+    shard->owner = NULL;
+    SCMutexUnlock(&flow_shards_lock);
+}
+
+/** \brief call Func for each worker flow table
+ *
+ *  Called under the registry lock, so Func shouldn't take long. */
+void FlowShardForEach(void (*Func)(FlowShard *, void *), void *data)
+{
+    SCMutexLock(&flow_shards_lock);
+    FlowShard *shard;
+    for (shard = flow_shards; shard != NULL; shard = shard->next) {
+        Func(shard, data);
+    }
+    SCMutexUnlock(&flow_shards_lock);
+}
+
+/** \internal
+ *  \brief free the flows in a list of rows and destroy the rows */
+static void FlowFreeRows(FlowBucket *rows, uint32_t size)
+{
+    Flow *f;
+    uint32_t u;
+
+    for (u = 0; u < size; u++) {
+        f = rows[u].head;
+        while (f) {
+#ifdef DEBUG_VALIDATION
+            BUG_ON(SC_ATOMIC_GET(f->use_cnt) != 0);
+#endif
+            Flow *n = f->hnext;
+            uint8_t proto_map = FlowGetProtoMapping(f->proto);
+            FlowClearMemory(f, proto_map);
+            FlowFree(f);
+            f = n;
+        }
+
+        FBLOCK_DESTROY(&rows[u]);
+        SC_ATOMIC_DESTROY(rows[u].next_ts);
+    }
+}
+
 /** \brief shutdown the flow engine
  *  \warning Not thread safe */
 void FlowShutdown(void)
 {
     Flow *f;
-    uint32_t u;
 
     FlowPrintStats();
 
@@ -548,29 +778,35 @@ void FlowShutdown(void)
         FlowFree(f);
     }
 
+    /* clear and free the worker tables */
+    while (flow_shards != NULL) {
+        FlowShard *shard = flow_shards;
+        flow_shards = shard->next;
+
+        FlowFreeRows(shard->rows, shard->size);
+        SCFreeAligned(shard->rows);
+        (void) SC_ATOMIC_SUB(flow_memuse, shard->size * sizeof(FlowBucket));
+        SC_ATOMIC_DESTROY(shard->timeout_ts);
+        SCFree(shard);
+    }
+    flow_shards_cnt = 0;
+
     /* clear and free the hash */
     if (flow_hash != NULL) {
         /* clean up flow mutexes */
-        for (u = 0; u < flow_config.hash_size; u++) {
-            f = flow_hash[u].head;
-            while (f) {
-#ifdef DEBUG_VALIDATION
-                BUG_ON(SC_ATOMIC_GET(f->use_cnt) != 0);
-#endif
-                Flow *n = f->hnext;
-                uint8_t proto_map = FlowGetProtoMapping(f->proto);
-                FlowClearMemory(f, proto_map);
-                FlowFree(f);
-                f = n;
-            }
-
-            FBLOCK_DESTROY(&flow_hash[u]);
-            SC_ATOMIC_DESTROY(flow_hash[u].next_ts);
-        }
+        FlowFreeRows(flow_hash, flow_config.hash_size);
         SCFreeAligned(flow_hash);
         flow_hash = NULL;
     }
+    if (flow_hash_dirty != NULL) {
+        SCFreeAligned(flow_hash_dirty);
+        flow_hash_dirty = NULL;
+    }
     (void) SC_ATOMIC_SUB(flow_memuse, flow_config.hash_size * sizeof(FlowBucket));
+    if (flow_config.toeplitz != NULL) {
+        ToeplitzFree(flow_config.toeplitz);
+        flow_config.toeplitz = NULL;
+    }
     FlowQueueDestroy(&flow_spare_q);
     FlowQueueDestroy(&flow_recycle_q);
 
@@ -973,9 +1209,51 @@ void FlowUpdateState(Flow *f, enum FlowState s)
 
     if (f->fb) {
         /* and reset the flow buckup next_ts value so that the flow manager
-         * has to revisit this row */
+         * has to revisit this row. Rows of worker tables are not in the
+         * flow_hash range and are left alone by FlowHashRowMarkDirty. */
         SC_ATOMIC_SET(f->fb->next_ts, 0);
+        FlowHashRowMarkDirty(f->fb);
+    }
+}
+
+/**
+ *  \brief Track the byte rate of a flow to find elephant flows
+ *
+ *  The rate is measured over windows of at least a second, so this costs
+ *  a compare per packet. Flows that have been marked are not checked
+ *  again.
+ *
+ *  \retval 1 flow just became an elephant flow, FLOW_ELEPHANT is set
+ *  \retval 0 otherwise
+ */
+int FlowElephantUpdate(Flow *f, const Packet *p)
+{
+    if (flow_config.elephant_rate == 0 || (f->flags & FLOW_ELEPHANT))
+        return 0;
+
+    const uint64_t now_ms = (uint64_t)p->ts.tv_sec * 1000 + p->ts.tv_usec / 1000;
+    const uint64_t bytes = f->todstbytecnt + f->tosrcbytecnt;
+
+    if (f->elephant_win_ms == 0) {
+        f->elephant_win_ms = now_ms;
+        f->elephant_win_bytes = bytes;
+        return 0;
     }
+
+    if (now_ms < f->elephant_win_ms + 1000)
+        return 0;
+
+    const uint64_t elapsed_ms = now_ms - f->elephant_win_ms;
+    const uint64_t rate = (bytes - f->elephant_win_bytes) * 1000 / elapsed_ms;
+    f->elephant_win_ms = now_ms;
+    f->elephant_win_bytes = bytes;
+
+    if (rate < flow_config.elephant_rate)
+        return 0;
+
+    SCLogDebug("flow %p: %"PRIu64" bytes/sec, elephant", f, rate);
+    f->flags |= FLOW_ELEPHANT;
+    return 1;
 }
 
 /************************************Unittests*******************************/
@@ -1187,6 +1465,175 @@ static int FlowTest09 (void)
     return result;
 }
 
+/**
+ *  \test  flows in a worker flow table are found there, not in the hash,
+ *         and are timed out by the owner
+ */
+static int FlowTest10 (void)
+{
+    DecodeThreadVars dtv;
+    uint8_t payload[] = "Payload";
+
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.worker_tables = 1;
+    flow_config.worker_hash_size = 1024;
+
+    memset(&dtv, 0, sizeof(dtv));
+    dtv.flow_shard = FlowShardGet(NULL);
+    FAIL_IF_NULL(dtv.flow_shard);
+
+    Packet *p = UTHBuildPacket(payload, sizeof(payload), IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    FlowSetupPacket(p);
+
+    FlowHandlePacket(NULL, &dtv, p);
+    FAIL_IF_NULL(p->flow);
+    Flow *f = p->flow;
+    FAIL_IF(f->fb != &dtv.flow_shard->rows[p->flow_hash % 1024]);
+    FAIL_IF_NOT_NULL(flow_hash[p->flow_hash % flow_config.hash_size].head);
+    FLOWLOCK_UNLOCK(f);
+    FlowDeReference(&p->flow);
+
+    /* second lookup finds the same flow */
+    FlowHandlePacket(NULL, &dtv, p);
+    FAIL_IF(p->flow != f);
+    FLOWLOCK_UNLOCK(f);
+    FlowDeReference(&p->flow);
+
+    /* no time handed over yet, nothing to do */
+    FAIL_IF(FlowShardTimeout(dtv.flow_shard) != 0);
+
+    f->flags |= FLOW_TIMEOUT_REASSEMBLY_DONE;
+    SC_ATOMIC_SET(dtv.flow_shard->timeout_ts, (uint32_t)f->lastts.tv_sec + 5000);
+    /* a packet only sweeps part of the table */
+    uint32_t cnt = FlowShardTimeout(dtv.flow_shard);
+    FAIL_IF(dtv.flow_shard->sweep_idx != 256);
+    /* an idle worker finishes the sweep at once */
+    cnt += FlowShardTimeoutAll(dtv.flow_shard);
+    FAIL_IF(dtv.flow_shard->sweep_idx != 1024);
+    FAIL_IF(cnt != 1);
+    FAIL_IF(flow_recycle_q.len != 1);
+
+    UTHFreePacket(p);
+    FlowShardRelease(dtv.flow_shard);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test  the lookup members of a flow are in the first cache line, the
+ *         per packet members in the second, and allocated flows are
+ *         cache line aligned
+ */
+static int FlowTest11 (void)
+{
+    FAIL_IF(offsetof(Flow, hnext) + sizeof(Flow *) > CLS);
+    FAIL_IF(offsetof(Flow, flags) + sizeof(uint32_t) > CLS);
+    FAIL_IF(offsetof(Flow, protoctx) + sizeof(void *) > 2 * CLS);
+
+    FlowInitConfig(FLOW_QUIET);
+    Flow *f = FlowAlloc();
+    FAIL_IF_NULL(f);
+    FAIL_IF(((uintptr_t)f % CLS) != 0);
+    FlowFree(f);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test  with the toeplitz hash type both directions of a flow get the
+ *         NIC's RSS hash for queue selection, the flow table keeps the
+ *         seeded hash
+ */
+static int FlowTest12 (void)
+{
+    uint8_t payload[] = "Payload";
+    /* RSS input: src, dst, sp, dp */
+    uint8_t in[12] = { 192, 168, 1, 1, 10, 0, 0, 1, 0x04, 0x00, 0x00, 0x50 };
+
+    FlowInitConfig(FLOW_QUIET);
+    FAIL_IF_NOT_NULL(flow_config.toeplitz);
+    flow_config.toeplitz = ToeplitzInit(flow_toeplitz_default_key,
+            sizeof(flow_toeplitz_default_key));
+    FAIL_IF_NULL(flow_config.toeplitz);
+
+    Packet *p1 = UTHBuildPacketReal(payload, sizeof(payload), IPPROTO_TCP,
+            "192.168.1.1", "10.0.0.1", 1024, 80);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = UTHBuildPacketReal(payload, sizeof(payload), IPPROTO_TCP,
+            "10.0.0.1", "192.168.1.1", 80, 1024);
+    FAIL_IF_NULL(p2);
+
+    FlowSetupPacket(p1);
+    FlowSetupPacket(p2);
+    FAIL_IF(p1->flow_hash != p2->flow_hash);
+
+    uint32_t rss = ToeplitzHashSlow(flow_toeplitz_default_key,
+            sizeof(flow_toeplitz_default_key), in, sizeof(in));
+    FAIL_IF(FlowGetRssHash(p1) != rss);
+    FAIL_IF(FlowGetRssHash(p2) != rss);
+
+    /* the row index doesn't change with the hash type */
+    uint32_t row_hash = p1->flow_hash;
+    ToeplitzFree(flow_config.toeplitz);
+    flow_config.toeplitz = NULL;
+    FlowSetupPacket(p1);
+    FAIL_IF(p1->flow_hash != row_hash);
+    FAIL_IF(FlowGetRssHash(p1) != 0);
+
+    UTHFreePacket(p1);
+    UTHFreePacket(p2);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test  elephant flow detection over one second windows
+ */
+static int FlowTest13 (void)
+{
+    Flow f;
+    Packet p;
+    memset(&f, 0, sizeof(f));
+    memset(&p, 0, sizeof(p));
+
+    uint64_t rate = flow_config.elephant_rate;
+    flow_config.elephant_rate = 1000;
+
+    p.ts.tv_sec = 100;
+    p.ts.tv_usec = 500000;
+    f.todstbytecnt = 100;
+    FAIL_IF(FlowElephantUpdate(&f, &p) != 0);
+    FAIL_IF(f.elephant_win_ms != 100500);
+
+    /* less than a second: no verdict yet */
+    p.ts.tv_sec = 101;
+    p.ts.tv_usec = 0;
+    f.todstbytecnt = 5000;
+    FAIL_IF(FlowElephantUpdate(&f, &p) != 0);
+
+    /* 900 bytes in 1.5 sec */
+    p.ts.tv_sec = 102;
+    f.todstbytecnt = 1000;
+    FAIL_IF(FlowElephantUpdate(&f, &p) != 0);
+    FAIL_IF(f.flags & FLOW_ELEPHANT);
+    FAIL_IF(f.elephant_win_bytes != 1000);
+
+    /* 2000 bytes in 1 sec */
+    p.ts.tv_sec = 103;
+    f.tosrcbytecnt = 2000;
+    FAIL_IF(FlowElephantUpdate(&f, &p) != 1);
+    FAIL_IF_NOT(f.flags & FLOW_ELEPHANT);
+
+    /* reported once */
+    p.ts.tv_sec = 105;
+    f.tosrcbytecnt = 20000;
+    FAIL_IF(FlowElephantUpdate(&f, &p) != 0);
+
+    flow_config.elephant_rate = rate;
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -1204,6 +1651,10 @@ void FlowRegisterTests (void)
                    FlowTest08);
     UtRegisterTest("FlowTest09 -- Test flow Allocations when it reach memcap",
                    FlowTest09);
+    UtRegisterTest("FlowTest10 -- Worker flow table", FlowTest10);
+    UtRegisterTest("FlowTest11 -- Flow layout", FlowTest11);
+    UtRegisterTest("FlowTest12 -- Toeplitz flow hash", FlowTest12);
+    UtRegisterTest("FlowTest13 -- Elephant flow", FlowTest13);
 
     FlowMgrRegisterTests();
     RegisterFlowStorageTests();
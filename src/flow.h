@@ -96,6 +96,12 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 /** Indicate that alproto detection for flow should be done again */
 #define FLOW_CHANGE_PROTO               BIT_U32(22)
 
+/** flow exceeded flow.elephant.rate */
+#define FLOW_ELEPHANT                   BIT_U32(23)
+
+/** flow was bypassed by the app-layer encryption-bypass option */
+#define FLOW_ENCRYPTION_BYPASSED        BIT_U32(24)
+
 /* File flags */
 
 /** no magic on files in this flow */
@@ -256,8 +262,25 @@ typedef struct FlowCnf_
     uint32_t emerg_timeout_est;
     uint32_t emergency_recovery;
 
+    /** each worker has its own flow table ("flow.worker-tables") */
+    int worker_tables;
+    uint32_t worker_hash_size;
+
+    /** Toeplitz hash ctx if "flow.hash-type" is "toeplitz", NULL otherwise */
+    struct ToeplitzCtx_ *toeplitz;
+
+    /** elephant flows: bytes/sec above which a flow is one, 0 disabled */
+    uint64_t elephant_rate;
+    /** what to do with them: FLOW_ELEPHANT_ACTION_* */
+    int elephant_action;
+
 } FlowConfig;
 
+/** elephant flows get no more payload inspection */
+#define FLOW_ELEPHANT_ACTION_REDUCE     0
+/** elephant flows are bypassed */
+#define FLOW_ELEPHANT_ACTION_BYPASS     1
+
 /* Hash key for the flow hash */
 typedef struct FlowKey_
 {
@@ -313,6 +336,20 @@ typedef uint16_t FlowThreadId;
  *  The flow "header" (addresses, ports, proto, recursion level) are static
  *  after the initialization and remain read-only throughout the entire live
  *  of a flow. This is why we can access those without protection of the lock.
+ *
+ *  Layout
+ *
+ *  The members are grouped by how often they are touched. Flows are
+ *  allocated cache line aligned (see FlowAlloc) so that:
+ *  - the first cache line holds everything FlowCompare needs while walking
+ *    a hash row: the header, the flags and the hash list next pointer.
+ *  - the second cache line holds what FlowHandlePacketUpdate and the flow
+ *    worker touch for every packet.
+ *  - the lock and the app-layer pointers follow, then the members used by
+ *    detection and the queues, and finally the cold members that are only
+ *    used on setup, protocol detection/change and logging.
+ *  The flow storage is allocated after the end of the structure, see
+ *  FlowAlloc and flow-storage.c.
  */
 
 typedef struct Flow_
@@ -331,17 +368,26 @@ typedef struct Flow_
     uint8_t proto;
     uint8_t recursion_level;
     uint16_t vlan_id[2];
+    /** input the flow was seen on, see Packet::input_id */
+    uint16_t input_id;
+
+    /* end of flow "header" */
+
+    uint32_t flags;         /**< generic flags */
 
     /** flow hash - the flow hash before hash table size mod. */
     uint32_t flow_hash;
 
+    /** hash list next pointer, protected by fb->s */
+    struct Flow_ *hnext; /* hash list */
+
+    /* end of the first cache line: the lookup data */
+
     /* time stamp of last update (last packet). Set/updated under the
      * flow and flow hash row locks, safe to read under either the
      * flow lock or flow hash row lock. */
     struct timeval lastts;
 
-    /* end of flow "header" */
-
     SC_ATOMIC_DECLARE(FlowStateType, flow_state);
 
     /** how many pkts and stream msgs are using the flow *right now*. This
@@ -352,21 +398,29 @@ typedef struct Flow_
      */
     SC_ATOMIC_DECLARE(FlowRefCount, use_cnt);
 
-    /** flow tenant id, used to setup flow timeout and stream pseudo
-     *  packets with the correct tenant id set */
-    uint32_t tenant_id;
+    uint32_t todstpktcnt;
+    uint32_t tosrcpktcnt;
+    uint64_t todstbytecnt;
+    uint64_t tosrcbytecnt;
 
-    uint32_t probing_parser_toserver_alproto_masks;
-    uint32_t probing_parser_toclient_alproto_masks;
+    /** protocol specific data pointer, e.g. for TcpSession */
+    void *protoctx;
 
-    uint32_t flags;         /**< generic flags */
+    /** ttl tracking */
+    uint8_t min_ttl_toserver;
+    uint8_t max_ttl_toserver;
+    uint8_t min_ttl_toclient;
+    uint8_t max_ttl_toclient;
 
-    uint16_t file_flags;    /**< file tracking/extraction flags */
-    /* coccinelle: Flow:file_flags:FLOWFILE_ */
+    /** mapping to Flow's protocol specific protocols for timeouts
+        and state and free functions. */
+    uint8_t protomap;
 
-    /** destination port to be used in protocol detection. This is meant
-     *  for use with STARTTLS and HTTP CONNECT detection */
-    uint16_t protodetect_dp; /**< 0 if not used */
+    /** Thread ID for the stream/detect portion of this flow */
+    FlowThreadId thread_id;
+
+    /* end of the second cache line: the per packet update data. Checked
+     * at compile time in flow-util.c */
 
 #ifdef FLOWLOCK_RWLOCK
     SCRWLock r;
@@ -376,47 +430,21 @@ typedef struct Flow_
     #error Enable FLOWLOCK_RWLOCK or FLOWLOCK_MUTEX
 #endif
 
-    /** protocol specific data pointer, e.g. for TcpSession */
-    void *protoctx;
-
-    /** mapping to Flow's protocol specific protocols for timeouts
-        and state and free functions. */
-    uint8_t protomap;
-
-    uint8_t flow_end_flags;
-    /* coccinelle: Flow:flow_end_flags:FLOW_END_FLAG_ */
-
     AppProto alproto; /**< \brief application level protocol */
     AppProto alproto_ts;
     AppProto alproto_tc;
 
-    /** original application level protocol. Used to indicate the previous
-       protocol when changing to another protocol , e.g. with STARTTLS. */
-    AppProto alproto_orig;
-    /** expected app protocol: used in protocol change/upgrade like in
-     *  STARTTLS. */
-    AppProto alproto_expect;
-
-    /** detection engine ctx version used to inspect this flow. Set at initial
-     *  inspection. If it doesn't match the currently in use de_ctx, the
-     *  stored sgh ptrs are reset. */
-    uint32_t de_ctx_version;
-
-    /** Thread ID for the stream/detect portion of this flow */
-    FlowThreadId thread_id;
-
-    /** ttl tracking */
-    uint8_t min_ttl_toserver;
-    uint8_t max_ttl_toserver;
-    uint8_t min_ttl_toclient;
-    uint8_t max_ttl_toclient;
-
     /** application level storage ptrs.
      *
      */
     AppLayerParserState *alparser;     /**< parser internal state */
     void *alstate;      /**< application layer state */
 
+    /** detection engine ctx version used to inspect this flow. Set at initial
+     *  inspection. If it doesn't match the currently in use de_ctx, the
+     *  stored sgh ptrs are reset. */
+    uint32_t de_ctx_version;
+
     /** toclient sgh for this flow. Only use when FLOW_SGH_TOCLIENT flow flag
      *  has been set. */
     const struct SigGroupHead_ *sgh_toclient;
@@ -428,19 +456,47 @@ typedef struct Flow_
     GenericVar *flowvar;
 
     /** hash list pointers, protected by fb->s */
-    struct Flow_ *hnext; /* hash list */
     struct Flow_ *hprev;
     struct FlowBucket_ *fb;
 
     /** queue list pointers, protected by queue mutex */
     struct Flow_ *lnext; /* list */
     struct Flow_ *lprev;
+
+    /* cold: only used on flow setup, protocol detection and change,
+     * timeout and logging */
+
     struct timeval startts;
 
-    uint32_t todstpktcnt;
-    uint32_t tosrcpktcnt;
-    uint64_t todstbytecnt;
-    uint64_t tosrcbytecnt;
+    /** elephant flow rate window: start in ms and the flow's byte count
+     *  at that time. Only used if flow.elephant is enabled, and then only
+     *  once per second of the flow. */
+    uint64_t elephant_win_ms;
+    uint64_t elephant_win_bytes;
+
+    /** flow tenant id, used to setup flow timeout and stream pseudo
+     *  packets with the correct tenant id set */
+    uint32_t tenant_id;
+
+    uint32_t probing_parser_toserver_alproto_masks;
+    uint32_t probing_parser_toclient_alproto_masks;
+
+    uint16_t file_flags;    /**< file tracking/extraction flags */
+    /* coccinelle: Flow:file_flags:FLOWFILE_ */
+
+    /** destination port to be used in protocol detection. This is meant
+     *  for use with STARTTLS and HTTP CONNECT detection */
+    uint16_t protodetect_dp; /**< 0 if not used */
+
+    /** original application level protocol. Used to indicate the previous
+       protocol when changing to another protocol , e.g. with STARTTLS. */
+    AppProto alproto_orig;
+    /** expected app protocol: used in protocol change/upgrade like in
+     *  STARTTLS. */
+    AppProto alproto_expect;
+
+    uint8_t flow_end_flags;
+    /* coccinelle: Flow:flow_end_flags:FLOW_END_FLAG_ */
 } Flow;
 
 enum FlowState {
@@ -471,6 +527,9 @@ void FlowHandlePacket (ThreadVars *, DecodeThreadVars *, Packet *);
 void FlowInitConfig (char);
 void FlowPrintQueueInfo (void);
 void FlowShutdown(void);
+struct FlowShard_ *FlowShardGet(ThreadVars *tv);
+void FlowShardRelease(struct FlowShard_ *);
+void FlowShardForEach(void (*Func)(struct FlowShard_ *, void *), void *data);
 void FlowSetIPOnlyFlag(Flow *, int);
 void FlowSetHasAlertsFlag(Flow *);
 int FlowHasAlerts(const Flow *);
@@ -496,6 +555,7 @@ int FlowGetPacketDirection(const Flow *, const Packet *);
 void FlowCleanupAppLayer(Flow *);
 
 void FlowUpdateState(Flow *f, enum FlowState s);
+int FlowElephantUpdate(Flow *f, const Packet *p);
 
 /** ----- Inline functions ----- */
 
@@ -219,6 +219,9 @@ static TmEcode OutputFiledataLog(ThreadVars *tv, Packet *p, void *thread_data)
             StreamingBufferGetDataAtOffset(ff->sb,
                     &data, &data_len,
                     ff->content_stored);
+            /* a shared buffer may hold more than the file's data */
+            if (ff->sb_user != 0 && ff->content_stored + data_len > FileDataSize(ff))
+                data_len = (uint32_t)(FileDataSize(ff) - ff->content_stored);
 
             int file_logged = CallLoggers(tv, store, p, ff, data, data_len, file_flags);
             if (file_logged) {
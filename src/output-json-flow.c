@@ -264,6 +264,10 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
     json_object_set_new(hjs, "state",
             json_string(state));
 
+    if (f->flags & FLOW_ELEPHANT) {
+        json_object_set_new(hjs, "elephant", json_true());
+    }
+
     const char *reason = NULL;
     if (f->flow_end_flags & FLOW_END_FLAG_TIMEOUT)
         reason = "timeout";
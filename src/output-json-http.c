@@ -354,7 +354,7 @@ static void JsonHttpLogJSONExtended(json_t *js, htp_tx_t *tx)
 
 static void BodyPrintableBuffer(json_t *js, HtpBody *body, const char *key)
 {
-    if (body->sb != NULL && body->sb->buf != NULL) {
+    if (body->sb != NULL) {
         uint32_t offset = 0;
         const uint8_t *body_data;
         uint32_t body_data_len;
@@ -392,7 +392,7 @@ void JsonHttpLogJSONBodyPrintable(json_t *js, Flow *f, uint64_t tx_id)
 
 static void BodyBase64Buffer(json_t *js, HtpBody *body, const char *key)
 {
-    if (body->sb != NULL && body->sb->buf != NULL) {
+    if (body->sb != NULL) {
         const uint8_t *body_data;
         uint32_t body_data_len;
         uint64_t body_offset;
@@ -161,20 +161,24 @@ static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data)
     int logged = 0;
     int gap = 0;
 
-    for (; tx_id < total_txs; tx_id++)
-    {
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(p->proto, alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
+    while (1) {
+        AppLayerGetTxIterTuple ires = IterFunc(p->proto, alproto, alstate,
+                tx_id, total_txs, &state);
+        if (ires.tx_ptr == NULL)
+            break;
+        void * const tx = ires.tx_ptr;
+        tx_id = ires.tx_id;
+
         /* Track the number of loggers, of the eligible loggers that
          * actually logged this transaction. They all must have logged
          * before the transaction is considered logged. */
         int number_of_loggers = 0;
         int loggers_that_logged = 0;
 
-        void *tx = AppLayerParserGetTx(p->proto, alproto, alstate, tx_id);
-        if (tx == NULL) {
-            SCLogDebug("tx is NULL not logging");
-            continue;
-        }
-
         int tx_progress_ts = AppLayerParserGetStateProgress(p->proto, alproto,
                 tx, ts_disrupt_flags);
 
@@ -261,6 +265,10 @@ next:
         } else {
             gap = 1;
         }
+
+        if (!ires.has_next)
+            break;
+        tx_id++;
     }
 
     /* Update the the last ID that has been logged with all
@@ -378,6 +378,24 @@ static void *ParseAFPConfig(const char *iface)
         aconf->block_timeout = 10;
     }
 
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "batch-size", &value)) == 1) {
+        if (!(aconf->flags & AFP_TPACKET_V3)) {
+            SCLogWarning(SC_ERR_INVALID_VALUE,
+                    "%s: batch-size is only supported with tpacket-v3, ignoring",
+                    aconf->iface);
+        } else if (value < 0 || value > AFP_BATCH_SIZE_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE,
+                    "%s: batch-size must be between 0 and %d",
+                    aconf->iface, AFP_BATCH_SIZE_MAX);
+        } else {
+            aconf->batch_size = value;
+            if (value > 0) {
+                SCLogConfig("%s: handing packets to the workers in batches of "
+                        "up to %d packets", aconf->iface, aconf->batch_size);
+            }
+        }
+    }
+
     (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "disable-promisc", (int *)&boolval);
     if (boolval) {
         SCLogConfig("Disabling promiscuous mode on iface %s",
@@ -52,6 +52,11 @@ void RunModeFilePcapRegister(void)
                               "the same flow can be processed by any detect "
                               "thread",
                               RunModeFilePcapAutoFp);
+    RunModeRegisterNewRunMode(RUNMODE_PCAP_FILE, "workers",
+                              "Workers pcap file mode, each worker thread "
+                              "reads the memory mapped pcap or pcapng file "
+                              "and handles the flows that hash to it",
+                              RunModeFilePcapWorkers);
 
     return;
 }
@@ -265,3 +270,102 @@ int RunModeFilePcapAutoFp(void)
 
     return 0;
 }
+
+/**
+ * \brief RunModeFilePcapWorkers sets up worker threads that each read the
+ *        memory mapped pcap file, decode and run the flow worker.
+ *
+ *        The first worker walks the records of the file and passes the
+ *        packets that hash to another worker on through a queue per
+ *        worker. The packet data isn't copied, it stays in the mapping.
+ *
+ * \retval 0 If all goes well. (If any problem is detected the engine will
+ *           exit()).
+ */
+int RunModeFilePcapWorkers(void)
+{
+    SCEnter();
+    char tname[TM_THREAD_NAME_MAX];
+    uint16_t thread;
+
+    RunModeInitialize();
+
+    const char *file = NULL;
+    if (ConfGet("pcap-file.file", &file) == 0) {
+        SCLogError(SC_ERR_RUNMODE, "Failed retrieving pcap-file from Conf");
+        exit(EXIT_FAILURE);
+    }
+    SCLogDebug("file %s", file);
+
+    /* the workers all map the same file */
+    ConfNode *files = ConfGetNode("pcap-file.files");
+    if (files != NULL && !TAILQ_EMPTY(&files->head)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-file.files is not supported "
+                "by the workers runmode, use the single or autofp runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    TimeModeSetOffline();
+
+    PcapFileGlobalInit();
+
+    /* Available cpus */
+    uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
+
+    /* always create at least one thread */
+    int thread_max = TmThreadGetNbThreads(WORKER_CPU_SET);
+    if (thread_max == 0)
+        thread_max = ncpus * threading_detect_ratio;
+    if (thread_max < 1)
+        thread_max = 1;
+    if (thread_max > 1024)
+        thread_max = 1024;
+
+    if (PcapFileMmapSetup(file, (uint16_t)thread_max) != 0) {
+        SCLogError(SC_ERR_RUNMODE, "failed to set up pcap file %s", file);
+        exit(EXIT_FAILURE);
+    }
+
+    for (thread = 0; thread < (uint16_t)thread_max; thread++) {
+        snprintf(tname, sizeof(tname), "%s#%02u", thread_name_workers, thread+1);
+
+        ThreadVars *tv = TmThreadCreatePacketHandler(tname,
+                                                     "packetpool", "packetpool",
+                                                     "packetpool", "packetpool",
+                                                     "pktacqloop");
+        if (tv == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "threading setup failed");
+            exit(EXIT_FAILURE);
+        }
+
+        TmModule *tm_module = TmModuleGetByName("ReceivePcapFileMmap");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceivePcapFileMmap");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+        tm_module = TmModuleGetByName("DecodePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+        tm_module = TmModuleGetByName("FlowWorker");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+        TmThreadSetCPU(tv, WORKER_CPU_SET);
+
+        if (TmThreadSpawn(tv) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return 0;
+}
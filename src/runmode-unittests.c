@@ -107,6 +107,8 @@
 #include "util-byte.h"
 #include "util-proto-name.h"
 #include "util-memrchr.h"
+#include "util-memcap.h"
+#include "util-toeplitz.h"
 
 #include "util-mpm-ac.h"
 #include "util-mpm-hs.h"
@@ -116,6 +118,7 @@
 #include "conf.h"
 #include "conf-yaml-loader.h"
 #include "tmqh-flow.h"
+#include "tmqh-ring.h"
 #include "defrag.h"
 #include "detect-engine-siggroup.h"
 
@@ -169,6 +172,7 @@ static void RegisterUnittests(void)
     ConfRegisterTests();
     ConfYamlRegisterTests();
     TmqhFlowRegisterTests();
+    TmqhRingRegisterTests();
     FlowRegisterTests();
     HostRegisterUnittests();
     IPPairRegisterUnittests();
@@ -218,6 +222,8 @@ static void RegisterUnittests(void)
     DetectPortTests();
     SCAtomicRegisterTests();
     MemrchrRegisterTests();
+    MemcapCounterRegisterTests();
+    ToeplitzRegisterTests();
 #ifdef __SC_CUDA_SUPPORT__
     CudaBufferRegisterUnittests();
 #endif
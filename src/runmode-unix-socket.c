@@ -47,15 +47,30 @@ static const char *default_mode = NULL;
 
 int unix_socket_mode_is_running = 0;
 
+/** max number of files read in one run */
+#define PCAP_FILE_BATCH_MAX     64
+/** max number of results kept until a 'pcap-file-results' command */
+#define PCAP_FILE_RESULTS_MAX   1024
+
 typedef struct PcapFiles_ {
     char *filename;
     char *output_dir;
     int tenant_id;
+    /* result, set by the reader when it is done with the file */
+    TmEcode status;
+    uint32_t pkts;
+    int reported;
     TAILQ_ENTRY(PcapFiles_) next;
 } PcapFiles;
 
 typedef struct PcapCommand_ {
     TAILQ_HEAD(, PcapFiles_) files;
+    /** files of the current run */
+    TAILQ_HEAD(, PcapFiles_) running_files;
+    /** files of past runs, until fetched by 'pcap-file-results' */
+    TAILQ_HEAD(, PcapFiles_) done_files;
+    uint32_t done_cnt;
+    int batch_size;
     int running;
     char *currentfile;
 } PcapCommand;
@@ -71,6 +86,11 @@ static int RunModeUnixSocketMaster(void);
 static int unix_manager_file_task_running = 0;
 static int unix_manager_file_task_failed = 0;
 
+/** pcap command, for the readers to report their results. The lock
+ *  protects the results of the running files. */
+static PcapCommand *unix_manager_pcapcmd = NULL;
+static SCMutex unix_manager_pcap_lock = SCMUTEX_INITIALIZER;
+
 /**
  * \brief return list of files in the queue
  *
@@ -132,6 +152,56 @@ static TmEcode UnixSocketPcapCurrent(json_t *cmd, json_t* answer, void *data)
     return TM_ECODE_OK;
 }
 
+static void PcapFilesFree(PcapFiles *cfile);
+
+/**
+ * \brief return the results of the files processed since the last call
+ *
+ * Each file is reported once, with its status and packet count.
+ */
+static TmEcode UnixSocketPcapFilesResults(json_t *cmd, json_t* answer, void *data)
+{
+    PcapCommand *this = (PcapCommand *) data;
+    int i = 0;
+    PcapFiles *file;
+    json_t *jdata;
+    json_t *jarray;
+
+    jdata = json_object();
+    if (jdata == NULL) {
+        json_object_set_new(answer, "message",
+                            json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+    jarray = json_array();
+    if (jarray == NULL) {
+        json_decref(jdata);
+        json_object_set_new(answer, "message",
+                            json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+    while ((file = TAILQ_FIRST(&this->done_files)) != NULL) {
+        TAILQ_REMOVE(&this->done_files, file, next);
+
+        json_t *jfile = json_object();
+        if (jfile != NULL) {
+            json_object_set_new(jfile, "filename", json_string(file->filename));
+            json_object_set_new(jfile, "status",
+                    json_string(file->status == TM_ECODE_DONE ? "done" : "failed"));
+            json_object_set_new(jfile, "packets", json_integer(file->pkts));
+            json_array_append_new(jarray, jfile);
+            i++;
+        }
+        PcapFilesFree(file);
+    }
+    this->done_cnt = 0;
+
+    json_object_set_new(jdata, "count", json_integer(i));
+    json_object_set_new(jdata, "files", jarray);
+    json_object_set_new(answer, "message", jdata);
+    return TM_ECODE_OK;
+}
+
 
 
 static void PcapFilesFree(PcapFiles *cfile)
@@ -185,6 +255,7 @@ static TmEcode UnixListAddFile(PcapCommand *this,
     }
 
     cfile->tenant_id = tenant_id;
+    cfile->status = TM_ECODE_FAILED;
 
     TAILQ_INSERT_TAIL(&this->files, cfile, next);
     return TM_ECODE_OK;
@@ -271,6 +342,36 @@ static TmEcode UnixSocketAddPcapFile(json_t *cmd, json_t* answer, void *data)
     return TM_ECODE_OK;
 }
 
+/**
+ * \brief Move the files of the finished run to the results list
+ *
+ * \param this a PcapCommand:: structure
+ */
+static void UnixSocketPcapFilesFinish(PcapCommand *this)
+{
+    PcapFiles *cfile;
+
+    SCMutexLock(&unix_manager_pcap_lock);
+    while ((cfile = TAILQ_FIRST(&this->running_files)) != NULL) {
+        TAILQ_REMOVE(&this->running_files, cfile, next);
+        SCLogInfo("Finished run for '%s': %s, %" PRIu32 " packets",
+                cfile->filename,
+                cfile->status == TM_ECODE_DONE ? "done" : "failed",
+                cfile->pkts);
+
+        /* nobody is fetching the results, drop the oldest */
+        if (this->done_cnt == PCAP_FILE_RESULTS_MAX) {
+            PcapFiles *old = TAILQ_FIRST(&this->done_files);
+            TAILQ_REMOVE(&this->done_files, old, next);
+            PcapFilesFree(old);
+            this->done_cnt--;
+        }
+        TAILQ_INSERT_TAIL(&this->done_files, cfile, next);
+        this->done_cnt++;
+    }
+    SCMutexUnlock(&unix_manager_pcap_lock);
+}
+
 /**
  * \brief Handle the file queue
  *
@@ -281,6 +382,11 @@ static TmEcode UnixSocketAddPcapFile(json_t *cmd, json_t* answer, void *data)
  * This function also handles the cleaning of the previous
  * running mode.
  *
+ * If 'unix-command.pcap-file-batch' is set, up to that many queued
+ * files with the same output dir and tenant are read in the same run,
+ * one after another by the reader thread. Flows of the files are kept
+ * apart by the input id of the file.
+ *
  * \param this a UnixCommand:: structure
  * \retval 0 in case of error, 1 in case of success
  */
@@ -302,6 +408,8 @@ static TmEcode UnixSocketPcapFilesCheck(void *data)
         this->currentfile = NULL;
 
         PostRunDeinit(RUNMODE_PCAP_FILE, NULL /* no ts */);
+        UnixSocketPcapFilesFinish(this);
+        ConfRemove("pcap-file.files");
     }
     if (TAILQ_EMPTY(&this->files)) {
         // nothing to do
@@ -338,13 +446,42 @@ static TmEcode UnixSocketPcapFilesCheck(void *data)
         }
     } else {
         SCLogInfo("pcap-file.tenant-id not set");
+        ConfRemove("pcap-file.tenant-id");
     }
     this->currentfile = SCStrdup(cfile->filename);
     if (unlikely(this->currentfile == NULL)) {
         SCLogError(SC_ERR_MEM_ALLOC, "Failed file name allocation");
         return TM_ECODE_FAILED;
     }
-    PcapFilesFree(cfile);
+    TAILQ_INSERT_TAIL(&this->running_files, cfile, next);
+
+    /* add the following files that can share the run */
+    int batch = 1;
+    PcapFiles *nfile;
+    while (batch < this->batch_size &&
+            (nfile = TAILQ_FIRST(&this->files)) != NULL &&
+            nfile->tenant_id == cfile->tenant_id &&
+            ((nfile->output_dir == NULL && cfile->output_dir == NULL) ||
+             (nfile->output_dir != NULL && cfile->output_dir != NULL &&
+              strcmp(nfile->output_dir, cfile->output_dir) == 0)))
+    {
+        TAILQ_REMOVE(&this->files, nfile, next);
+        TAILQ_INSERT_TAIL(&this->running_files, nfile, next);
+        SCLogInfo("Adding '%s' to the run", nfile->filename);
+        batch++;
+    }
+    if (batch > 1) {
+        char fname[32];
+        int i = 0;
+        TAILQ_FOREACH(nfile, &this->running_files, next) {
+            snprintf(fname, sizeof(fname), "pcap-file.files.%d", i++);
+            if (ConfSet(fname, nfile->filename) != 1) {
+                SCLogError(SC_ERR_INVALID_ARGUMENTS,
+                        "Can not set working file to '%s'", nfile->filename);
+                return TM_ECODE_FAILED;
+            }
+        }
+    }
 
     PreRunInit(RUNMODE_PCAP_FILE);
     PreRunPostPrivsDropInit(RUNMODE_PCAP_FILE);
@@ -389,6 +526,36 @@ void UnixSocketPcapFile(TmEcode tm)
 #endif
 }
 
+/**
+ * \brief Record the result of a file of the current run
+ *
+ * Called by the reader of the file when it is done with it.
+ *
+ * \param filename file as set in the pcap-file config
+ * \param tm TM_ECODE_DONE if the file was read, TM_ECODE_FAILED if not
+ * \param pkts number of packets read from the file
+ */
+void UnixSocketPcapFileDone(const char *filename, TmEcode tm, uint32_t pkts)
+{
+#ifdef BUILD_UNIX_SOCKET
+    PcapFiles *cfile;
+
+    if (unix_manager_pcapcmd == NULL || filename == NULL)
+        return;
+
+    SCMutexLock(&unix_manager_pcap_lock);
+    TAILQ_FOREACH(cfile, &unix_manager_pcapcmd->running_files, next) {
+        if (cfile->reported == 0 && strcmp(cfile->filename, filename) == 0) {
+            cfile->status = tm;
+            cfile->pkts = pkts;
+            cfile->reported = 1;
+            break;
+        }
+    }
+    SCMutexUnlock(&unix_manager_pcap_lock);
+#endif
+}
+
 #ifdef BUILD_UNIX_SOCKET
 /**
  * \brief Command to add a tenant handler
@@ -1028,13 +1195,39 @@ static int RunModeUnixSocketMaster(void)
         return 1;
     }
     TAILQ_INIT(&pcapcmd->files);
+    TAILQ_INIT(&pcapcmd->running_files);
+    TAILQ_INIT(&pcapcmd->done_files);
+    pcapcmd->done_cnt = 0;
     pcapcmd->running = 0;
     pcapcmd->currentfile = NULL;
 
+    intmax_t batch_size = 1;
+    if (ConfGetInt("unix-command.pcap-file-batch", &batch_size) == 1) {
+        if (batch_size < 1 || batch_size > PCAP_FILE_BATCH_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "unix-command.pcap-file-batch "
+                    "must be between 1 and %d, using 1", PCAP_FILE_BATCH_MAX);
+            batch_size = 1;
+        }
+    }
+    if (batch_size > 1) {
+        const char *runmode = NULL;
+        if (ConfGet("runmode", &runmode) == 1 && strcmp(runmode, "workers") == 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "unix-command.pcap-file-batch "
+                    "is not supported by the workers runmode, using 1");
+            batch_size = 1;
+        }
+    }
+    pcapcmd->batch_size = (int)batch_size;
+    if (pcapcmd->batch_size > 1) {
+        SCLogInfo("reading up to %d pcap files per run", pcapcmd->batch_size);
+    }
+    unix_manager_pcapcmd = pcapcmd;
+
     UnixManagerRegisterCommand("pcap-file", UnixSocketAddPcapFile, pcapcmd, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("pcap-file-number", UnixSocketPcapFilesNumber, pcapcmd, 0);
     UnixManagerRegisterCommand("pcap-file-list", UnixSocketPcapFilesList, pcapcmd, 0);
     UnixManagerRegisterCommand("pcap-current", UnixSocketPcapCurrent, pcapcmd, 0);
+    UnixManagerRegisterCommand("pcap-file-results", UnixSocketPcapFilesResults, pcapcmd, 0);
 
     UnixManagerRegisterBackgroundTask(UnixSocketPcapFilesCheck, pcapcmd);
 
@@ -29,6 +29,7 @@ const char *RunModeUnixSocketGetDefaultMode(void);
 int RunModeUnixSocketIsActive(void);
 
 void UnixSocketPcapFile(TmEcode tm);
+void UnixSocketPcapFileDone(const char *filename, TmEcode tm, uint32_t pkts);
 
 #ifdef BUILD_UNIX_SOCKET
 TmEcode UnixSocketRegisterTenantHandler(json_t *cmd, json_t* answer, void *data);
@@ -52,6 +52,7 @@
 #include "tmqh-flow.h"
 #include "flow-manager.h"
 #include "counters.h"
+#include "defrag-hash.h"
 
 #ifdef __SC_CUDA_SUPPORT__
 #include "util-cuda-buffer.h"
@@ -380,6 +381,7 @@ void RunModeDispatch(int runmode, const char *custom_mode)
     if (strcasecmp(active_runmode, "autofp") == 0) {
         TmqhFlowPrintAutofpHandler();
     }
+    DefragThreadTrackersCheckRunmode(active_runmode);
 
     mode->RunModeFunc();
 
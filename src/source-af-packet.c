@@ -224,6 +224,12 @@ typedef struct AFPThreadVars_
     /* IPS peer */
     AFPPeer *mpeer;
 
+    /* tpacket_v3 batch mode: packets of the current block that still
+     * need to be passed to the slots */
+    Packet **batch;
+    uint32_t batch_cnt;
+    uint32_t batch_size;
+
     /* no mmap mode */
     uint8_t *data; /** Per function and thread data */
     int datalen; /** Length of per function and thread data */
@@ -1033,6 +1039,11 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
         }
     }
 
+    if (ptv->batch != NULL) {
+        ptv->batch[ptv->batch_cnt++] = p;
+        SCReturnInt(AFP_READ_OK);
+    }
+
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
         TmqhOutputPacketpool(ptv->tv, p);
         SCReturnInt(AFP_FAILURE);
@@ -1041,6 +1052,26 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     SCReturnInt(AFP_READ_OK);
 }
 
+/** \brief pass the pending batch of packets to the slots
+ *
+ *  Must be called before the block the packets point into is handed
+ *  back to the kernel.
+ */
+static inline int AFPDispatchBatch(AFPThreadVars *ptv)
+{
+    const uint32_t cnt = ptv->batch_cnt;
+    if (cnt == 0) {
+        SCReturnInt(AFP_READ_OK);
+    }
+    ptv->batch_cnt = 0;
+
+    /* on failure the packets have been returned to the pool */
+    if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->batch, cnt) != TM_ECODE_OK) {
+        SCReturnInt(AFP_FAILURE);
+    }
+    SCReturnInt(AFP_READ_OK);
+}
+
 static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pbd)
 {
     int num_pkts = pbd->hdr.bh1.num_pkts, i;
@@ -1050,11 +1081,19 @@ static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pb
     for (i = 0; i < num_pkts; ++i) {
         if (unlikely(AFPParsePacketV3(ptv, pbd,
                              (struct tpacket3_hdr *)ppd) == AFP_FAILURE)) {
+            (void)AFPDispatchBatch(ptv);
+            SCReturnInt(AFP_READ_FAILURE);
+        }
+        if (ptv->batch_cnt == ptv->batch_size &&
+                AFPDispatchBatch(ptv) != AFP_READ_OK) {
             SCReturnInt(AFP_READ_FAILURE);
         }
         ppd = ppd + ((struct tpacket3_hdr *)ppd)->tp_next_offset;
     }
 
+    if (AFPDispatchBatch(ptv) != AFP_READ_OK) {
+        SCReturnInt(AFP_READ_FAILURE);
+    }
     SCReturnInt(AFP_READ_OK);
 }
 #endif /* HAVE_TPACKET_V3 */
@@ -2217,6 +2256,19 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, const void *initdata, void **data)
     ptv->datalen = T_DATA_SIZE;
 #undef T_DATA_SIZE
 
+#ifdef HAVE_TPACKET_V3
+    if ((ptv->flags & AFP_TPACKET_V3) && afpconfig->batch_size > 0) {
+        ptv->batch = SCCalloc(afpconfig->batch_size, sizeof(Packet *));
+        if (ptv->batch == NULL) {
+            afpconfig->DerefFunc(afpconfig);
+            SCFree(ptv->data);
+            SCFree(ptv);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        ptv->batch_size = afpconfig->batch_size;
+    }
+#endif
+
     *data = (void *)ptv;
 
     afpconfig->DerefFunc(afpconfig);
@@ -2277,6 +2329,11 @@ TmEcode ReceiveAFPThreadDeinit(ThreadVars *tv, void *data)
 
     ptv->bpf_filter = NULL;
 
+    if (ptv->batch != NULL) {
+        SCFree(ptv->batch);
+        ptv->batch = NULL;
+    }
+
     SCFree(ptv);
     SCReturnInt(TM_ECODE_OK);
 }
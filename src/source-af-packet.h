@@ -65,6 +65,10 @@
  * to standard frame size */
 #define AFP_BLOCK_SIZE_DEFAULT_ORDER 3
 
+/* Upper limit for the number of packets passed to the slots as one batch
+ * in tpacket_v3 mode. */
+#define AFP_BATCH_SIZE_MAX 1024
+
 typedef struct AFPIfaceConfig_
 {
     char iface[AFP_IFACE_NAME_LENGTH];
@@ -78,6 +82,9 @@ typedef struct AFPIfaceConfig_
     int block_size;
     /* block timeout for tpacket_v3 in milliseconds */
     int block_timeout;
+    /* max number of packets handed to the slots as one batch for
+     * tpacket_v3, 0 to disable batching */
+    int batch_size;
     /* cluster param */
     int cluster_id;
     int cluster_type;
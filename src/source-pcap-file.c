@@ -44,6 +44,8 @@
 #include "runmode-unix-socket.h"
 #include "util-checksum.h"
 #include "util-atomic.h"
+#include "util-byte.h"
+#include "util-hash-lookup3.h"
 
 #ifdef __SC_CUDA_SUPPORT__
 
@@ -60,20 +62,44 @@
 extern int max_pending_packets;
 
 typedef struct PcapFileGlobalVars_ {
-    pcap_t *pcap_handle;
     int (*Decoder)(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
     int datalink;
     struct bpf_program filter;
-    uint64_t cnt; /** packet counter */
     ChecksumValidationMode conf_checksum_mode;
     ChecksumValidationMode checksum_mode;
     SC_ATOMIC_DECLARE(unsigned int, invalid_checksums);
 
+    /* mmap reader, used by the workers runmode */
+    uint8_t *map;
+    size_t map_len;
+    int map_pcapng;         /**< file is pcapng instead of pcap */
+    int map_swapped;        /**< file byte order differs from ours */
+    int map_nsec;           /**< timestamps are in nanoseconds */
+    int map_filter_set;     /**< bpf filter compiled into 'filter' */
+    const char *map_bpf;    /**< bpf filter, for the other datalinks */
+    uint16_t map_readers;   /**< number of reader threads */
+    /** per reader queues of the packets the first reader found for it */
+    struct PcapFileMmapQueue_ *map_queues;
+    SC_ATOMIC_DECLARE(uint16_t, map_reader_id);
+    SC_ATOMIC_DECLARE(uint16_t, map_readers_active);
+    SC_ATOMIC_DECLARE(uint16_t, map_users);
 } PcapFileGlobalVars;
 
 typedef struct PcapFileThreadVars_
 {
+    pcap_t *pcap_handle;
+    struct bpf_program filter;
+    int filter_set;
+    int datalink;
+    uint64_t cnt; /** packet counter */
+
+    const char *filename;
+    /** next file to read of pcap-file.files, if set */
+    ConfNode *file_node;
+    /** number of files opened */
+    uint16_t files;
     uint32_t tenant_id;
+    uint16_t input_id;
 
     /* counters */
     uint32_t pkts;
@@ -89,6 +115,140 @@ typedef struct PcapFileThreadVars_
     uint32_t errs;
 } PcapFileThreadVars;
 
+/** pcapng interface as described by an Interface Description Block */
+typedef struct PcapFileNgIface_ {
+    int datalink;
+    uint32_t snaplen;
+    uint64_t ts_units;      /**< timestamp units per second */
+    int64_t ts_offset;      /**< seconds to add to the timestamps */
+} PcapFileNgIface;
+
+/** parse state of a reader walking the mapped file */
+typedef struct PcapFileMmapState_ {
+    /** offset of the next record or block */
+    size_t offset;
+    /** byte order of the file (pcapng: of the current section) differs
+     *  from ours */
+    int swapped;
+    /** timestamp of the last packet, for pcapng blocks without one */
+    struct timeval last_ts;
+
+    /* pcapng interfaces of the current section */
+    PcapFileNgIface *ifaces;
+    uint32_t ifaces_cnt;
+    uint32_t ifaces_size;
+} PcapFileMmapState;
+
+/** how a reader handles the packets of a datalink other than the
+ *  file's main one */
+typedef struct PcapFileMmapLink_ {
+    int datalink;
+    int usable;             /**< decoder and filter are available */
+    int filter_set;         /**< bpf filter compiled into 'filter' */
+    struct bpf_program filter;
+} PcapFileMmapLink;
+
+/** packet as found in the mapped file */
+typedef struct PcapFileMmapPkt_ {
+    uint8_t *data;
+    uint32_t caplen;
+    uint32_t len;
+    int datalink;
+    struct timeval ts;
+} PcapFileMmapPkt;
+
+/** packet the first reader hands to another reader */
+typedef struct PcapFileMmapRec_ {
+    PcapFileMmapPkt pkt;
+    uint64_t pcap_cnt;
+    int ignore_checksum;
+} PcapFileMmapRec;
+
+#define PCAP_FILE_MMAP_QUEUE_SIZE   1024    /**< power of 2 */
+/** usecs a reader sleeps if its queue is empty or full */
+#define PCAP_FILE_MMAP_QUEUE_WAIT   10
+
+/** \brief queue of packets of a reader
+ *
+ *  The first reader is the only one walking the file. It puts the
+ *  packets that belong to another reader in its queue, which that
+ *  reader then gets them from. With a single writer and a single reader
+ *  the queue needs no atomic read-modify-write operations.
+ */
+typedef struct PcapFileMmapQueue_ {
+    /* writer side */
+    uint32_t tail __attribute__((aligned(CLS)));
+    int done;               /**< no more packets will be added */
+
+    /* reader side */
+    uint32_t head __attribute__((aligned(CLS)));
+
+    PcapFileMmapRec recs[PCAP_FILE_MMAP_QUEUE_SIZE] __attribute__((aligned(CLS)));
+} PcapFileMmapQueue;
+
+typedef struct PcapFileMmapThreadVars_
+{
+    uint32_t tenant_id;
+
+    /* counters */
+    uint32_t pkts;
+    uint64_t bytes;
+
+    ThreadVars *tv;
+    TmSlot *slot;
+
+    /** reader id, packets are assigned to readers by hashing their
+     *  address pair */
+    uint16_t reader_id;
+
+    /** parse state, only used by the first reader */
+    PcapFileMmapState st;
+    /** records seen so far, used to number the packets like the
+     *  single reader would */
+    uint64_t records;
+
+    /** datalinks of pcapng interfaces other than the main one */
+    PcapFileMmapLink *links;
+    uint32_t links_cnt;
+} PcapFileMmapThreadVars;
+
+/** decode thread data. There can be a decode thread per reader, so the
+ *  state lives here and not in pcap_g. */
+typedef struct PcapFileDecodeThreadVars_
+{
+    DecodeThreadVars *dtv;
+    /** packet time the flow manager was last woken up at */
+    double prev_signaled_ts;
+} PcapFileDecodeThreadVars;
+
+/** pcap file record header as stored in the file */
+typedef struct PcapFileRecordHdr_ {
+    uint32_t ts_sec;
+    uint32_t ts_frac;
+    uint32_t caplen;
+    uint32_t len;
+} PcapFileRecordHdr;
+
+#define PCAP_FILE_HDR_LEN           24
+#define PCAP_FILE_MAGIC_USEC        0xa1b2c3d4
+#define PCAP_FILE_MAGIC_NSEC        0xa1b23c4d
+
+/* pcapng block types and options */
+#define PCAPNG_BLOCK_SHB            0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB            0x00000001
+#define PCAPNG_BLOCK_OPB            0x00000002
+#define PCAPNG_BLOCK_SPB            0x00000003
+#define PCAPNG_BLOCK_EPB            0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC     0x1a2b3c4d
+#define PCAPNG_OPT_END              0
+#define PCAPNG_OPT_IF_TSRESOL       9
+#define PCAPNG_OPT_IF_TSOFFSET      14
+
+/* return values of the record parsers */
+#define PCAP_FILE_REC_PKT           1   /**< packet returned */
+#define PCAP_FILE_REC_SKIP          0   /**< non-packet block, call again */
+#define PCAP_FILE_REC_END           -1  /**< end of file or unusable data */
+
 static PcapFileGlobalVars pcap_g;
 
 TmEcode ReceivePcapFileLoop(ThreadVars *, void *, void *);
@@ -101,6 +261,14 @@ TmEcode DecodePcapFile(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueu
 TmEcode DecodePcapFileThreadInit(ThreadVars *, const void *, void **);
 TmEcode DecodePcapFileThreadDeinit(ThreadVars *tv, void *data);
 
+TmEcode ReceivePcapFileMmapLoop(ThreadVars *, void *, void *);
+TmEcode ReceivePcapFileMmapThreadInit(ThreadVars *, const void *, void **);
+void ReceivePcapFileMmapThreadExitStats(ThreadVars *, void *);
+TmEcode ReceivePcapFileMmapThreadDeinit(ThreadVars *, void *);
+void PcapFileRegisterTests(void);
+
+static void PcapFileSetChecksumMode(void);
+
 void TmModuleReceivePcapFileRegister (void)
 {
     tmm_modules[TMM_RECEIVEPCAPFILE].name = "ReceivePcapFile";
@@ -115,6 +283,20 @@ void TmModuleReceivePcapFileRegister (void)
     tmm_modules[TMM_RECEIVEPCAPFILE].flags = TM_FLAG_RECEIVE_TM;
 }
 
+void TmModuleReceivePcapFileMmapRegister (void)
+{
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].name = "ReceivePcapFileMmap";
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].ThreadInit = ReceivePcapFileMmapThreadInit;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].Func = NULL;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].PktAcqLoop = ReceivePcapFileMmapLoop;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].PktAcqBreakLoop = NULL;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].ThreadExitPrintStats = ReceivePcapFileMmapThreadExitStats;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].ThreadDeinit = ReceivePcapFileMmapThreadDeinit;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].RegisterTests = PcapFileRegisterTests;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].cap_flags = 0;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].flags = TM_FLAG_RECEIVE_TM;
+}
+
 void TmModuleDecodePcapFileRegister (void)
 {
     tmm_modules[TMM_DECODEPCAPFILE].name = "DecodePcapFile";
@@ -131,6 +313,81 @@ void PcapFileGlobalInit()
 {
     memset(&pcap_g, 0x00, sizeof(pcap_g));
     SC_ATOMIC_INIT(pcap_g.invalid_checksums);
+    SC_ATOMIC_INIT(pcap_g.map_reader_id);
+    SC_ATOMIC_INIT(pcap_g.map_readers_active);
+    SC_ATOMIC_INIT(pcap_g.map_users);
+    /* no default decoder until a reader sets it */
+    pcap_g.datalink = -1;
+    PcapFileSetChecksumMode();
+}
+
+typedef int (*PcapFileDecoderFunc)(ThreadVars *, DecodeThreadVars *,
+        Packet *, uint8_t *, uint16_t, PacketQueue *);
+
+/** \brief get the decoder for a pcap datalink type
+ *  \retval decoder or NULL if the datalink is not supported */
+static PcapFileDecoderFunc PcapFileGetDecoder(int datalink)
+{
+    switch (datalink) {
+        case LINKTYPE_LINUX_SLL:
+            return DecodeSll;
+        case LINKTYPE_ETHERNET:
+            return DecodeEthernet;
+        case LINKTYPE_PPP:
+            return DecodePPP;
+        case LINKTYPE_IPV4:
+        case LINKTYPE_RAW:
+        case LINKTYPE_RAW2:
+            return DecodeRaw;
+        case LINKTYPE_NULL:
+            return DecodeNull;
+    }
+    return NULL;
+}
+
+/** \brief set the decoder for a pcap datalink type
+ *  \retval 0 ok, -1 datalink not supported */
+static int PcapFileSetDecoder(int datalink)
+{
+    pcap_g.Decoder = PcapFileGetDecoder(datalink);
+    if (pcap_g.Decoder == NULL) {
+        SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
+                  "(yet) supported in module PcapFile.", datalink);
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t PcapFileGetTenantId(void)
+{
+    intmax_t tenant = 0;
+    if (ConfGetInt("pcap-file.tenant-id", &tenant) == 1) {
+        if (tenant > 0 && tenant < UINT_MAX) {
+            SCLogInfo("tenant %u", (uint32_t)tenant);
+            return (uint32_t)tenant;
+        } else {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "tenant out of range");
+        }
+    }
+    return 0;
+}
+
+static void PcapFileSetChecksumMode(void)
+{
+    const char *tmpstring = NULL;
+
+    if (ConfGet("pcap-file.checksum-checks", &tmpstring) != 1) {
+        pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_AUTO;
+    } else {
+        if (strcmp(tmpstring, "auto") == 0) {
+            pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_AUTO;
+        } else if (ConfValIsTrue(tmpstring)){
+            pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_ENABLE;
+        } else if (ConfValIsFalse(tmpstring)) {
+            pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+        }
+    }
+    pcap_g.checksum_mode = pcap_g.conf_checksum_mode;
 }
 
 static void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
@@ -149,8 +406,9 @@ static void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     p->ts.tv_sec = h->ts.tv_sec;
     p->ts.tv_usec = h->ts.tv_usec;
     SCLogDebug("p->ts.tv_sec %"PRIuMAX"", (uintmax_t)p->ts.tv_sec);
-    p->datalink = pcap_g.datalink;
-    p->pcap_cnt = ++pcap_g.cnt;
+    p->datalink = ptv->datalink;
+    p->pcap_cnt = ++ptv->cnt;
+    p->input_id = ptv->input_id;
 
     p->pcap_v.tenant_id = ptv->tenant_id;
     ptv->pkts++;
@@ -176,13 +434,123 @@ static void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
 
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
-        pcap_breakloop(pcap_g.pcap_handle);
+        pcap_breakloop(ptv->pcap_handle);
         ptv->cb_result = TM_ECODE_FAILED;
     }
 
     SCReturn;
 }
 
+/**
+ *  \brief Open a pcap file and set up the bpf filter and decoder for it
+ *
+ *  \retval TM_ECODE_OK file is ready
+ *  \retval TM_ECODE_DONE file can't be read
+ *  \retval TM_ECODE_FAILED bpf error
+ */
+static TmEcode PcapFileOpen(PcapFileThreadVars *ptv, const char *filename)
+{
+    const char *tmpbpfstring = NULL;
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+
+    SCLogInfo("reading pcap file %s", filename);
+
+    ptv->filename = filename;
+    ptv->pcap_handle = pcap_open_offline(filename, errbuf);
+    if (ptv->pcap_handle == NULL) {
+        SCLogError(SC_ERR_FOPEN, "%s\n", errbuf);
+        return TM_ECODE_DONE;
+    }
+
+    if (ptv->filter_set) {
+        pcap_freecode(&ptv->filter);
+        ptv->filter_set = 0;
+    }
+    if (ConfGet("bpf-filter", &tmpbpfstring) != 1) {
+        SCLogDebug("could not get bpf or none specified");
+    } else {
+        SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
+
+        if (pcap_compile(ptv->pcap_handle, &ptv->filter, (char *)tmpbpfstring, 1, 0) < 0) {
+            SCLogError(SC_ERR_BPF,"bpf compilation error %s",
+                    pcap_geterr(ptv->pcap_handle));
+            goto error;
+        }
+        ptv->filter_set = 1;
+
+        if (pcap_setfilter(ptv->pcap_handle, &ptv->filter) < 0) {
+            SCLogError(SC_ERR_BPF,"could not set bpf filter %s", pcap_geterr(ptv->pcap_handle));
+            goto error;
+        }
+    }
+
+    ptv->datalink = pcap_datalink(ptv->pcap_handle);
+    SCLogDebug("datalink %" PRId32 "", ptv->datalink);
+
+    /* only this thread decodes, so the decoder can follow the file */
+    if (PcapFileSetDecoder(ptv->datalink) < 0) {
+        pcap_close(ptv->pcap_handle);
+        ptv->pcap_handle = NULL;
+        return TM_ECODE_DONE;
+    }
+    pcap_g.datalink = ptv->datalink;
+
+    /* each file gets its own flows and defrag trackers */
+    ptv->input_id = ptv->files++;
+    ptv->cnt = 0;
+    return TM_ECODE_OK;
+
+error:
+    pcap_close(ptv->pcap_handle);
+    ptv->pcap_handle = NULL;
+    return TM_ECODE_FAILED;
+}
+
+/**
+ *  \brief Open the next file of pcap-file.files that can be read
+ *
+ *  Files that can't be read are reported as failed and skipped.
+ *
+ *  \retval TM_ECODE_OK next file is ready
+ *  \retval TM_ECODE_DONE no files left
+ *  \retval TM_ECODE_FAILED bpf error
+ */
+static TmEcode PcapFileOpenNext(PcapFileThreadVars *ptv)
+{
+    while (ptv->file_node != NULL) {
+        ConfNode *node = ptv->file_node;
+        ptv->file_node = TAILQ_NEXT(node, next);
+
+        TmEcode r = PcapFileOpen(ptv, node->val);
+        if (r != TM_ECODE_DONE)
+            return r;
+        UnixSocketPcapFileDone(node->val, TM_ECODE_FAILED, 0);
+    }
+    return TM_ECODE_DONE;
+}
+
+/**
+ *  \brief Close the file, report it to the unix socket code and move on
+ *          to the next file of pcap-file.files
+ *
+ *  The files of a batch are read one after another by this thread, so
+ *  the offline clock follows the file being read. The input id keeps the
+ *  flows of the files apart.
+ *
+ *  \param status TM_ECODE_DONE if the file was read, TM_ECODE_FAILED if not
+ *  \retval 1 next file is ready, 0 no files left
+ */
+static int PcapFileDone(PcapFileThreadVars *ptv, TmEcode status)
+{
+    if (ptv->pcap_handle != NULL) {
+        pcap_close(ptv->pcap_handle);
+        ptv->pcap_handle = NULL;
+    }
+    UnixSocketPcapFileDone(ptv->filename, status, (uint32_t)ptv->cnt);
+
+    return (PcapFileOpenNext(ptv) == TM_ECODE_OK);
+}
+
 /**
  *  \brief Main PCAP file reading Loop function
  */
@@ -198,6 +566,12 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
     ptv->slot = s->slot_next;
     ptv->cb_result = TM_ECODE_OK;
 
+    /* no file could be opened, see ReceivePcapFileThreadInit */
+    if (ptv->pcap_handle == NULL) {
+        UnixSocketPcapFile(TM_ECODE_DONE);
+        SCReturnInt(TM_ECODE_DONE);
+    }
+
     while (1) {
         if (suricata_ctl_flags & SURICATA_STOP) {
             SCReturnInt(TM_ECODE_OK);
@@ -208,29 +582,32 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
         PacketPoolWait();
 
         /* Right now we just support reading packets one at a time. */
-        r = pcap_dispatch(pcap_g.pcap_handle, packet_q_len,
+        r = pcap_dispatch(ptv->pcap_handle, packet_q_len,
                           (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
         if (unlikely(r == -1)) {
             SCLogError(SC_ERR_PCAP_DISPATCH, "error code %" PRId32 " %s",
-                       r, pcap_geterr(pcap_g.pcap_handle));
+                       r, pcap_geterr(ptv->pcap_handle));
             if (ptv->cb_result == TM_ECODE_FAILED) {
                 SCReturnInt(TM_ECODE_FAILED);
             }
+            if (PcapFileDone(ptv, TM_ECODE_FAILED)) {
+                continue;
+            }
             if (! RunModeUnixSocketIsActive()) {
                 EngineStop();
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
         } else if (unlikely(r == 0)) {
-            SCLogInfo("pcap file end of file reached (pcap err code %" PRId32 ")", r);
+            SCLogInfo("pcap file %s end of file reached (pcap err code %" PRId32 ")",
+                    ptv->filename, r);
+            if (PcapFileDone(ptv, TM_ECODE_DONE)) {
+                continue;
+            }
             if (! RunModeUnixSocketIsActive()) {
                 EngineStop();
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -240,8 +617,10 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
             if (! RunModeUnixSocketIsActive()) {
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                pcap_close(ptv->pcap_handle);
+                ptv->pcap_handle = NULL;
+                UnixSocketPcapFileDone(ptv->filename, TM_ECODE_FAILED,
+                        (uint32_t)ptv->cnt);
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -256,157 +635,938 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **d
 {
     SCEnter();
 
-    const char *tmpbpfstring = NULL;
-    const char *tmpstring = NULL;
+    TmEcode r;
 
     if (initdata == NULL) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "error: initdata == NULL");
         SCReturnInt(TM_ECODE_FAILED);
     }
 
-    SCLogInfo("reading pcap file %s", (char *)initdata);
-
     PcapFileThreadVars *ptv = SCMalloc(sizeof(PcapFileThreadVars));
     if (unlikely(ptv == NULL))
         SCReturnInt(TM_ECODE_FAILED);
     memset(ptv, 0, sizeof(PcapFileThreadVars));
 
-    intmax_t tenant = 0;
-    if (ConfGetInt("pcap-file.tenant-id", &tenant) == 1) {
-        if (tenant > 0 && tenant < UINT_MAX) {
-            ptv->tenant_id = (uint32_t)tenant;
-            SCLogInfo("tenant %u", ptv->tenant_id);
-        } else {
-            SCLogError(SC_ERR_INVALID_ARGUMENT, "tenant out of range");
-        }
+    ptv->tenant_id = PcapFileGetTenantId();
+    ptv->tv = tv;
+
+    /* a batch of files is read one file after another */
+    ConfNode *files = ConfGetNode("pcap-file.files");
+    if (files != NULL && !TAILQ_EMPTY(&files->head)) {
+        ptv->file_node = TAILQ_FIRST(&files->head);
+        r = PcapFileOpenNext(ptv);
+    } else {
+        r = PcapFileOpen(ptv, (const char *)initdata);
+        if (r == TM_ECODE_DONE)
+            UnixSocketPcapFileDone((const char *)initdata, TM_ECODE_FAILED, 0);
     }
 
-    char errbuf[PCAP_ERRBUF_SIZE] = "";
-    pcap_g.pcap_handle = pcap_open_offline((char *)initdata, errbuf);
-    if (pcap_g.pcap_handle == NULL) {
-        SCLogError(SC_ERR_FOPEN, "%s\n", errbuf);
+    /* in unix socket mode the loop ends the run if no file could be
+     * opened */
+    if (r == TM_ECODE_FAILED ||
+            (r == TM_ECODE_DONE && ! RunModeUnixSocketIsActive())) {
+        ReceivePcapFileThreadDeinit(tv, ptv);
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    *data = (void *)ptv;
+    SCReturnInt(TM_ECODE_OK);
+}
+
+void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data)
+{
+    SCEnter();
+    PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
+
+    if (pcap_g.conf_checksum_mode == CHECKSUM_VALIDATION_AUTO &&
+            ptv->cnt < CHECKSUM_SAMPLE_COUNT &&
+            SC_ATOMIC_GET(pcap_g.invalid_checksums)) {
+        uint64_t chrate = ptv->cnt / SC_ATOMIC_GET(pcap_g.invalid_checksums);
+        if (chrate < CHECKSUM_INVALID_RATIO)
+            SCLogWarning(SC_ERR_INVALID_CHECKSUM,
+                         "1/%" PRIu64 "th of packets have an invalid checksum,"
+                         " consider setting pcap-file.checksum-checks variable to no"
+                         " or use '-k none' option on command line.",
+                         chrate);
+        else
+            SCLogInfo("1/%" PRIu64 "th of packets have an invalid checksum",
+                      chrate);
+    }
+    SCLogNotice("Pcap-file module read %" PRIu32 " packets, %" PRIu64 " bytes", ptv->pkts, ptv->bytes);
+    return;
+}
+
+TmEcode ReceivePcapFileThreadDeinit(ThreadVars *tv, void *data)
+{
+    SCEnter();
+    PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
+    if (ptv) {
+        if (ptv->pcap_handle != NULL)
+            pcap_close(ptv->pcap_handle);
+        if (ptv->filter_set)
+            pcap_freecode(&ptv->filter);
         SCFree(ptv);
-        if (! RunModeUnixSocketIsActive()) {
-            return TM_ECODE_FAILED;
+    }
+    SCReturnInt(TM_ECODE_OK);
+}
+
+static inline uint16_t PcapFileGet16(const uint8_t *data, int swapped)
+{
+    uint16_t v;
+    memcpy(&v, data, sizeof(v));
+    return swapped ? SCByteSwap16(v) : v;
+}
+
+static inline uint32_t PcapFileGet32(const uint8_t *data, int swapped)
+{
+    uint32_t v;
+    memcpy(&v, data, sizeof(v));
+    return swapped ? SCByteSwap32(v) : v;
+}
+
+static inline uint64_t PcapFileGet64(const uint8_t *data, int swapped)
+{
+    uint64_t v;
+    memcpy(&v, data, sizeof(v));
+    return swapped ? SCByteSwap64(v) : v;
+}
+
+/** \internal
+ *  \brief get the next packet from a mapped classic pcap file
+ *
+ *  \param st parse state, offset is advanced past the record
+ *  \param nsec timestamps are in nanoseconds
+ *  \param datalink datalink from the file header
+ *  \param pkt filled with the packet, data points into the map
+ */
+static int PcapFileClassicNext(PcapFileMmapState *st, uint8_t *map, size_t map_len,
+        int nsec, int datalink, PcapFileMmapPkt *pkt)
+{
+    PcapFileRecordHdr rec;
+
+    if (st->offset >= map_len)
+        return PCAP_FILE_REC_END;
+
+    if (map_len - st->offset < sizeof(rec)) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "pcap file truncated record "
+                "header at offset %"PRIuMAX, (uintmax_t)st->offset);
+        return PCAP_FILE_REC_END;
+    }
+    memcpy(&rec, map + st->offset, sizeof(rec));
+    if (st->swapped) {
+        rec.ts_sec = SCByteSwap32(rec.ts_sec);
+        rec.ts_frac = SCByteSwap32(rec.ts_frac);
+        rec.caplen = SCByteSwap32(rec.caplen);
+        rec.len = SCByteSwap32(rec.len);
+    }
+    if (rec.caplen > map_len - st->offset - sizeof(rec)) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "pcap file truncated record "
+                "at offset %"PRIuMAX, (uintmax_t)st->offset);
+        return PCAP_FILE_REC_END;
+    }
+
+    pkt->data = map + st->offset + sizeof(rec);
+    pkt->caplen = rec.caplen;
+    pkt->len = rec.len;
+    pkt->datalink = datalink;
+    pkt->ts.tv_sec = rec.ts_sec;
+    pkt->ts.tv_usec = nsec ? rec.ts_frac / 1000 : rec.ts_frac;
+
+    st->offset += sizeof(rec) + rec.caplen;
+    return PCAP_FILE_REC_PKT;
+}
+
+/** \internal
+ *  \brief add an interface from a pcapng Interface Description Block
+ *  \retval 0 ok, -1 error
+ */
+static int PcapFileNgAddIface(PcapFileMmapState *st, const uint8_t *body, uint32_t body_len)
+{
+    if (body_len < 8)
+        return -1;
+
+    if (st->ifaces_cnt == st->ifaces_size) {
+        uint32_t size = st->ifaces_size ? st->ifaces_size * 2 : 4;
+        PcapFileNgIface *ifaces = SCRealloc(st->ifaces, size * sizeof(PcapFileNgIface));
+        if (ifaces == NULL)
+            return -1;
+        st->ifaces = ifaces;
+        st->ifaces_size = size;
+    }
+
+    PcapFileNgIface *iface = &st->ifaces[st->ifaces_cnt];
+    iface->datalink = PcapFileGet16(body, st->swapped);
+    iface->snaplen = PcapFileGet32(body + 4, st->swapped);
+    iface->ts_units = 1000000;
+    iface->ts_offset = 0;
+
+    uint32_t off = 8;
+    while (body_len - off >= 4) {
+        uint16_t code = PcapFileGet16(body + off, st->swapped);
+        uint16_t len = PcapFileGet16(body + off + 2, st->swapped);
+        if (code == PCAPNG_OPT_END || len > body_len - off - 4)
+            break;
+
+        const uint8_t *val = body + off + 4;
+        if (code == PCAPNG_OPT_IF_TSRESOL && len >= 1) {
+            /* MSB set: negative power of 2, otherwise of 10 */
+            if (val[0] & 0x80) {
+                if ((val[0] & 0x7f) < 64)
+                    iface->ts_units = 1ULL << (val[0] & 0x7f);
+            } else if (val[0] <= 19) {
+                uint64_t units = 1;
+                for (uint8_t i = 0; i < val[0]; i++)
+                    units *= 10;
+                iface->ts_units = units;
+            }
+        } else if (code == PCAPNG_OPT_IF_TSOFFSET && len >= 8) {
+            iface->ts_offset = (int64_t)PcapFileGet64(val, st->swapped);
+        }
+
+        /* options are padded to 32 bits */
+        off += 4 + ((len + 3) & ~3);
+        if (off > body_len)
+            break;
+    }
+
+    st->ifaces_cnt++;
+    return 0;
+}
+
+/** \internal
+ *  \brief convert a pcapng timestamp using the interface's resolution */
+static void PcapFileNgTimestamp(const PcapFileNgIface *iface, uint64_t ts,
+        struct timeval *tv)
+{
+    const uint64_t units = iface->ts_units;
+    const uint64_t frac = ts % units;
+
+    tv->tv_sec = (time_t)((int64_t)(ts / units) + iface->ts_offset);
+    if (units == 1000000) {
+        tv->tv_usec = frac;
+    } else if (units > 1000000 && (units % 1000000) == 0) {
+        tv->tv_usec = frac / (units / 1000000);
+    } else {
+        tv->tv_usec = (suseconds_t)((double)frac * 1000000.0 / (double)units);
+    }
+}
+
+/** \internal
+ *  \brief get the next block from a mapped pcapng file
+ *
+ *  Section Header and Interface Description Blocks update the parse
+ *  state. Enhanced, Simple and (obsolete) Packet Blocks are returned as
+ *  packets pointing into the map. Other blocks are skipped.
+ *
+ *  \param st parse state, offset is advanced past the block
+ *  \param pkt filled with the packet, data points into the map
+ */
+static int PcapFileNgNext(PcapFileMmapState *st, uint8_t *map, size_t map_len,
+        PcapFileMmapPkt *pkt)
+{
+    if (st->offset >= map_len)
+        return PCAP_FILE_REC_END;
+
+    if (map_len - st->offset < 12) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "pcapng file truncated block "
+                "at offset %"PRIuMAX, (uintmax_t)st->offset);
+        return PCAP_FILE_REC_END;
+    }
+
+    uint8_t *blk = map + st->offset;
+    uint32_t type = PcapFileGet32(blk, 0);
+    if (type == PCAPNG_BLOCK_SHB) {
+        /* a new section, possibly with another byte order */
+        uint32_t bom = PcapFileGet32(blk + 8, 0);
+        if (bom == PCAPNG_BYTE_ORDER_MAGIC) {
+            st->swapped = 0;
+        } else if (SCByteSwap32(bom) == PCAPNG_BYTE_ORDER_MAGIC) {
+            st->swapped = 1;
         } else {
-            UnixSocketPcapFile(TM_ECODE_FAILED);
-            SCReturnInt(TM_ECODE_DONE);
+            SCLogWarning(SC_ERR_PCAP_DISPATCH, "pcapng file invalid section "
+                    "header at offset %"PRIuMAX, (uintmax_t)st->offset);
+            return PCAP_FILE_REC_END;
         }
+        st->ifaces_cnt = 0;
+    } else {
+        type = PcapFileGet32(blk, st->swapped);
     }
 
-    if (ConfGet("bpf-filter", &tmpbpfstring) != 1) {
-        SCLogDebug("could not get bpf or none specified");
+    uint32_t blen = PcapFileGet32(blk + 4, st->swapped);
+    if (blen < 12 || (blen % 4) != 0 || blen > map_len - st->offset) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "pcapng file invalid block "
+                "length at offset %"PRIuMAX, (uintmax_t)st->offset);
+        return PCAP_FILE_REC_END;
+    }
+    st->offset += blen;
+
+    uint8_t *body = blk + 8;
+    uint32_t body_len = blen - 12;
+    uint32_t if_id;
+    uint32_t hdr_len;
+
+    switch (type) {
+        case PCAPNG_BLOCK_SHB:
+            return PCAP_FILE_REC_SKIP;
+        case PCAPNG_BLOCK_IDB:
+            if (PcapFileNgAddIface(st, body, body_len) < 0) {
+                SCLogWarning(SC_ERR_PCAP_DISPATCH, "pcapng file invalid "
+                        "interface description block");
+                return PCAP_FILE_REC_END;
+            }
+            return PCAP_FILE_REC_SKIP;
+        case PCAPNG_BLOCK_EPB:
+        case PCAPNG_BLOCK_OPB:
+            if (body_len < 20)
+                return PCAP_FILE_REC_END;
+            if (type == PCAPNG_BLOCK_EPB) {
+                if_id = PcapFileGet32(body, st->swapped);
+            } else {
+                if_id = PcapFileGet16(body, st->swapped);
+            }
+            hdr_len = 20;
+            break;
+        case PCAPNG_BLOCK_SPB:
+            if (body_len < 4)
+                return PCAP_FILE_REC_END;
+            if_id = 0;
+            hdr_len = 4;
+            break;
+        default:
+            return PCAP_FILE_REC_SKIP;
+    }
+
+    if (if_id >= st->ifaces_cnt) {
+        SCLogDebug("packet for unknown interface %u", if_id);
+        return PCAP_FILE_REC_SKIP;
+    }
+    const PcapFileNgIface *iface = &st->ifaces[if_id];
+
+    if (type == PCAPNG_BLOCK_SPB) {
+        /* no captured length or timestamp, derive them */
+        pkt->len = PcapFileGet32(body, st->swapped);
+        pkt->caplen = MIN(pkt->len, body_len - hdr_len);
+        if (iface->snaplen > 0)
+            pkt->caplen = MIN(pkt->caplen, iface->snaplen);
+        pkt->ts = st->last_ts;
+    } else {
+        uint64_t ts = ((uint64_t)PcapFileGet32(body + 4, st->swapped) << 32) |
+                      PcapFileGet32(body + 8, st->swapped);
+        pkt->caplen = PcapFileGet32(body + 12, st->swapped);
+        pkt->len = PcapFileGet32(body + 16, st->swapped);
+        if (pkt->caplen > body_len - hdr_len) {
+            SCLogWarning(SC_ERR_PCAP_DISPATCH, "pcapng file invalid packet "
+                    "block at offset %"PRIuMAX, (uintmax_t)(st->offset - blen));
+            return PCAP_FILE_REC_END;
+        }
+        PcapFileNgTimestamp(iface, ts, &pkt->ts);
+        st->last_ts = pkt->ts;
+    }
+    pkt->data = body + hdr_len;
+    pkt->datalink = iface->datalink;
+    return PCAP_FILE_REC_PKT;
+}
+
+/**
+ *  \brief map a pcap file for the mmap readers
+ *
+ *  Maps the file, parses the file header and sets up the decoder and
+ *  bpf filter. The first reader then walks the records of the mapped
+ *  file and hands the packets that hash to another reader to it.
+ *
+ *  Both pcap and pcapng files are supported. For pcapng the decoder and
+ *  bpf filter are set up for the datalink of the first interface, the
+ *  readers set them up for the datalinks of the other interfaces.
+ *
+ *  \param filename pcap file to map
+ *  \param readers number of reader threads that will be created
+ *
+ *  \retval 0 ok, -1 error
+ */
+int PcapFileMmapSetup(const char *filename, uint16_t readers)
+{
+    const char *tmpbpfstring = NULL;
+    struct stat st;
+    uint32_t magic;
+    uint32_t snaplen;
+    uint32_t linktype;
+
+    if (readers == 0)
+        return -1;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", filename, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < PCAP_FILE_HDR_LEN) {
+        SCLogError(SC_ERR_FOPEN, "%s: not a pcap file", filename);
+        close(fd);
+        return -1;
+    }
+
+    /* private writable mapping so that code modifying packet data gets
+     * its own copy of the page instead of faulting */
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to mmap %s: %s", filename, strerror(errno));
+        return -1;
+    }
+#ifdef MADV_SEQUENTIAL
+    (void)madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    pcap_g.map = map;
+    pcap_g.map_len = (size_t)st.st_size;
+
+    memcpy(&magic, pcap_g.map, sizeof(magic));
+    if (magic == PCAPNG_BLOCK_SHB) {
+        /* walk the blocks up to the first interface description */
+        PcapFileMmapState ng;
+        PcapFileMmapPkt pkt;
+        memset(&ng, 0, sizeof(ng));
+        while (ng.ifaces_cnt == 0 &&
+               PcapFileNgNext(&ng, pcap_g.map, pcap_g.map_len, &pkt) == PCAP_FILE_REC_SKIP)
+            ;
+        if (ng.ifaces_cnt == 0) {
+            SCLogError(SC_ERR_FOPEN, "%s: no interface found in pcapng file", filename);
+            SCFree(ng.ifaces);
+            goto error;
+        }
+        pcap_g.map_pcapng = 1;
+        linktype = ng.ifaces[0].datalink;
+        snaplen = ng.ifaces[0].snaplen ? ng.ifaces[0].snaplen : 65535;
+        SCFree(ng.ifaces);
     } else {
+        if (magic == PCAP_FILE_MAGIC_USEC || magic == PCAP_FILE_MAGIC_NSEC) {
+            pcap_g.map_swapped = 0;
+        } else if (SCByteSwap32(magic) == PCAP_FILE_MAGIC_USEC ||
+                   SCByteSwap32(magic) == PCAP_FILE_MAGIC_NSEC) {
+            pcap_g.map_swapped = 1;
+            magic = SCByteSwap32(magic);
+        } else {
+            SCLogError(SC_ERR_FOPEN, "%s: not a pcap file", filename);
+            goto error;
+        }
+        pcap_g.map_nsec = (magic == PCAP_FILE_MAGIC_NSEC);
+
+        snaplen = PcapFileGet32(pcap_g.map + 16, pcap_g.map_swapped);
+        linktype = PcapFileGet32(pcap_g.map + 20, pcap_g.map_swapped);
+    }
+
+    pcap_g.datalink = (int)(linktype & 0xffff);
+    SCLogDebug("datalink %" PRId32 "", pcap_g.datalink);
+    if (PcapFileSetDecoder(pcap_g.datalink) < 0)
+        goto error;
+
+    if (ConfGet("bpf-filter", &tmpbpfstring) == 1) {
         SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
 
-        if (pcap_compile(pcap_g.pcap_handle, &pcap_g.filter, (char *)tmpbpfstring, 1, 0) < 0) {
-            SCLogError(SC_ERR_BPF,"bpf compilation error %s",
-                    pcap_geterr(pcap_g.pcap_handle));
-            SCFree(ptv);
-            return TM_ECODE_FAILED;
+        pcap_t *dead = pcap_open_dead(pcap_g.datalink, (int)snaplen);
+        if (dead == NULL) {
+            SCLogError(SC_ERR_BPF, "could not set up bpf filter");
+            goto error;
+        }
+        if (pcap_compile(dead, &pcap_g.filter, (char *)tmpbpfstring, 1, 0) < 0) {
+            SCLogError(SC_ERR_BPF, "bpf compilation error %s", pcap_geterr(dead));
+            pcap_close(dead);
+            goto error;
         }
+        pcap_close(dead);
+        pcap_g.map_filter_set = 1;
+        pcap_g.map_bpf = tmpbpfstring;
+    }
 
-        if (pcap_setfilter(pcap_g.pcap_handle, &pcap_g.filter) < 0) {
-            SCLogError(SC_ERR_BPF,"could not set bpf filter %s", pcap_geterr(pcap_g.pcap_handle));
-            SCFree(ptv);
-            return TM_ECODE_FAILED;
+    if (readers > 1) {
+        pcap_g.map_queues = SCMallocAligned(readers * sizeof(PcapFileMmapQueue), CLS);
+        if (pcap_g.map_queues == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "failed to set up the reader queues");
+            goto error;
         }
+        memset(pcap_g.map_queues, 0, readers * sizeof(PcapFileMmapQueue));
     }
 
-    pcap_g.datalink = pcap_datalink(pcap_g.pcap_handle);
-    SCLogDebug("datalink %" PRId32 "", pcap_g.datalink);
+    pcap_g.map_readers = readers;
+    SC_ATOMIC_SET(pcap_g.map_readers_active, readers);
 
-    switch (pcap_g.datalink) {
-        case LINKTYPE_LINUX_SLL:
-            pcap_g.Decoder = DecodeSll;
-            break;
+    SCLogInfo("reading %s file %s using %u readers",
+            pcap_g.map_pcapng ? "pcapng" : "pcap", filename, readers);
+    return 0;
+
+error:
+    if (pcap_g.map_filter_set) {
+        pcap_freecode(&pcap_g.filter);
+        pcap_g.map_filter_set = 0;
+    }
+    munmap(pcap_g.map, pcap_g.map_len);
+    pcap_g.map = NULL;
+    pcap_g.map_len = 0;
+    return -1;
+}
+
+/** \internal
+ *  \brief add a packet to a reader's queue, first reader only
+ *  \retval 0 ok, -1 queue is full */
+static inline int PcapFileMmapQueuePut(PcapFileMmapQueue *q, const PcapFileMmapRec *rec)
+{
+    const uint32_t tail = q->tail;
+
+    if (tail - SCAtomicLoadAcquire(&q->head) == PCAP_FILE_MMAP_QUEUE_SIZE)
+        return -1;
+
+    q->recs[tail & (PCAP_FILE_MMAP_QUEUE_SIZE - 1)] = *rec;
+    SCAtomicStoreRelease(&q->tail, tail + 1);
+    return 0;
+}
+
+/** \internal
+ *  \brief get a packet from the reader's own queue
+ *  \retval 0 ok, -1 queue is empty */
+static inline int PcapFileMmapQueueGet(PcapFileMmapQueue *q, PcapFileMmapRec *rec)
+{
+    const uint32_t head = q->head;
+
+    if (SCAtomicLoadAcquire(&q->tail) == head)
+        return -1;
+
+    *rec = q->recs[head & (PCAP_FILE_MMAP_QUEUE_SIZE - 1)];
+    SCAtomicStoreRelease(&q->head, head + 1);
+    return 0;
+}
+
+/** \internal
+ *  \brief get the reader a packet belongs to
+ *
+ *  The IP address pair is hashed symmetrically, so that both directions
+ *  of a flow as well as all fragments of a datagram are handled by the
+ *  same reader. Packets we can't get the addresses from are handled by
+ *  the first reader.
+ */
+static uint16_t PcapFileMmapGetReader(const PcapFileMmapPkt *pkt)
+{
+    const uint8_t *data = pkt->data;
+    const uint32_t len = pkt->caplen;
+    uint32_t offset;
+    uint16_t ether_type;
+
+    switch (pkt->datalink) {
         case LINKTYPE_ETHERNET:
-            pcap_g.Decoder = DecodeEthernet;
+            if (len < ETHERNET_HEADER_LEN)
+                return 0;
+            ether_type = (data[12] << 8) | data[13];
+            offset = ETHERNET_HEADER_LEN;
+            /* skip up to two vlan layers */
+            for (int i = 0; i < 2; i++) {
+                if (ether_type != ETHERNET_TYPE_8021Q &&
+                    ether_type != ETHERNET_TYPE_8021AD &&
+                    ether_type != ETHERNET_TYPE_8021QINQ)
+                    break;
+                if (len < offset + 4)
+                    return 0;
+                ether_type = (data[offset + 2] << 8) | data[offset + 3];
+                offset += 4;
+            }
+            if (ether_type != ETHERNET_TYPE_IP && ether_type != ETHERNET_TYPE_IPV6)
+                return 0;
             break;
-        case LINKTYPE_PPP:
-            pcap_g.Decoder = DecodePPP;
+        case LINKTYPE_LINUX_SLL:
+            offset = SLL_HEADER_LEN;
+            break;
+        case LINKTYPE_NULL:
+            offset = 4;
             break;
         case LINKTYPE_IPV4:
         case LINKTYPE_RAW:
         case LINKTYPE_RAW2:
-            pcap_g.Decoder = DecodeRaw;
-            break;
-        case LINKTYPE_NULL:
-            pcap_g.Decoder = DecodeNull;
+            offset = 0;
             break;
+        default:
+            return 0;
+    }
 
+    if (len <= offset)
+        return 0;
+
+    uint32_t addrs[8];
+    uint32_t words;
+    const uint8_t *ip = data + offset;
+    switch (ip[0] >> 4) {
+        case 4:
+            if (len < offset + IPV4_HEADER_LEN)
+                return 0;
+            words = 1;
+            break;
+        case 6:
+            if (len < offset + IPV6_HEADER_LEN)
+                return 0;
+            words = 4;
+            break;
         default:
-            SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
-                      "(yet) supported in module PcapFile.\n", pcap_g.datalink);
-            SCFree(ptv);
-            if (! RunModeUnixSocketIsActive()) {
-                SCReturnInt(TM_ECODE_FAILED);
+            return 0;
+    }
+
+    /* order the addresses so both directions hash the same */
+    const uint8_t *src = (words == 1) ? ip + 12 : ip + 8;
+    const uint8_t *dst = src + (words * 4);
+    if (memcmp(src, dst, words * 4) > 0) {
+        const uint8_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    memcpy(&addrs[0], src, words * 4);
+    memcpy(&addrs[words], dst, words * 4);
+
+    return (uint16_t)(hashword(addrs, words * 2, 0) % pcap_g.map_readers);
+}
+
+/** \internal
+ *  \brief get how to handle a datalink other than the main one
+ *
+ *  pcapng interfaces can each have their own datalink. The first time
+ *  a reader sees a datalink it checks that it can be decoded and
+ *  compiles the bpf filter for it. If either fails, the packets of the
+ *  datalink are skipped, as the filter can't be applied to them.
+ *
+ *  \retval link or NULL if out of memory
+ */
+static PcapFileMmapLink *PcapFileMmapGetLink(PcapFileMmapThreadVars *ptv, int datalink)
+{
+    for (uint32_t i = 0; i < ptv->links_cnt; i++) {
+        if (ptv->links[i].datalink == datalink)
+            return &ptv->links[i];
+    }
+
+    PcapFileMmapLink *links = SCRealloc(ptv->links,
+            (ptv->links_cnt + 1) * sizeof(PcapFileMmapLink));
+    if (links == NULL)
+        return NULL;
+    ptv->links = links;
+
+    PcapFileMmapLink *link = &ptv->links[ptv->links_cnt++];
+    memset(link, 0, sizeof(*link));
+    link->datalink = datalink;
+
+    if (PcapFileGetDecoder(datalink) == NULL) {
+        SCLogWarning(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
+                "(yet) supported in module PcapFile, skipping its packets",
+                datalink);
+        return link;
+    }
+
+    if (pcap_g.map_filter_set) {
+        pcap_t *dead = pcap_open_dead(datalink, 65535);
+        if (dead == NULL) {
+            SCLogWarning(SC_ERR_BPF, "could not set up bpf filter for "
+                    "datalink type %" PRId32 ", skipping its packets", datalink);
+            return link;
+        }
+        if (pcap_compile(dead, &link->filter, (char *)pcap_g.map_bpf, 1, 0) < 0) {
+            SCLogWarning(SC_ERR_BPF, "bpf compilation error for datalink type "
+                    "%" PRId32 ", skipping its packets: %s", datalink,
+                    pcap_geterr(dead));
+            pcap_close(dead);
+            return link;
+        }
+        pcap_close(dead);
+        link->filter_set = 1;
+    }
+
+    link->usable = 1;
+    return link;
+}
+
+/** \internal
+ *  \brief pass a packet of the mapped file on to the other slots
+ *  \retval TM_ECODE_OK or TM_ECODE_FAILED if processing failed */
+static TmEcode PcapFileMmapProcess(ThreadVars *tv, PcapFileMmapThreadVars *ptv,
+        const PcapFileMmapRec *rec)
+{
+    /* make sure we have at least one packet in the packet pool, to prevent
+     * us from alloc'ing packets at line rate */
+    PacketPoolWait();
+
+    Packet *p = PacketGetFromQueueOrAlloc();
+    if (unlikely(p == NULL)) {
+        return TM_ECODE_OK;
+    }
+    PACKET_PROFILING_TMM_START(p, TMM_RECEIVEPCAPFILEMMAP);
+
+    PKT_SET_SRC(p, PKT_SRC_WIRE);
+    p->ts = rec->pkt.ts;
+    p->datalink = rec->pkt.datalink;
+    p->pcap_cnt = rec->pcap_cnt;
+
+    p->pcap_v.tenant_id = ptv->tenant_id;
+    ptv->pkts++;
+    ptv->bytes += rec->pkt.caplen;
+
+    /* the mapping outlives the packets, so no need to copy */
+    if (unlikely(PacketSetData(p, rec->pkt.data, rec->pkt.caplen))) {
+        TmqhOutputPacketpool(ptv->tv, p);
+        PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILEMMAP);
+        return TM_ECODE_OK;
+    }
+
+    if (rec->ignore_checksum) {
+        p->flags |= PKT_IGNORE_CHECKSUM;
+    }
+
+    PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILEMMAP);
+
+    if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+        SCLogError(SC_ERR_PCAP_DISPATCH, "pcap file processing failed");
+        return TM_ECODE_FAILED;
+    }
+
+    if ((ptv->pkts & 0x3f) == 0) {
+        StatsSyncCountersIfSignalled(tv);
+    }
+    return TM_ECODE_OK;
+}
+
+/** \internal
+ *  \brief walk the records of the mapped file, first reader only
+ *
+ *  Applies the bpf filter, numbers the packets and decides on the
+ *  checksum validation, then processes the packets that belong to this
+ *  reader and puts the others in the queue of their reader. As the
+ *  queues are filled in file order, the packet order of a flow is the
+ *  same as with a single reader.
+ *
+ *  \retval TM_ECODE_DONE at the end of the file, TM_ECODE_OK if the
+ *          engine is stopping, TM_ECODE_FAILED on error
+ */
+static TmEcode PcapFileMmapSplit(ThreadVars *tv, PcapFileMmapThreadVars *ptv)
+{
+    TmEcode ret = TM_ECODE_DONE;
+
+    while (1) {
+        if (unlikely(suricata_ctl_flags & SURICATA_STOP)) {
+            ret = TM_ECODE_OK;
+            break;
+        }
+
+        PcapFileMmapRec rec;
+        int r;
+        if (pcap_g.map_pcapng) {
+            r = PcapFileNgNext(&ptv->st, pcap_g.map, pcap_g.map_len, &rec.pkt);
+        } else {
+            r = PcapFileClassicNext(&ptv->st, pcap_g.map, pcap_g.map_len,
+                    pcap_g.map_nsec, pcap_g.datalink, &rec.pkt);
+        }
+        if (r == PCAP_FILE_REC_END)
+            break;
+        if (r == PCAP_FILE_REC_SKIP)
+            continue;
+
+        /* apply the filter before counting, so that packets get the same
+         * numbers the single reader would give them */
+        const struct bpf_program *filter = NULL;
+        if (rec.pkt.datalink == pcap_g.datalink) {
+            if (pcap_g.map_filter_set)
+                filter = &pcap_g.filter;
+        } else {
+            PcapFileMmapLink *link = PcapFileMmapGetLink(ptv, rec.pkt.datalink);
+            if (link == NULL || !link->usable)
+                continue;
+            if (link->filter_set)
+                filter = &link->filter;
+        }
+        if (filter != NULL) {
+            struct pcap_pkthdr h;
+            h.ts = rec.pkt.ts;
+            h.caplen = rec.pkt.caplen;
+            h.len = rec.pkt.len;
+            if (pcap_offline_filter(filter, &h, rec.pkt.data) == 0)
+                continue;
+        }
+        ptv->records++;
+        rec.pcap_cnt = ptv->records;
+
+        /* only this thread updates the checksum mode, the other readers
+         * get the result with the packet */
+        rec.ignore_checksum = 0;
+        if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+            rec.ignore_checksum = 1;
+        } else if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+            if (ChecksumAutoModeCheck(ptv->records, ptv->records,
+                        SC_ATOMIC_GET(pcap_g.invalid_checksums))) {
+                pcap_g.checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+                rec.ignore_checksum = 1;
+            }
+        }
+
+        uint16_t reader = 0;
+        if (pcap_g.map_readers > 1)
+            reader = PcapFileMmapGetReader(&rec.pkt);
+
+        if (reader == ptv->reader_id) {
+            if (PcapFileMmapProcess(tv, ptv, &rec) != TM_ECODE_OK) {
+                ret = TM_ECODE_FAILED;
+                break;
+            }
+            continue;
+        }
+
+        PcapFileMmapQueue *q = &pcap_g.map_queues[reader];
+        while (PcapFileMmapQueuePut(q, &rec) < 0) {
+            if (unlikely(suricata_ctl_flags & SURICATA_STOP))
+                break;
+            usleep(PCAP_FILE_MMAP_QUEUE_WAIT);
+        }
+    }
+
+    /* the other readers finish their queues and stop */
+    for (uint16_t i = 0; i < pcap_g.map_readers; i++) {
+        if (i != ptv->reader_id)
+            SCAtomicStoreRelease(&pcap_g.map_queues[i].done, 1);
+    }
+    return ret;
+}
+
+/** \internal
+ *  \brief process the packets the first reader put in our queue
+ *
+ *  \retval TM_ECODE_DONE at the end of the file, TM_ECODE_OK if the
+ *          engine is stopping, TM_ECODE_FAILED on error
+ */
+static TmEcode PcapFileMmapConsume(ThreadVars *tv, PcapFileMmapThreadVars *ptv)
+{
+    PcapFileMmapQueue *q = &pcap_g.map_queues[ptv->reader_id];
+
+    while (1) {
+        if (unlikely(suricata_ctl_flags & SURICATA_STOP)) {
+            return TM_ECODE_OK;
+        }
+
+        PcapFileMmapRec rec;
+        if (PcapFileMmapQueueGet(q, &rec) < 0) {
+            /* done is set after the last packet was added */
+            if (SCAtomicLoadAcquire(&q->done)) {
+                if (PcapFileMmapQueueGet(q, &rec) < 0)
+                    return TM_ECODE_DONE;
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
-                UnixSocketPcapFile(TM_ECODE_DONE);
-                SCReturnInt(TM_ECODE_DONE);
+                TmThreadsCaptureInjectPacket(tv, ptv->slot, NULL);
+                usleep(PCAP_FILE_MMAP_QUEUE_WAIT);
+                continue;
             }
+        }
+
+        TmEcode r = PcapFileMmapProcess(tv, ptv, &rec);
+        if (r != TM_ECODE_OK)
+            return r;
     }
+}
 
-    if (ConfGet("pcap-file.checksum-checks", &tmpstring) != 1) {
-        pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_AUTO;
+/**
+ *  \brief mmap reader loop
+ *
+ *  The first reader walks the file and hands the packets of the other
+ *  readers to them, the other readers only process the packets they
+ *  get. So the record headers are parsed once.
+ */
+TmEcode ReceivePcapFileMmapLoop(ThreadVars *tv, void *data, void *slot)
+{
+    SCEnter();
+
+    PcapFileMmapThreadVars *ptv = (PcapFileMmapThreadVars *)data;
+    TmSlot *s = (TmSlot *)slot;
+
+    ptv->slot = s->slot_next;
+
+    TmEcode r;
+    if (ptv->reader_id == 0) {
+        r = PcapFileMmapSplit(tv, ptv);
     } else {
-        if (strcmp(tmpstring, "auto") == 0) {
-            pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_AUTO;
-        } else if (ConfValIsTrue(tmpstring)){
-            pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_ENABLE;
-        } else if (ConfValIsFalse(tmpstring)) {
-            pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_DISABLE;
-        }
+        r = PcapFileMmapConsume(tv, ptv);
+    }
+    if (r != TM_ECODE_DONE) {
+        SCReturnInt(r);
+    }
+
+    SCLogInfo("pcap file end of file reached (reader %u)", ptv->reader_id);
+    /* last reader done stops the engine */
+    if (SC_ATOMIC_SUB(pcap_g.map_readers_active, 1) == 0) {
+        EngineStop();
+    }
+    SCReturnInt(TM_ECODE_DONE);
+}
+
+TmEcode ReceivePcapFileMmapThreadInit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCEnter();
+
+    if (pcap_g.map == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "error: pcap file not mapped");
+        SCReturnInt(TM_ECODE_FAILED);
     }
-    pcap_g.checksum_mode = pcap_g.conf_checksum_mode;
 
+    PcapFileMmapThreadVars *ptv = SCCalloc(1, sizeof(PcapFileMmapThreadVars));
+    if (unlikely(ptv == NULL))
+        SCReturnInt(TM_ECODE_FAILED);
+
+    ptv->tenant_id = PcapFileGetTenantId();
+    ptv->reader_id = SC_ATOMIC_ADD(pcap_g.map_reader_id, 1) - 1;
+    if (!pcap_g.map_pcapng) {
+        ptv->st.offset = PCAP_FILE_HDR_LEN;
+        ptv->st.swapped = pcap_g.map_swapped;
+    }
     ptv->tv = tv;
-    *data = (void *)ptv;
+    (void)SC_ATOMIC_ADD(pcap_g.map_users, 1);
 
+    *data = (void *)ptv;
     SCReturnInt(TM_ECODE_OK);
 }
 
-void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data)
+void ReceivePcapFileMmapThreadExitStats(ThreadVars *tv, void *data)
 {
     SCEnter();
-    PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
+    PcapFileMmapThreadVars *ptv = (PcapFileMmapThreadVars *)data;
 
-    if (pcap_g.conf_checksum_mode == CHECKSUM_VALIDATION_AUTO &&
-            pcap_g.cnt < CHECKSUM_SAMPLE_COUNT &&
-            SC_ATOMIC_GET(pcap_g.invalid_checksums)) {
-        uint64_t chrate = pcap_g.cnt / SC_ATOMIC_GET(pcap_g.invalid_checksums);
-        if (chrate < CHECKSUM_INVALID_RATIO)
-            SCLogWarning(SC_ERR_INVALID_CHECKSUM,
-                         "1/%" PRIu64 "th of packets have an invalid checksum,"
-                         " consider setting pcap-file.checksum-checks variable to no"
-                         " or use '-k none' option on command line.",
-                         chrate);
-        else
-            SCLogInfo("1/%" PRIu64 "th of packets have an invalid checksum",
-                      chrate);
-    }
-    SCLogNotice("Pcap-file module read %" PRIu32 " packets, %" PRIu64 " bytes", ptv->pkts, ptv->bytes);
-    return;
+    SCLogNotice("Pcap-file reader %u read %" PRIu32 " packets, %" PRIu64 " bytes",
+            ptv->reader_id, ptv->pkts, ptv->bytes);
 }
 
-TmEcode ReceivePcapFileThreadDeinit(ThreadVars *tv, void *data)
+TmEcode ReceivePcapFileMmapThreadDeinit(ThreadVars *tv, void *data)
 {
     SCEnter();
-    PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
+    PcapFileMmapThreadVars *ptv = (PcapFileMmapThreadVars *)data;
     if (ptv) {
+        if (ptv->st.ifaces != NULL)
+            SCFree(ptv->st.ifaces);
+        for (uint32_t i = 0; i < ptv->links_cnt; i++) {
+            if (ptv->links[i].filter_set)
+                pcap_freecode(&ptv->links[i].filter);
+        }
+        if (ptv->links != NULL)
+            SCFree(ptv->links);
         SCFree(ptv);
     }
+
+    /* last user unmaps the file */
+    if (SC_ATOMIC_SUB(pcap_g.map_users, 1) == 0) {
+        if (pcap_g.map_filter_set) {
+            pcap_freecode(&pcap_g.filter);
+            pcap_g.map_filter_set = 0;
+        }
+        if (pcap_g.map_queues != NULL) {
+            SCFreeAligned(pcap_g.map_queues);
+            pcap_g.map_queues = NULL;
+        }
+        munmap(pcap_g.map, pcap_g.map_len);
+        pcap_g.map = NULL;
+        pcap_g.map_len = 0;
+    }
     SCReturnInt(TM_ECODE_OK);
 }
 
-static double prev_signaled_ts = 0;
-
 TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
 {
     SCEnter();
-    DecodeThreadVars *dtv = (DecodeThreadVars *)data;
+    PcapFileDecodeThreadVars *dptv = (PcapFileDecodeThreadVars *)data;
+    DecodeThreadVars *dtv = dptv->dtv;
 
     /* XXX HACK: flow timeout can call us for injected pseudo packets
      *           see bug: https://redmine.openinfosecfoundation.org/issues/1107 */
@@ -417,13 +1577,20 @@ TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, P
     DecodeUpdatePacketCounters(tv, dtv, p);
 
     double curr_ts = p->ts.tv_sec + p->ts.tv_usec / 1000.0;
-    if (curr_ts < prev_signaled_ts || (curr_ts - prev_signaled_ts) > 60.0) {
-        prev_signaled_ts = curr_ts;
+    if (curr_ts < dptv->prev_signaled_ts ||
+            (curr_ts - dptv->prev_signaled_ts) > 60.0) {
+        dptv->prev_signaled_ts = curr_ts;
         FlowWakeupFlowManagerThread();
     }
 
-    /* call the decoder */
-    pcap_g.Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+    /* call the decoder, pcapng files can have a datalink per interface */
+    if (likely(p->datalink == pcap_g.datalink)) {
+        pcap_g.Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+    } else {
+        PcapFileDecoderFunc Decoder = PcapFileGetDecoder(p->datalink);
+        if (Decoder != NULL)
+            Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+    }
 
 #ifdef DEBUG
     BUG_ON(p->pkt_src != PKT_SRC_WIRE && p->pkt_src != PKT_SRC_FFR);
@@ -437,28 +1604,42 @@ TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, P
 TmEcode DecodePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **data)
 {
     SCEnter();
+    PcapFileDecodeThreadVars *dptv = SCCalloc(1, sizeof(*dptv));
+    if (unlikely(dptv == NULL))
+        SCReturnInt(TM_ECODE_FAILED);
+
     DecodeThreadVars *dtv = NULL;
     dtv = DecodeThreadVarsAlloc(tv);
 
-    if (dtv == NULL)
+    if (dtv == NULL) {
+        SCFree(dptv);
         SCReturnInt(TM_ECODE_FAILED);
+    }
 
     DecodeRegisterPerfCounters(dtv, tv);
 
 #ifdef __SC_CUDA_SUPPORT__
-    if (CudaThreadVarsInit(&dtv->cuda_vars) < 0)
+    if (CudaThreadVarsInit(&dtv->cuda_vars) < 0) {
+        DecodeThreadVarsFree(tv, dtv);
+        SCFree(dptv);
         SCReturnInt(TM_ECODE_FAILED);
+    }
 #endif
 
-    *data = (void *)dtv;
+    dptv->dtv = dtv;
+    *data = (void *)dptv;
 
     SCReturnInt(TM_ECODE_OK);
 }
 
 TmEcode DecodePcapFileThreadDeinit(ThreadVars *tv, void *data)
 {
-    if (data != NULL)
-        DecodeThreadVarsFree(tv, data);
+    PcapFileDecodeThreadVars *dptv = (PcapFileDecodeThreadVars *)data;
+    if (dptv != NULL) {
+        if (dptv->dtv != NULL)
+            DecodeThreadVarsFree(tv, dptv->dtv);
+        SCFree(dptv);
+    }
     SCReturnInt(TM_ECODE_OK);
 }
 
@@ -467,5 +1648,285 @@ void PcapIncreaseInvalidChecksum()
     (void) SC_ATOMIC_ADD(pcap_g.invalid_checksums, 1);
 }
 
-/* eof */
+#ifdef UNITTESTS
+#include "util-unittest.h"
+
+/** \internal
+ *  \brief append a pcapng block to a buffer, optionally in the other
+ *         byte order */
+static void PcapFileNgTestBlock(uint8_t *buf, uint32_t *off, uint32_t type,
+        const uint8_t *body, uint32_t body_len, int swap)
+{
+    uint32_t blen = 12 + ((body_len + 3) & ~3);
+    uint32_t v;
+
+    v = swap ? SCByteSwap32(type) : type;
+    memcpy(buf + *off, &v, 4);
+    v = swap ? SCByteSwap32(blen) : blen;
+    memcpy(buf + *off + 4, &v, 4);
+    memset(buf + *off + 8, 0, blen - 12);
+    memcpy(buf + *off + 8, body, body_len);
+    memcpy(buf + *off + blen - 4, &v, 4);
+    *off += blen;
+}
+
+static void PcapFileNgTestPut32(uint8_t *dst, uint32_t v, int swap)
+{
+    v = swap ? SCByteSwap32(v) : v;
+    memcpy(dst, &v, 4);
+}
+
+static void PcapFileNgTestPut16(uint8_t *dst, uint16_t v, int swap)
+{
+    v = swap ? SCByteSwap16(v) : v;
+    memcpy(dst, &v, 2);
+}
+
+/** \internal
+ *  \brief build a pcapng section with two interfaces of different
+ *         datalink and timestamp resolution and walk it */
+static int PcapFileNgTestWalk(int swap)
+{
+    uint8_t buf[512];
+    uint8_t body[64];
+    uint32_t off = 0;
+    uint64_t ts;
+
+    /* section header */
+    memset(body, 0, sizeof(body));
+    PcapFileNgTestPut32(body, PCAPNG_BYTE_ORDER_MAGIC, swap);
+    PcapFileNgTestPut16(body + 4, 1, swap);
+    memset(body + 8, 0xff, 8);
+    PcapFileNgTestBlock(buf, &off, PCAPNG_BLOCK_SHB, body, 16, swap);
+
+    /* ethernet interface with nanosecond timestamps */
+    memset(body, 0, sizeof(body));
+    PcapFileNgTestPut16(body, LINKTYPE_ETHERNET, swap);
+    PcapFileNgTestPut32(body + 4, 65535, swap);
+    PcapFileNgTestPut16(body + 8, PCAPNG_OPT_IF_TSRESOL, swap);
+    PcapFileNgTestPut16(body + 10, 1, swap);
+    body[12] = 9;
+    PcapFileNgTestBlock(buf, &off, PCAPNG_BLOCK_IDB, body, 20, swap);
+
+    /* raw interface with default (microsecond) timestamps */
+    memset(body, 0, sizeof(body));
+    PcapFileNgTestPut16(body, LINKTYPE_RAW, swap);
+    PcapFileNgTestBlock(buf, &off, PCAPNG_BLOCK_IDB, body, 8, swap);
+
+    /* packet on the ethernet interface */
+    memset(body, 0, sizeof(body));
+    ts = 1500000000123456789ULL;
+    PcapFileNgTestPut32(body, 0, swap);
+    PcapFileNgTestPut32(body + 4, (uint32_t)(ts >> 32), swap);
+    PcapFileNgTestPut32(body + 8, (uint32_t)ts, swap);
+    PcapFileNgTestPut32(body + 12, 5, swap);
+    PcapFileNgTestPut32(body + 16, 60, swap);
+    memcpy(body + 20, "ABCDE", 5);
+    const uint32_t pkt1_off = off + 8 + 20;
+    PcapFileNgTestBlock(buf, &off, PCAPNG_BLOCK_EPB, body, 25, swap);
+
+    /* unknown block is skipped */
+    memset(body, 0, sizeof(body));
+    PcapFileNgTestBlock(buf, &off, 0xbad, body, 8, swap);
+
+    /* packet on the raw interface */
+    memset(body, 0, sizeof(body));
+    ts = 1500000001000002ULL;
+    PcapFileNgTestPut32(body, 1, swap);
+    PcapFileNgTestPut32(body + 4, (uint32_t)(ts >> 32), swap);
+    PcapFileNgTestPut32(body + 8, (uint32_t)ts, swap);
+    PcapFileNgTestPut32(body + 12, 4, swap);
+    PcapFileNgTestPut32(body + 16, 4, swap);
+    memcpy(body + 20, "\x45\x00\x00\x14", 4);
+    const uint32_t pkt2_off = off + 8 + 20;
+    PcapFileNgTestBlock(buf, &off, PCAPNG_BLOCK_EPB, body, 24, swap);
+
+    /* simple packet block, belongs to the first interface */
+    memset(body, 0, sizeof(body));
+    PcapFileNgTestPut32(body, 3, swap);
+    memcpy(body + 4, "xyz", 3);
+    const uint32_t pkt3_off = off + 8 + 4;
+    PcapFileNgTestBlock(buf, &off, PCAPNG_BLOCK_SPB, body, 7, swap);
+
+    PcapFileMmapState st;
+    PcapFileMmapPkt pkt;
+    memset(&st, 0, sizeof(st));
+
+    FAIL_IF(PcapFileNgNext(&st, buf, off, &pkt) != PCAP_FILE_REC_SKIP);
+    FAIL_IF(st.swapped != swap);
+    FAIL_IF(PcapFileNgNext(&st, buf, off, &pkt) != PCAP_FILE_REC_SKIP);
+    FAIL_IF(PcapFileNgNext(&st, buf, off, &pkt) != PCAP_FILE_REC_SKIP);
+    FAIL_IF(st.ifaces_cnt != 2);
+
+    FAIL_IF(PcapFileNgNext(&st, buf, off, &pkt) != PCAP_FILE_REC_PKT);
+    FAIL_IF(pkt.datalink != LINKTYPE_ETHERNET);
+    FAIL_IF(pkt.caplen != 5 || pkt.len != 60);
+    FAIL_IF(pkt.data != buf + pkt1_off);
+    FAIL_IF(pkt.ts.tv_sec != 1500000000 || pkt.ts.tv_usec != 123456);
+
+    FAIL_IF(PcapFileNgNext(&st, buf, off, &pkt) != PCAP_FILE_REC_SKIP);
+
+    FAIL_IF(PcapFileNgNext(&st, buf, off, &pkt) != PCAP_FILE_REC_PKT);
+    FAIL_IF(pkt.datalink != LINKTYPE_RAW);
+    FAIL_IF(pkt.caplen != 4);
+    FAIL_IF(pkt.data != buf + pkt2_off);
+    FAIL_IF(pkt.ts.tv_sec != 1500000001 || pkt.ts.tv_usec != 2);
+
+    FAIL_IF(PcapFileNgNext(&st, buf, off, &pkt) != PCAP_FILE_REC_PKT);
+    FAIL_IF(pkt.datalink != LINKTYPE_ETHERNET);
+    FAIL_IF(pkt.caplen != 3);
+    FAIL_IF(pkt.data != buf + pkt3_off);
+    FAIL_IF(pkt.ts.tv_sec != 1500000001);
+
+    FAIL_IF(PcapFileNgNext(&st, buf, off, &pkt) != PCAP_FILE_REC_END);
+
+    SCFree(st.ifaces);
+    PASS;
+}
+
+static int PcapFileNgTest01(void)
+{
+    return PcapFileNgTestWalk(0);
+}
+
+/** \test section in the other byte order */
+static int PcapFileNgTest02(void)
+{
+    return PcapFileNgTestWalk(1);
+}
+
+/** \test packet block claiming more data than the block holds */
+static int PcapFileNgTest03(void)
+{
+    uint8_t buf[128];
+    uint8_t body[32];
+    uint32_t off = 0;
+
+    memset(body, 0, sizeof(body));
+    PcapFileNgTestPut32(body, PCAPNG_BYTE_ORDER_MAGIC, 0);
+    PcapFileNgTestBlock(buf, &off, PCAPNG_BLOCK_SHB, body, 16, 0);
+    memset(body, 0, sizeof(body));
+    PcapFileNgTestPut16(body, LINKTYPE_ETHERNET, 0);
+    PcapFileNgTestBlock(buf, &off, PCAPNG_BLOCK_IDB, body, 8, 0);
+    memset(body, 0, sizeof(body));
+    PcapFileNgTestPut32(body + 12, 1000, 0);
+    PcapFileNgTestBlock(buf, &off, PCAPNG_BLOCK_EPB, body, 24, 0);
+
+    PcapFileMmapState st;
+    PcapFileMmapPkt pkt;
+    memset(&st, 0, sizeof(st));
+
+    FAIL_IF(PcapFileNgNext(&st, buf, off, &pkt) != PCAP_FILE_REC_SKIP);
+    FAIL_IF(PcapFileNgNext(&st, buf, off, &pkt) != PCAP_FILE_REC_SKIP);
+    FAIL_IF(PcapFileNgNext(&st, buf, off, &pkt) != PCAP_FILE_REC_END);
+
+    SCFree(st.ifaces);
+    PASS;
+}
+
+/** \test classic pcap records, the last one truncated */
+static int PcapFileClassicTest01(void)
+{
+    uint8_t buf[PCAP_FILE_HDR_LEN + 2 * sizeof(PcapFileRecordHdr) + 4];
+    PcapFileRecordHdr rec = { 1500000000, 999999, 4, 64 };
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf + PCAP_FILE_HDR_LEN, &rec, sizeof(rec));
+    memcpy(buf + PCAP_FILE_HDR_LEN + sizeof(rec), "abcd", 4);
+    memcpy(buf + PCAP_FILE_HDR_LEN + sizeof(rec) + 4, &rec, sizeof(rec));
+
+    PcapFileMmapState st;
+    PcapFileMmapPkt pkt;
+    memset(&st, 0, sizeof(st));
+    st.offset = PCAP_FILE_HDR_LEN;
+
+    FAIL_IF(PcapFileClassicNext(&st, buf, sizeof(buf), 0, LINKTYPE_ETHERNET, &pkt) != PCAP_FILE_REC_PKT);
+    FAIL_IF(pkt.caplen != 4 || pkt.len != 64);
+    FAIL_IF(pkt.data != buf + PCAP_FILE_HDR_LEN + sizeof(rec));
+    FAIL_IF(pkt.ts.tv_sec != 1500000000 || pkt.ts.tv_usec != 999999);
+    FAIL_IF(PcapFileClassicNext(&st, buf, sizeof(buf), 0, LINKTYPE_ETHERNET, &pkt) != PCAP_FILE_REC_END);
+    PASS;
+}
 
+/** \test the bpf filter is compiled for the datalink of each pcapng
+ *        interface, datalinks we can't decode are skipped */
+static int PcapFileMmapLinkTest01(void)
+{
+    PcapFileMmapThreadVars ptv;
+    memset(&ptv, 0, sizeof(ptv));
+    const int filter_set = pcap_g.map_filter_set;
+    const char *bpf = pcap_g.map_bpf;
+    pcap_g.map_filter_set = 1;
+    pcap_g.map_bpf = "tcp port 80";
+
+    PcapFileMmapLink *link = PcapFileMmapGetLink(&ptv, LINKTYPE_RAW);
+    FAIL_IF_NULL(link);
+    FAIL_IF_NOT(link->usable);
+    FAIL_IF_NOT(link->filter_set);
+
+    /* no decoder for it */
+    link = PcapFileMmapGetLink(&ptv, 0xffff);
+    FAIL_IF_NULL(link);
+    FAIL_IF(link->usable);
+
+    /* looked up again, not added */
+    link = PcapFileMmapGetLink(&ptv, LINKTYPE_RAW);
+    FAIL_IF_NULL(link);
+    FAIL_IF_NOT(link->usable);
+    FAIL_IF(ptv.links_cnt != 2);
+
+    pcap_freecode(&ptv.links[0].filter);
+    SCFree(ptv.links);
+    pcap_g.map_filter_set = filter_set;
+    pcap_g.map_bpf = bpf;
+    PASS;
+}
+
+/** \test reader queue keeps the packet order and is bounded */
+static int PcapFileMmapQueueTest01(void)
+{
+    PcapFileMmapQueue *q = SCMallocAligned(sizeof(PcapFileMmapQueue), CLS);
+    FAIL_IF_NULL(q);
+    memset(q, 0, sizeof(*q));
+    PcapFileMmapRec rec;
+    memset(&rec, 0, sizeof(rec));
+
+    FAIL_IF(PcapFileMmapQueueGet(q, &rec) == 0);
+
+    /* fill it, wrapping around once */
+    for (uint64_t i = 1; i <= PCAP_FILE_MMAP_QUEUE_SIZE / 2; i++) {
+        rec.pcap_cnt = i;
+        FAIL_IF(PcapFileMmapQueuePut(q, &rec) != 0);
+        FAIL_IF(PcapFileMmapQueueGet(q, &rec) != 0);
+        FAIL_IF(rec.pcap_cnt != i);
+    }
+    for (uint64_t i = 1; i <= PCAP_FILE_MMAP_QUEUE_SIZE; i++) {
+        rec.pcap_cnt = i;
+        FAIL_IF(PcapFileMmapQueuePut(q, &rec) != 0);
+    }
+    FAIL_IF(PcapFileMmapQueuePut(q, &rec) == 0);
+
+    for (uint64_t i = 1; i <= PCAP_FILE_MMAP_QUEUE_SIZE; i++) {
+        FAIL_IF(PcapFileMmapQueueGet(q, &rec) != 0);
+        FAIL_IF(rec.pcap_cnt != i);
+    }
+    FAIL_IF(PcapFileMmapQueueGet(q, &rec) == 0);
+
+    SCFreeAligned(q);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void PcapFileRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapFileNgTest01", PcapFileNgTest01);
+    UtRegisterTest("PcapFileNgTest02", PcapFileNgTest02);
+    UtRegisterTest("PcapFileNgTest03", PcapFileNgTest03);
+    UtRegisterTest("PcapFileClassicTest01", PcapFileClassicTest01);
+    UtRegisterTest("PcapFileMmapLinkTest01", PcapFileMmapLinkTest01);
+    UtRegisterTest("PcapFileMmapQueueTest01", PcapFileMmapQueueTest01);
+#endif /* UNITTESTS */
+}
+
+/* eof */
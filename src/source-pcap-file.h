@@ -25,11 +25,13 @@
 #define __SOURCE_PCAP_FILE_H__
 
 void TmModuleReceivePcapFileRegister (void);
+void TmModuleReceivePcapFileMmapRegister (void);
 void TmModuleDecodePcapFileRegister (void);
 
 void PcapIncreaseInvalidChecksum(void);
 
 void PcapFileGlobalInit(void);
+int PcapFileMmapSetup(const char *filename, uint16_t readers);
 
 #endif /* __SOURCE_PCAP_FILE_H__ */
 
@@ -97,6 +97,264 @@ static inline int InsertSegmentDataCustom(TcpStream *stream, TcpSegment *seg, ui
     SCReturnInt(0);
 }
 
+/*
+ *  Segment tree
+ *
+ *  The segment list is indexed by a red-black tree keyed on seq, so that
+ *  the place to insert an out of order segment is found in O(log n)
+ *  instead of by walking the list. The list itself stays the way to
+ *  iterate the segments in order. Segments with the same seq are ordered
+ *  by insert time in both.
+ */
+
+#define SEG_TREE_BLACK  0
+#define SEG_TREE_RED    1
+
+#define SEG_TREE_IS_RED(seg) ((seg) != NULL && (seg)->tree_color == SEG_TREE_RED)
+
+/** \internal
+ *  \brief put 'new' in the place of 'old' in old's parent, or at the root */
+static inline void SegTreeReplaceChild(TcpStream *stream, TcpSegment *parent,
+        TcpSegment *old, TcpSegment *new)
+{
+    if (parent == NULL)
+        stream->seg_tree = new;
+    else if (parent->tree_left == old)
+        parent->tree_left = new;
+    else
+        parent->tree_right = new;
+}
+
+static void SegTreeRotateLeft(TcpStream *stream, TcpSegment *x)
+{
+    TcpSegment *y = x->tree_right;
+
+    x->tree_right = y->tree_left;
+    if (y->tree_left != NULL)
+        y->tree_left->tree_parent = x;
+
+    y->tree_parent = x->tree_parent;
+    SegTreeReplaceChild(stream, x->tree_parent, x, y);
+
+    y->tree_left = x;
+    x->tree_parent = y;
+}
+
+static void SegTreeRotateRight(TcpStream *stream, TcpSegment *x)
+{
+    TcpSegment *y = x->tree_left;
+
+    x->tree_left = y->tree_right;
+    if (y->tree_right != NULL)
+        y->tree_right->tree_parent = x;
+
+    y->tree_parent = x->tree_parent;
+    SegTreeReplaceChild(stream, x->tree_parent, x, y);
+
+    y->tree_right = x;
+    x->tree_parent = y;
+}
+
+/** \internal
+ *  \brief find the first segment with a seq beyond 'seq'
+ *
+ *  \param parent set to the node to attach a new segment with this seq to
+ *
+ *  \retval seg segment to insert before, or NULL to append
+ */
+static TcpSegment *SegTreeFindNext(const TcpStream *stream, uint32_t seq,
+        TcpSegment **parent)
+{
+    TcpSegment *node = stream->seg_tree;
+    TcpSegment *next = NULL;
+
+    *parent = NULL;
+    while (node != NULL) {
+        *parent = node;
+        if (SEQ_LT(seq, node->seq)) {
+            next = node;
+            node = node->tree_left;
+        } else {
+            node = node->tree_right;
+        }
+    }
+    return next;
+}
+
+/** \internal
+ *  \brief add a segment to the tree below 'parent', as returned by
+ *         SegTreeFindNext, and rebalance */
+static void SegTreeInsert(TcpStream *stream, TcpSegment *seg, TcpSegment *parent)
+{
+    seg->tree_left = seg->tree_right = NULL;
+    seg->tree_parent = parent;
+    seg->tree_color = SEG_TREE_RED;
+
+    if (parent == NULL)
+        stream->seg_tree = seg;
+    else if (SEQ_LT(seg->seq, parent->seq))
+        parent->tree_left = seg;
+    else
+        parent->tree_right = seg;
+
+    while ((parent = seg->tree_parent) != NULL && parent->tree_color == SEG_TREE_RED) {
+        /* parent is red so it is not the root */
+        TcpSegment *gparent = parent->tree_parent;
+
+        if (parent == gparent->tree_left) {
+            TcpSegment *uncle = gparent->tree_right;
+            if (SEG_TREE_IS_RED(uncle)) {
+                uncle->tree_color = SEG_TREE_BLACK;
+                parent->tree_color = SEG_TREE_BLACK;
+                gparent->tree_color = SEG_TREE_RED;
+                seg = gparent;
+                continue;
+            }
+            if (seg == parent->tree_right) {
+                SegTreeRotateLeft(stream, parent);
+                seg = parent;
+                parent = seg->tree_parent;
+            }
+            parent->tree_color = SEG_TREE_BLACK;
+            gparent->tree_color = SEG_TREE_RED;
+            SegTreeRotateRight(stream, gparent);
+        } else {
+            TcpSegment *uncle = gparent->tree_left;
+            if (SEG_TREE_IS_RED(uncle)) {
+                uncle->tree_color = SEG_TREE_BLACK;
+                parent->tree_color = SEG_TREE_BLACK;
+                gparent->tree_color = SEG_TREE_RED;
+                seg = gparent;
+                continue;
+            }
+            if (seg == parent->tree_left) {
+                SegTreeRotateRight(stream, parent);
+                seg = parent;
+                parent = seg->tree_parent;
+            }
+            parent->tree_color = SEG_TREE_BLACK;
+            gparent->tree_color = SEG_TREE_RED;
+            SegTreeRotateLeft(stream, gparent);
+        }
+    }
+    stream->seg_tree->tree_color = SEG_TREE_BLACK;
+}
+
+/** \internal
+ *  \brief restore the red-black properties after removing a black node
+ *
+ *  \param x node that took the removed node's place, may be NULL
+ *  \param parent parent of x
+ */
+static void SegTreeRemoveFixup(TcpStream *stream, TcpSegment *x, TcpSegment *parent)
+{
+    while (x != stream->seg_tree && !SEG_TREE_IS_RED(x)) {
+        if (x == parent->tree_left) {
+            TcpSegment *w = parent->tree_right;
+            if (w->tree_color == SEG_TREE_RED) {
+                w->tree_color = SEG_TREE_BLACK;
+                parent->tree_color = SEG_TREE_RED;
+                SegTreeRotateLeft(stream, parent);
+                w = parent->tree_right;
+            }
+            if (!SEG_TREE_IS_RED(w->tree_left) && !SEG_TREE_IS_RED(w->tree_right)) {
+                w->tree_color = SEG_TREE_RED;
+                x = parent;
+                parent = x->tree_parent;
+            } else {
+                if (!SEG_TREE_IS_RED(w->tree_right)) {
+                    w->tree_left->tree_color = SEG_TREE_BLACK;
+                    w->tree_color = SEG_TREE_RED;
+                    SegTreeRotateRight(stream, w);
+                    w = parent->tree_right;
+                }
+                w->tree_color = parent->tree_color;
+                parent->tree_color = SEG_TREE_BLACK;
+                w->tree_right->tree_color = SEG_TREE_BLACK;
+                SegTreeRotateLeft(stream, parent);
+                x = stream->seg_tree;
+                break;
+            }
+        } else {
+            TcpSegment *w = parent->tree_left;
+            if (w->tree_color == SEG_TREE_RED) {
+                w->tree_color = SEG_TREE_BLACK;
+                parent->tree_color = SEG_TREE_RED;
+                SegTreeRotateRight(stream, parent);
+                w = parent->tree_left;
+            }
+            if (!SEG_TREE_IS_RED(w->tree_left) && !SEG_TREE_IS_RED(w->tree_right)) {
+                w->tree_color = SEG_TREE_RED;
+                x = parent;
+                parent = x->tree_parent;
+            } else {
+                if (!SEG_TREE_IS_RED(w->tree_left)) {
+                    w->tree_right->tree_color = SEG_TREE_BLACK;
+                    w->tree_color = SEG_TREE_RED;
+                    SegTreeRotateLeft(stream, w);
+                    w = parent->tree_left;
+                }
+                w->tree_color = parent->tree_color;
+                parent->tree_color = SEG_TREE_BLACK;
+                w->tree_left->tree_color = SEG_TREE_BLACK;
+                SegTreeRotateRight(stream, parent);
+                x = stream->seg_tree;
+                break;
+            }
+        }
+    }
+    if (x != NULL)
+        x->tree_color = SEG_TREE_BLACK;
+}
+
+/** \internal
+ *  \brief remove a segment from the tree and rebalance */
+static void SegTreeRemove(TcpStream *stream, TcpSegment *seg)
+{
+    TcpSegment *child, *parent;
+    uint8_t color;
+
+    if (seg->tree_left != NULL && seg->tree_right != NULL) {
+        /* two children: the in order successor takes seg's place */
+        TcpSegment *next = seg->tree_right;
+        while (next->tree_left != NULL)
+            next = next->tree_left;
+
+        child = next->tree_right;
+        color = next->tree_color;
+
+        if (next->tree_parent == seg) {
+            parent = next;
+        } else {
+            parent = next->tree_parent;
+            parent->tree_left = child;
+            if (child != NULL)
+                child->tree_parent = parent;
+            next->tree_right = seg->tree_right;
+            seg->tree_right->tree_parent = next;
+        }
+
+        next->tree_parent = seg->tree_parent;
+        SegTreeReplaceChild(stream, seg->tree_parent, seg, next);
+        next->tree_left = seg->tree_left;
+        seg->tree_left->tree_parent = next;
+        next->tree_color = seg->tree_color;
+    } else {
+        child = seg->tree_left != NULL ? seg->tree_left : seg->tree_right;
+        parent = seg->tree_parent;
+        color = seg->tree_color;
+
+        if (child != NULL)
+            child->tree_parent = parent;
+        SegTreeReplaceChild(stream, parent, seg, child);
+    }
+
+    if (color == SEG_TREE_BLACK)
+        SegTreeRemoveFixup(stream, child, parent);
+
+    seg->tree_left = seg->tree_right = seg->tree_parent = NULL;
+}
+
 /** \internal
  *  \brief insert the segment into the proper place in the list
  *         don't worry about the data or overlaps
@@ -129,68 +387,63 @@ static int DoInsertSegment (TcpStream *stream, TcpSegment *seg, Packet *p)
         stream->seg_list = seg;
         seg->prev = NULL;
         stream->seg_list_tail = seg;
+        SegTreeInsert(stream, seg, NULL);
         return 0;
     }
 
-    /* insert the segment in the stream list using this fast track, if seg->seq
-       is equal or higher than stream->seg_list_tail.*/
-    if (SEQ_GEQ(seg->seq, (stream->seg_list_tail->seq +
-                    TCP_SEG_LEN(stream->seg_list_tail))))
-    {
+    /* find the list segment to insert before in the tree. Also gets us
+     * the tree node to attach the segment to. In order data goes after
+     * the list tail, which is the rightmost node, so skip the lookup. */
+    TcpSegment *parent;
+    TcpSegment *list_seg;
+    if (SEQ_GEQ(seg->seq, stream->seg_list_tail->seq)) {
+        list_seg = NULL;
+        parent = stream->seg_list_tail;
+    } else {
+        list_seg = SegTreeFindNext(stream, seg->seq, &parent);
+    }
+    SegTreeInsert(stream, seg, parent);
+
+    /* no segment with a higher seq: append to the list */
+    if (list_seg == NULL) {
         SCLogDebug("seg beyond list tail, append");
-        stream->seg_list_tail->next = seg;
         seg->prev = stream->seg_list_tail;
+        stream->seg_list_tail->next = seg;
         stream->seg_list_tail = seg;
+
+        if (SEQ_GT(SEG_SEQ_RIGHT_EDGE(seg->prev), seg->seq)) {
+            SCLogDebug("seg inserted with overlap (before)");
+            return 1;
+        }
         return 0;
     }
 
-    /* walk the list to see where we can insert the segment.
-     * Check if a segment overlaps with us, if so we return 1 to indicate
-     * to the caller that we need to handle overlaps. */
-    TcpSegment *list_seg;
-    for (list_seg = stream->seg_list; list_seg != NULL; list_seg = list_seg->next)
-    {
-        if (SEQ_LT(seg->seq, list_seg->seq)) {
-            if (list_seg->prev != NULL) {
-                list_seg->prev->next = seg;
-            } else {
-                stream->seg_list = seg;
-            }
-            seg->prev = list_seg->prev;
-            seg->next = list_seg;
-            list_seg->prev = seg;
-
-            SCLogDebug("inserted %u before %p seq %u", seg->seq, list_seg, list_seg->seq);
+    /* insert before list_seg. Check if a segment overlaps with us, if so
+     * we return 1 to indicate to the caller that we need to handle
+     * overlaps. */
+    if (list_seg->prev != NULL) {
+        list_seg->prev->next = seg;
+    } else {
+        stream->seg_list = seg;
+    }
+    seg->prev = list_seg->prev;
+    seg->next = list_seg;
+    list_seg->prev = seg;
 
-            if (seg->prev != NULL) {
-                SCLogDebug("previous %u", seg->prev->seq);
-            }
-            if (seg->next != NULL) {
-                SCLogDebug("next %u", seg->next->seq);
-            }
-            if (seg->prev != NULL && SEQ_GT(SEG_SEQ_RIGHT_EDGE(seg->prev), seg->seq)) {
-                SCLogDebug("seg inserted with overlap (before)");
-                return 1;
-            }
-            else if (SEQ_GT(SEG_SEQ_RIGHT_EDGE(seg), seg->next->seq)) {
-                SCLogDebug("seg inserted with overlap (after)");
-                return 1;
-            }
+    SCLogDebug("inserted %u before %p seq %u", seg->seq, list_seg, list_seg->seq);
 
-            return 0;
-        }
+    if (seg->prev != NULL) {
+        SCLogDebug("previous %u", seg->prev->seq);
     }
-    /* if we got here we didn't insert. Append */
-    seg->prev = stream->seg_list_tail;
-    stream->seg_list_tail->next = seg;
-    stream->seg_list_tail = seg;
-
     if (seg->prev != NULL && SEQ_GT(SEG_SEQ_RIGHT_EDGE(seg->prev), seg->seq)) {
         SCLogDebug("seg inserted with overlap (before)");
         return 1;
     }
+    else if (SEQ_GT(SEG_SEQ_RIGHT_EDGE(seg), seg->next->seq)) {
+        SCLogDebug("seg inserted with overlap (after)");
+        return 1;
+    }
 
-    SCLogDebug("default: append");
     return 0;
 }
 
@@ -714,6 +967,8 @@ static inline uint64_t GetLeftEdge(TcpSession *ssn, TcpStream *stream)
 
 static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg)
 {
+    SegTreeRemove(stream, seg);
+
     if (seg->prev == NULL) {
         stream->seg_list = seg->next;
         if (stream->seg_list != NULL)
@@ -48,7 +48,6 @@ typedef struct TcpStateQueue_ {
 typedef struct StreamTcpSackRecord_ {
     uint32_t le;    /**< left edge, host order */
     uint32_t re;    /**< right edge, host order */
-    struct StreamTcpSackRecord_ *next;
 } StreamTcpSackRecord;
 
 typedef struct TcpSegment_ {
@@ -56,8 +55,13 @@ typedef struct TcpSegment_ {
     uint16_t payload_len;       /**< actual size of the payload */
     uint32_t seq;
     StreamingBufferSegment sbseg;
+    uint8_t tree_color;         /**< red/black, see stream-tcp-list.c */
     struct TcpSegment_ *next;
     struct TcpSegment_ *prev;
+    /* seq ordered index of the stream's segment list */
+    struct TcpSegment_ *tree_left;
+    struct TcpSegment_ *tree_right;
+    struct TcpSegment_ *tree_parent;
 } TcpSegment;
 
 #define TCP_SEG_LEN(seg)        (seg)->payload_len
@@ -93,9 +97,17 @@ typedef struct TcpStream_ {
 
     TcpSegment *seg_list;           /**< list of TCP segments that are not yet (fully) used in reassembly */
     TcpSegment *seg_list_tail;      /**< Last segment in the reassembled stream seg list*/
+    TcpSegment *seg_tree;           /**< root of the red-black tree indexing seg_list on seq */
 
-    StreamTcpSackRecord *sack_head; /**< head of list of SACK records */
-    StreamTcpSackRecord *sack_tail; /**< tail of list of SACK records */
+    StreamTcpSackRecord *sack_list; /**< SACK records, ordered, not overlapping or touching */
+    uint16_t sack_cnt;              /**< records in use */
+    uint16_t sack_size;             /**< records allocated */
+    uint32_t sacked_size;           /**< bytes covered by the SACK records */
+
+    uint64_t depth_limit;           /**< app-layer declared stream offset where reassembly
+                                         stops. Only valid with STREAMTCP_STREAM_FLAG_DEPTH_LIMIT */
+    uint64_t skip_until;            /**< app-layer declared stream offset up to where it
+                                         doesn't need the data */
 } TcpStream;
 
 #define STREAM_BASE_OFFSET(stream)  ((stream)->sb.stream_offset)
@@ -134,7 +146,8 @@ enum
 #define STREAMTCP_FLAG_TIMESTAMP                    0x0008
 /** Server supports wscale (even though it can be 0) */
 #define STREAMTCP_FLAG_SERVER_WSCALE                0x0010
-// vacancy
+/** Session is encrypted, bypass once encryption_bypass_left is used up */
+#define STREAMTCP_FLAG_ENCRYPTION_BYPASS            0x0020
 /** Flag to indicate that the session is handling asynchronous stream.*/
 #define STREAMTCP_FLAG_ASYNC                        0x0040
 /** Flag to indicate we're dealing with 4WHS: SYN, SYN, SYN/ACK, ACK
@@ -185,7 +198,8 @@ enum
 #define STREAMTCP_STREAM_FLAG_NEW_RAW_DISABLED 0x0200
 /** Raw reassembly disabled completely */
 #define STREAMTCP_STREAM_FLAG_DISABLE_RAW 0x400
-// vacancy 1x
+/** App-layer declared how much more of this stream it needs */
+#define STREAMTCP_STREAM_FLAG_DEPTH_LIMIT 0x800
 
 /** NOTE: flags field is 12 bits */
 
@@ -231,6 +245,7 @@ typedef struct TcpSession_ {
     TcpStream server;
     TcpStream client;
     TcpStateQueue *queue;                   /**< list of SYN/ACK candidates */
+    uint64_t encryption_bypass_left;        /**< encrypted bytes until bypass */
 } TcpSession;
 
 #define StreamTcpSetStreamFlagAppProtoDetectionCompleted(stream) \
@@ -59,12 +59,14 @@
 #include "util-debug.h"
 #include "app-layer-protos.h"
 #include "app-layer.h"
+#include "app-layer-parser.h"
 #include "app-layer-events.h"
 
 #include "detect-engine-state.h"
 
 #include "util-profiling.h"
 #include "util-validate.h"
+#include "util-memcap.h"
 
 #ifdef DEBUG
 static SCMutex segment_pool_memuse_mutex;
@@ -76,8 +78,8 @@ static PoolThread *segment_thread_pool = NULL;
 /* init only, protect initializing and growing pool */
 static SCMutex segment_thread_pool_mutex = SCMUTEX_INITIALIZER;
 
-/* Memory use counter */
-SC_ATOMIC_DECLARE(uint64_t, ra_memuse);
+/* Memory use counter, see util-memcap.c */
+static MemcapCounter ra_memuse;
 
 /* prototypes */
 TcpSegment *StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *);
@@ -86,7 +88,7 @@ void StreamTcpReassemblePseudoPacketCreate(TcpStream *, Packet *, PacketQueue *)
 
 void StreamTcpReassembleInitMemuse(void)
 {
-    SC_ATOMIC_INIT(ra_memuse);
+    MemcapCounterInit(&ra_memuse, "reassembly", &stream_config.reassembly_memcap);
 }
 
 /**
@@ -97,8 +99,8 @@ void StreamTcpReassembleInitMemuse(void)
  */
 void StreamTcpReassembleIncrMemuse(uint64_t size)
 {
-    (void) SC_ATOMIC_ADD(ra_memuse, size);
-    SCLogDebug("REASSEMBLY %"PRIu64", incr %"PRIu64, StreamTcpReassembleMemuseGlobalCounter(), size);
+    MemcapCounterIncr(&ra_memuse, size);
+    SCLogDebug("REASSEMBLY incr %"PRIu64, size);
     return;
 }
 
@@ -110,29 +112,14 @@ void StreamTcpReassembleIncrMemuse(uint64_t size)
  */
 void StreamTcpReassembleDecrMemuse(uint64_t size)
 {
-#ifdef UNITTESTS
-    uint64_t presize = SC_ATOMIC_GET(ra_memuse);
-    if (RunmodeIsUnittests()) {
-        BUG_ON(presize > UINT_MAX);
-    }
-#endif
-
-    (void) SC_ATOMIC_SUB(ra_memuse, size);
-
-#ifdef UNITTESTS
-    if (RunmodeIsUnittests()) {
-        uint64_t postsize = SC_ATOMIC_GET(ra_memuse);
-        BUG_ON(postsize > presize);
-    }
-#endif
-    SCLogDebug("REASSEMBLY %"PRIu64", decr %"PRIu64, StreamTcpReassembleMemuseGlobalCounter(), size);
+    MemcapCounterDecr(&ra_memuse, size);
+    SCLogDebug("REASSEMBLY decr %"PRIu64, size);
     return;
 }
 
 uint64_t StreamTcpReassembleMemuseGlobalCounter(void)
 {
-    uint64_t smemuse = SC_ATOMIC_GET(ra_memuse);
-    return smemuse;
+    return MemcapCounterGet(&ra_memuse);
 }
 
 /**
@@ -145,10 +132,7 @@ uint64_t StreamTcpReassembleMemuseGlobalCounter(void)
  */
 int StreamTcpReassembleCheckMemcap(uint32_t size)
 {
-    if (stream_config.reassembly_memcap == 0 ||
-            (uint64_t)((uint64_t)size + SC_ATOMIC_GET(ra_memuse)) <= stream_config.reassembly_memcap)
-        return 1;
-    return 0;
+    return MemcapCounterCheck(&ra_memuse, size);
 }
 
 /* memory functions for the streaming buffer API */
@@ -303,6 +287,7 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
 
     stream->seg_list = NULL;
     stream->seg_list_tail = NULL;
+    stream->seg_tree = NULL;
 }
 
 /** \internal
@@ -373,6 +358,54 @@ static int StreamTcpReassemblyConfig(char quiet)
     return 0;
 }
 
+/* skipped bytes counter names. Only used at init. */
+static char reass_skipped_counter_names[ALPROTO_MAX][64];
+
+static void StreamTcpReassembleSetupSkippedCounters(void)
+{
+    AppProto alproto;
+
+    memset(reass_skipped_counter_names, 0, sizeof(reass_skipped_counter_names));
+    for (alproto = 0; alproto < ALPROTO_MAX; alproto++) {
+        if (alproto == ALPROTO_FAILED) {
+            snprintf(reass_skipped_counter_names[alproto],
+                    sizeof(reass_skipped_counter_names[alproto]),
+                    "tcp.reassembly_skipped.failed");
+        } else if (AppLayerParserProtoIsRegistered(IPPROTO_TCP, alproto)) {
+            snprintf(reass_skipped_counter_names[alproto],
+                    sizeof(reass_skipped_counter_names[alproto]),
+                    "tcp.reassembly_skipped.%s", AppLayerGetProtoName(alproto));
+        }
+    }
+}
+
+/**
+ *  \brief register the per app-layer protocol counters for the bytes
+ *         that were not reassembled because of the (app-layer) depth
+ */
+void StreamTcpReassembleRegisterSkippedCounters(ThreadVars *tv,
+        TcpReassemblyThreadCtx *ra_ctx)
+{
+    AppProto alproto;
+
+    for (alproto = 0; alproto < ALPROTO_MAX; alproto++) {
+        if (reass_skipped_counter_names[alproto][0] != '\0') {
+            ra_ctx->counter_tcp_reass_skipped[alproto] =
+                StatsRegisterCounter(reass_skipped_counter_names[alproto], tv);
+        }
+    }
+}
+
+static inline void StreamTcpReassembleIncrSkipped(ThreadVars *tv,
+        TcpReassemblyThreadCtx *ra_ctx, const Packet *p, uint32_t skipped)
+{
+    const AppProto alproto = p->flow ? p->flow->alproto : ALPROTO_UNKNOWN;
+
+    if (alproto < ALPROTO_MAX && ra_ctx->counter_tcp_reass_skipped[alproto] > 0) {
+        StatsAddUI64(tv, ra_ctx->counter_tcp_reass_skipped[alproto], skipped);
+    }
+}
+
 int StreamTcpReassembleInit(char quiet)
 {
     /* init the memcap/use tracker */
@@ -386,6 +419,7 @@ int StreamTcpReassembleInit(char quiet)
 #endif
     StatsRegisterGlobalCounter("tcp.reassembly_memuse",
             StreamTcpReassembleMemuseGlobalCounter);
+    StreamTcpReassembleSetupSkippedCounters();
     return 0;
 }
 
@@ -503,8 +537,10 @@ static uint32_t StreamTcpReassembleCheckDepth(TcpSession *ssn, TcpStream *stream
     SCEnter();
 
     /* if the configured depth value is 0, it means there is no limit on
-       reassembly depth. Otherwise carry on my boy ;) */
-    if (ssn->reassembly_depth == 0) {
+       reassembly depth unless the app-layer declared one. Otherwise carry
+       on my boy ;) */
+    if (ssn->reassembly_depth == 0 &&
+            !(stream->flags & STREAMTCP_STREAM_FLAG_DEPTH_LIMIT)) {
         SCReturnUInt(size);
     }
 
@@ -526,6 +562,25 @@ static uint32_t StreamTcpReassembleCheckDepth(TcpSession *ssn, TcpStream *stream
         seg_depth = STREAM_BASE_OFFSET(stream) + ((seq + size) - stream->base_seq);
     }
 
+    /* the app-layer told us how much more of this stream it needs */
+    if (stream->flags & STREAMTCP_STREAM_FLAG_DEPTH_LIMIT &&
+            seg_depth > stream->depth_limit)
+    {
+        const int64_t seg_start = (int64_t)seg_depth - (int64_t)size;
+        stream->flags |= STREAMTCP_STREAM_FLAG_DEPTH_REACHED;
+        if (seg_start >= (int64_t)stream->depth_limit) {
+            SCLogDebug("app-layer depth limit %"PRIu64" reached", stream->depth_limit);
+            SCReturnUInt(0);
+        }
+        /* partial fit, continue with only what fits */
+        uint32_t part = (uint32_t)((int64_t)stream->depth_limit - seg_start);
+        seg_depth -= (size - part);
+        size = part;
+    }
+    if (ssn->reassembly_depth == 0) {
+        SCReturnUInt(size);
+    }
+
     /* if the base_seq has moved passed the depth window we stop
      * checking and just reject the rest of the packets including
      * retransmissions. Saves us the hassle of dealing with sequence
@@ -566,6 +621,28 @@ static uint32_t StreamTcpReassembleCheckDepth(TcpSession *ssn, TcpStream *stream
     SCReturnUInt(0);
 }
 
+/**
+ *  \internal
+ *  \brief check if a segment lies in the part of the stream the app-layer
+ *         asked to skip
+ *
+ *  \retval true if none of the segment's data is needed
+ */
+static bool StreamTcpReassembleCheckSkip(TcpStream *stream,
+        uint32_t seq, uint32_t size)
+{
+    if (stream->skip_until <= STREAM_APP_PROGRESS(stream))
+        return false;
+    /* retransmissions of data before base_seq are left to the
+     * regular handling */
+    if (SEQ_LT(seq, stream->base_seq))
+        return false;
+
+    const uint64_t seg_start = STREAM_BASE_OFFSET(stream) + (seq - stream->base_seq);
+    return (seg_start >= STREAM_APP_PROGRESS(stream) &&
+            seg_start + size <= stream->skip_until);
+}
+
 /**
  *  \brief Insert a packets TCP data into the stream reassembly engine.
  *
@@ -597,6 +674,7 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
     if ((ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED) &&
         (stream->flags & STREAMTCP_STREAM_FLAG_NEW_RAW_DISABLED)) {
         SCLogDebug("ssn %p: both app and raw reassembly disabled, not reassembling", ssn);
+        StreamTcpReassembleIncrSkipped(tv, ra_ctx, p, p->payload_len);
         SCReturnInt(0);
     }
 
@@ -608,12 +686,21 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
     if (stream->flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED) {
         /* increment stream depth counter */
         StatsIncr(tv, ra_ctx->counter_tcp_stream_depth);
+        if (size < p->payload_len)
+            StreamTcpReassembleIncrSkipped(tv, ra_ctx, p, p->payload_len - size);
     }
     if (size == 0) {
         SCLogDebug("ssn %p: depth reached, not reassembling", ssn);
         SCReturnInt(0);
     }
 
+    /* the app-layer doesn't need this part of the stream */
+    if (StreamTcpReassembleCheckSkip(stream, TCP_GET_SEQ(p), size)) {
+        SCLogDebug("ssn %p: segment in app-layer skip range, not reassembling", ssn);
+        StreamTcpReassembleIncrSkipped(tv, ra_ctx, p, p->payload_len);
+        SCReturnInt(0);
+    }
+
     DEBUG_VALIDATE_BUG_ON(size > p->payload_len);
     if (size > p->payload_len)
         size = p->payload_len;
@@ -975,6 +1062,25 @@ static int ReassembleUpdateAppLayer (ThreadVars *tv,
     const uint8_t *mydata;
     uint32_t mydata_len;
 
+    /* move past the part the app-layer asked to skip, as far as the
+     * other side has ack'd it */
+    if (app_progress < stream->skip_until) {
+        uint64_t right_edge = STREAM_BASE_OFFSET(stream);
+        if (STREAM_LASTACK_GT_BASESEQ(stream)) {
+            right_edge += stream->last_ack - stream->base_seq;
+            /* FIN takes a seq */
+            if (ssn->state >= TCP_FIN_WAIT1)
+                right_edge -= 1;
+        }
+        uint64_t skip_to = MIN(right_edge, stream->skip_until);
+        if (skip_to > app_progress) {
+            SCLogDebug("skipping app progress from %"PRIu64" to %"PRIu64,
+                    app_progress, skip_to);
+            stream->app_progress_rel += (skip_to - app_progress);
+            app_progress = skip_to;
+        }
+    }
+
     while (1) {
         GetAppBuffer(stream, &mydata, &mydata_len, app_progress);
         if (mydata == NULL && mydata_len > 0 && CheckGap(ssn, stream, p)) {
@@ -1628,6 +1734,60 @@ int StreamReassembleRaw(TcpSession *ssn, const Packet *p,
             (p->flags & PKT_PSEUDO_STREAM_END));
 }
 
+static int StreamRawSpansAdd(void *cb_data, const uint8_t *data, const uint32_t data_len)
+{
+    StreamRawSpans *spans = cb_data;
+
+    if (spans->cnt == spans->size) {
+        uint32_t size = spans->size ? spans->size * 2 : 4;
+        void *ptr = SCRealloc(spans->span, size * sizeof(StreamRawSpan));
+        if (ptr == NULL) {
+            spans->failed = true;
+            return 1;
+        }
+        spans->span = ptr;
+        spans->size = size;
+    }
+
+    spans->span[spans->cnt].data = data;
+    spans->span[spans->cnt].data_len = data_len;
+    spans->cnt++;
+    return 0;
+}
+
+/** \brief get the raw stream data for a packet as a list of spans
+ *
+ *  Looks up the same data StreamReassembleRaw passes to its callback,
+ *  so it can be inspected multiple times without walking the block
+ *  list or working out the inline window again. The spans are valid
+ *  until the stream is updated.
+ *
+ *  \param spans reused between calls, free with StreamRawSpansFree
+ */
+void StreamReassembleRawSpans(TcpSession *ssn, const Packet *p, StreamRawSpans *spans)
+{
+    spans->cnt = 0;
+    spans->progress = 0;
+    spans->failed = false;
+    (void)StreamReassembleRaw(ssn, p, StreamRawSpansAdd, spans, &spans->progress);
+
+    /* the raw reassembly moves its progress past the data it couldn't
+     * add. Inspect nothing and leave the progress alone, so that all of
+     * it is inspected with the next packet. */
+    if (spans->failed) {
+        TcpStream *stream = PKT_IS_TOSERVER(p) ? &ssn->client : &ssn->server;
+        spans->cnt = 0;
+        spans->progress = STREAM_RAW_PROGRESS(stream);
+    }
+}
+
+void StreamRawSpansFree(StreamRawSpans *spans)
+{
+    if (spans->span != NULL)
+        SCFree(spans->span);
+    memset(spans, 0, sizeof(*spans));
+}
+
 int StreamReassembleLog(TcpSession *ssn, TcpStream *stream,
                         StreamReassembleRawFunc Callback, void *cb_data,
                         uint64_t progress_in,
@@ -2879,15 +3039,15 @@ end:
 static int StreamTcpReassembleTest44(void)
 {
     StreamTcpInitConfig(TRUE);
-    uint32_t memuse = SC_ATOMIC_GET(ra_memuse);
+    uint32_t memuse = StreamTcpReassembleMemuseGlobalCounter();
     StreamTcpReassembleIncrMemuse(500);
-    FAIL_IF(SC_ATOMIC_GET(ra_memuse) != (memuse+500));
+    FAIL_IF(StreamTcpReassembleMemuseGlobalCounter() != (memuse+500));
     StreamTcpReassembleDecrMemuse(500);
-    FAIL_IF(SC_ATOMIC_GET(ra_memuse) != memuse);
+    FAIL_IF(StreamTcpReassembleMemuseGlobalCounter() != memuse);
     FAIL_IF(StreamTcpReassembleCheckMemcap(500) != 1);
     FAIL_IF(StreamTcpReassembleCheckMemcap((1 + memuse + stream_config.reassembly_memcap)) != 0);
     StreamTcpFreeConfig(TRUE);
-    FAIL_IF(SC_ATOMIC_GET(ra_memuse) != 0);
+    FAIL_IF(StreamTcpReassembleMemuseGlobalCounter() != 0);
     PASS;
 }
 
@@ -2977,6 +3137,111 @@ end:
     return result;
 }
 
+/**
+ *  \test   Test the depth limit declared by the app-layer.
+ */
+
+static int StreamTcpReassembleTest48 (void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    TcpSession ssn;
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    uint8_t payload[100] = {0};
+    uint16_t payload_size = 100;
+
+    StreamTcpUTInit(&ra_ctx);
+    stream_config.reassembly_depth = 0;
+
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.server, 100);
+    StreamTcpUTSetupStream(&ssn.client, 100);
+
+    int r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 101, payload, payload_size);
+    FAIL_IF(r != 0);
+    FAIL_IF(ssn.client.flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED);
+
+    /* app-layer needs 150 more bytes, so 50 of the next segment fit */
+    StreamTcpSetStreamDepthRemaining(&ssn, STREAM_TOSERVER, 150);
+    FAIL_IF(!(ssn.client.flags & STREAMTCP_STREAM_FLAG_DEPTH_LIMIT));
+    FAIL_IF(ssn.server.flags & STREAMTCP_STREAM_FLAG_DEPTH_LIMIT);
+    FAIL_IF(ssn.client.depth_limit != 150);
+
+    r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 201, payload, payload_size);
+    FAIL_IF(r != 0);
+    FAIL_IF(!(ssn.client.flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED));
+    FAIL_IF_NULL(ssn.client.seg_list_tail);
+    FAIL_IF(ssn.client.seg_list_tail->seq != 201);
+    FAIL_IF(TCP_SEG_LEN(ssn.client.seg_list_tail) != 50);
+
+    r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 301, payload, payload_size);
+    FAIL_IF(r != 0);
+    FAIL_IF(ssn.client.seg_list_tail->seq != 201);
+
+    /* other direction is not affected */
+    r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.server, 101, payload, payload_size);
+    FAIL_IF(r != 0);
+    r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.server, 201, payload, payload_size);
+    FAIL_IF(r != 0);
+    FAIL_IF(ssn.server.flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED);
+    FAIL_IF(TCP_SEG_LEN(ssn.server.seg_list_tail) != 100);
+
+    StreamTcpUTClearStream(&ssn.server);
+    StreamTcpUTClearStream(&ssn.client);
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
+/**
+ *  \test   Test the part of the stream the app-layer asked to skip.
+ */
+
+static int StreamTcpReassembleTest49 (void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    TcpSession ssn;
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    uint8_t payload[100] = {0};
+    uint16_t payload_size = 100;
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.server, 100);
+    StreamTcpUTSetupStream(&ssn.client, 100);
+
+    int r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 101, payload, payload_size);
+    FAIL_IF(r != 0);
+    ssn.client.app_progress_rel = 100;
+
+    /* parser consumed 100 bytes, doesn't need the next 250 */
+    StreamTcpSetStreamSkip(&ssn, STREAM_TOSERVER, 0, 250);
+    FAIL_IF(ssn.client.skip_until != 350);
+    FAIL_IF(ssn.server.skip_until != 0);
+
+    r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 201, payload, payload_size);
+    FAIL_IF(r != 0);
+    r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 301, payload, payload_size);
+    FAIL_IF(r != 0);
+    FAIL_IF(ssn.client.seg_list_tail->seq != 101);
+
+    /* partly past the skipped part, so it's needed */
+    r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 401, payload, payload_size);
+    FAIL_IF(r != 0);
+    FAIL_IF(ssn.client.seg_list_tail->seq != 401);
+    r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 501, payload, payload_size);
+    FAIL_IF(r != 0);
+    FAIL_IF(ssn.client.seg_list_tail->seq != 501);
+    FAIL_IF(ssn.client.flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED);
+
+    StreamTcpUTClearStream(&ssn.server);
+    StreamTcpUTClearStream(&ssn.client);
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
 /**
  *  \test   Test to make sure we detect the sequence wrap around and continue
  *          stream reassembly properly.
@@ -3657,6 +3922,10 @@ void StreamTcpReassembleRegisterTests(void)
                    StreamTcpReassembleTest46);
     UtRegisterTest("StreamTcpReassembleTest47 -- TCP Sequence Wraparound Test",
                    StreamTcpReassembleTest47);
+    UtRegisterTest("StreamTcpReassembleTest48 -- App-layer Depth Test",
+                   StreamTcpReassembleTest48);
+    UtRegisterTest("StreamTcpReassembleTest49 -- App-layer Skip Test",
+                   StreamTcpReassembleTest49);
 
     UtRegisterTest("StreamTcpReassembleInlineTest01 -- inline RAW ra",
                    StreamTcpReassembleInlineTest01);
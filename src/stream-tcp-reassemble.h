@@ -76,6 +76,9 @@ typedef struct TcpReassemblyThreadCtx_ {
     uint16_t counter_tcp_reass_data_normal_fail;
     uint16_t counter_tcp_reass_data_overlap_fail;
     uint16_t counter_tcp_reass_list_fail;
+
+    /** bytes not reassembled because of the depth, per app-layer protocol */
+    uint16_t counter_tcp_reass_skipped[ALPROTO_MAX];
 } TcpReassemblyThreadCtx;
 
 #define OS_POLICY_DEFAULT   OS_POLICY_BSD
@@ -87,6 +90,8 @@ void StreamTcpReassembleFree(char);
 void StreamTcpReassembleRegisterTests(void);
 TcpReassemblyThreadCtx *StreamTcpReassembleInitThreadCtx(ThreadVars *tv);
 void StreamTcpReassembleFreeThreadCtx(TcpReassemblyThreadCtx *);
+void StreamTcpReassembleRegisterSkippedCounters(ThreadVars *tv,
+        TcpReassemblyThreadCtx *ra_ctx);
 int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
                                  TcpSession *ssn, TcpStream *stream,
                                  Packet *p, enum StreamUpdateDir dir);
@@ -95,6 +100,7 @@ void StreamTcpCreateTestPacket(uint8_t *, uint8_t, uint8_t, uint8_t);
 
 void StreamTcpSetSessionNoReassemblyFlag (TcpSession *, char );
 void StreamTcpSetSessionBypassFlag (TcpSession *);
+void StreamTcpSetSessionEncryptionBypass(TcpSession *ssn, uint64_t bytes);
 void StreamTcpSetDisableRawReassemblyFlag (TcpSession *ssn, char direction);
 
 void StreamTcpSetOSPolicy(TcpStream *, Packet *);
@@ -29,33 +29,96 @@
 #include "stream-tcp-sack.h"
 #include "util-unittest.h"
 
+/*
+ *  The SACK records of a stream are kept in a single array, ordered on
+ *  the left edge. Records never overlap or touch: a new range is merged
+ *  with all the records it overlaps or touches. So the records to merge
+ *  with are found with a binary search, and the array is only grown
+ *  when a stream has more records than ever before, instead of a malloc
+ *  per record. The number of bytes covered is kept up to date on insert
+ *  and prune.
+ */
+
+/** records allocated for a stream's first SACK range */
+#define SACK_LIST_INITIAL_SIZE  8
+
 #ifdef DEBUG
 static void StreamTcpSackPrintList(TcpStream *stream)
 {
-    StreamTcpSackRecord *rec = stream->sack_head;
-    for (; rec != NULL; rec = rec->next) {
-        SCLogDebug("record %8u - %8u", rec->le, rec->re);
+    uint16_t i;
+    for (i = 0; i < stream->sack_cnt; i++) {
+        SCLogDebug("record %8u - %8u", stream->sack_list[i].le, stream->sack_list[i].re);
     }
 }
 #endif /* DEBUG */
 
-static StreamTcpSackRecord *StreamTcpSackRecordAlloc(void)
+/** \internal
+ *  \brief make room for one more record
+ *
+ *  \retval 0 ok
+ *  \retval -1 memcap or alloc failure
+ */
+static int StreamTcpSackListGrow(TcpStream *stream)
 {
-    if (StreamTcpCheckMemcap((uint32_t)sizeof(StreamTcpSackRecord)) == 0)
-        return NULL;
-
-    StreamTcpSackRecord *rec = SCMalloc(sizeof(*rec));
-    if (unlikely(rec == NULL))
-        return NULL;
+    if (stream->sack_cnt < stream->sack_size)
+        return 0;
+    if (stream->sack_size == UINT16_MAX)
+        return -1;
+
+    uint32_t size = stream->sack_size ? (uint32_t)stream->sack_size * 2 :
+                                        SACK_LIST_INITIAL_SIZE;
+    if (size > UINT16_MAX)
+        size = UINT16_MAX;
+
+    const uint64_t grow = (uint64_t)(size - stream->sack_size) * sizeof(StreamTcpSackRecord);
+    if (StreamTcpCheckMemcap(grow) == 0)
+        return -1;
+
+    void *ptr = SCRealloc(stream->sack_list, size * sizeof(StreamTcpSackRecord));
+    if (unlikely(ptr == NULL))
+        return -1;
+
+    StreamTcpIncrMemuse(grow);
+    stream->sack_list = ptr;
+    stream->sack_size = (uint16_t)size;
+    return 0;
+}
 
-    StreamTcpIncrMemuse((uint64_t)sizeof(*rec));
-    return rec;
+/** \internal
+ *  \brief find the first record that ends at or after 'seq'
+ *
+ *  \retval idx index of the record or sack_cnt if there is none
+ */
+static uint16_t StreamTcpSackFindFirstEndingAfter(const TcpStream *stream, uint32_t seq)
+{
+    uint16_t lo = 0, hi = stream->sack_cnt;
+    while (lo < hi) {
+        uint16_t m = lo + (hi - lo) / 2;
+        if (SEQ_LT(stream->sack_list[m].re, seq))
+            lo = m + 1;
+        else
+            hi = m;
+    }
+    return lo;
 }
 
-static void StreamTcpSackRecordFree(StreamTcpSackRecord *rec)
+/** \internal
+ *  \brief find the first record starting after 'seq'
+ *
+ *  \retval idx index of the record or sack_cnt if there is none
+ */
+static uint16_t StreamTcpSackFindFirstStartingAfter(const TcpStream *stream,
+        uint16_t lo, uint32_t seq)
 {
-    SCFree(rec);
-    StreamTcpDecrMemuse((uint64_t)sizeof(*rec));
+    uint16_t hi = stream->sack_cnt;
+    while (lo < hi) {
+        uint16_t m = lo + (hi - lo) / 2;
+        if (SEQ_LEQ(stream->sack_list[m].le, seq))
+            lo = m + 1;
+        else
+            hi = m;
+    }
+    return lo;
 }
 
 /**
@@ -77,167 +140,46 @@ static int StreamTcpSackInsertRange(TcpStream *stream, uint32_t le, uint32_t re)
     /* if to the left of last_ack then ignore */
     if (SEQ_LT(re, stream->last_ack)) {
         SCLogDebug("too far left. discarding");
-        goto end;
+        SCReturnInt(0);
     }
     /* if to the right of the tcp window then ignore */
     if (SEQ_GT(le, (stream->last_ack + stream->window))) {
         SCLogDebug("too far right. discarding");
-        goto end;
+        SCReturnInt(0);
     }
-    if (stream->sack_head != NULL) {
-        StreamTcpSackRecord *rec;
-
-        for (rec = stream->sack_head; rec != NULL; rec = rec->next) {
-            SCLogDebug("rec %p, le %u, re %u", rec, rec->le, rec->re);
-
-            if (SEQ_LT(le, rec->le)) {
-                SCLogDebug("SEQ_LT(le, rec->le)");
-                if (SEQ_LT(re, rec->le)) {
-                    SCLogDebug("SEQ_LT(re, rec->le)");
-                    // entirely before, prepend
-                    StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-                    if (unlikely(stsr == NULL)) {
-                        SCReturnInt(-1);
-                    }
-                    stsr->le = le;
-                    stsr->re = re;
-
-                    stsr->next = stream->sack_head;
-                    stream->sack_head = stsr;
-                    goto end;
-                } else if (SEQ_EQ(re, rec->le)) {
-                    SCLogDebug("SEQ_EQ(re, rec->le)");
-                    // starts before, ends on rec->le, expand
-                    rec->le = le;
-                } else if (SEQ_GT(re, rec->le)) {
-                    SCLogDebug("SEQ_GT(re, rec->le)");
-                    // starts before, ends beyond rec->le
-                    if (SEQ_LEQ(re, rec->re)) {
-                        SCLogDebug("SEQ_LEQ(re, rec->re)");
-                        // ends before rec->re, expand
-                        rec->le = le;
-                    } else { // implied if (re > rec->re)
-                        SCLogDebug("implied if (re > rec->re), le set to %u", rec->re);
-                        le = rec->re;
-                        continue;
-                    }
-                }
-            } else if (SEQ_EQ(le, rec->le)) {
-                SCLogDebug("SEQ_EQ(le, rec->le)");
-                if (SEQ_LEQ(re, rec->re)) {
-                    SCLogDebug("SEQ_LEQ(re, rec->re)");
-                    // new record fully overlapped
-                    SCReturnInt(0);
-                } else { // implied re > rec->re
-                    SCLogDebug("implied re > rec->re");
-                    if (rec->next != NULL) {
-                        if (SEQ_LEQ(re, rec->next->le)) {
-                            rec->re = re;
-                            goto end;
-                        } else {
-                            rec->re = rec->next->le;
-                            le = rec->next->le;
-                            SCLogDebug("le is now %u", le);
-                            continue;
-                        }
-                    } else {
-                        rec->re = re;
-                        goto end;
-                    }
-                }
-            } else { // implied (le > rec->le)
-                SCLogDebug("implied (le > rec->le)");
-                if (SEQ_LT(le, rec->re)) {
-                    SCLogDebug("SEQ_LT(le, rec->re))");
-                    // new record fully overlapped
-                    if (SEQ_GT(re, rec->re)) {
-                        SCLogDebug("SEQ_GT(re, rec->re)");
-
-                        if (rec->next != NULL) {
-                            if (SEQ_LEQ(re, rec->next->le)) {
-                                rec->re = re;
-                                goto end;
-                            } else {
-                                rec->re = rec->next->le;
-                                le = rec->next->le;
-                                continue;
-                            }
-                        } else {
-                            rec->re = re;
-                            goto end;
-                        }
-                    }
-
-                    SCLogDebug("new range fully overlapped");
-                    SCReturnInt(0);
-                } else if (SEQ_EQ(le, rec->re)) {
-                    SCLogDebug("here");
-                    // new record fully overlapped
-                    //int r = StreamTcpSackInsertRange(stream, rec->re+1, re);
-                    //SCReturnInt(r);
-                    le = rec->re;
-                    continue;
-                } else { /* implied le > rec->re */
-                    SCLogDebug("implied le > rec->re");
-                    if (rec->next == NULL) {
-                        SCLogDebug("rec->next == NULL");
-                        StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-                        if (unlikely(stsr == NULL)) {
-                            SCReturnInt(-1);
-                        }
-                        stsr->le = le;
-                        stsr->re = re;
-                        stsr->next = NULL;
-
-                        stream->sack_tail->next = stsr;
-                        stream->sack_tail = stsr;
-                        goto end;
-                    } else {
-                        SCLogDebug("implied rec->next != NULL");
-                        if (SEQ_LT(le, rec->next->le) && SEQ_LT(re, rec->next->le)) {
-                            SCLogDebug("SEQ_LT(le, rec->next->le) && SEQ_LT(re, rec->next->le)");
-                            StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-                            if (unlikely(stsr == NULL)) {
-                                SCReturnInt(-1);
-                            }
-                            stsr->le = le;
-                            stsr->re = re;
-                            stsr->next = rec->next;
-                            rec->next = stsr;
-
-                        } else if (SEQ_LT(le, rec->next->le) && SEQ_GEQ(re, rec->next->le)) {
-                            SCLogDebug("SEQ_LT(le, rec->next->le) && SEQ_GEQ(re, rec->next->le)");
-                            StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-                            if (unlikely(stsr == NULL)) {
-                                SCReturnInt(-1);
-                            }
-                            stsr->le = le;
-                            stsr->re = rec->next->le;
-                            stsr->next = rec->next;
-                            rec->next = stsr;
-
-                            le = rec->next->le;
-                        }
-                    }
-                }
-            }
-        }
-    } else {
-        SCLogDebug("implied empty list");
-        StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-        if (unlikely(stsr == NULL)) {
+
+    /* records first..last-1 overlap or touch the new range */
+    const uint16_t first = StreamTcpSackFindFirstEndingAfter(stream, le);
+    const uint16_t last = StreamTcpSackFindFirstStartingAfter(stream, first, re);
+
+    if (first == last) {
+        if (StreamTcpSackListGrow(stream) != 0)
             SCReturnInt(-1);
-        }
-        stsr->le = le;
-        stsr->re = re;
-        stsr->next = NULL;
 
-        stream->sack_head = stsr;
-        stream->sack_tail = stsr;
+        memmove(&stream->sack_list[first + 1], &stream->sack_list[first],
+                (stream->sack_cnt - first) * sizeof(StreamTcpSackRecord));
+        stream->sack_list[first].le = le;
+        stream->sack_list[first].re = re;
+        stream->sack_cnt++;
+        stream->sacked_size += (re - le);
+    } else {
+        StreamTcpSackRecord *rec = &stream->sack_list[first];
+        uint16_t i;
+        for (i = first; i < last; i++)
+            stream->sacked_size -= (stream->sack_list[i].re - stream->sack_list[i].le);
+
+        if (SEQ_GT(rec->le, le))
+            rec->le = le;
+        rec->re = SEQ_GT(stream->sack_list[last - 1].re, re) ?
+                  stream->sack_list[last - 1].re : re;
+        stream->sacked_size += (rec->re - rec->le);
+
+        memmove(&stream->sack_list[first + 1], &stream->sack_list[last],
+                (stream->sack_cnt - last) * sizeof(StreamTcpSackRecord));
+        stream->sack_cnt -= (last - first - 1);
     }
 
     StreamTcpSackPruneList(stream);
-end:
     SCReturnInt(0);
 }
 
@@ -301,32 +243,28 @@ void StreamTcpSackPruneList(TcpStream *stream)
 {
     SCEnter();
 
-    StreamTcpSackRecord *rec = stream->sack_head;
-
-    while (rec != NULL) {
-        if (SEQ_LT(rec->re, stream->last_ack)) {
-            SCLogDebug("removing le %u re %u", rec->le, rec->re);
-
-            if (rec->next != NULL) {
-                stream->sack_head = rec->next;
-                StreamTcpSackRecordFree(rec);
-                rec = stream->sack_head;
-                continue;
-            } else {
-                stream->sack_head = NULL;
-                stream->sack_tail = NULL;
-                StreamTcpSackRecordFree(rec);
-                break;
-            }
-        } else if (SEQ_LT(rec->le, stream->last_ack)) {
-            SCLogDebug("adjusting record to le %u re %u", rec->le, rec->re);
-            /* last ack inside this record, update */
-            rec->le = stream->last_ack;
-            break;
-        } else {
-            SCLogDebug("record beyond last_ack, nothing to do. Bailing out.");
-            break;
+    if (stream->sack_cnt == 0)
+        SCReturn;
+
+    /* remove the records completely before last_ack */
+    const uint16_t first = StreamTcpSackFindFirstEndingAfter(stream, stream->last_ack);
+    if (first > 0) {
+        uint16_t i;
+        for (i = 0; i < first; i++) {
+            SCLogDebug("removing le %u re %u", stream->sack_list[i].le, stream->sack_list[i].re);
+            stream->sacked_size -= (stream->sack_list[i].re - stream->sack_list[i].le);
         }
+        memmove(&stream->sack_list[0], &stream->sack_list[first],
+                (stream->sack_cnt - first) * sizeof(StreamTcpSackRecord));
+        stream->sack_cnt -= first;
+    }
+
+    /* last ack inside the first record, update */
+    if (stream->sack_cnt > 0 && SEQ_LT(stream->sack_list[0].le, stream->last_ack)) {
+        StreamTcpSackRecord *rec = &stream->sack_list[0];
+        SCLogDebug("adjusting record to le %u re %u", rec->le, rec->re);
+        stream->sacked_size -= (stream->last_ack - rec->le);
+        rec->le = stream->last_ack;
     }
 #ifdef DEBUG
     StreamTcpSackPrintList(stream);
@@ -343,17 +281,15 @@ void StreamTcpSackFreeList(TcpStream *stream)
 {
     SCEnter();
 
-    StreamTcpSackRecord *rec = stream->sack_head;
-    StreamTcpSackRecord *next = NULL;
-
-    while (rec != NULL) {
-        next = rec->next;
-        StreamTcpSackRecordFree(rec);
-        rec = next;
+    if (stream->sack_list != NULL) {
+        SCFree(stream->sack_list);
+        StreamTcpDecrMemuse((uint64_t)stream->sack_size * sizeof(StreamTcpSackRecord));
     }
 
-    stream->sack_head = NULL;
-    stream->sack_tail = NULL;
+    stream->sack_list = NULL;
+    stream->sack_cnt = 0;
+    stream->sack_size = 0;
+    stream->sacked_size = 0;
     SCReturn;
 }
 
@@ -382,9 +318,9 @@ static int StreamTcpSackTest01 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 1 || stream.sack_head->re != 20) {
+    if (stream.sack_list[0].le != 1 || stream.sack_list[0].re != 20) {
         printf("list in weird state, head le %u, re %u: ",
-                stream.sack_head->le, stream.sack_head->re);
+                stream.sack_list[0].le, stream.sack_list[0].re);
         goto end;
     }
 
@@ -419,9 +355,9 @@ static int StreamTcpSackTest02 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 1 || stream.sack_head->re != 20) {
+    if (stream.sack_list[0].le != 1 || stream.sack_list[0].re != 20) {
         printf("list in weird state, head le %u, re %u: ",
-                stream.sack_head->le, stream.sack_head->re);
+                stream.sack_list[0].le, stream.sack_list[0].re);
         goto end;
     }
 
@@ -460,7 +396,7 @@ static int StreamTcpSackTest03 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 5) {
+    if (stream.sack_list[0].le != 5) {
         goto end;
     }
 
@@ -496,7 +432,7 @@ static int StreamTcpSackTest04 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (stream.sack_list[0].le != 0) {
         goto end;
     }
 
@@ -532,7 +468,7 @@ static int StreamTcpSackTest05 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (stream.sack_list[0].le != 0) {
         goto end;
     }
 
@@ -570,7 +506,7 @@ static int StreamTcpSackTest06 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (stream.sack_list[0].le != 0) {
         goto end;
     }
 
@@ -608,7 +544,7 @@ static int StreamTcpSackTest07 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (stream.sack_list[0].le != 0) {
         goto end;
     }
 
@@ -655,7 +591,7 @@ static int StreamTcpSackTest08 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (stream.sack_list[0].le != 0) {
         goto end;
     }
 
@@ -703,7 +639,7 @@ static int StreamTcpSackTest09 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (stream.sack_list[0].le != 0) {
         goto end;
     }
 
@@ -750,7 +686,7 @@ static int StreamTcpSackTest10 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 100) {
+    if (stream.sack_list[0].le != 100) {
         goto end;
     }
 
@@ -797,7 +733,7 @@ static int StreamTcpSackTest11 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 100) {
+    if (stream.sack_list[0].le != 100) {
         goto end;
     }
 
@@ -844,7 +780,7 @@ static int StreamTcpSackTest12 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 100) {
+    if (stream.sack_list[0].le != 100) {
         goto end;
     }
 
@@ -941,6 +877,108 @@ end:
     SCReturnInt(retval);
 }
 
+/** \internal
+ *  \brief check the records are ordered, don't touch, match the
+ *         bitmap and the sacked size */
+static int StreamTcpSackTestCheck(TcpStream *stream, const uint8_t *map,
+        uint32_t base, uint32_t map_len)
+{
+    uint32_t size = 0;
+    uint16_t i;
+    for (i = 0; i < stream->sack_cnt; i++) {
+        const StreamTcpSackRecord *rec = &stream->sack_list[i];
+        if (SEQ_GT(rec->le, rec->re))
+            return 0;
+        if (i > 0 && SEQ_LEQ(rec->le, stream->sack_list[i - 1].re))
+            return 0;
+        size += rec->re - rec->le;
+    }
+    if (size != StreamTcpSackedSize(stream))
+        return 0;
+
+    uint32_t o;
+    for (o = 0; o < map_len; o++) {
+        int sacked = 0;
+        for (i = 0; i < stream->sack_cnt; i++) {
+            if (SEQ_GEQ(base + o, stream->sack_list[i].le) &&
+                SEQ_LT(base + o, stream->sack_list[i].re))
+                sacked = 1;
+        }
+        if (sacked != map[o])
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ *  \test  Random inserts and prunes against a bitmap, around the
+ *          sequence number wrap.
+ */
+static int StreamTcpSackTest15 (void)
+{
+    TcpStream stream;
+    uint8_t map[5000];
+    const uint32_t base = 0xfffff000;
+    uint32_t seed = 1;
+    int i;
+
+    memset(&stream, 0, sizeof(stream));
+    memset(map, 0, sizeof(map));
+    stream.last_ack = base;
+    stream.window = 4000;
+
+    for (i = 0; i < 2000; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t le = (seed >> 8) % 4000;
+        seed = seed * 1103515245 + 12345;
+        uint32_t len = 1 + (seed >> 8) % 50;
+
+        FAIL_IF(StreamTcpSackInsertRange(&stream, base + le, base + le + len) != 0);
+        memset(map + le, 1, len);
+        FAIL_IF_NOT(StreamTcpSackTestCheck(&stream, map, base, sizeof(map)));
+    }
+
+    for (i = 0; i < 40; i++) {
+        stream.last_ack += 100;
+        StreamTcpSackPruneList(&stream);
+        memset(map, 0, (i + 1) * 100);
+        FAIL_IF_NOT(StreamTcpSackTestCheck(&stream, map, base, sizeof(map)));
+    }
+    FAIL_IF(stream.sack_cnt > 1);
+
+    StreamTcpSackFreeList(&stream);
+    FAIL_IF(stream.sack_list != NULL || StreamTcpSackedSize(&stream) != 0);
+    PASS;
+}
+
+/**
+ *  \test  Many records: the list grows, then a single range covers
+ *          them all.
+ */
+static int StreamTcpSackTest16 (void)
+{
+    TcpStream stream;
+    int i;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.window = 100000;
+
+    for (i = 0; i < 1000; i++) {
+        FAIL_IF(StreamTcpSackInsertRange(&stream, 100 + (i * 20), 110 + (i * 20)) != 0);
+    }
+    FAIL_IF(stream.sack_cnt != 1000);
+    FAIL_IF(stream.sack_size < 1000);
+    FAIL_IF(StreamTcpSackedSize(&stream) != 10000);
+
+    FAIL_IF(StreamTcpSackInsertRange(&stream, 105, 20100) != 0);
+    FAIL_IF(stream.sack_cnt != 1);
+    FAIL_IF(stream.sack_list[0].le != 100 || stream.sack_list[0].re != 20100);
+    FAIL_IF(StreamTcpSackedSize(&stream) != 20000);
+
+    StreamTcpSackFreeList(&stream);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void StreamTcpSackRegisterTests (void)
@@ -964,5 +1002,9 @@ void StreamTcpSackRegisterTests (void)
                    StreamTcpSackTest13);
     UtRegisterTest("StreamTcpSackTest14 -- Insertion out of window",
                    StreamTcpSackTest14);
+    UtRegisterTest("StreamTcpSackTest15 -- Insertion && Pruning random",
+                   StreamTcpSackTest15);
+    UtRegisterTest("StreamTcpSackTest16 -- Insertion many records",
+                   StreamTcpSackTest16);
 #endif
 }
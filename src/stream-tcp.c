@@ -74,6 +74,7 @@
 #include "util-validate.h"
 #include "util-runmodes.h"
 #include "util-random.h"
+#include "util-memcap.h"
 
 #include "source-pcap-file.h"
 
@@ -115,45 +116,32 @@ static uint64_t ssn_pool_cnt = 0; /** counts ssns, protected by ssn_pool_mutex *
 #endif
 
 uint64_t StreamTcpReassembleMemuseGlobalCounter(void);
-SC_ATOMIC_DECLARE(uint64_t, st_memuse);
+
+/* Memory use counter, see util-memcap.c */
+static MemcapCounter st_memuse;
 
 void StreamTcpInitMemuse(void)
 {
-    SC_ATOMIC_INIT(st_memuse);
+    MemcapCounterInit(&st_memuse, "stream", &stream_config.memcap);
 }
 
 void StreamTcpIncrMemuse(uint64_t size)
 {
-    (void) SC_ATOMIC_ADD(st_memuse, size);
-    SCLogDebug("STREAM %"PRIu64", incr %"PRIu64, StreamTcpMemuseCounter(), size);
+    MemcapCounterIncr(&st_memuse, size);
+    SCLogDebug("STREAM incr %"PRIu64, size);
     return;
 }
 
 void StreamTcpDecrMemuse(uint64_t size)
 {
-#ifdef DEBUG_VALIDATION
-    uint64_t presize = SC_ATOMIC_GET(st_memuse);
-    if (RunmodeIsUnittests()) {
-        BUG_ON(presize > UINT_MAX);
-    }
-#endif
-
-    (void) SC_ATOMIC_SUB(st_memuse, size);
-
-#ifdef DEBUG_VALIDATION
-    if (RunmodeIsUnittests()) {
-        uint64_t postsize = SC_ATOMIC_GET(st_memuse);
-        BUG_ON(postsize > presize);
-    }
-#endif
-    SCLogDebug("STREAM %"PRIu64", decr %"PRIu64, StreamTcpMemuseCounter(), size);
+    MemcapCounterDecr(&st_memuse, size);
+    SCLogDebug("STREAM decr %"PRIu64, size);
     return;
 }
 
 uint64_t StreamTcpMemuseCounter(void)
 {
-    uint64_t memusecopy = SC_ATOMIC_GET(st_memuse);
-    return memusecopy;
+    return MemcapCounterGet(&st_memuse);
 }
 
 /**
@@ -164,9 +152,7 @@ uint64_t StreamTcpMemuseCounter(void)
  */
 int StreamTcpCheckMemcap(uint64_t size)
 {
-    if (stream_config.memcap == 0 || size + SC_ATOMIC_GET(st_memuse) <= stream_config.memcap)
-        return 1;
-    return 0;
+    return MemcapCounterCheck(&st_memuse, size);
 }
 
 void StreamTcpStreamCleanup(TcpStream *stream)
@@ -4599,6 +4585,12 @@ int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
         }
     skip:
 
+        if (TCP_HAS_SACK(p)) {
+            const TcpStream *acked = PKT_IS_TOSERVER(p) ? &ssn->server : &ssn->client;
+            StatsAddUI64(tv, stt->counter_tcp_sack_records, acked->sack_cnt);
+            StatsSetUI64(tv, stt->counter_tcp_sack_records_max, acked->sack_cnt);
+        }
+
         if (ssn->state >= TCP_ESTABLISHED) {
             p->flags |= PKT_STREAM_EST;
         }
@@ -4676,6 +4668,18 @@ int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
             SCLogDebug("bypass as stream is dead and we have no rules");
             PacketBypassCallback(p);
         }
+
+        /* encrypted session that used up its bytes: nothing left to match */
+        if (ssn->flags & STREAMTCP_FLAG_ENCRYPTION_BYPASS) {
+            if (p->payload_len >= ssn->encryption_bypass_left) {
+                SCLogDebug("ssn %p: encryption bypass", ssn);
+                ssn->encryption_bypass_left = 0;
+                p->flow->flags |= FLOW_ENCRYPTION_BYPASSED;
+                PacketBypassCallback(p);
+            } else {
+                ssn->encryption_bypass_left -= p->payload_len;
+            }
+        }
     }
 
     SCReturnInt(0);
@@ -4951,6 +4955,8 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->counter_tcp_syn = StatsRegisterCounter("tcp.syn", tv);
     stt->counter_tcp_synack = StatsRegisterCounter("tcp.synack", tv);
     stt->counter_tcp_rst = StatsRegisterCounter("tcp.rst", tv);
+    stt->counter_tcp_sack_records = StatsRegisterAvgCounter("tcp.sack_records", tv);
+    stt->counter_tcp_sack_records_max = StatsRegisterMaxCounter("tcp.sack_records_max", tv);
 
     /* init reassembly ctx */
     stt->ra_ctx = StreamTcpReassembleInitThreadCtx(tv);
@@ -4966,6 +4972,7 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->ra_ctx->counter_tcp_reass_data_normal_fail = StatsRegisterCounter("tcp.insert_data_normal_fail", tv);
     stt->ra_ctx->counter_tcp_reass_data_overlap_fail = StatsRegisterCounter("tcp.insert_data_overlap_fail", tv);
     stt->ra_ctx->counter_tcp_reass_list_fail = StatsRegisterCounter("tcp.insert_list_fail", tv);
+    StreamTcpReassembleRegisterSkippedCounters(tv, stt->ra_ctx);
 
 
     SCLogDebug("StreamTcp thread specific ctx online at %p, reassembly ctx %p",
@@ -5607,6 +5614,21 @@ void StreamTcpSetSessionBypassFlag (TcpSession *ssn)
     ssn->flags |= STREAMTCP_FLAG_BYPASS;
 }
 
+/** \brief start the encryption bypass countdown
+ *
+ * \param ssn TCP Session
+ * \param bytes bytes (both directions) to still process before bypass
+ */
+void StreamTcpSetSessionEncryptionBypass(TcpSession *ssn, uint64_t bytes)
+{
+    if (ssn->flags & STREAMTCP_FLAG_ENCRYPTION_BYPASS)
+        return;
+
+    SCLogDebug("ssn %p: encrypted, bypass after %"PRIu64" bytes", ssn, bytes);
+    ssn->encryption_bypass_left = bytes;
+    ssn->flags |= STREAMTCP_FLAG_ENCRYPTION_BYPASS;
+}
+
 #define PSEUDO_PKT_SET_IPV4HDR(nipv4h,ipv4h) do { \
         IPV4_SET_RAW_VER(nipv4h, IPV4_GET_RAW_VER(ipv4h)); \
         IPV4_SET_RAW_HLEN(nipv4h, IPV4_GET_RAW_HLEN(ipv4h)); \
@@ -5764,6 +5786,7 @@ void StreamTcpPseudoPacketCreateStreamEndPacket(ThreadVars *tv, StreamTcpThread
     StreamTcpPseudoPacketSetupHeader(np,p);
 
     np->tenant_id = p->flow->tenant_id;
+    np->input_id = p->flow->input_id;
 
     np->flowflags = p->flowflags;
 
@@ -5831,6 +5854,7 @@ static void StreamTcpPseudoPacketCreateDetectLogFlush(ThreadVars *tv,
     StreamTcpPseudoPacketSetupHeader(np,p);
 
     np->tenant_id = p->flow->tenant_id;
+    np->input_id = p->flow->input_id;
     np->flowflags = p->flowflags;
 
     np->flags |= PKT_STREAM_EST;
@@ -5968,6 +5992,43 @@ void TcpSessionSetReassemblyDepth(TcpSession *ssn, uint32_t size)
     return;
 }
 
+/**
+ *  \brief Limit reassembly of a stream to what the app-layer still needs
+ *
+ *  The limit is relative to the app-layer progress of the stream. Once
+ *  it is reached the stream is treated as if its reassembly depth was
+ *  reached.
+ *
+ *  \param direction STREAM_TOSERVER or STREAM_TOCLIENT
+ *  \param remaining bytes past the app-layer progress still needed
+ */
+void StreamTcpSetStreamDepthRemaining(TcpSession *ssn, uint8_t direction,
+        uint64_t remaining)
+{
+    TcpStream *stream = (direction & STREAM_TOSERVER) ? &ssn->client : &ssn->server;
+
+    stream->depth_limit = STREAM_APP_PROGRESS(stream) + remaining;
+    stream->flags |= STREAMTCP_STREAM_FLAG_DEPTH_LIMIT;
+    SCLogDebug("ssn %p: stream %p depth limit %"PRIu64, ssn, stream,
+            stream->depth_limit);
+}
+
+/**
+ *  \brief Skip a part of a stream on behalf of the app-layer
+ *
+ *  The \a len bytes starting \a offset bytes past the app progress
+ *  are not reassembled and not handed to the app-layer.
+ */
+void StreamTcpSetStreamSkip(TcpSession *ssn, uint8_t direction,
+        uint64_t offset, uint32_t len)
+{
+    TcpStream *stream = (direction & STREAM_TOSERVER) ? &ssn->client : &ssn->server;
+
+    stream->skip_until = STREAM_APP_PROGRESS(stream) + offset + len;
+    SCLogDebug("ssn %p: stream %p skip until %"PRIu64, ssn, stream,
+            stream->skip_until);
+}
+
 #ifdef UNITTESTS
 
 #define SET_ISN(stream, setseq)             \
@@ -8291,7 +8352,7 @@ static int StreamTcpTest23(void)
     SCFree(p);
     FLOW_DESTROY(&f);
     StreamTcpUTDeinit(stt.ra_ctx);
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) > 0);
+    FAIL_IF(StreamTcpMemuseCounter() > 0);
     PASS;
 }
 
@@ -8356,7 +8417,7 @@ static int StreamTcpTest24(void)
     SCFree(p);
     FLOW_DESTROY(&f);
     StreamTcpUTDeinit(stt.ra_ctx);
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) > 0);
+    FAIL_IF(StreamTcpMemuseCounter() > 0);
     PASS;
 }
 
@@ -8647,13 +8708,13 @@ static int StreamTcpTest28(void)
     StreamTcpThread stt;
     StreamTcpUTInit(&stt.ra_ctx);
 
-    uint32_t memuse = SC_ATOMIC_GET(st_memuse);
+    uint32_t memuse = StreamTcpMemuseCounter();
 
     StreamTcpIncrMemuse(500);
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) != (memuse+500));
+    FAIL_IF(StreamTcpMemuseCounter() != (memuse+500));
 
     StreamTcpDecrMemuse(500);
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) != memuse);
+    FAIL_IF(StreamTcpMemuseCounter() != memuse);
 
     FAIL_IF(StreamTcpCheckMemcap(500) != 1);
 
@@ -8661,7 +8722,7 @@ static int StreamTcpTest28(void)
 
     StreamTcpUTDeinit(stt.ra_ctx);
 
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) != 0);
+    FAIL_IF(StreamTcpMemuseCounter() != 0);
     PASS;
 }
 
@@ -10420,6 +10481,74 @@ end:
     return ret;
 }
 
+/**
+ *  \test   Test the encryption bypass: the flow is bypassed once the
+ *          configured number of bytes has been seen.
+ */
+
+static int StreamTcpTest46 (void)
+{
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    FAIL_IF(unlikely(p == NULL));
+    Flow f;
+    ThreadVars tv;
+    StreamTcpThread stt;
+    TCPHdr tcph;
+    uint8_t payload[2] = { 0x42, 0x42 };
+
+    memset(p, 0, SIZE_OF_PACKET);
+    PacketQueue pq;
+    memset(&pq,0,sizeof(PacketQueue));
+    memset (&f, 0, sizeof(Flow));
+    memset(&tv, 0, sizeof (ThreadVars));
+    memset(&stt, 0, sizeof(StreamTcpThread));
+    memset(&tcph, 0, sizeof(TCPHdr));
+
+    FLOW_INITIALIZE(&f);
+    p->flow = &f;
+
+    StreamTcpUTInit(&stt.ra_ctx);
+    stream_config.midstream = TRUE;
+
+    tcph.th_win = htons(5480);
+    tcph.th_seq = htonl(10);
+    tcph.th_ack = htonl(20);
+    tcph.th_flags = TH_ACK|TH_PUSH;
+    p->tcph = &tcph;
+
+    p->payload = payload;
+    p->payload_len = 2;
+
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+    TcpSession *ssn = p->flow->protoctx;
+    FAIL_IF_NULL(ssn);
+
+    StreamTcpSetSessionEncryptionBypass(ssn, 3);
+    FAIL_IF_NOT(ssn->flags & STREAMTCP_FLAG_ENCRYPTION_BYPASS);
+    /* already counting down, can't be reset */
+    StreamTcpSetSessionEncryptionBypass(ssn, 100);
+    FAIL_IF(ssn->encryption_bypass_left != 3);
+
+    p->tcph->th_seq = htonl(12);
+    p->flowflags = FLOW_PKT_TOSERVER;
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+    FAIL_IF(ssn->encryption_bypass_left != 1);
+    FAIL_IF(SC_ATOMIC_GET(f.flow_state) == FLOW_STATE_LOCAL_BYPASSED);
+    FAIL_IF(f.flags & FLOW_ENCRYPTION_BYPASSED);
+
+    p->tcph->th_seq = htonl(14);
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+    FAIL_IF(ssn->encryption_bypass_left != 0);
+    FAIL_IF(SC_ATOMIC_GET(f.flow_state) != FLOW_STATE_LOCAL_BYPASSED);
+    FAIL_IF_NOT(f.flags & FLOW_ENCRYPTION_BYPASSED);
+
+    StreamTcpSessionClear(p->flow->protoctx);
+    SCFree(p);
+    FLOW_DESTROY(&f);
+    StreamTcpUTDeinit(stt.ra_ctx);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void StreamTcpRegisterTests (void)
@@ -10496,6 +10625,7 @@ void StreamTcpRegisterTests (void)
     UtRegisterTest("StreamTcpTest43 -- SYN/ACK queue", StreamTcpTest43);
     UtRegisterTest("StreamTcpTest44 -- SYN/ACK queue", StreamTcpTest44);
     UtRegisterTest("StreamTcpTest45 -- SYN/ACK queue", StreamTcpTest45);
+    UtRegisterTest("StreamTcpTest46 -- encryption bypass", StreamTcpTest46);
 
     /* set up the reassembly tests as well */
     StreamTcpReassembleRegisterTests();
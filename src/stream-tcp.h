@@ -94,6 +94,9 @@ typedef struct StreamTcpThread_ {
     uint16_t counter_tcp_synack;
     /** rst pkts */
     uint16_t counter_tcp_rst;
+    /** SACK records of the stream acked by a pkt with SACK, avg and max */
+    uint16_t counter_tcp_sack_records;
+    uint16_t counter_tcp_sack_records_max;
 
     /** tcp reassembly thread data */
     TcpReassemblyThreadCtx *ra_ctx;
@@ -120,6 +123,10 @@ int StreamTcpSegmentForEach(const Packet *p, uint8_t flag,
                         void *data);
 void StreamTcpReassembleConfigEnableOverlapCheck(void);
 void TcpSessionSetReassemblyDepth(TcpSession *ssn, uint32_t size);
+void StreamTcpSetStreamDepthRemaining(TcpSession *ssn, uint8_t direction,
+        uint64_t remaining);
+void StreamTcpSetStreamSkip(TcpSession *ssn, uint8_t direction,
+        uint64_t offset, uint32_t len);
 
 typedef int (*StreamReassembleRawFunc)(void *data, const uint8_t *input, const uint32_t input_len);
 
@@ -130,6 +137,8 @@ int StreamReassembleLog(TcpSession *ssn, TcpStream *stream,
 int StreamReassembleRaw(TcpSession *ssn, const Packet *p,
         StreamReassembleRawFunc Callback, void *cb_data, uint64_t *progress_out);
 void StreamReassembleRawUpdateProgress(TcpSession *ssn, Packet *p, uint64_t progress);
+void StreamReassembleRawSpans(TcpSession *ssn, const Packet *p, StreamRawSpans *spans);
+void StreamRawSpansFree(StreamRawSpans *spans);
 
 void StreamTcpDetectLogFlush(ThreadVars *tv, StreamTcpThread *stt, Flow *f, Packet *p, PacketQueue *pq);
 
@@ -33,6 +33,23 @@
 #define STREAM_GAP              0x10    /**< data gap encountered */
 #define STREAM_DEPTH            0x20    /**< depth reached */
 
+/** contiguous block of raw stream data */
+typedef struct StreamRawSpan_ {
+    const uint8_t *data;
+    uint32_t data_len;
+} StreamRawSpan;
+
+/** the raw stream data to inspect for a packet, as the list of blocks
+ *  the raw reassembly would hand to its callback one by one. The spans
+ *  point into the stream's buffer. */
+typedef struct StreamRawSpans_ {
+    StreamRawSpan *span;
+    uint32_t cnt;
+    uint32_t size;          /**< size of the span array */
+    uint64_t progress;      /**< raw progress after inspecting all spans */
+    bool failed;            /**< span array couldn't grow */
+} StreamRawSpans;
+
 typedef int (*StreamSegmentCallback)(const Packet *, void *, const uint8_t *, uint32_t);
 int StreamSegmentForEach(const Packet *p, uint8_t flag,
                          StreamSegmentCallback CallbackFunc,
@@ -904,6 +904,7 @@ void RegisterAllModules(void)
     TmModuleDecodePcapRegister();
     /* pcap file */
     TmModuleReceivePcapFileRegister();
+    TmModuleReceivePcapFileMmapRegister();
     TmModuleDecodePcapFileRegister();
 #ifdef HAVE_MPIPE
     /* mpipe */
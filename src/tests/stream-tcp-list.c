@@ -708,6 +708,101 @@ static int StreamTcpReassembleTest32(void)
     OVERLAP_END;
 }
 
+/** \internal
+ *  \brief check the segment tree: parent links, order, no red node with a
+ *         red child, the same number of black nodes on every path and an
+ *         in order walk that matches the segment list
+ *
+ *  \retval black height, or -1 on error
+ */
+static int SegTreeValidateNode(const TcpSegment *node, const TcpSegment **list)
+{
+    if (node == NULL)
+        return 0;
+
+    if (node->tree_left != NULL && (node->tree_left->tree_parent != node ||
+                SEQ_GT(node->tree_left->seq, node->seq)))
+        return -1;
+    if (node->tree_right != NULL && (node->tree_right->tree_parent != node ||
+                SEQ_LT(node->tree_right->seq, node->seq)))
+        return -1;
+    if (node->tree_color == SEG_TREE_RED &&
+            (SEG_TREE_IS_RED(node->tree_left) || SEG_TREE_IS_RED(node->tree_right)))
+        return -1;
+
+    int l = SegTreeValidateNode(node->tree_left, list);
+    if (l < 0 || *list != node)
+        return -1;
+    *list = node->next;
+    int r = SegTreeValidateNode(node->tree_right, list);
+    if (r < 0 || l != r)
+        return -1;
+
+    return l + (node->tree_color == SEG_TREE_BLACK);
+}
+
+static int SegTreeValidate(const TcpStream *stream)
+{
+    const TcpSegment *list = stream->seg_list;
+
+    if (stream->seg_tree != NULL && (stream->seg_tree->tree_parent != NULL ||
+                stream->seg_tree->tree_color != SEG_TREE_BLACK))
+        return 0;
+    if (SegTreeValidateNode(stream->seg_tree, &list) < 0)
+        return 0;
+    /* all list segments seen */
+    return (list == NULL);
+}
+
+/** \test heavily reordered inserts and removals keep the segment tree
+ *        balanced and in line with the list */
+static int StreamTcpReassembleTest33(void)
+{
+    OVERLAP_START(0, OS_POLICY_BSD);
+
+    const uint32_t segs = 1000;
+    uint8_t expect[segs * 4];
+    uint32_t i;
+
+    for (i = 0; i < segs; i++) {
+        /* 389 and 1000 are coprime, so this visits every segment once */
+        uint32_t n = (i * 389) % segs;
+        uint8_t data[4];
+        memset(data, 'A' + (n % 26), sizeof(data));
+        memcpy(expect + n * 4, data, sizeof(data));
+
+        FAIL_IF(StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, stream,
+                    stream->isn + 1 + n * 4, data, sizeof(data)) != 0);
+        /* retransmissions */
+        if (i % 10 == 0) {
+            FAIL_IF(StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, stream,
+                        stream->isn + 1 + n * 4, data, sizeof(data)) != 0);
+        }
+        if (i % 50 == 0) {
+            FAIL_IF_NOT(SegTreeValidate(stream));
+        }
+    }
+    FAIL_IF_NOT(SegTreeValidate(stream));
+    FAIL_IF(!(VALIDATE(stream, expect, sizeof(expect))));
+
+    /* remove every other segment */
+    TcpSegment *seg = stream->seg_list;
+    for (i = 0; seg != NULL; i++) {
+        TcpSegment *next = seg->next;
+        if (i % 2 == 0) {
+            StreamTcpRemoveSegmentFromStream(stream, seg);
+            StreamTcpSegmentReturntoPool(seg);
+        }
+        if (i % 50 == 0) {
+            FAIL_IF_NOT(SegTreeValidate(stream));
+        }
+        seg = next;
+    }
+    FAIL_IF_NOT(SegTreeValidate(stream));
+
+    OVERLAP_END;
+}
+
 void StreamTcpListRegisterTests(void)
 {
     UtRegisterTest("StreamTcpReassembleTest01 -- BSD policy",
@@ -729,5 +824,7 @@ void StreamTcpListRegisterTests(void)
             StreamTcpReassembleTest31);
     UtRegisterTest("StreamTcpReassembleTest32",
             StreamTcpReassembleTest32);
+    UtRegisterTest("StreamTcpReassembleTest33 -- segment tree",
+            StreamTcpReassembleTest33);
 
 }
@@ -54,7 +54,21 @@ static int TestReassembleRawValidate(TcpSession *ssn, Packet *p,
 {
     struct TestReassembleRawCallbackData cb = { data, data_len };
     uint64_t progress = 0;
+
+    /* the spans should have the same data and progress */
+    StreamRawSpans spans;
+    memset(&spans, 0, sizeof(spans));
+    StreamReassembleRawSpans(ssn, p, &spans);
+    int spans_ok = (spans.cnt == 1 && spans.span[0].data_len == data_len &&
+                    memcmp(spans.span[0].data, data, data_len) == 0);
+    uint64_t spans_progress = spans.progress;
+    StreamRawSpansFree(&spans);
+    if (!spans_ok)
+        return -1;
+
     int r = StreamReassembleRaw(ssn, p, TestReassembleRawCallback, &cb, &progress);
+    if (spans_progress != progress)
+        return -1;
     if (r == 1) {
         StreamReassembleRawUpdateProgress(ssn, p, progress);
     }
@@ -187,6 +201,60 @@ static int StreamTcpReassembleRawTest08 (void)
     RAWREASSEMBLY_END;
 }
 
+static int TestReassembleRawCountCallback(void *cb_data, const uint8_t *data, const uint32_t data_len)
+{
+    (*(uint32_t *)cb_data)++;
+    return 0;
+}
+
+/** \test IDS mode: one span per block of data around a gap */
+static int StreamTcpReassembleRawTest09 (void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    TcpSession ssn;
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+    TcpStream *stream = &ssn.client;
+
+    FAIL_IF(StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, stream, 2, (uint8_t *)"AAA", 3) != 0);
+    FAIL_IF(StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, stream, 8, (uint8_t *)"CCC", 3) != 0);
+    stream->last_ack = 11;
+    stream->flags |= STREAMTCP_STREAM_FLAG_TRIGGER_RAW;
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    p->flowflags = FLOW_PKT_TOSERVER;
+
+    StreamRawSpans spans;
+    memset(&spans, 0, sizeof(spans));
+    StreamReassembleRawSpans(&ssn, p, &spans);
+    FAIL_IF(spans.cnt != 2);
+    FAIL_IF(spans.span[0].data_len != 3 || memcmp(spans.span[0].data, "AAA", 3) != 0);
+    FAIL_IF(spans.span[1].data_len != 3 || memcmp(spans.span[1].data, "CCC", 3) != 0);
+
+    /* same blocks and progress as the callback gets */
+    uint32_t cnt = 0;
+    uint64_t progress = 0;
+    StreamReassembleRaw(&ssn, p, TestReassembleRawCountCallback, &cnt, &progress);
+    FAIL_IF(cnt != spans.cnt);
+    FAIL_IF(progress != spans.progress);
+
+    /* reused without leaking */
+    StreamReassembleRawSpans(&ssn, p, &spans);
+    FAIL_IF(spans.cnt != 2);
+    StreamRawSpansFree(&spans);
+    FAIL_IF_NOT_NULL(spans.span);
+
+    PacketFree(p);
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
 static void StreamTcpReassembleRawRegisterTests(void)
 {
     UtRegisterTest("StreamTcpReassembleRawTest01",
@@ -205,4 +273,6 @@ static void StreamTcpReassembleRawRegisterTests(void)
                    StreamTcpReassembleRawTest07);
     UtRegisterTest("StreamTcpReassembleRawTest08",
                    StreamTcpReassembleRawTest08);
+    UtRegisterTest("StreamTcpReassembleRawTest09",
+                   StreamTcpReassembleRawTest09);
 }
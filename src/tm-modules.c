@@ -207,6 +207,7 @@ const char * TmModuleTmmIdToString(TmmId id)
         CASE_CODE (TMM_RECEIVENFQ);
         CASE_CODE (TMM_RECEIVEPCAP);
         CASE_CODE (TMM_RECEIVEPCAPFILE);
+        CASE_CODE (TMM_RECEIVEPCAPFILEMMAP);
         CASE_CODE (TMM_DECODEPCAP);
         CASE_CODE (TMM_DECODEPCAPFILE);
         CASE_CODE (TMM_RECEIVEPFRING);
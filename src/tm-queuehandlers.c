@@ -34,6 +34,7 @@
 #include "tmqh-nfq.h"
 #include "tmqh-packetpool.h"
 #include "tmqh-flow.h"
+#include "tmqh-ring.h"
 
 void TmqhSetup (void)
 {
@@ -42,12 +43,15 @@ void TmqhSetup (void)
     TmqhSimpleRegister();
     TmqhNfqRegister();
     TmqhPacketpoolRegister();
+    TmqhRingRegister();
     TmqhFlowRegister();
 }
 
 /** \brief Clean up registration time allocs */
 void TmqhCleanup(void)
 {
+    TmqhRingCleanup();
+    TmqhFlowCleanup();
 }
 
 Tmqh* TmqhGetQueueHandlerByName(const char *name)
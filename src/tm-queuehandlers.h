@@ -29,6 +29,7 @@ enum {
     TMQH_NFQ,
     TMQH_PACKETPOOL,
     TMQH_FLOW,
+    TMQH_RING,
 
     TMQH_SIZE,
 };
@@ -40,6 +41,7 @@ typedef struct Tmqh_ {
     void (*OutHandler)(ThreadVars *, Packet *);
     void *(*OutHandlerCtxSetup)(const char *);
     void (*OutHandlerCtxFree)(void *);
+    void (*OutHandlerCtxRegisterCounters)(ThreadVars *, void *);
     void (*RegisterTests)(void);
 } Tmqh;
 
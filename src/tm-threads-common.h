@@ -37,6 +37,7 @@ typedef enum {
     TMM_RECEIVENFQ,
     TMM_RECEIVEPCAP,
     TMM_RECEIVEPCAPFILE,
+    TMM_RECEIVEPCAPFILEMMAP,
     TMM_DECODEPCAP,
     TMM_DECODEPCAPFILE,
     TMM_RECEIVEPFRING,
@@ -34,6 +34,7 @@
 #include "tm-queuehandlers.h"
 #include "tm-threads.h"
 #include "tmqh-packetpool.h"
+#include "tmqh-ring.h"
 #include "threads.h"
 #include "util-debug.h"
 #include "util-privs.h"
@@ -173,6 +174,166 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
     return TM_ECODE_OK;
 }
 
+/** \internal
+ *  \brief return packets of a failed batch to the packet pool */
+static void TmThreadsSlotBatchRelease(ThreadVars *tv, Packet **pkts, uint32_t cnt)
+{
+    for (uint32_t i = 0; i < cnt; i++) {
+        TmqhOutputPacketpool(tv, pkts[i]);
+    }
+}
+
+/** \internal
+ *  \brief run a batch through the slots starting at 's'
+ *
+ *  When the slot puts pseudo packets in its pre queue for packet 'i',
+ *  packets 0..i-1 are first run through the remaining slots, then the
+ *  pseudo packets, and then the rest of the batch continues. This way
+ *  the packets reach each slot in the same order as they would with
+ *  TmThreadsSlotVarRun.
+ *
+ *  \retval TM_ECODE_OK or TM_ECODE_FAILED. On failure the packets that
+ *          were not passed to tmqh_out yet have been returned to the
+ *          packet pool.
+ */
+static TmEcode TmThreadsSlotRunBatch(ThreadVars *tv, TmSlot *s,
+        Packet **pkts, uint32_t cnt)
+{
+    TmEcode r;
+
+    if (s == NULL) {
+        for (uint32_t i = 0; i < cnt; i++) {
+            tv->tmqh_out(tv, pkts[i]);
+        }
+        return TM_ECODE_OK;
+    }
+    if (cnt == 0)
+        return TM_ECODE_OK;
+
+    TmSlotFunc SlotFunc = SC_ATOMIC_GET(s->SlotFunc);
+    void *slot_data = SC_ATOMIC_GET(s->slot_data);
+
+    if (tmm_modules[s->tm_id].FuncBatchPrepare != NULL) {
+        tmm_modules[s->tm_id].FuncBatchPrepare(tv, pkts, cnt, slot_data);
+    }
+
+    /* first packet not yet passed on to the next slot */
+    uint32_t start = 0;
+    for (uint32_t i = 0; i < cnt; i++) {
+        Packet *p = pkts[i];
+
+        PACKET_PROFILING_TMM_START(p, s->tm_id);
+        if (unlikely(s->id == 0)) {
+            r = SlotFunc(tv, p, slot_data, &s->slot_pre_pq, &s->slot_post_pq);
+        } else {
+            r = SlotFunc(tv, p, slot_data, &s->slot_pre_pq, NULL);
+        }
+        PACKET_PROFILING_TMM_END(p, s->tm_id);
+
+        if (unlikely(r == TM_ECODE_FAILED)) {
+            TmThreadsSlotBatchRelease(tv, pkts + start, cnt - start);
+            return TM_ECODE_FAILED;
+        }
+
+        if (likely(s->slot_pre_pq.top == NULL))
+            continue;
+
+        /* the packets before this one go ahead of its pseudo packets */
+        r = TmThreadsSlotRunBatch(tv, s->slot_next, pkts + start, i - start);
+        start = i;
+        if (unlikely(r == TM_ECODE_FAILED)) {
+            TmThreadsSlotBatchRelease(tv, pkts + start, cnt - start);
+            return TM_ECODE_FAILED;
+        }
+
+        while (s->slot_pre_pq.top != NULL) {
+            Packet *extra_p = PacketDequeue(&s->slot_pre_pq);
+            if (unlikely(extra_p == NULL))
+                continue;
+
+            if (s->slot_next != NULL) {
+                r = TmThreadsSlotVarRun(tv, extra_p, s->slot_next);
+                if (unlikely(r == TM_ECODE_FAILED)) {
+                    TmqhOutputPacketpool(tv, extra_p);
+                    TmThreadsSlotBatchRelease(tv, pkts + start, cnt - start);
+                    return TM_ECODE_FAILED;
+                }
+            }
+            tv->tmqh_out(tv, extra_p);
+        }
+    }
+
+    return TmThreadsSlotRunBatch(tv, s->slot_next, pkts + start, cnt - start);
+}
+
+/**
+ * \brief Process a batch of packets through the slots
+ *
+ * Unlike TmThreadsSlotProcessPkt the batch is processed slot by slot:
+ * each slot handles the packets of the batch before the next slot is
+ * called. Modules can register a FuncBatchPrepare callback to see the
+ * packets before their Func is called for the individual packets, e.g.
+ * to prefetch.
+ *
+ * When a slot queues pseudo packets for a packet, the batch is split
+ * there: the packets before it finish the remaining slots first, then
+ * the pseudo packets, so that each slot still sees the packets in the
+ * same order as with TmThreadsSlotVarRun.
+ *
+ * \param slot first slot to run the batch through
+ * \param pkts array of packets
+ * \param cnt number of packets in the array
+ *
+ * \retval TM_ECODE_OK or TM_ECODE_FAILED. On failure the packets of the
+ *         batch that were not passed on yet have been returned to the
+ *         packet pool.
+ */
+TmEcode TmThreadsSlotProcessPktBatch(ThreadVars *tv, TmSlot *slot,
+        Packet **pkts, uint32_t cnt)
+{
+    TmEcode r;
+
+    if (TmThreadsSlotRunBatch(tv, slot, pkts, cnt) != TM_ECODE_OK) {
+        for (TmSlot *s = slot; s != NULL; s = s->slot_next) {
+            TmqhReleasePacketsToPacketPool(&s->slot_pre_pq);
+
+            SCMutexLock(&s->slot_post_pq.mutex_q);
+            TmqhReleasePacketsToPacketPool(&s->slot_post_pq);
+            SCMutexUnlock(&s->slot_post_pq.mutex_q);
+        }
+        TmThreadsSetFlag(tv, THV_FAILED);
+        return TM_ECODE_FAILED;
+    }
+
+    /* post process pq */
+    for (TmSlot *s = slot; s != NULL; s = s->slot_next) {
+        while (s->slot_post_pq.top != NULL) {
+            SCMutexLock(&s->slot_post_pq.mutex_q);
+            Packet *extra_p = PacketDequeue(&s->slot_post_pq);
+            SCMutexUnlock(&s->slot_post_pq.mutex_q);
+
+            if (extra_p == NULL)
+                break;
+
+            if (s->slot_next != NULL) {
+                r = TmThreadsSlotVarRun(tv, extra_p, s->slot_next);
+                if (r == TM_ECODE_FAILED) {
+                    SCMutexLock(&s->slot_post_pq.mutex_q);
+                    TmqhReleasePacketsToPacketPool(&s->slot_post_pq);
+                    SCMutexUnlock(&s->slot_post_pq.mutex_q);
+
+                    TmqhOutputPacketpool(tv, extra_p);
+                    TmThreadsSetFlag(tv, THV_FAILED);
+                    return TM_ECODE_FAILED;
+                }
+            }
+            tv->tmqh_out(tv, extra_p);
+        }
+    }
+
+    return TM_ECODE_OK;
+}
+
 /** \internal
  *
  *  \brief Process flow timeout packets
@@ -1168,6 +1329,15 @@ ThreadVars *TmThreadCreate(const char *name, const char *inq_name, const char *i
 
         tv->tmqh_in = tmqh->InHandler;
         tv->InShutdownHandler = tmqh->InShutdownHandler;
+
+        /* a ring has a single reader */
+        if (tv->tmqh_in == TmqhInputRing && tv->inq != NULL &&
+                tv->inq->reader_cnt > 1) {
+            SCLogError(SC_ERR_THREAD_QUEUE, "queue \"%s\" has more than one "
+                    "reader, which the ring queue handler doesn't support",
+                    tv->inq->name);
+            goto error;
+        }
         SCLogDebug("tv->tmqh_in %p", tv->tmqh_in);
     }
 
@@ -1189,6 +1359,8 @@ ThreadVars *TmThreadCreate(const char *name, const char *inq_name, const char *i
                 tv->outctx = tmqh->OutHandlerCtxSetup(outq_name);
                 if (tv->outctx == NULL)
                     goto error;
+                if (tmqh->OutHandlerCtxRegisterCounters != NULL)
+                    tmqh->OutHandlerCtxRegisterCounters(tv, tv->outctx);
                 tv->outq = NULL;
             } else {
                 tmq = TmqGetQueueByName(outq_name);
@@ -1424,6 +1596,21 @@ void TmThreadRemove(ThreadVars *tv, int type)
     return;
 }
 
+/** \internal
+ *  \brief check if the input queue of a thread still holds packets
+ *
+ *  Threads using the "ring" queue handler get their packets from the
+ *  queue's ring, so that is checked next to the packet queue.
+ */
+static int TmThreadInqHasPackets(ThreadVars *tv)
+{
+    if (trans_q[tv->inq->id].len != 0)
+        return 1;
+    if (TmqhRingQueueLen(tv->inq->id) != 0)
+        return 1;
+    return 0;
+}
+
 /**
  * \brief Kill a thread.
  *
@@ -1450,8 +1637,7 @@ static int TmThreadKillThread(ThreadVars *tv)
          * packet acquire by now using TmThreadDisableReceiveThreads()*/
         if (!(strlen(tv->inq->name) == strlen("packetpool") &&
               strcasecmp(tv->inq->name, "packetpool") == 0)) {
-            PacketQueue *q = &trans_q[tv->inq->id];
-            if (q->len != 0) {
+            if (TmThreadInqHasPackets(tv)) {
                 return 0;
             }
         }
@@ -1536,8 +1722,7 @@ again:
              * packet acquire by now using TmThreadDisableReceiveThreads()*/
             if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                         strcasecmp(tv->inq->name, "packetpool") == 0)) {
-                PacketQueue *q = &trans_q[tv->inq->id];
-                if (q->len != 0) {
+                if (TmThreadInqHasPackets(tv)) {
                     SCMutexUnlock(&tv_root_lock);
 
                     total_wait_time += WAIT_TIME;
@@ -1611,8 +1796,7 @@ again:
                  * packet acquire by now using TmThreadDisableReceiveThreads()*/
                 if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                       strcasecmp(tv->inq->name, "packetpool") == 0)) {
-                    PacketQueue *q = &trans_q[tv->inq->id];
-                    if (q->len != 0) {
+                    if (TmThreadInqHasPackets(tv)) {
                         SCMutexUnlock(&tv_root_lock);
                         /* don't sleep while holding a lock */
                         usleep(1000);
@@ -1700,8 +1884,7 @@ again:
              * packet acquire by now using TmThreadDisableReceiveThreads()*/
             if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                         strcasecmp(tv->inq->name, "packetpool") == 0)) {
-                PacketQueue *q = &trans_q[tv->inq->id];
-                if (q->len != 0) {
+                if (TmThreadInqHasPackets(tv)) {
                     SCMutexUnlock(&tv_root_lock);
                     /* don't sleep while holding a lock */
                     usleep(1000);
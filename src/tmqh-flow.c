@@ -33,25 +33,66 @@
 #include "threads.h"
 #include "threadvars.h"
 #include "tmqh-flow.h"
+#include "tmqh-ring.h"
+#include "flow-private.h"
+#include "flow-hash.h"
 
 #include "tm-queuehandlers.h"
 
 #include "conf.h"
+#include "counters.h"
 #include "util-unittest.h"
+#include "util-toeplitz.h"
 
 Packet *TmqhInputFlow(ThreadVars *t);
 void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
 void TmqhOutputFlowIPPair(ThreadVars *t, Packet *p);
+void TmqhOutputFlowLeastLoaded(ThreadVars *t, Packet *p);
 void *TmqhOutputFlowSetupCtx(const char *queue_str);
 void TmqhOutputFlowFreeCtx(void *ctx);
+void TmqhOutputFlowRegisterCounters(ThreadVars *tv, void *ctx);
 void TmqhFlowRegisterTests(void);
 
+static void TmqhFlowSlotRelease(Packet *p);
+static int TmqhFlowSlotsSetup(TmqhFlowCtx *ctx);
+static void TmqhFlowSlotsFree(void);
+
+/** stats counter names per thread queue id: "autofp.<queue>.depth" and
+ *  "autofp.<queue>.flows". The stats api keeps the pointers, so they
+ *  live until TmqhFlowCleanup. */
+static char *counter_names[256][2];
+
+/** queue per flow hash for the "least-loaded" scheduler. Shared by all
+ *  writers, so both directions of a flow end up in the same queue no
+ *  matter which capture thread they arrive on. */
+static TmqhFlowSlot *flow_slots = NULL;
+/** queues of the writers using flow_slots. The slots store the index
+ *  in this list, so all writers need to output to the same queues. */
+static uint16_t flow_slots_queues[256];
+static uint16_t flow_slots_queues_cnt = 0;
+
+/* TmqhFlowSlot::state layout */
+#define SLOT_QUEUE_MASK         0xffffULL
+#define SLOT_INFLIGHT_SHIFT     16
+#define SLOT_INFLIGHT_MASK      0xffffffULL
+#define SLOT_TS_SHIFT           40
+#define SLOT_TS_MASK            0xffffffULL
+
+#define SLOT_QUEUE(s)       (uint16_t)((s) & SLOT_QUEUE_MASK)
+#define SLOT_INFLIGHT(s)    (((s) >> SLOT_INFLIGHT_SHIFT) & SLOT_INFLIGHT_MASK)
+#define SLOT_TS(s)          (((s) >> SLOT_TS_SHIFT) & SLOT_TS_MASK)
+#define SLOT_STATE(q, inflight, ts) \
+    ((uint64_t)(q) | ((uint64_t)(inflight) << SLOT_INFLIGHT_SHIFT) | \
+     ((uint64_t)(ts) << SLOT_TS_SHIFT))
+
 void TmqhFlowRegister(void)
 {
     tmqh_table[TMQH_FLOW].name = "flow";
     tmqh_table[TMQH_FLOW].InHandler = TmqhInputFlow;
     tmqh_table[TMQH_FLOW].OutHandlerCtxSetup = TmqhOutputFlowSetupCtx;
     tmqh_table[TMQH_FLOW].OutHandlerCtxFree = TmqhOutputFlowFreeCtx;
+    tmqh_table[TMQH_FLOW].OutHandlerCtxRegisterCounters =
+        TmqhOutputFlowRegisterCounters;
     tmqh_table[TMQH_FLOW].RegisterTests = TmqhFlowRegisterTests;
 
     const char *scheduler = NULL;
@@ -62,6 +103,8 @@ void TmqhFlowRegister(void)
         } else if (strcasecmp(scheduler, "active-packets") == 0) {
             SCLogNotice("using flow hash instead of active packets");
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
+        } else if (strcasecmp(scheduler, "least-loaded") == 0) {
+            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowLeastLoaded;
         } else if (strcasecmp(scheduler, "hash") == 0) {
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
         } else if (strcasecmp(scheduler, "ippair") == 0) {
@@ -76,6 +119,30 @@ void TmqhFlowRegister(void)
         tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
     }
 
+    const char *queue_type = NULL;
+    if (ConfGet("autofp-queue-type", &queue_type) == 1) {
+        if (strcasecmp(queue_type, "ring") == 0) {
+            /* same balancing, but over lock free rings */
+            tmqh_table[TMQH_FLOW].InHandler = TmqhInputRing;
+            tmqh_table[TMQH_FLOW].OutHandlerCtxSetup = TmqhOutputRingSetupCtx;
+            tmqh_table[TMQH_FLOW].OutHandlerCtxFree = TmqhOutputRingFreeCtx;
+            tmqh_table[TMQH_FLOW].OutHandlerCtxRegisterCounters = NULL;
+            if (tmqh_table[TMQH_FLOW].OutHandler == TmqhOutputFlowIPPair) {
+                tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputRingIPPair;
+            } else {
+                if (tmqh_table[TMQH_FLOW].OutHandler == TmqhOutputFlowLeastLoaded)
+                    SCLogNotice("using flow hash instead of least loaded "
+                            "for the ring queues");
+                tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputRingHash;
+            }
+        } else if (strcasecmp(queue_type, "mutex") != 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
+                       "for autofp-queue-type in conf.  Killing engine.",
+                       queue_type);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     return;
 }
 
@@ -87,6 +154,9 @@ void TmqhFlowPrintAutofpHandler(void)
 
     PRINT_IF_FUNC(TmqhOutputFlowHash, "Hash");
     PRINT_IF_FUNC(TmqhOutputFlowIPPair, "IPPair");
+    PRINT_IF_FUNC(TmqhOutputFlowLeastLoaded, "Least Loaded");
+    PRINT_IF_FUNC(TmqhOutputRingHash, "Hash (ring queues)");
+    PRINT_IF_FUNC(TmqhOutputRingIPPair, "IPPair (ring queues)");
 
 #undef PRINT_IF_FUNC
 }
@@ -107,6 +177,8 @@ Packet *TmqhInputFlow(ThreadVars *tv)
     if (q->len > 0) {
         Packet *p = PacketDequeue(q);
         SCMutexUnlock(&q->mutex_q);
+        if (p->flags & PKT_AUTOFP_SLOT)
+            TmqhFlowSlotRelease(p);
         return p;
     } else {
         /* return NULL if we have no pkt. Should only happen on signals. */
@@ -115,6 +187,32 @@ Packet *TmqhInputFlow(ThreadVars *tv)
     }
 }
 
+/** \internal
+ *  \brief get the stats counter names for a thread queue
+ *  \retval 0 ok, -1 on error */
+static int TmqhFlowCounterNames(const Tmq *tmq)
+{
+    const char *suffix[2] = { "depth", "flows" };
+    char name[256];
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        snprintf(name, sizeof(name), "autofp.%s.%s", tmq->name, suffix[i]);
+
+        if (counter_names[tmq->id][i] != NULL) {
+            if (strcmp(counter_names[tmq->id][i], name) == 0)
+                continue;
+            /* queue id reused for another queue in a new run, the
+             * counters of the old run are gone by now */
+            SCFree(counter_names[tmq->id][i]);
+        }
+        counter_names[tmq->id][i] = SCStrdup(name);
+        if (unlikely(counter_names[tmq->id][i] == NULL))
+            return -1;
+    }
+    return 0;
+}
+
 static int StoreQueueId(TmqhFlowCtx *ctx, char *name)
 {
     void *ptmp;
@@ -126,6 +224,9 @@ static int StoreQueueId(TmqhFlowCtx *ctx, char *name)
     }
     tmq->writer_cnt++;
 
+    if (TmqhFlowCounterNames(tmq) < 0)
+        return -1;
+
     uint16_t id = tmq->id;
 
     if (ctx->queues == NULL) {
@@ -199,9 +300,17 @@ void *TmqhOutputFlowSetupCtx(const char *queue_str)
     } while (tstr != NULL);
 
     SCFree(str);
+
+    if (tmqh_table[TMQH_FLOW].OutHandler == TmqhOutputFlowLeastLoaded) {
+        str = NULL;
+        if (TmqhFlowSlotsSetup(ctx) < 0)
+            goto error;
+    }
     return (void *)ctx;
 
 error:
+    if (ctx->queues != NULL)
+        SCFree(ctx->queues);
     SCFree(ctx);
     if (str != NULL)
         SCFree(str);
@@ -220,6 +329,66 @@ void TmqhOutputFlowFreeCtx(void *ctx)
     return;
 }
 
+/**
+ * \brief register the per queue counters of the writer thread
+ *
+ * "autofp.<queue>.depth" is the average number of packets waiting in the
+ * queue when a packet is added to it. It is an average counter, so the
+ * values of all writers of the queue are merged into one average instead
+ * of being summed up. "autofp.<queue>.flows" is the number of flows
+ * assigned to the queue.
+ */
+void TmqhOutputFlowRegisterCounters(ThreadVars *tv, void *ctx)
+{
+    TmqhFlowCtx *fctx = (TmqhFlowCtx *)ctx;
+    uint16_t i;
+
+    for (i = 0; i < fctx->size; i++) {
+        int id = (int)(fctx->queues[i].q - trans_q);
+        if (counter_names[id][0] == NULL || counter_names[id][1] == NULL)
+            continue;
+
+        fctx->queues[i].counter_depth =
+            StatsRegisterAvgCounter(counter_names[id][0], tv);
+        fctx->queues[i].counter_assigned =
+            StatsRegisterCounter(counter_names[id][1], tv);
+    }
+}
+
+/** \brief free the counter names, the stats api must be done with them,
+ *         and the flow slots */
+void TmqhFlowCleanup(void)
+{
+    int i, j;
+
+    TmqhFlowSlotsFree();
+
+    for (i = 0; i < 256; i++) {
+        for (j = 0; j < 2; j++) {
+            if (counter_names[i][j] != NULL) {
+                SCFree(counter_names[i][j]);
+                counter_names[i][j] = NULL;
+            }
+        }
+    }
+}
+
+/** \internal
+ *  \brief put the packet in a queue, update the depth counter */
+static inline void TmqhFlowOutput(ThreadVars *tv, TmqhFlowMode *fq, Packet *p)
+{
+    PacketQueue *q = fq->q;
+
+    SCMutexLock(&q->mutex_q);
+    PacketEnqueue(q, p);
+    SCCondSignal(&q->cond_q);
+    uint32_t depth = q->len;
+    SCMutexUnlock(&q->mutex_q);
+
+    if (fq->counter_depth > 0)
+        StatsAddUI64(tv, fq->counter_depth, depth);
+}
+
 void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
 {
     int16_t qid = 0;
@@ -228,7 +397,12 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
 
     if (p->flags & PKT_WANTS_FLOW) {
         uint32_t hash = p->flow_hash;
-        qid = hash % ctx->size;
+        /* with the NIC's hash, pick the queue like its default RSS
+         * indirection table picks the rx queue */
+        if (flow_config.toeplitz != NULL)
+            qid = ToeplitzRetaQueue(FlowGetRssHash(p), ctx->size);
+        else
+            qid = hash % ctx->size;
     } else {
         qid = ctx->last++;
 
@@ -236,11 +410,7 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
             ctx->last = 0;
     }
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
+    TmqhFlowOutput(tv, &ctx->queues[qid], p);
 
     return;
 }
@@ -271,15 +441,189 @@ void TmqhOutputFlowIPPair(ThreadVars *tv, Packet *p)
      * ctx->size will be lesser than 2 ** 31 for sure */
     qid = addr_hash % ctx->size;
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
+    TmqhFlowOutput(tv, &ctx->queues[qid], p);
 
     return;
 }
 
+/** \internal
+ *  \brief get the queue with the least packets waiting
+ *
+ *  The queue lengths are read without taking the locks, they are only
+ *  used as a hint. Ties are broken round robin.
+ */
+static uint16_t TmqhFlowLeastLoaded(TmqhFlowCtx *ctx)
+{
+    uint16_t best = ctx->last;
+    uint32_t best_len = ctx->queues[best].q->len;
+    uint16_t i, qid;
+
+    for (i = 1; i < ctx->size && best_len > 0; i++) {
+        qid = (ctx->last + i) % ctx->size;
+        uint32_t len = ctx->queues[qid].q->len;
+        if (len < best_len) {
+            best = qid;
+            best_len = len;
+        }
+    }
+
+    ctx->last = (best + 1) % ctx->size;
+    return best;
+}
+
+/** \internal
+ *  \brief seconds between two 24 bit slot timestamps, 0 if the clock
+ *         went back a bit */
+static inline uint32_t TmqhFlowSlotAge(uint64_t now, uint64_t ts)
+{
+    uint32_t age = (uint32_t)((now - ts) & SLOT_TS_MASK);
+    if (age & 0x800000)
+        return 0;
+    return age;
+}
+
+/** \internal
+ *  \brief get the queue for a flow
+ *
+ *  A flow hash keeps its queue while it has packets waiting in, or just
+ *  taken from, that queue, or while it had a packet in the last
+ *  TMQH_FLOW_SLOT_TIMEOUT seconds. Only a new or idle one goes to the
+ *  queue that has the least packets waiting.
+ *
+ *  The slot is updated with a CAS, so writers racing for a new flow
+ *  hash all end up with the queue picked by the first one.
+ *
+ *  \param assigned set to 1 if a queue was picked for a new flow
+ */
+static uint16_t TmqhFlowGetSlotQueue(TmqhFlowCtx *ctx, Packet *p,
+                                     int *assigned)
+{
+    TmqhFlowSlot *slot = &flow_slots[p->flow_hash & (TMQH_FLOW_SLOTS - 1)];
+    const uint64_t now = (uint64_t)p->ts.tv_sec & SLOT_TS_MASK;
+
+    while (1) {
+        uint64_t state = SC_ATOMIC_GET(slot->state);
+        uint16_t q = SLOT_QUEUE(state);
+        uint64_t inflight = SLOT_INFLIGHT(state);
+        uint64_t ts = SLOT_TS(state);
+        uint32_t age = TmqhFlowSlotAge(now, ts);
+
+        if (q != 0 && q <= ctx->size &&
+                (inflight > 0 || age <= TMQH_FLOW_SLOT_TIMEOUT))
+        {
+            /* active, stays in its queue */
+            if (inflight == SLOT_INFLIGHT_MASK) {
+                *assigned = 0;
+                return q - 1;
+            }
+            uint64_t new_state = SLOT_STATE(q, inflight + 1, age > 0 ? now : ts);
+            if (SC_ATOMIC_CAS(&slot->state, state, new_state)) {
+                *assigned = 0;
+                p->flags |= PKT_AUTOFP_SLOT;
+                return q - 1;
+            }
+        } else {
+            /* new or idle */
+            q = TmqhFlowLeastLoaded(ctx) + 1;
+            if (SC_ATOMIC_CAS(&slot->state, state, SLOT_STATE(q, 1, now))) {
+                *assigned = 1;
+                p->flags |= PKT_AUTOFP_SLOT;
+                return q - 1;
+            }
+        }
+        /* another thread updated the slot, try again */
+    }
+}
+
+/** \internal
+ *  \brief a packet left the queue, drop it from its slot's count */
+static void TmqhFlowSlotRelease(Packet *p)
+{
+    p->flags &= ~PKT_AUTOFP_SLOT;
+    if (flow_slots == NULL)
+        return;
+
+    TmqhFlowSlot *slot = &flow_slots[p->flow_hash & (TMQH_FLOW_SLOTS - 1)];
+    (void)SC_ATOMIC_SUB(slot->state, (1ULL << SLOT_INFLIGHT_SHIFT));
+}
+
+/** \internal
+ *  \brief set up the shared flow slots for a writer
+ *
+ *  Called at thread setup, before any of the threads run.
+ *
+ *  \retval 0 ok, -1 on error
+ */
+static int TmqhFlowSlotsSetup(TmqhFlowCtx *ctx)
+{
+    uint16_t i;
+
+    if (flow_slots == NULL) {
+        flow_slots = SCCalloc(TMQH_FLOW_SLOTS, sizeof(TmqhFlowSlot));
+        if (unlikely(flow_slots == NULL))
+            return -1;
+        for (i = 0; i < ctx->size; i++) {
+            flow_slots_queues[i] = (uint16_t)(ctx->queues[i].q - trans_q);
+        }
+        flow_slots_queues_cnt = ctx->size;
+        return 0;
+    }
+
+    int same = (flow_slots_queues_cnt == ctx->size);
+    for (i = 0; same && i < ctx->size; i++) {
+        if (flow_slots_queues[i] != (uint16_t)(ctx->queues[i].q - trans_q))
+            same = 0;
+    }
+    if (!same) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "the least-loaded autofp-scheduler "
+                "needs all capture threads to output to the same queues");
+        return -1;
+    }
+    return 0;
+}
+
+static void TmqhFlowSlotsFree(void)
+{
+    if (flow_slots != NULL) {
+        SCFree(flow_slots);
+        flow_slots = NULL;
+    }
+    flow_slots_queues_cnt = 0;
+}
+
+/**
+ * \brief select the queue with the least packets waiting for new flows
+ *
+ * The flow doesn't exist yet at this point, the workers look it up. So
+ * the queue picked for a flow is remembered per flow hash in a table
+ * shared by all writers, and packets of the flow go to that queue for
+ * as long as the flow is active.
+ * Packets without a flow are spread round robin.
+ *
+ * \param tv thread vars.
+ * \param p packet.
+ */
+void TmqhOutputFlowLeastLoaded(ThreadVars *tv, Packet *p)
+{
+    uint16_t qid;
+
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+
+    if (p->flags & PKT_WANTS_FLOW) {
+        int assigned = 0;
+        qid = TmqhFlowGetSlotQueue(ctx, p, &assigned);
+        if (assigned && ctx->queues[qid].counter_assigned > 0)
+            StatsIncr(tv, ctx->queues[qid].counter_assigned);
+    } else {
+        qid = ctx->last++;
+
+        if (ctx->last == ctx->size)
+            ctx->last = 0;
+    }
+
+    TmqhFlowOutput(tv, &ctx->queues[qid], p);
+}
+
 #ifdef UNITTESTS
 
 static int TmqhOutputFlowSetupCtxTest01(void)
@@ -418,6 +762,232 @@ end:
     return retval;
 }
 
+/** \test new flows go to the least loaded queue and stay there */
+static int TmqhOutputFlowLeastLoadedTest01(void)
+{
+    Packet p;
+    int assigned = 0;
+
+    TmqResetQueues();
+
+    TmqhFlowCtx *fctx = TmqhOutputFlowSetupCtx("queue1,queue2,queue3");
+    FAIL_IF_NULL(fctx);
+    FAIL_IF(TmqhFlowSlotsSetup(fctx) != 0);
+
+    trans_q[0].len = 10;
+    trans_q[1].len = 2;
+    trans_q[2].len = 5;
+
+    memset(&p, 0x00, sizeof(p));
+    p.flow_hash = 1234;
+    p.ts.tv_sec = 1000;
+    FAIL_IF(TmqhFlowGetSlotQueue(fctx, &p, &assigned) != 1);
+    FAIL_IF(assigned != 1);
+    FAIL_IF_NOT(p.flags & PKT_AUTOFP_SLOT);
+    TmqhFlowSlotRelease(&p);
+    FAIL_IF(p.flags & PKT_AUTOFP_SLOT);
+
+    /* the flow stays put when its queue fills up */
+    trans_q[1].len = 20;
+    p.ts.tv_sec = 1000 + TMQH_FLOW_SLOT_TIMEOUT;
+    FAIL_IF(TmqhFlowGetSlotQueue(fctx, &p, &assigned) != 1);
+    FAIL_IF(assigned != 0);
+    TmqhFlowSlotRelease(&p);
+
+    /* a new flow picks the shortest queue */
+    p.flow_hash = 4321;
+    FAIL_IF(TmqhFlowGetSlotQueue(fctx, &p, &assigned) != 2);
+    FAIL_IF(assigned != 1);
+    TmqhFlowSlotRelease(&p);
+
+    /* an idle flow hash is reassigned */
+    p.flow_hash = 1234;
+    p.ts.tv_sec = 1000 + 2 * TMQH_FLOW_SLOT_TIMEOUT + 1;
+    FAIL_IF(TmqhFlowGetSlotQueue(fctx, &p, &assigned) != 2);
+    FAIL_IF(assigned != 1);
+    TmqhFlowSlotRelease(&p);
+
+    trans_q[0].len = trans_q[1].len = trans_q[2].len = 0;
+    TmqhOutputFlowFreeCtx(fctx);
+    TmqhFlowSlotsFree();
+    TmqResetQueues();
+    PASS;
+}
+
+/** \test equal queues are filled round robin */
+static int TmqhOutputFlowLeastLoadedTest02(void)
+{
+    Packet p;
+    int assigned = 0;
+    uint32_t i;
+
+    TmqResetQueues();
+
+    TmqhFlowCtx *fctx = TmqhOutputFlowSetupCtx("queue1,queue2");
+    FAIL_IF_NULL(fctx);
+    FAIL_IF(TmqhFlowSlotsSetup(fctx) != 0);
+
+    memset(&p, 0x00, sizeof(p));
+    p.ts.tv_sec = 1;
+    for (i = 0; i < 4; i++) {
+        p.flow_hash = i;
+        FAIL_IF(TmqhFlowGetSlotQueue(fctx, &p, &assigned) != (i % 2));
+        TmqhFlowSlotRelease(&p);
+    }
+
+    TmqhOutputFlowFreeCtx(fctx);
+    TmqhFlowSlotsFree();
+    TmqResetQueues();
+    PASS;
+}
+
+/** \test writers share the queue picked for a flow hash */
+static int TmqhOutputFlowLeastLoadedTest03(void)
+{
+    Packet p;
+    int assigned = 0;
+
+    TmqResetQueues();
+
+    TmqhFlowCtx *fctx1 = TmqhOutputFlowSetupCtx("queue1,queue2");
+    FAIL_IF_NULL(fctx1);
+    FAIL_IF(TmqhFlowSlotsSetup(fctx1) != 0);
+    TmqhFlowCtx *fctx2 = TmqhOutputFlowSetupCtx("queue1,queue2");
+    FAIL_IF_NULL(fctx2);
+    FAIL_IF(TmqhFlowSlotsSetup(fctx2) != 0);
+
+    trans_q[0].len = 5;
+    memset(&p, 0x00, sizeof(p));
+    p.flow_hash = 99;
+    p.ts.tv_sec = 1;
+    FAIL_IF(TmqhFlowGetSlotQueue(fctx1, &p, &assigned) != 1);
+    FAIL_IF(assigned != 1);
+    TmqhFlowSlotRelease(&p);
+
+    /* the other direction arrives on another capture thread */
+    trans_q[0].len = 0;
+    trans_q[1].len = 5;
+    FAIL_IF(TmqhFlowGetSlotQueue(fctx2, &p, &assigned) != 1);
+    FAIL_IF(assigned != 0);
+    TmqhFlowSlotRelease(&p);
+
+    /* writers with other queues can't share the slots */
+    TmqhFlowCtx *fctx3 = TmqhOutputFlowSetupCtx("queue2,queue1");
+    FAIL_IF_NULL(fctx3);
+    FAIL_IF(TmqhFlowSlotsSetup(fctx3) == 0);
+
+    trans_q[1].len = 0;
+    TmqhOutputFlowFreeCtx(fctx1);
+    TmqhOutputFlowFreeCtx(fctx2);
+    TmqhOutputFlowFreeCtx(fctx3);
+    TmqhFlowSlotsFree();
+    TmqResetQueues();
+    PASS;
+}
+
+/** \test a flow hash with packets in its queue is never reassigned */
+static int TmqhOutputFlowLeastLoadedTest04(void)
+{
+    Packet p1, p2;
+    int assigned = 0;
+
+    TmqResetQueues();
+
+    TmqhFlowCtx *fctx = TmqhOutputFlowSetupCtx("queue1,queue2");
+    FAIL_IF_NULL(fctx);
+    FAIL_IF(TmqhFlowSlotsSetup(fctx) != 0);
+
+    memset(&p1, 0x00, sizeof(p1));
+    p1.flow_hash = 7;
+    p1.ts.tv_sec = 100;
+    FAIL_IF(TmqhFlowGetSlotQueue(fctx, &p1, &assigned) != 0);
+    FAIL_IF(assigned != 1);
+
+    /* p1 is still in queue1 when the next packet arrives much later */
+    trans_q[0].len = 10;
+    memset(&p2, 0x00, sizeof(p2));
+    p2.flow_hash = 7;
+    p2.ts.tv_sec = 100 + TMQH_FLOW_SLOT_TIMEOUT + 10;
+    FAIL_IF(TmqhFlowGetSlotQueue(fctx, &p2, &assigned) != 0);
+    FAIL_IF(assigned != 0);
+
+    TmqhFlowSlotRelease(&p1);
+    TmqhFlowSlotRelease(&p2);
+
+    /* drained and idle: free to move */
+    p2.ts.tv_sec += TMQH_FLOW_SLOT_TIMEOUT + 1;
+    FAIL_IF(TmqhFlowGetSlotQueue(fctx, &p2, &assigned) != 1);
+    FAIL_IF(assigned != 1);
+    TmqhFlowSlotRelease(&p2);
+
+    trans_q[0].len = 0;
+    TmqhOutputFlowFreeCtx(fctx);
+    TmqhFlowSlotsFree();
+    TmqResetQueues();
+    PASS;
+}
+
+/** \test with many flows the new ones still go to the least loaded
+ *  queue once the earlier ones are idle */
+static int TmqhOutputFlowLeastLoadedTest05(void)
+{
+    Packet p;
+    int assigned = 0;
+    uint32_t i, rnd = 1;
+    uint32_t cnt[4] = { 0, 0, 0, 0 };
+    uint32_t assigned_cnt = 0;
+    const uint32_t flows = 100000;
+
+    TmqResetQueues();
+
+    TmqhFlowCtx *fctx = TmqhOutputFlowSetupCtx("queue1,queue2,queue3,queue4");
+    FAIL_IF_NULL(fctx);
+    FAIL_IF(TmqhFlowSlotsSetup(fctx) != 0);
+
+    /* a burst of flows while queue1 is the shortest */
+    trans_q[1].len = trans_q[2].len = trans_q[3].len = 100;
+    memset(&p, 0x00, sizeof(p));
+    p.ts.tv_sec = 1000;
+    for (i = 0; i < flows; i++) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 17;
+        rnd ^= rnd << 5;
+        p.flow_hash = rnd;
+        FAIL_IF(TmqhFlowGetSlotQueue(fctx, &p, &assigned) != 0);
+        TmqhFlowSlotRelease(&p);
+    }
+
+    /* next burst of new flows, now queue1 is loaded */
+    trans_q[0].len = 100;
+    trans_q[1].len = trans_q[2].len = trans_q[3].len = 0;
+    p.ts.tv_sec = 1000 + TMQH_FLOW_SLOT_TIMEOUT + 1;
+    for (i = 0; i < flows; i++) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 17;
+        rnd ^= rnd << 5;
+        p.flow_hash = rnd;
+        uint16_t qid = TmqhFlowGetSlotQueue(fctx, &p, &assigned);
+        FAIL_IF(qid >= 4);
+        cnt[qid]++;
+        assigned_cnt += assigned;
+        TmqhFlowSlotRelease(&p);
+    }
+
+    /* the slots of the first burst don't hold on to queue1 and most
+     * new flows get a slot of their own */
+    FAIL_IF(cnt[0] != 0);
+    for (i = 1; i < 4; i++) {
+        FAIL_IF(cnt[i] < flows / 4);
+    }
+    FAIL_IF(assigned_cnt < flows * 3 / 4);
+
+    trans_q[0].len = 0;
+    TmqhOutputFlowFreeCtx(fctx);
+    TmqhFlowSlotsFree();
+    TmqResetQueues();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void TmqhFlowRegisterTests(void)
@@ -429,6 +999,16 @@ void TmqhFlowRegisterTests(void)
                    TmqhOutputFlowSetupCtxTest02);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest03",
                    TmqhOutputFlowSetupCtxTest03);
+    UtRegisterTest("TmqhOutputFlowLeastLoadedTest01",
+                   TmqhOutputFlowLeastLoadedTest01);
+    UtRegisterTest("TmqhOutputFlowLeastLoadedTest02",
+                   TmqhOutputFlowLeastLoadedTest02);
+    UtRegisterTest("TmqhOutputFlowLeastLoadedTest03",
+                   TmqhOutputFlowLeastLoadedTest03);
+    UtRegisterTest("TmqhOutputFlowLeastLoadedTest04",
+                   TmqhOutputFlowLeastLoadedTest04);
+    UtRegisterTest("TmqhOutputFlowLeastLoadedTest05",
+                   TmqhOutputFlowLeastLoadedTest05);
 #endif
 
     return;
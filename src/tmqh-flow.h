@@ -26,8 +26,31 @@
 
 typedef struct TmqhFlowMode_ {
     PacketQueue *q;
+
+    uint16_t counter_depth;     /**< stats: avg packets waiting in the queue */
+    uint16_t counter_assigned;  /**< stats: flows assigned to the queue */
 } TmqhFlowMode;
 
+/** \brief queue picked for a flow hash by the "least-loaded" scheduler
+ *
+ *  state packs the queue index + 1 (bits 0-15, 0 if never used), the
+ *  number of packets of the slot still waiting in the queue (bits 16-39)
+ *  and the time of the last packet in seconds (bits 40-63), so that it
+ *  can be updated by all writers with a single CAS. */
+typedef struct TmqhFlowSlot_ {
+    SC_ATOMIC_DECLARE(uint64_t, state);
+} TmqhFlowSlot;
+
+/** number of slots, indexed by flow hash. Must be a power of 2. Sized
+ *  so that at a few 100k new flows per TMQH_FLOW_SLOT_TIMEOUT most new
+ *  flows still find an unused slot. */
+#define TMQH_FLOW_SLOTS         (1 << 18)
+/** seconds without packets before an idle slot is free to be reassigned.
+ *  Only needs to cover the packets the worker just took from the queue,
+ *  the slot stays put while packets are waiting anyway. Kept short so
+ *  that the slots of finished flows are soon free for new flows. */
+#define TMQH_FLOW_SLOT_TIMEOUT  2
+
 /** \brief Ctx for the flow queue handler
  *  \param size number of queues to output to
  *  \param queues array of queue id's this flow handler outputs to */
@@ -42,5 +65,6 @@ void TmqhFlowRegister (void);
 void TmqhFlowRegisterTests(void);
 
 void TmqhFlowPrintAutofpHandler(void);
+void TmqhFlowCleanup(void);
 
 #endif /* __TMQH_FLOW_H__ */
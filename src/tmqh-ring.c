@@ -0,0 +1,576 @@
+/* Copyright (C) 2007-2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Ring queue handler: packets are passed between threads through a
+ * bounded lock free ring per queue instead of the locked PacketQueue.
+ *
+ * The ring is the bounded queue with per cell sequence numbers described
+ * by Dmitry Vyukov. Writers claim a cell by moving the tail, which is
+ * a plain store with a single writer and a CAS with more. The single
+ * reader never needs a read-modify-write.
+ *
+ * An idle reader first spins on the ring, then sleeps on the cond of the
+ * regular thread queue. The spin budget adapts: it grows when spinning
+ * found a packet and shrinks when the reader had to sleep anyway.
+ *
+ * Like the "flow" handler, output to a list of queues is balanced by
+ * flow hash (or ip pair), so the handler can be used for the autofp
+ * queues. See "autofp-queue-type".
+ */
+
+#include "suricata.h"
+#include "packet-queue.h"
+#include "decode.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-queues.h"
+#include "tm-queuehandlers.h"
+#include "tmqh-ring.h"
+#include "flow-private.h"
+#include "flow-hash.h"
+
+#include "util-atomic.h"
+#include "util-toeplitz.h"
+#include "util-unittest.h"
+
+extern int max_pending_packets;
+
+#define RING_SIZE_MIN       64
+/** spin budget of the reader: start, min and max iterations */
+#define RING_SPIN_INIT      256
+#define RING_SPIN_MIN       16
+#define RING_SPIN_MAX       8192
+/** times a writer yields on a full ring before it starts sleeping */
+#define RING_FULL_YIELDS    64
+
+/** rings by thread queue id. They live until TmqhRingCleanup and are
+ *  reset when the first writer of a new run registers. */
+static PacketRing *rings[256];
+
+/** \internal
+ *  \brief (re)initialize a ring, must not be used by any thread
+ *  \retval 0 ok, -1 on allocation error */
+static int PacketRingInit(PacketRing *r, uint32_t size)
+{
+    uint32_t i;
+
+    if (r->cells == NULL || r->size != size) {
+        PacketRingCell *cells = SCMalloc(size * sizeof(PacketRingCell));
+        if (unlikely(cells == NULL))
+            return -1;
+        if (r->cells != NULL)
+            SCFree(r->cells);
+        r->cells = cells;
+        r->size = size;
+        r->mask = size - 1;
+    }
+    for (i = 0; i < size; i++) {
+        r->cells[i].seq = i;
+        r->cells[i].p = NULL;
+    }
+    r->tail = 0;
+    r->head = 0;
+    r->spin = RING_SPIN_INIT;
+    SC_ATOMIC_INIT(r->sleeping);
+    return 0;
+}
+
+/** \internal
+ *  \brief add a packet to the ring
+ *  \retval 0 ok, -1 ring is full */
+static inline int PacketRingEnqueue(PacketRing *r, Packet *p)
+{
+    PacketRingCell *cell;
+    uint32_t pos = SCAtomicLoadAcquire(&r->tail);
+
+    while (1) {
+        cell = &r->cells[pos & r->mask];
+        uint32_t seq = SCAtomicLoadAcquire(&cell->seq);
+        int32_t dif = (int32_t)(seq - pos);
+
+        if (dif == 0) {
+            if (r->writers <= 1) {
+                SCAtomicStoreRelease(&r->tail, pos + 1);
+                break;
+            }
+            if (SCAtomicCompareAndSwap(&r->tail, pos, pos + 1))
+                break;
+            pos = SCAtomicLoadAcquire(&r->tail);
+        } else if (dif < 0) {
+            /* cell still holds the packet of the previous lap */
+            return -1;
+        } else {
+            /* another writer got here first */
+            pos = SCAtomicLoadAcquire(&r->tail);
+        }
+    }
+
+    cell->p = p;
+    SCAtomicStoreRelease(&cell->seq, pos + 1);
+    return 0;
+}
+
+/** \internal
+ *  \brief get a packet from the ring, reader only
+ *  \retval p packet or NULL if the ring is empty */
+static inline Packet *PacketRingDequeue(PacketRing *r)
+{
+    uint32_t pos = r->head;
+    PacketRingCell *cell = &r->cells[pos & r->mask];
+    uint32_t seq = SCAtomicLoadAcquire(&cell->seq);
+
+    if ((int32_t)(seq - (pos + 1)) < 0)
+        return NULL;
+
+    Packet *p = cell->p;
+    /* release: TmqhRingQueueLen reads it from other threads */
+    SCAtomicStoreRelease(&r->head, pos + 1);
+    /* hand the cell to the writers for the next lap */
+    SCAtomicStoreRelease(&cell->seq, pos + r->mask + 1);
+    return p;
+}
+
+/**
+ *  \brief get the number of packets in the ring of a queue
+ *
+ *  Can be called from any thread. The result is a snapshot, it's used
+ *  at shutdown to see if a thread still has packets to process.
+ *
+ *  \param id thread queue id
+ *  \retval len packets in the ring, 0 if the queue has no ring
+ */
+uint32_t TmqhRingQueueLen(int id)
+{
+    if (id < 0 || id >= (int)(sizeof(rings) / sizeof(rings[0])))
+        return 0;
+
+    PacketRing *r = rings[id];
+    if (r == NULL || r->cells == NULL)
+        return 0;
+
+    uint32_t head = SCAtomicLoadAcquire(&r->head);
+    uint32_t tail = SCAtomicLoadAcquire(&r->tail);
+    return tail - head;
+}
+
+/** \internal
+ *  \brief get the ring of a queue and register a writer for it
+ *
+ *  Called at thread setup, before any of the threads run.
+ */
+static PacketRing *PacketRingGetForWriter(Tmq *tmq)
+{
+    PacketRing *r = rings[tmq->id];
+    if (r == NULL) {
+        r = SCMallocAligned(sizeof(PacketRing), CLS);
+        if (unlikely(r == NULL))
+            return NULL;
+        memset(r, 0, sizeof(PacketRing));
+        rings[tmq->id] = r;
+    }
+
+    /* the packets in flight are bound by the packet pools of the
+     * writers, size the ring so it's rarely full */
+    uint32_t want = (uint32_t)max_pending_packets * (r->writers + 1);
+    uint32_t size = RING_SIZE_MIN;
+    while (size < want && size < (1U << 24))
+        size <<= 1;
+
+    if (r->writers == 0 || size > r->size) {
+        if (PacketRingInit(r, size) < 0)
+            return NULL;
+    }
+    r->writers++;
+    r->q = &trans_q[tmq->id];
+
+    SCLogDebug("ring for queue %s: size %u, writers %u",
+            tmq->name, r->size, r->writers);
+    return r;
+}
+
+static int StoreRing(TmqhRingCtx *ctx, char *name)
+{
+    void *ptmp;
+    Tmq *tmq = TmqGetQueueByName(name);
+    if (tmq == NULL) {
+        tmq = TmqCreateQueue(name);
+        if (tmq == NULL)
+            return -1;
+    }
+    tmq->writer_cnt++;
+
+    PacketRing *r = PacketRingGetForWriter(tmq);
+    if (r == NULL)
+        return -1;
+
+    ptmp = SCRealloc(ctx->rings, (ctx->size + 1) * sizeof(PacketRing *));
+    if (ptmp == NULL) {
+        r->writers--;
+        return -1;
+    }
+    ctx->rings = ptmp;
+    ctx->rings[ctx->size++] = r;
+    return 0;
+}
+
+/**
+ * \brief setup the ring handler ctx
+ *
+ * Parses a comma separated string "queuename1,queuename2,etc"
+ * and sets the ctx up to divide flows over the rings of these queues.
+ *
+ * \param queue_str comma separated string with output queue names
+ *
+ * \retval ctx queues handlers ctx or NULL in error
+ */
+void *TmqhOutputRingSetupCtx(const char *queue_str)
+{
+    if (queue_str == NULL || strlen(queue_str) == 0)
+        return NULL;
+
+    SCLogDebug("queue_str %s", queue_str);
+
+    TmqhRingCtx *ctx = SCMalloc(sizeof(TmqhRingCtx));
+    if (unlikely(ctx == NULL))
+        return NULL;
+    memset(ctx, 0x00, sizeof(TmqhRingCtx));
+
+    char *str = SCStrdup(queue_str);
+    if (unlikely(str == NULL)) {
+        goto error;
+    }
+    char *tstr = str;
+
+    /* parse the comma separated string */
+    do {
+        char *comma = strchr(tstr,',');
+        if (comma != NULL) {
+            *comma = '\0';
+        }
+        if (StoreRing(ctx, tstr) < 0)
+            goto error;
+        tstr = comma ? (comma + 1) : comma;
+    } while (tstr != NULL);
+
+    SCFree(str);
+    return (void *)ctx;
+
+error:
+    TmqhOutputRingFreeCtx(ctx);
+    if (str != NULL)
+        SCFree(str);
+    return NULL;
+}
+
+void TmqhOutputRingFreeCtx(void *ctx)
+{
+    TmqhRingCtx *rctx = (TmqhRingCtx *)ctx;
+    uint16_t i;
+
+    /* the rings themselves are kept, readers may still be running */
+    for (i = 0; i < rctx->size; i++) {
+        rctx->rings[i]->writers--;
+    }
+    if (rctx->rings != NULL)
+        SCFree(rctx->rings);
+    SCFree(rctx);
+}
+
+/** \internal
+ *  \brief put the packet in the ring, wake up the reader if it sleeps
+ */
+static inline void TmqhRingOutput(PacketRing *r, Packet *p)
+{
+    uint32_t tries = 0;
+
+    while (PacketRingEnqueue(r, p) < 0) {
+        /* full, the reader is behind. Let it catch up. */
+        if (++tries < RING_FULL_YIELDS)
+            sched_yield();
+        else
+            usleep(10);
+    }
+
+    /* order the cell update before the check, the reader sets 'sleeping'
+     * before it checks the ring a last time */
+    SCAtomicFence();
+    if (SC_ATOMIC_GET(r->sleeping)) {
+        SCMutexLock(&r->q->mutex_q);
+        SCCondSignal(&r->q->cond_q);
+        SCMutexUnlock(&r->q->mutex_q);
+    }
+}
+
+void TmqhOutputRingHash(ThreadVars *tv, Packet *p)
+{
+    uint16_t qid;
+
+    TmqhRingCtx *ctx = (TmqhRingCtx *)tv->outctx;
+
+    if (p->flags & PKT_WANTS_FLOW) {
+        if (flow_config.toeplitz != NULL)
+            qid = ToeplitzRetaQueue(FlowGetRssHash(p), ctx->size);
+        else
+            qid = p->flow_hash % ctx->size;
+    } else {
+        qid = ctx->last++;
+
+        if (ctx->last == ctx->size)
+            ctx->last = 0;
+    }
+
+    TmqhRingOutput(ctx->rings[qid], p);
+}
+
+/**
+ * \brief select the ring to output based on IP address pair.
+ *
+ * \param tv thread vars.
+ * \param p packet.
+ */
+void TmqhOutputRingIPPair(ThreadVars *tv, Packet *p)
+{
+    uint32_t addr_hash = 0;
+    int i;
+
+    TmqhRingCtx *ctx = (TmqhRingCtx *)tv->outctx;
+
+    if (p->src.family == AF_INET6) {
+        for (i = 0; i < 4; i++) {
+            addr_hash += p->src.addr_data32[i] + p->dst.addr_data32[i];
+        }
+    } else {
+        addr_hash = p->src.addr_data32[0] + p->dst.addr_data32[0];
+    }
+
+    TmqhRingOutput(ctx->rings[addr_hash % ctx->size], p);
+}
+
+Packet *TmqhInputRing(ThreadVars *tv)
+{
+    PacketQueue *q = &trans_q[tv->inq->id];
+    PacketRing *r = rings[tv->inq->id];
+    Packet *p = NULL;
+    uint32_t i;
+
+    StatsSyncCountersIfSignalled(tv);
+
+    if (likely(r != NULL)) {
+        for (i = 0; ; i++) {
+            p = PacketRingDequeue(r);
+            if (p != NULL) {
+                if (i > 0 && r->spin < RING_SPIN_MAX)
+                    r->spin <<= 1;
+                return p;
+            }
+            /* pseudo packets from the flow timeout code are put in
+             * the queue directly */
+            if (q->len > 0)
+                break;
+            if (i >= r->spin) {
+                if (r->spin > RING_SPIN_MIN)
+                    r->spin >>= 1;
+                break;
+            }
+        }
+    }
+
+    SCMutexLock(&q->mutex_q);
+    if (r != NULL) {
+        (void)SC_ATOMIC_SET(r->sleeping, 1);
+        p = PacketRingDequeue(r);
+    }
+    if (p == NULL) {
+        if (q->len == 0) {
+            /* if we have no packets in queue, wait... */
+            SCCondWait(&q->cond_q, &q->mutex_q);
+        }
+        if (q->len > 0)
+            p = PacketDequeue(q);
+    }
+    if (r != NULL)
+        (void)SC_ATOMIC_SET(r->sleeping, 0);
+    SCMutexUnlock(&q->mutex_q);
+
+    if (p == NULL && r != NULL)
+        p = PacketRingDequeue(r);
+    /* NULL if we have no pkt. Should only happen on signals. */
+    return p;
+}
+
+void TmqhRingRegister(void)
+{
+    tmqh_table[TMQH_RING].name = "ring";
+    tmqh_table[TMQH_RING].InHandler = TmqhInputRing;
+    tmqh_table[TMQH_RING].OutHandler = TmqhOutputRingHash;
+    tmqh_table[TMQH_RING].OutHandlerCtxSetup = TmqhOutputRingSetupCtx;
+    tmqh_table[TMQH_RING].OutHandlerCtxFree = TmqhOutputRingFreeCtx;
+    tmqh_table[TMQH_RING].RegisterTests = TmqhRingRegisterTests;
+}
+
+/** \brief free the rings, all threads must be gone */
+void TmqhRingCleanup(void)
+{
+    int i;
+    for (i = 0; i < 256; i++) {
+        if (rings[i] != NULL) {
+            if (rings[i]->cells != NULL)
+                SCFree(rings[i]->cells);
+            SCFreeAligned(rings[i]);
+            rings[i] = NULL;
+        }
+    }
+}
+
+#ifdef UNITTESTS
+
+/** \test fill, drain and wrap a single writer ring */
+static int TmqhRingTest01(void)
+{
+    PacketRing r;
+    Packet pkts[6];
+    int i;
+
+    memset(&r, 0, sizeof(r));
+    FAIL_IF(PacketRingInit(&r, 4) != 0);
+    r.writers = 1;
+
+    FAIL_IF_NOT_NULL(PacketRingDequeue(&r));
+    for (i = 0; i < 4; i++) {
+        FAIL_IF(PacketRingEnqueue(&r, &pkts[i]) != 0);
+    }
+    /* full */
+    FAIL_IF(PacketRingEnqueue(&r, &pkts[4]) != -1);
+
+    FAIL_IF(PacketRingDequeue(&r) != &pkts[0]);
+    FAIL_IF(PacketRingDequeue(&r) != &pkts[1]);
+
+    /* wrap around */
+    FAIL_IF(PacketRingEnqueue(&r, &pkts[4]) != 0);
+    FAIL_IF(PacketRingEnqueue(&r, &pkts[5]) != 0);
+    FAIL_IF(PacketRingEnqueue(&r, &pkts[0]) != -1);
+
+    for (i = 2; i < 6; i++) {
+        FAIL_IF(PacketRingDequeue(&r) != &pkts[i]);
+    }
+    FAIL_IF_NOT_NULL(PacketRingDequeue(&r));
+
+    SCFree(r.cells);
+    PASS;
+}
+
+/** \test multi writer path keeps the order and the bound */
+static int TmqhRingTest02(void)
+{
+    PacketRing r;
+    Packet pkts[8];
+    uint32_t lap;
+    int i;
+
+    memset(&r, 0, sizeof(r));
+    FAIL_IF(PacketRingInit(&r, 8) != 0);
+    r.writers = 2;
+
+    for (lap = 0; lap < 3; lap++) {
+        for (i = 0; i < 8; i++) {
+            FAIL_IF(PacketRingEnqueue(&r, &pkts[i]) != 0);
+        }
+        FAIL_IF(PacketRingEnqueue(&r, &pkts[0]) != -1);
+        for (i = 0; i < 8; i++) {
+            FAIL_IF(PacketRingDequeue(&r) != &pkts[i]);
+        }
+        FAIL_IF_NOT_NULL(PacketRingDequeue(&r));
+    }
+    FAIL_IF(r.tail != 24);
+    FAIL_IF(r.head != 24);
+
+    SCFree(r.cells);
+    PASS;
+}
+
+/** \test ctx setup registers the writers on the queue rings */
+static int TmqhRingTest03(void)
+{
+    TmqResetQueues();
+
+    TmqhRingCtx *ctx = TmqhOutputRingSetupCtx("ringq1,ringq2");
+    FAIL_IF_NULL(ctx);
+    FAIL_IF(ctx->size != 2);
+    FAIL_IF(ctx->rings[0] != rings[0]);
+    FAIL_IF(ctx->rings[1] != rings[1]);
+    FAIL_IF(rings[0]->writers != 1);
+
+    TmqhRingCtx *ctx2 = TmqhOutputRingSetupCtx("ringq2");
+    FAIL_IF_NULL(ctx2);
+    FAIL_IF(ctx2->rings[0] != rings[1]);
+    FAIL_IF(rings[1]->writers != 2);
+    FAIL_IF(rings[1]->q != &trans_q[1]);
+
+    TmqhOutputRingFreeCtx(ctx2);
+    FAIL_IF(rings[1]->writers != 1);
+    TmqhOutputRingFreeCtx(ctx);
+    FAIL_IF(rings[0]->writers != 0);
+
+    TmqhRingCleanup();
+    TmqResetQueues();
+    PASS;
+}
+
+/** \test packets in a ring are seen by the shutdown drain check */
+static int TmqhRingTest04(void)
+{
+    Packet pkts[2];
+
+    TmqResetQueues();
+
+    TmqhRingCtx *ctx = TmqhOutputRingSetupCtx("ringq1");
+    FAIL_IF_NULL(ctx);
+    FAIL_IF(TmqhRingQueueLen(0) != 0);
+    /* queue without a ring */
+    FAIL_IF(TmqhRingQueueLen(1) != 0);
+
+    FAIL_IF(PacketRingEnqueue(rings[0], &pkts[0]) != 0);
+    FAIL_IF(PacketRingEnqueue(rings[0], &pkts[1]) != 0);
+    FAIL_IF(TmqhRingQueueLen(0) != 2);
+    /* the packet queue doesn't know about these */
+    FAIL_IF(trans_q[0].len != 0);
+
+    FAIL_IF(PacketRingDequeue(rings[0]) != &pkts[0]);
+    FAIL_IF(TmqhRingQueueLen(0) != 1);
+    FAIL_IF(PacketRingDequeue(rings[0]) != &pkts[1]);
+    FAIL_IF(TmqhRingQueueLen(0) != 0);
+
+    TmqhOutputRingFreeCtx(ctx);
+    TmqhRingCleanup();
+    TmqResetQueues();
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void TmqhRingRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("TmqhRingTest01", TmqhRingTest01);
+    UtRegisterTest("TmqhRingTest02", TmqhRingTest02);
+    UtRegisterTest("TmqhRingTest03", TmqhRingTest03);
+    UtRegisterTest("TmqhRingTest04", TmqhRingTest04);
+#endif
+}
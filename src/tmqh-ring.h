@@ -0,0 +1,78 @@
+/* Copyright (C) 2007-2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __TMQH_RING_H__
+#define __TMQH_RING_H__
+
+typedef struct PacketRingCell_ {
+    uint32_t seq;   /**< position the cell is ready for */
+    Packet *p;
+} PacketRingCell;
+
+/** \brief bounded lock free packet queue
+ *
+ *  One ring per thread queue. A ring has a single reader and one or
+ *  more writers. With a single writer no atomic read-modify-write
+ *  operations are done at all.
+ */
+typedef struct PacketRing_ {
+    /* set up before the threads start, read only after that */
+    PacketRingCell *cells;
+    uint32_t size;
+    uint32_t mask;
+    uint16_t writers;       /**< registered writers, > 1 means CAS on tail */
+
+    /** thread queue of the ring. Its lock and cond are used by the reader
+     *  to sleep, and its packet queue for packets injected by the flow
+     *  timeout code. */
+    PacketQueue *q;
+
+    /* writer side */
+    uint32_t tail __attribute__((aligned(CLS)));
+
+    /* reader side */
+    uint32_t head __attribute__((aligned(CLS)));
+    uint32_t spin;          /**< current spin budget before sleeping */
+    SC_ATOMIC_DECLARE(int, sleeping);
+} PacketRing;
+
+/** \brief Ctx for the ring queue handler
+ *  \param size number of rings to output to
+ *  \param rings array of rings this handler outputs to */
+typedef struct TmqhRingCtx_ {
+    uint16_t size;
+    uint16_t last;
+
+    PacketRing **rings;
+} TmqhRingCtx;
+
+void TmqhRingRegister(void);
+void TmqhRingCleanup(void);
+void TmqhRingRegisterTests(void);
+
+Packet *TmqhInputRing(ThreadVars *tv);
+uint32_t TmqhRingQueueLen(int id);
+void TmqhOutputRingHash(ThreadVars *tv, Packet *p);
+void TmqhOutputRingIPPair(ThreadVars *tv, Packet *p);
+void *TmqhOutputRingSetupCtx(const char *queue_str);
+void TmqhOutputRingFreeCtx(void *ctx);
+
+#endif /* __TMQH_RING_H__ */
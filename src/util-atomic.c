@@ -26,6 +26,10 @@
 #include "util-atomic.h"
 #include "util-unittest.h"
 
+#ifdef SC_ATOMIC_USE_LOCKS
+SCMutex sc_atomic_fallback_lock = SCMUTEX_INITIALIZER;
+#endif
+
 #ifdef UNITTESTS
 
 static int SCAtomicTest01(void)
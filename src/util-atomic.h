@@ -47,6 +47,7 @@
   !defined(__tile__)
 
 /* Do not have atomic operations support, so implement them with locks. */
+#define SC_ATOMIC_USE_LOCKS 1
 
 /**
  *  \brief wrapper to declare an atomic variable including a (spin) lock
@@ -233,6 +234,68 @@
     r; \
 })
 
+/** lock for SCAtomicLoadAcquire, SCAtomicStoreRelease, SCAtomicFence and
+ *  SCAtomicCompareAndSwap on plain variables, which have no lock of their
+ *  own. All accesses to such a variable have to use these. */
+extern SCMutex sc_atomic_fallback_lock;
+
+/**
+ *  \brief Compare and Swap a plain variable
+ *
+ *  \param addr Address of the variable to CAS
+ *  \param tv Test value to compare the value at address against
+ *  \param nv New value to set the variable at addr to
+ *
+ *  \retval 0 CAS failed
+ *  \retval 1 CAS succeeded
+ */
+#define SCAtomicCompareAndSwap(addr, tv, nv) ({ \
+    char sc_cas_r__ = 0; \
+    SCMutexLock(&sc_atomic_fallback_lock); \
+    if (*(addr) == (tv)) { \
+        *(addr) = (nv); \
+        sc_cas_r__ = 1; \
+    } \
+    SCMutexUnlock(&sc_atomic_fallback_lock); \
+    sc_cas_r__; \
+})
+
+/**
+ *  \brief load a value with acquire semantics: loads and stores after it
+ *         can't be reordered before it. Pairs with SCAtomicStoreRelease.
+ *
+ *  \param addr Address of the variable to load
+ */
+#define SCAtomicLoadAcquire(addr) ({ \
+    SCMutexLock(&sc_atomic_fallback_lock); \
+    typeof(*(addr)) sc_load_var__ = *(addr); \
+    SCMutexUnlock(&sc_atomic_fallback_lock); \
+    sc_load_var__; \
+})
+
+/**
+ *  \brief store a value with release semantics: loads and stores before
+ *         it can't be reordered after it.
+ *
+ *  \param addr Address of the variable to store to
+ *  \param value Value to store
+ */
+#define SCAtomicStoreRelease(addr, value) \
+    do { \
+        SCMutexLock(&sc_atomic_fallback_lock); \
+        *(addr) = (value); \
+        SCMutexUnlock(&sc_atomic_fallback_lock); \
+    } while (0)
+
+/**
+ *  \brief full memory barrier
+ */
+#define SCAtomicFence() \
+    do { \
+        SCMutexLock(&sc_atomic_fallback_lock); \
+        SCMutexUnlock(&sc_atomic_fallback_lock); \
+    } while (0)
+
 #else /* we do have support for CAS */
 
 /**
@@ -468,6 +531,31 @@
         ;                                                       \
         })
 
+/**
+ *  \brief load a value with acquire semantics: loads and stores after it
+ *         can't be reordered before it. Pairs with SCAtomicStoreRelease.
+ *
+ *  \param addr Address of the variable to load
+ */
+#define SCAtomicLoadAcquire(addr) \
+    __atomic_load_n((addr), __ATOMIC_ACQUIRE)
+
+/**
+ *  \brief store a value with release semantics: loads and stores before
+ *         it can't be reordered after it.
+ *
+ *  \param addr Address of the variable to store to
+ *  \param value Value to store
+ */
+#define SCAtomicStoreRelease(addr, value) \
+    __atomic_store_n((addr), (value), __ATOMIC_RELEASE)
+
+/**
+ *  \brief full memory barrier
+ */
+#define SCAtomicFence() \
+    __sync_synchronize()
+
 #endif /* !no atomic operations */
 
 void SCAtomicRegisterTests(void);
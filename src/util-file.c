@@ -274,9 +274,12 @@ static int FileMagicSize(void)
 uint64_t FileDataSize(const File *file)
 {
     if (file != NULL && file->sb != NULL) {
-        SCLogDebug("returning %"PRIu64,
-                file->sb->stream_offset + file->sb->buf_offset);
-        return file->sb->stream_offset + file->sb->buf_offset;
+        uint64_t size = file->sb->stream_offset + file->sb->buf_offset;
+        /* a shared buffer may hold more than was passed to the file */
+        if (file->sb_user != 0 && size > file->size)
+            size = file->size;
+        SCLogDebug("returning %"PRIu64, size);
+        return size;
     }
     SCLogDebug("returning 0 (default)");
     return 0;
@@ -319,7 +322,7 @@ static int FilePruneFile(File *file)
     }
 
     if (left_edge) {
-        StreamingBufferSlideToOffset(file->sb, left_edge);
+        StreamingBufferSlideToOffsetUser(file->sb, file->sb_user, left_edge);
     }
 
     if (left_edge != FileDataSize(file)) {
@@ -467,7 +470,7 @@ static void FileFree(File *ff)
         SCFree(ff->magic);
 #endif
     if (ff->sb != NULL) {
-        StreamingBufferFree(ff->sb);
+        StreamingBufferFreeUser(ff->sb, ff->sb_user);
     }
 
 #ifdef HAVE_NSS
@@ -552,7 +555,23 @@ static int FileStoreNoStoreCheck(File *ff)
 
 static int AppendData(File *file, const uint8_t *data, uint32_t data_len)
 {
-    if (StreamingBufferAppendNoTrack(file->sb, data, data_len) != 0) {
+    if (file->sb_user != 0) {
+        /* shared buffer: the owner may have added (part of) this data
+         * already. The file data is at the same offsets as in the buffer,
+         * so only add what is beyond its end. */
+        const uint64_t data_offset = file->size - data_len;
+        const uint64_t sb_end = file->sb->stream_offset + file->sb->buf_offset;
+        if (sb_end > data_offset) {
+            const uint64_t have = MIN(sb_end - data_offset, (uint64_t)data_len);
+            if (have < data_len &&
+                StreamingBufferAppendNoTrack(file->sb, data + have,
+                                             data_len - (uint32_t)have) != 0) {
+                SCReturnInt(-1);
+            }
+        } else if (StreamingBufferAppendNoTrack(file->sb, data, data_len) != 0) {
+            SCReturnInt(-1);
+        }
+    } else if (StreamingBufferAppendNoTrack(file->sb, data, data_len) != 0) {
         SCReturnInt(-1);
     }
 
@@ -740,7 +759,8 @@ int FileAppendGAPById(FileContainer *ffc, uint32_t track_id,
  *
  *  \note filename is not a string, so it's not nul terminated.
  */
-File *FileOpenFile(FileContainer *ffc, const StreamingBufferConfig *sbcfg,
+static File *FileOpenFileDo(FileContainer *ffc, const StreamingBufferConfig *sbcfg,
+        StreamingBuffer *shared_sb,
         const uint8_t *name, uint16_t name_len,
         const uint8_t *data, uint32_t data_len, uint16_t flags)
 {
@@ -753,7 +773,12 @@ File *FileOpenFile(FileContainer *ffc, const StreamingBufferConfig *sbcfg,
         SCReturnPtr(NULL, "File");
     }
 
-    ff->sb = StreamingBufferInit(sbcfg);
+    if (shared_sb != NULL && StreamingBufferShareRef(shared_sb, &ff->sb_user) == 0) {
+        ff->sb = shared_sb;
+    } else {
+        ff->sb_user = 0;
+        ff->sb = StreamingBufferInit(sbcfg);
+    }
     if (ff->sb == NULL) {
         FileFree(ff);
         SCReturnPtr(NULL, "File");
@@ -826,6 +851,31 @@ File *FileOpenFile(FileContainer *ffc, const StreamingBufferConfig *sbcfg,
 
     SCReturnPtr(ff, "File");
 }
+File *FileOpenFile(FileContainer *ffc, const StreamingBufferConfig *sbcfg,
+        const uint8_t *name, uint16_t name_len,
+        const uint8_t *data, uint32_t data_len, uint16_t flags)
+{
+    return FileOpenFileDo(ffc, sbcfg, NULL, name, name_len, data, data_len, flags);
+}
+
+/**
+ *  \brief Open a new File that reads its data from a buffer it shares
+ *         with another user, e.g. the HTTP body it is part of
+ *
+ *  The file data has to be at the same offsets in 'sb' as in the file.
+ *  Data passed to the file that 'sb' already holds is not copied again,
+ *  the rest is added to 'sb'. If 'sb' can't be shared the file gets its
+ *  own buffer, as with FileOpenFile.
+ *
+ *  \param sb buffer to share
+ */
+File *FileOpenFileWithBuffer(FileContainer *ffc, const StreamingBufferConfig *sbcfg,
+        StreamingBuffer *sb, const uint8_t *name, uint16_t name_len,
+        const uint8_t *data, uint32_t data_len, uint16_t flags)
+{
+    return FileOpenFileDo(ffc, sbcfg, sb, name, name_len, data, data_len, flags);
+}
+
 File *FileOpenFileWithId(FileContainer *ffc, const StreamingBufferConfig *sbcfg,
         uint32_t track_id, const uint8_t *name, uint16_t name_len,
         const uint8_t *data, uint32_t data_len, uint16_t flags)
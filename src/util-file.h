@@ -66,6 +66,8 @@ typedef struct File_ {
     uint16_t name_len;
     int16_t state;
     StreamingBuffer *sb;
+    uint8_t sb_user;                /**< user id of a shared 'sb', 0 if the
+                                     *   file owns it */
     uint64_t txid;                  /**< tx this file is part of */
     uint32_t file_track_id;         /**< id used by protocol parser. Optional
                                      *   only used if FILE_USE_TRACKID flag set */
@@ -129,6 +131,9 @@ File *FileOpenFile(FileContainer *, const StreamingBufferConfig *,
 File *FileOpenFileWithId(FileContainer *, const StreamingBufferConfig *,
         uint32_t track_id, const uint8_t *name, uint16_t name_len,
         const uint8_t *data, uint32_t data_len, uint16_t flags);
+File *FileOpenFileWithBuffer(FileContainer *, const StreamingBufferConfig *,
+        StreamingBuffer *sb, const uint8_t *name, uint16_t name_len,
+        const uint8_t *data, uint32_t data_len, uint16_t flags);
 
 /**
  *  \brief Close a File
@@ -0,0 +1,488 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memory use accounting against a memcap with per thread credits.
+ *
+ * Updating a single atomic counter on every alloc and free makes all
+ * threads fight over its cache line. Here each thread reserves memory
+ * from the global counter in batches and keeps the unused part as a
+ * credit. Allocations use up the credit, frees add to it. Only when the
+ * credit runs out, or grows beyond a batch, is the global counter
+ * updated.
+ *
+ * The global counter so holds the memory in use plus the unused credits.
+ * MemcapCounterCheck only looks at the global counter and the credit of
+ * the calling thread, so it never takes a lock. Close to the memcap no
+ * extra batch is reserved and frees return all of the credit, so the
+ * credits that count as used are bounded: at most a batch per thread
+ * that has been idle since before the memcap got close. The batch size
+ * is 1/64th of the memcap, up to MEMCAP_BATCH_MAX.
+ *
+ * MemcapCounterGet subtracts the credits of all threads to get the real
+ * memory use. It walks all threads under a lock, so it is for the stats.
+ *
+ * When a thread exits its credits are returned.
+ */
+
+#include "suricata-common.h"
+#include "threads.h"
+#include "util-memcap.h"
+#include "util-unittest.h"
+#include "util-validate.h"
+
+typedef struct MemcapThreadCtx_ {
+    /** credit per counter, only updated by the owning thread */
+    uint64_t credit[MEMCAP_COUNTERS_MAX];
+    struct MemcapThreadCtx_ *next;
+} MemcapThreadCtx;
+
+/** protects the counter registration and the list of thread ctxs */
+static SCMutex memcap_mutex = SCMUTEX_INITIALIZER;
+static MemcapCounter *memcap_counters[MEMCAP_COUNTERS_MAX];
+static int memcap_counters_cnt = 0;
+static MemcapThreadCtx *memcap_thread_list = NULL;
+
+/* the key is also used with TLS, for the destructor at thread exit */
+static pthread_key_t memcap_thread_key;
+static int memcap_thread_key_initialized = 0;
+
+#ifdef TLS
+static __thread MemcapThreadCtx *memcap_thread_ctx = NULL;
+#endif
+
+static void MemcapThreadCtxFree(void *data)
+{
+    MemcapThreadCtx *ctx = (MemcapThreadCtx *)data;
+    int id;
+
+    SCMutexLock(&memcap_mutex);
+    for (id = 0; id < memcap_counters_cnt; id++) {
+        if (ctx->credit[id] > 0)
+            (void) SC_ATOMIC_SUB(memcap_counters[id]->reserved, ctx->credit[id]);
+    }
+    MemcapThreadCtx **pctx = &memcap_thread_list;
+    while (*pctx != NULL) {
+        if (*pctx == ctx) {
+            *pctx = ctx->next;
+            break;
+        }
+        pctx = &(*pctx)->next;
+    }
+    SCMutexUnlock(&memcap_mutex);
+
+#ifdef TLS
+    memcap_thread_ctx = NULL;
+#endif
+    SCFreeAligned(ctx);
+}
+
+static MemcapThreadCtx *MemcapThreadCtxCreate(void)
+{
+    MemcapThreadCtx *ctx = SCMallocAligned(sizeof(*ctx), CLS);
+    if (unlikely(ctx == NULL))
+        return NULL;
+    memset(ctx, 0, sizeof(*ctx));
+
+    if (pthread_setspecific(memcap_thread_key, ctx) != 0) {
+        SCFreeAligned(ctx);
+        return NULL;
+    }
+
+    SCMutexLock(&memcap_mutex);
+    ctx->next = memcap_thread_list;
+    memcap_thread_list = ctx;
+    SCMutexUnlock(&memcap_mutex);
+
+#ifdef TLS
+    memcap_thread_ctx = ctx;
+#endif
+    return ctx;
+}
+
+/** \internal
+ *  \brief true if reserving 'size' plus a batch of credit would take us
+ *         over the memcap */
+static inline int MemcapNearCap(const MemcapCounter *c, uint64_t size)
+{
+    const uint64_t memcap = *c->memcap;
+    return (memcap != 0 &&
+            SC_ATOMIC_GET(c->reserved) + size + c->batch > memcap);
+}
+
+static inline MemcapThreadCtx *MemcapGetThreadCtx(void)
+{
+#ifdef TLS
+    MemcapThreadCtx *ctx = memcap_thread_ctx;
+#else
+    MemcapThreadCtx *ctx = pthread_getspecific(memcap_thread_key);
+#endif
+    if (likely(ctx != NULL))
+        return ctx;
+    return MemcapThreadCtxCreate();
+}
+
+/**
+ *  \brief set up a counter, or reset it if it was set up before
+ *
+ *  \param name name for the log messages
+ *  \param memcap the memcap to check against. Read on every check, so
+ *                it needs to stay around. The batch size is based on
+ *                its value at init.
+ */
+void MemcapCounterInit(MemcapCounter *c, const char *name, const uint64_t *memcap)
+{
+    SCMutexLock(&memcap_mutex);
+    if (!memcap_thread_key_initialized) {
+        int r = pthread_key_create(&memcap_thread_key, MemcapThreadCtxFree);
+        if (r != 0) {
+            SCLogError(SC_ERR_MEM_ALLOC, "pthread_key_create failed with %d", r);
+            exit(EXIT_FAILURE);
+        }
+        memcap_thread_key_initialized = 1;
+    }
+
+    int id;
+    for (id = 0; id < memcap_counters_cnt; id++) {
+        if (memcap_counters[id] == c)
+            break;
+    }
+    if (id == memcap_counters_cnt) {
+        if (memcap_counters_cnt < MEMCAP_COUNTERS_MAX) {
+            memcap_counters[memcap_counters_cnt++] = c;
+        } else {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "no per thread credits for "
+                    "memcap counter %s", name);
+            id = -1;
+        }
+    }
+
+    c->id = id;
+    c->name = name;
+    c->memcap = memcap;
+    c->batch = 0;
+    if (id >= 0) {
+        c->batch = MEMCAP_BATCH_MAX;
+        if (*memcap != 0 && *memcap / 64 < MEMCAP_BATCH_MAX)
+            c->batch = (uint32_t)(*memcap / 64);
+
+        /* drop the credits of a previous use of the counter */
+        MemcapThreadCtx *ctx;
+        for (ctx = memcap_thread_list; ctx != NULL; ctx = ctx->next)
+            ctx->credit[id] = 0;
+    }
+    SC_ATOMIC_INIT(c->reserved);
+    SCMutexUnlock(&memcap_mutex);
+
+    SCLogDebug("memcap counter %s: id %d batch %u", name, c->id, c->batch);
+}
+
+/**
+ *  \brief account for 'size' bytes of memory
+ */
+void MemcapCounterIncr(MemcapCounter *c, uint64_t size)
+{
+    MemcapThreadCtx *ctx;
+    if (c->batch == 0 || (ctx = MemcapGetThreadCtx()) == NULL) {
+        (void) SC_ATOMIC_ADD(c->reserved, size);
+        return;
+    }
+
+    uint64_t credit = ctx->credit[c->id];
+    if (credit < size) {
+        /* reserve what is missing plus a batch, or only what is missing
+         * if the batch would take us over the memcap */
+        uint64_t reserve = size - credit;
+        if (!MemcapNearCap(c, reserve))
+            reserve += c->batch;
+        (void) SC_ATOMIC_ADD(c->reserved, reserve);
+        credit += reserve;
+    }
+    SCAtomicStoreRelease(&ctx->credit[c->id], credit - size);
+}
+
+/**
+ *  \brief release 'size' bytes of memory
+ */
+void MemcapCounterDecr(MemcapCounter *c, uint64_t size)
+{
+    MemcapThreadCtx *ctx;
+    if (c->batch == 0 || (ctx = MemcapGetThreadCtx()) == NULL) {
+        DEBUG_VALIDATE_BUG_ON(SC_ATOMIC_GET(c->reserved) < size);
+        (void) SC_ATOMIC_SUB(c->reserved, size);
+        return;
+    }
+
+    uint64_t credit = ctx->credit[c->id] + size;
+    /* keep one batch, or nothing close to the memcap, return the rest */
+    uint64_t keep = MemcapNearCap(c, 0) ? 0 : c->batch;
+    if (credit > keep) {
+        uint64_t release = credit - keep;
+        DEBUG_VALIDATE_BUG_ON(SC_ATOMIC_GET(c->reserved) < release);
+        (void) SC_ATOMIC_SUB(c->reserved, release);
+        credit = keep;
+    }
+    SCAtomicStoreRelease(&ctx->credit[c->id], credit);
+}
+
+/**
+ *  \brief Check if alloc'ing "size" would mean we're over memcap
+ *
+ *  Unused credit of other threads counts as used, see the top of the
+ *  file for how that is bounded.
+ *
+ *  \retval 1 if in bounds
+ *  \retval 0 if not in bounds
+ */
+int MemcapCounterCheck(MemcapCounter *c, uint64_t size)
+{
+    const uint64_t memcap = *c->memcap;
+    if (memcap == 0)
+        return 1;
+
+    uint64_t credit = 0;
+    MemcapThreadCtx *ctx;
+    if (c->batch != 0 && (ctx = MemcapGetThreadCtx()) != NULL) {
+        credit = ctx->credit[c->id];
+        if (credit >= size)
+            return 1;
+    }
+    if (size - credit + SC_ATOMIC_GET(c->reserved) <= memcap)
+        return 1;
+    return 0;
+}
+
+/**
+ *  \brief get the memory in use, for the stats
+ *
+ *  The global counter minus the credits of all threads. Takes the
+ *  global lock and walks all threads, so not for the packet path.
+ */
+uint64_t MemcapCounterGet(MemcapCounter *c)
+{
+    uint64_t credit = 0;
+
+    SCMutexLock(&memcap_mutex);
+    if (c->batch != 0) {
+        MemcapThreadCtx *ctx;
+        for (ctx = memcap_thread_list; ctx != NULL; ctx = ctx->next)
+            credit += SCAtomicLoadAcquire(&ctx->credit[c->id]);
+    }
+    uint64_t reserved = SC_ATOMIC_GET(c->reserved);
+    SCMutexUnlock(&memcap_mutex);
+
+    return reserved > credit ? reserved - credit : 0;
+}
+
+#ifdef UNITTESTS
+
+/* counters stay registered, so the tests share a static one */
+static MemcapCounter memcap_test_counter;
+static uint64_t memcap_test_memcap;
+
+/** \test credits are taken in batches and returned when they grow */
+static int MemcapCounterTest01(void)
+{
+    MemcapCounter *c = &memcap_test_counter;
+    memcap_test_memcap = 64 * 1024;
+    MemcapCounterInit(c, "test", &memcap_test_memcap);
+    FAIL_IF(c->batch != 1024);
+
+    MemcapCounterIncr(c, 100);
+    FAIL_IF(MemcapCounterGet(c) != 100);
+    FAIL_IF(SC_ATOMIC_GET(c->reserved) != 100 + 1024);
+
+    /* served from the credit */
+    MemcapCounterIncr(c, 1000);
+    FAIL_IF(MemcapCounterGet(c) != 1100);
+    FAIL_IF(SC_ATOMIC_GET(c->reserved) != 100 + 1024);
+
+    /* credit beyond a batch is returned */
+    MemcapCounterDecr(c, 1100);
+    FAIL_IF(MemcapCounterGet(c) != 0);
+    FAIL_IF(SC_ATOMIC_GET(c->reserved) != 1024);
+
+    MemcapCounterIncr(c, 5000);
+    MemcapCounterDecr(c, 5000);
+    FAIL_IF(MemcapCounterGet(c) != 0);
+    FAIL_IF(SC_ATOMIC_GET(c->reserved) != 1024);
+
+    /* re-init drops the credit */
+    MemcapCounterInit(c, "test", &memcap_test_memcap);
+    FAIL_IF(SC_ATOMIC_GET(c->reserved) != 0);
+    FAIL_IF(MemcapCounterGet(c) != 0);
+    PASS;
+}
+
+/** \test memcap checks */
+static int MemcapCounterTest02(void)
+{
+    MemcapCounter *c = &memcap_test_counter;
+    memcap_test_memcap = 64 * 1024;
+    MemcapCounterInit(c, "test", &memcap_test_memcap);
+
+    FAIL_IF(MemcapCounterCheck(c, memcap_test_memcap) != 1);
+    FAIL_IF(MemcapCounterCheck(c, memcap_test_memcap + 1) != 0);
+
+    uint64_t used = 0;
+    while (MemcapCounterCheck(c, 100)) {
+        MemcapCounterIncr(c, 100);
+        used += 100;
+    }
+    FAIL_IF(MemcapCounterGet(c) != used);
+    /* no batch is reserved beyond the memcap */
+    FAIL_IF(SC_ATOMIC_GET(c->reserved) > memcap_test_memcap);
+    FAIL_IF(used > memcap_test_memcap);
+    FAIL_IF(used + 100 <= memcap_test_memcap);
+
+    MemcapCounterDecr(c, used);
+    FAIL_IF(MemcapCounterGet(c) != 0);
+    FAIL_IF(MemcapCounterCheck(c, memcap_test_memcap) != 1);
+
+    /* no memcap */
+    memcap_test_memcap = 0;
+    FAIL_IF(MemcapCounterCheck(c, UINT32_MAX) != 1);
+    PASS;
+}
+
+static void *MemcapCounterTestThread(void *arg)
+{
+    uint32_t seed = (uint32_t)(uintptr_t)arg;
+    uint64_t used = 0;
+    int i;
+
+    for (i = 0; i < 100000; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint64_t size = (seed >> 16) % 2000;
+        if (used > 100000 || (seed & 1)) {
+            if (size > used)
+                size = used;
+            MemcapCounterDecr(&memcap_test_counter, size);
+            used -= size;
+        } else {
+            MemcapCounterIncr(&memcap_test_counter, size);
+            used += size;
+        }
+    }
+    /* the frees happen in the main thread */
+    return (void *)(uintptr_t)used;
+}
+
+/** \test threads: totals are exact and credits are returned at exit */
+static int MemcapCounterTest03(void)
+{
+    memcap_test_memcap = 0;
+    MemcapCounterInit(&memcap_test_counter, "test", &memcap_test_memcap);
+    FAIL_IF(memcap_test_counter.batch != MEMCAP_BATCH_MAX);
+
+    pthread_t t[4];
+    uint64_t used = 0;
+    int i;
+    for (i = 0; i < 4; i++) {
+        FAIL_IF(pthread_create(&t[i], NULL, MemcapCounterTestThread,
+                    (void *)(uintptr_t)(i + 1)) != 0);
+    }
+    for (i = 0; i < 4; i++) {
+        void *r = NULL;
+        FAIL_IF(pthread_join(t[i], &r) != 0);
+        used += (uint64_t)(uintptr_t)r;
+    }
+    FAIL_IF(MemcapCounterGet(&memcap_test_counter) != used);
+
+    MemcapCounterDecr(&memcap_test_counter, used);
+    FAIL_IF(MemcapCounterGet(&memcap_test_counter) != 0);
+    PASS;
+}
+
+static pthread_mutex_t memcap_test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t memcap_test_cond = PTHREAD_COND_INITIALIZER;
+static int memcap_test_state = 0;
+
+static void *MemcapCounterTestIdleThread(void *arg)
+{
+    MemcapCounterIncr(&memcap_test_counter, 100);
+    MemcapCounterDecr(&memcap_test_counter, 100);
+
+    /* hold on to the credit until the main thread is done */
+    pthread_mutex_lock(&memcap_test_mutex);
+    memcap_test_state = 1;
+    pthread_cond_broadcast(&memcap_test_cond);
+    while (memcap_test_state != 2)
+        pthread_cond_wait(&memcap_test_cond, &memcap_test_mutex);
+    pthread_mutex_unlock(&memcap_test_mutex);
+    return NULL;
+}
+
+/** \test the idle credit of another thread counts against the memcap
+ *        for at most a batch */
+static int MemcapCounterTest04(void)
+{
+    MemcapCounter *c = &memcap_test_counter;
+    memcap_test_memcap = 64 * 1024;
+    MemcapCounterInit(c, "test", &memcap_test_memcap);
+    memcap_test_state = 0;
+
+    pthread_t t;
+    FAIL_IF(pthread_create(&t, NULL, MemcapCounterTestIdleThread, NULL) != 0);
+    pthread_mutex_lock(&memcap_test_mutex);
+    while (memcap_test_state != 1)
+        pthread_cond_wait(&memcap_test_cond, &memcap_test_mutex);
+    pthread_mutex_unlock(&memcap_test_mutex);
+
+    /* the other thread holds a batch of credit */
+    FAIL_IF(SC_ATOMIC_GET(c->reserved) != c->batch);
+    FAIL_IF(MemcapCounterGet(c) != 0);
+
+    /* all but that batch is available here */
+    const uint64_t avail = memcap_test_memcap - c->batch;
+    FAIL_IF(MemcapCounterCheck(c, avail) != 1);
+    FAIL_IF(MemcapCounterCheck(c, avail + 1) != 0);
+    MemcapCounterIncr(c, avail);
+    FAIL_IF(MemcapCounterGet(c) != avail);
+    FAIL_IF(SC_ATOMIC_GET(c->reserved) != memcap_test_memcap);
+    FAIL_IF(MemcapCounterCheck(c, 1) != 0);
+
+    /* close to the memcap a free returns all of the credit */
+    MemcapCounterDecr(c, 100);
+    FAIL_IF(MemcapCounterGet(c) != avail - 100);
+    FAIL_IF(SC_ATOMIC_GET(c->reserved) != memcap_test_memcap - 100);
+    MemcapCounterDecr(c, avail - 100);
+
+    pthread_mutex_lock(&memcap_test_mutex);
+    memcap_test_state = 2;
+    pthread_cond_broadcast(&memcap_test_cond);
+    pthread_mutex_unlock(&memcap_test_mutex);
+    FAIL_IF(pthread_join(t, NULL) != 0);
+
+    FAIL_IF(MemcapCounterGet(c) != 0);
+    FAIL_IF(SC_ATOMIC_GET(c->reserved) != 0);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void MemcapCounterRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MemcapCounterTest01", MemcapCounterTest01);
+    UtRegisterTest("MemcapCounterTest02", MemcapCounterTest02);
+    UtRegisterTest("MemcapCounterTest03", MemcapCounterTest03);
+    UtRegisterTest("MemcapCounterTest04", MemcapCounterTest04);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,54 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memory use accounting against a memcap with per thread credits.
+ */
+
+#ifndef __UTIL_MEMCAP_H__
+#define __UTIL_MEMCAP_H__
+
+#include "util-atomic.h"
+
+/** max number of counters that use per thread credits */
+#define MEMCAP_COUNTERS_MAX     16
+
+/** max size a thread reserves from the global counter at once */
+#define MEMCAP_BATCH_MAX        (64 * 1024)
+
+typedef struct MemcapCounter_ {
+    /** memory reserved by the threads: the memory in use plus the
+     *  credit the threads have not used yet */
+    SC_ATOMIC_DECLARE(uint64_t, reserved);
+
+    const uint64_t *memcap;     /**< memcap, 0 means no limit */
+    uint32_t batch;             /**< reserve size, 0 disables the credits */
+    int id;                     /**< index in the per thread credits */
+    const char *name;
+} MemcapCounter;
+
+void MemcapCounterInit(MemcapCounter *c, const char *name, const uint64_t *memcap);
+void MemcapCounterIncr(MemcapCounter *c, uint64_t size);
+void MemcapCounterDecr(MemcapCounter *c, uint64_t size);
+int MemcapCounterCheck(MemcapCounter *c, uint64_t size);
+uint64_t MemcapCounterGet(MemcapCounter *c);
+
+void MemcapCounterRegisterTests(void);
+
+#endif /* __UTIL_MEMCAP_H__ */
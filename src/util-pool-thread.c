@@ -35,6 +35,21 @@
 #include "util-unittest.h"
 #include "util-debug.h"
 
+static uint32_t PoolThreadDrainReturnQueue(PoolThreadElement *e);
+
+static PoolThreadReturnQueue *PoolThreadReturnQueueAlloc(void)
+{
+    PoolThreadReturnQueue *q = SCMallocAligned(sizeof(*q), CLS);
+    if (unlikely(q == NULL))
+        return NULL;
+    memset(q, 0x00, sizeof(*q));
+
+    uint32_t i;
+    for (i = 0; i < POOL_THREAD_RETURN_SIZE; i++)
+        q->slots[i].seq = i;
+    return q;
+}
+
 PoolThread *PoolThreadInit(int threads, uint32_t size, uint32_t prealloc_size, uint32_t elt_size,  void *(*Alloc)(void), int (*Init)(void *, void *), void *InitData,  void (*Cleanup)(void *), void (*Free)(void *))
 {
     PoolThread *pt = NULL;
@@ -57,11 +72,17 @@ PoolThread *PoolThreadInit(int threads, uint32_t size, uint32_t prealloc_size, u
         SCLogDebug("memory alloc error");
         goto error;
     }
+    memset(pt->array, 0x00, threads * sizeof(PoolThreadElement));
     pt->size = threads;
 
     for (i = 0; i < threads; i++) {
         PoolThreadElement *e = &pt->array[i];
 
+        e->rq = PoolThreadReturnQueueAlloc();
+        if (e->rq == NULL) {
+            SCLogDebug("memory alloc error");
+            goto error;
+        }
         SCMutexInit(&e->lock, NULL);
         SCMutexLock(&e->lock);
 //        SCLogDebug("size %u prealloc_size %u elt_size %u Alloc %p Init %p InitData %p Cleanup %p Free %p",
@@ -111,6 +132,11 @@ int PoolThreadGrow(PoolThread *pt, uint32_t size, uint32_t prealloc_size, uint32
 
     e = &pt->array[newsize - 1];
     memset(e, 0x00, sizeof(*e));
+    e->rq = PoolThreadReturnQueueAlloc();
+    if (e->rq == NULL) {
+        SCLogError(SC_ERR_POOL_INIT, "pool grow failed");
+        return -1;
+    }
     SCMutexInit(&e->lock, NULL);
     SCMutexLock(&e->lock);
     e->pool = PoolInit(size, prealloc_size, elt_size, Alloc, Init, InitData, Cleanup, Free);
@@ -141,15 +167,80 @@ void PoolThreadFree(PoolThread *pt)
         for (i = 0; i < (int)pt->size; i++) {
             PoolThreadElement *e = &pt->array[i];
             SCMutexLock(&e->lock);
+            if (e->pool != NULL && e->rq != NULL) {
+                /* hand the cached and queued data back to the pool
+                 * so PoolFree frees it */
+                do {
+                    while (e->cache_cnt > 0)
+                        PoolReturn(e->pool, e->cache[--e->cache_cnt]);
+                } while (PoolThreadDrainReturnQueue(e) > 0);
+            }
             PoolFree(e->pool);
             SCMutexUnlock(&e->lock);
             SCMutexDestroy(&e->lock);
+            SCFreeAligned(e->rq);
         }
         SCFree(pt->array);
     }
     SCFree(pt);
 }
 
+/** \internal
+ *  \brief move the data other threads returned into the cache
+ *
+ *  Only called by the owner, or with the element lock held when the
+ *  owner is gone. Stops when the cache is full.
+ *
+ *  \retval cnt number of items moved
+ */
+static uint32_t PoolThreadDrainReturnQueue(PoolThreadElement *e)
+{
+    PoolThreadReturnQueue *q = e->rq;
+    uint32_t cnt = 0;
+
+    while (e->cache_cnt < POOL_THREAD_CACHE_SIZE) {
+        PoolThreadReturnSlot *slot = &q->slots[q->head & (POOL_THREAD_RETURN_SIZE - 1)];
+        if (SCAtomicLoadAcquire(&slot->seq) != q->head + 1)
+            break;
+
+        e->cache[e->cache_cnt++] = slot->data;
+        SCAtomicStoreRelease(&slot->seq, q->head + POOL_THREAD_RETURN_SIZE);
+        q->head++;
+        cnt++;
+    }
+    return cnt;
+}
+
+/** \internal
+ *  \brief add data to the return queue of an element
+ *
+ *  \retval 1 queued
+ *  \retval 0 queue is full
+ */
+static int PoolThreadReturnQueuePush(PoolThreadReturnQueue *q, void *data)
+{
+    uint32_t pos = SCAtomicLoadAcquire(&q->tail);
+
+    while (1) {
+        PoolThreadReturnSlot *slot = &q->slots[pos & (POOL_THREAD_RETURN_SIZE - 1)];
+        const uint32_t seq = SCAtomicLoadAcquire(&slot->seq);
+        const int32_t diff = (int32_t)(seq - pos);
+
+        if (diff == 0) {
+            /* slot is free, claim it */
+            if (SCAtomicCompareAndSwap(&q->tail, pos, pos + 1)) {
+                slot->data = data;
+                SCAtomicStoreRelease(&slot->seq, pos + 1);
+                return 1;
+            }
+        } else if (diff < 0) {
+            /* slot still holds data from a full lap ago */
+            return 0;
+        }
+        pos = SCAtomicLoadAcquire(&q->tail);
+    }
+}
+
 void *PoolThreadGetById(PoolThread *pt, uint16_t id)
 {
     void *data = NULL;
@@ -158,9 +249,35 @@ void *PoolThreadGetById(PoolThread *pt, uint16_t id)
         return NULL;
 
     PoolThreadElement *e = &pt->array[id];
-    SCMutexLock(&e->lock);
-    data = PoolGet(e->pool);
-    SCMutexUnlock(&e->lock);
+    if (unlikely(e->owner_set == 0 || !pthread_equal(e->owner, pthread_self()))) {
+        /* first use, or the thread that used this id is gone */
+        SCMutexLock(&e->lock);
+        e->owner = pthread_self();
+        e->owner_set = 1;
+        SCMutexUnlock(&e->lock);
+    }
+
+    if (e->cache_cnt == 0)
+        PoolThreadDrainReturnQueue(e);
+
+    if (e->cache_cnt > 0) {
+        data = e->cache[--e->cache_cnt];
+    } else {
+        /* refill the cache with the data the pool has ready, only
+         * allocate a single new item so the pool limits still apply */
+        SCMutexLock(&e->lock);
+        while (e->cache_cnt < POOL_THREAD_CACHE_BATCH &&
+               e->pool->alloc_stack_size > 1)
+        {
+            void *d = PoolGet(e->pool);
+            if (d == NULL)
+                break;
+            e->cache[e->cache_cnt++] = d;
+        }
+        data = PoolGet(e->pool);
+        SCMutexUnlock(&e->lock);
+    }
+
     if (data) {
         PoolThreadReserved *did = data;
         *did = id;
@@ -179,6 +296,22 @@ void PoolThreadReturn(PoolThread *pt, void *data)
     SCLogDebug("returning to id %u", *id);
 
     PoolThreadElement *e = &pt->array[*id];
+    if (e->owner_set && pthread_equal(e->owner, pthread_self())) {
+        if (unlikely(e->cache_cnt == POOL_THREAD_CACHE_SIZE)) {
+            /* cache is full, move a batch back to the pool */
+            SCMutexLock(&e->lock);
+            while (e->cache_cnt > POOL_THREAD_CACHE_SIZE - POOL_THREAD_CACHE_BATCH)
+                PoolReturn(e->pool, e->cache[--e->cache_cnt]);
+            SCMutexUnlock(&e->lock);
+        }
+        e->cache[e->cache_cnt++] = data;
+        return;
+    }
+
+    /* returned by another thread: queue it for the owner */
+    if (PoolThreadReturnQueuePush(e->rq, data) == 1)
+        return;
+
     SCMutexLock(&e->lock);
     PoolReturn(e->pool, data);
     SCMutexUnlock(&e->lock);
@@ -323,7 +456,8 @@ static int PoolThreadTestReturn01(void)
         goto end;
     }
 
-    if (pt->array[3].pool->outstanding != 1) {
+    /* the other preallocated items moved into the cache */
+    if (pt->array[3].pool->outstanding != 5 || pt->array[3].cache_cnt != 4) {
         printf("pool outstanding count wrong %u: ",
                 pt->array[3].pool->outstanding);
         goto end;
@@ -331,12 +465,19 @@ static int PoolThreadTestReturn01(void)
 
     PoolThreadReturn(pt, data);
 
-    if (pt->array[3].pool->outstanding != 0) {
+    /* returned by the owner so it's in the cache, not in the pool */
+    if (pt->array[3].pool->outstanding != 5 || pt->array[3].cache_cnt != 5) {
         printf("pool outstanding count wrong %u: ",
                 pt->array[3].pool->outstanding);
         goto end;
     }
 
+    if (PoolThreadGetById(pt, 3) != data) {
+        printf("data not from the cache: ");
+        goto end;
+    }
+    PoolThreadReturn(pt, data);
+
 
     result = 1;
 end:
@@ -413,7 +554,8 @@ static int PoolThreadTestGrow03(void)
         goto end;
     }
 
-    if (pt->array[4].pool->outstanding != 1) {
+    /* the other preallocated items moved into the cache */
+    if (pt->array[4].pool->outstanding != 5 || pt->array[4].cache_cnt != 4) {
         printf("pool outstanding count wrong %u: ",
                 pt->array[4].pool->outstanding);
         goto end;
@@ -421,7 +563,7 @@ static int PoolThreadTestGrow03(void)
 
     PoolThreadReturn(pt, data);
 
-    if (pt->array[4].pool->outstanding != 0) {
+    if (pt->array[4].pool->outstanding != 5 || pt->array[4].cache_cnt != 5) {
         printf("pool outstanding count wrong %u: ",
                 pt->array[4].pool->outstanding);
         goto end;
@@ -434,6 +576,109 @@ end:
     return result;
 }
 
+/** \test owner gets and returns through the cache, a full cache
+ *        moves a batch back to the pool */
+static int PoolThreadTestCache01(void)
+{
+    void *data[POOL_THREAD_CACHE_SIZE + 1];
+    int i;
+
+    PoolThread *pt = PoolThreadInit(2, /* threads */
+                                    0, 8, sizeof(struct PoolThreadTestData),
+                                    PoolThreadTestAlloc, NULL, NULL, NULL, NULL);
+    FAIL_IF_NULL(pt);
+    PoolThreadElement *e = &pt->array[1];
+
+    /* first get moves the preallocated items into the cache */
+    data[0] = PoolThreadGetById(pt, 1);
+    FAIL_IF_NULL(data[0]);
+    FAIL_IF(e->cache_cnt != 7);
+    FAIL_IF(e->pool->outstanding != 8);
+
+    for (i = 1; i < POOL_THREAD_CACHE_SIZE + 1; i++) {
+        data[i] = PoolThreadGetById(pt, 1);
+        FAIL_IF_NULL(data[i]);
+    }
+    FAIL_IF(e->cache_cnt != 0);
+    FAIL_IF(e->pool->outstanding != POOL_THREAD_CACHE_SIZE + 1);
+
+    for (i = 0; i < POOL_THREAD_CACHE_SIZE; i++)
+        PoolThreadReturn(pt, data[i]);
+    FAIL_IF(e->cache_cnt != POOL_THREAD_CACHE_SIZE);
+    FAIL_IF(e->pool->outstanding != POOL_THREAD_CACHE_SIZE + 1);
+
+    PoolThreadReturn(pt, data[POOL_THREAD_CACHE_SIZE]);
+    FAIL_IF(e->cache_cnt != POOL_THREAD_CACHE_SIZE - POOL_THREAD_CACHE_BATCH + 1);
+    FAIL_IF(e->pool->outstanding != POOL_THREAD_CACHE_SIZE - POOL_THREAD_CACHE_BATCH + 1);
+
+    /* last in, first out */
+    FAIL_IF(PoolThreadGetById(pt, 1) != data[POOL_THREAD_CACHE_SIZE]);
+    PoolThreadReturn(pt, data[POOL_THREAD_CACHE_SIZE]);
+
+    PoolThreadFree(pt);
+    PASS;
+}
+
+#define POOL_THREAD_TEST_ITEMS (POOL_THREAD_RETURN_SIZE + 16)
+
+struct PoolThreadTestReturner {
+    PoolThread *pt;
+    void **data;
+    int cnt;
+};
+
+static void *PoolThreadTestReturner(void *arg)
+{
+    struct PoolThreadTestReturner *r = arg;
+    int i;
+    for (i = 0; i < r->cnt; i++)
+        PoolThreadReturn(r->pt, r->data[i]);
+    return NULL;
+}
+
+/** \test data returned by another thread is queued for the owner,
+ *        when the queue is full it goes to the pool */
+static int PoolThreadTestReturn02(void)
+{
+    static void *data[POOL_THREAD_TEST_ITEMS];
+    int i, j;
+
+    PoolThread *pt = PoolThreadInit(1, /* threads */
+                                    0, 0, sizeof(struct PoolThreadTestData),
+                                    PoolThreadTestAlloc, NULL, NULL, NULL, NULL);
+    FAIL_IF_NULL(pt);
+    PoolThreadElement *e = &pt->array[0];
+
+    for (i = 0; i < POOL_THREAD_TEST_ITEMS; i++) {
+        data[i] = PoolThreadGetById(pt, 0);
+        FAIL_IF_NULL(data[i]);
+    }
+
+    struct PoolThreadTestReturner r = { pt, data, POOL_THREAD_TEST_ITEMS };
+    pthread_t t;
+    FAIL_IF(pthread_create(&t, NULL, PoolThreadTestReturner, &r) != 0);
+    pthread_join(t, NULL);
+
+    FAIL_IF(e->cache_cnt != 0);
+    FAIL_IF(e->pool->outstanding != POOL_THREAD_RETURN_SIZE);
+
+    /* the owner gets the queued items back, the first cache full at once */
+    void *d = PoolThreadGetById(pt, 0);
+    FAIL_IF_NULL(d);
+    FAIL_IF(e->cache_cnt != POOL_THREAD_CACHE_SIZE - 1);
+    int found = 0;
+    for (j = 0; j < POOL_THREAD_RETURN_SIZE; j++) {
+        if (data[j] == d)
+            found = 1;
+    }
+    FAIL_IF_NOT(found);
+    PoolThreadReturn(pt, d);
+
+    /* queued and cached items are freed with the pool */
+    PoolThreadFree(pt);
+    PASS;
+}
+
 #endif
 
 void PoolThreadRegisterTests(void)
@@ -446,6 +691,8 @@ void PoolThreadRegisterTests(void)
     UtRegisterTest("PoolThreadTestGet02", PoolThreadTestGet02);
 
     UtRegisterTest("PoolThreadTestReturn01", PoolThreadTestReturn01);
+    UtRegisterTest("PoolThreadTestReturn02", PoolThreadTestReturn02);
+    UtRegisterTest("PoolThreadTestCache01", PoolThreadTestCache01);
 
     UtRegisterTest("PoolThreadTestGrow01", PoolThreadTestGrow01);
     UtRegisterTest("PoolThreadTestGrow02", PoolThreadTestGrow02);
@@ -34,14 +34,57 @@
  *
  *  It's purpose is to make sure thread X can return data to a pool
  *  from thread Y.
+ *
+ *  Each element has a cache of data items in front of the pool that is
+ *  only used by the thread getting data from it: the owner. The owner
+ *  gets and returns data through the cache without locking. Data
+ *  returned by other threads goes into a lock free queue that the owner
+ *  empties into its cache. The element lock is only taken to move a
+ *  batch of items between the cache and the pool.
+ *
+ *  An id must only be used by one thread at a time to get data.
  */
 
 #ifndef __UTIL_POOL_THREAD_H__
 #define __UTIL_POOL_THREAD_H__
 
+/** size of the per thread cache of data items */
+#define POOL_THREAD_CACHE_SIZE      64
+/** number of items moved between the cache and the pool at once */
+#define POOL_THREAD_CACHE_BATCH     (POOL_THREAD_CACHE_SIZE / 2)
+/** size of the queue for data returned by other threads, power of 2 */
+#define POOL_THREAD_RETURN_SIZE     1024
+
+typedef struct PoolThreadReturnSlot_ {
+    uint32_t seq;
+    void *data;
+} PoolThreadReturnSlot;
+
+/** bounded lock free queue with many producers (the threads returning
+ *  data they didn't get themselves) and a single consumer (the owner) */
+typedef struct PoolThreadReturnQueue_ {
+    uint32_t tail;                  /**< producers, updated by CAS */
+    uint8_t pad0[CLS - sizeof(uint32_t)];
+    uint32_t head;                  /**< owner only */
+    uint8_t pad1[CLS - sizeof(uint32_t)];
+    PoolThreadReturnSlot slots[POOL_THREAD_RETURN_SIZE];
+} PoolThreadReturnQueue;
+
 struct PoolThreadElement_ {
     SCMutex lock;                   /**< lock, should have low contention */
     Pool *pool;                     /**< actual pool */
+
+    /** the thread getting data from this element. Only this thread
+     *  touches the cache, so getting and returning data through the
+     *  cache needs no lock. */
+    pthread_t owner;
+    int owner_set;
+
+    uint32_t cache_cnt;
+    void *cache[POOL_THREAD_CACHE_SIZE];
+
+    /** data returned by other threads, moved into the cache by the owner */
+    PoolThreadReturnQueue *rq;
 };
 // __attribute__((aligned(CLS))); <- VJ: breaks on clang 32bit, segv in PoolThreadTestGrow01
 
@@ -76,7 +119,8 @@ int PoolThreadGrow(PoolThread *pt, uint32_t size, uint32_t prealloc_size, uint32
 void PoolThreadFree(PoolThread *pt);
 
 /** \brief get data from thread pool by thread id
- *  \note wrapper around PoolGet()
+ *  \note wrapper around PoolGet(), the calling thread becomes the
+ *        owner of the id
  *  \param pt thread pool
  *  \param id thread id
  *  \retval ptr data or NULL */
@@ -40,6 +40,7 @@
     (cfg)->Free ? (cfg)->Free((ptr), (s)) : SCFree((ptr))
 
 static void SBBFree(StreamingBuffer *sb);
+static void RegionsFree(StreamingBuffer *sb);
 
 static inline int InitBuffer(StreamingBuffer *sb)
 {
@@ -58,7 +59,8 @@ StreamingBuffer *StreamingBufferInit(const StreamingBufferConfig *cfg)
         sb->buf_size = cfg->buf_size;
         sb->cfg = cfg;
 
-        if (cfg->buf_size > 0) {
+        /* regions are allocated when data is added */
+        if (cfg->buf_size > 0 && !(cfg->flags & STREAMING_BUFFER_REGIONS)) {
             if (InitBuffer(sb) == 0) {
                 return sb;
             }
@@ -77,6 +79,7 @@ void StreamingBufferClear(StreamingBuffer *sb)
         SCLogDebug("sb->buf_size %u max %u", sb->buf_size, sb->buf_size_max);
 
         SBBFree(sb);
+        RegionsFree(sb);
         if (sb->buf != NULL) {
             FREE(sb->cfg, sb->buf, sb->buf_size);
             sb->buf = NULL;
@@ -84,12 +87,74 @@ void StreamingBufferClear(StreamingBuffer *sb)
     }
 }
 
+/**
+ *  \brief drop the creator's reference to the buffer
+ *
+ *  If the buffer is shared it is only freed once the last user is done
+ *  with it, see StreamingBufferShareRef.
+ */
 void StreamingBufferFree(StreamingBuffer *sb)
 {
-    if (sb != NULL) {
-        StreamingBufferClear(sb);
-        FREE(sb->cfg, sb, sizeof(StreamingBuffer));
+    StreamingBufferFreeUser(sb, 0);
+}
+
+/**
+ *  \brief get a reference to a buffer for a new user
+ *
+ *  The user reads the data in place instead of keeping a copy. Each user
+ *  slides with StreamingBufferSlideToOffsetUser and the buffer only slides
+ *  up to the user that is furthest behind. The buffer is freed when all
+ *  users called StreamingBufferFreeUser (or StreamingBufferFree for the
+ *  creator).
+ *
+ *  \param user[out] id to pass to the *User functions
+ *
+ *  \retval 0 ok
+ *  \retval -1 no free user slot, or the buffer slides on its own
+ */
+int StreamingBufferShareRef(StreamingBuffer *sb, uint8_t *user)
+{
+    if (sb == NULL || (sb->cfg->flags & STREAMING_BUFFER_AUTOSLIDE))
+        return -1;
+
+    if (sb->share == NULL) {
+        sb->share = CALLOC(sb->cfg, 1, sizeof(StreamingBufferShare));
+        if (sb->share == NULL)
+            return -1;
+        sb->share->users = BIT_U8(0);
+        sb->share->edge[0] = sb->stream_offset;
+    }
+
+    uint8_t u;
+    for (u = 0; u < STREAMING_BUFFER_USERS_MAX; u++) {
+        if (!(sb->share->users & BIT_U8(u))) {
+            sb->share->users |= BIT_U8(u);
+            sb->share->edge[u] = sb->stream_offset;
+            *user = u;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ *  \brief drop a user's reference, free the buffer if it was the last
+ */
+void StreamingBufferFreeUser(StreamingBuffer *sb, uint8_t user)
+{
+    if (sb == NULL)
+        return;
+
+    if (sb->share != NULL) {
+        sb->share->users &= ~BIT_U8(user);
+        if (sb->share->users != 0)
+            return;
+        FREE(sb->cfg, sb->share, sizeof(StreamingBufferShare));
+        sb->share = NULL;
     }
+
+    StreamingBufferClear(sb);
+    FREE(sb->cfg, sb, sizeof(StreamingBuffer));
 }
 
 #ifdef DEBUG
@@ -472,6 +537,238 @@ static void SBBPrune(StreamingBuffer *sb)
     }
 }
 
+static int RegionsInit(StreamingBuffer *sb)
+{
+    StreamingBufferRegions *r = CALLOC(sb->cfg, 1, sizeof(*r));
+    if (r == NULL)
+        return -1;
+    r->region_size = sb->cfg->buf_size ? sb->cfg->buf_size :
+                                         STREAMING_BUFFER_REGION_SIZE_DEFAULT;
+    r->base = sb->stream_offset / r->region_size;
+    sb->regions = r;
+    return 0;
+}
+
+static void RegionsFree(StreamingBuffer *sb)
+{
+    StreamingBufferRegions *r = sb->regions;
+    if (r == NULL)
+        return;
+
+    uint32_t i;
+    for (i = 0; i < r->region_cnt; i++) {
+        if (r->region[i] != NULL)
+            FREE(sb->cfg, r->region[i], r->region_size);
+    }
+    if (r->region != NULL)
+        FREE(sb->cfg, r->region, r->region_cnt * sizeof(uint8_t *));
+    if (r->scratch != NULL)
+        FREE(sb->cfg, r->scratch, r->scratch_size);
+    FREE(sb->cfg, r, sizeof(*r));
+    sb->regions = NULL;
+}
+
+/** \internal
+ *  \brief make sure the region array covers region number 'n'
+ */
+static int RegionsGrow(StreamingBuffer *sb, uint64_t n)
+{
+    StreamingBufferRegions *r = sb->regions;
+    if (n - r->base < r->region_cnt)
+        return 0;
+    if (n - r->base >= UINT32_MAX / 2)
+        return -1;
+
+    uint32_t cnt = r->region_cnt ? r->region_cnt * 2 : 8;
+    while (cnt <= n - r->base)
+        cnt *= 2;
+
+    void *ptr = REALLOC(sb->cfg, r->region, r->region_cnt * sizeof(uint8_t *),
+            cnt * sizeof(uint8_t *));
+    if (ptr == NULL)
+        return -1;
+    r->region = ptr;
+    memset(r->region + r->region_cnt, 0, (cnt - r->region_cnt) * sizeof(uint8_t *));
+    r->region_cnt = cnt;
+    return 0;
+}
+
+/** \internal
+ *  \brief copy data into the regions at absolute offset 'offset'
+ *
+ *  Only the regions the data touches are allocated, so gaps don't
+ *  use memory.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, buffer offsets unchanged
+ */
+static int __attribute__((warn_unused_result))
+RegionsWrite(StreamingBuffer *sb, uint64_t offset,
+             const uint8_t *data, uint32_t data_len)
+{
+    if (data_len == 0)
+        return 0;
+    if (sb->regions == NULL) {
+        if (RegionsInit(sb) != 0)
+            return -1;
+    }
+    StreamingBufferRegions *r = sb->regions;
+    if (RegionsGrow(sb, (offset + data_len - 1) / r->region_size) != 0)
+        return -1;
+
+    while (data_len > 0) {
+        const uint32_t idx = (offset / r->region_size) - r->base;
+        const uint32_t roffset = offset % r->region_size;
+        const uint32_t len = MIN(r->region_size - roffset, data_len);
+
+        if (r->region[idx] == NULL) {
+            /* zeroed for safe printing of gaps, like Grow does */
+            r->region[idx] = CALLOC(sb->cfg, 1, r->region_size);
+            if (r->region[idx] == NULL)
+                return -1;
+        }
+        memcpy(r->region[idx] + roffset, data, len);
+        offset += len;
+        data += len;
+        data_len -= len;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief free the regions that are completely before stream_offset
+ */
+static void RegionsRelease(StreamingBuffer *sb)
+{
+    StreamingBufferRegions *r = sb->regions;
+    if (r == NULL)
+        return;
+
+    const uint64_t base = sb->stream_offset / r->region_size;
+    if (base <= r->base)
+        return;
+
+    uint32_t i;
+    uint32_t release = (base - r->base < r->region_cnt) ?
+                       (uint32_t)(base - r->base) : r->region_cnt;
+    for (i = 0; i < release; i++) {
+        if (r->region[i] != NULL)
+            FREE(sb->cfg, r->region[i], r->region_size);
+    }
+    /* only the pointers move, the data stays where it is */
+    memmove(r->region, r->region + release,
+            (r->region_cnt - release) * sizeof(uint8_t *));
+    memset(r->region + (r->region_cnt - release), 0, release * sizeof(uint8_t *));
+    r->base = base;
+}
+
+/** \internal
+ *  \brief copy an absolute range into the scratch buffer, gaps are zero
+ *         filled
+ *
+ *  Only the requested range is copied. The copy stays valid until the
+ *  next range that spans regions is requested.
+ *
+ *  \param offset absolute offset, within the window
+ *  \param len length, offset + len within the window
+ */
+static const uint8_t *RegionsCopyRange(const StreamingBuffer *sb,
+        uint64_t offset, uint32_t len)
+{
+    StreamingBufferRegions *r = sb->regions;
+
+    if (r->scratch_size < len) {
+        uint32_t size = ((len + r->region_size - 1) / r->region_size) * r->region_size;
+        void *ptr = REALLOC(sb->cfg, r->scratch, r->scratch_size, size);
+        if (ptr == NULL)
+            return NULL;
+        r->scratch = ptr;
+        r->scratch_size = size;
+    }
+
+    uint32_t done = 0;
+    while (done < len) {
+        const uint64_t idx = (offset / r->region_size) - r->base;
+        const uint32_t roffset = offset % r->region_size;
+        const uint32_t clen = MIN(r->region_size - roffset, len - done);
+
+        if (idx < r->region_cnt && r->region[idx] != NULL)
+            memcpy(r->scratch + done, r->region[idx] + roffset, clen);
+        else
+            memset(r->scratch + done, 0, clen);
+        offset += clen;
+        done += clen;
+    }
+    return r->scratch;
+}
+
+/** \internal
+ *  \brief get the data for an absolute range, clipped to the window
+ *
+ *  Returns a pointer into the region if the range is in one region,
+ *  otherwise a copy of just that range, see RegionsCopyRange.
+ */
+static void RegionsGetData(const StreamingBuffer *sb, uint64_t offset, uint64_t len,
+                           const uint8_t **data, uint32_t *data_len)
+{
+    const uint64_t right_edge = sb->stream_offset + sb->buf_offset;
+    const StreamingBufferRegions *r = sb->regions;
+
+    if (offset < sb->stream_offset) {
+        if (offset + len <= sb->stream_offset)
+            goto none;
+        len -= sb->stream_offset - offset;
+        offset = sb->stream_offset;
+    }
+    if (r == NULL || len == 0 || offset >= right_edge)
+        goto none;
+    if (offset + len > right_edge)
+        len = right_edge - offset;
+
+    const uint64_t n = offset / r->region_size;
+    if ((offset + len - 1) / r->region_size == n) {
+        const uint64_t idx = n - r->base;
+        if (idx < r->region_cnt && r->region[idx] != NULL) {
+            *data = r->region[idx] + (offset % r->region_size);
+            *data_len = (uint32_t)len;
+            return;
+        }
+    }
+
+    const uint8_t *copy = RegionsCopyRange(sb, offset, (uint32_t)len);
+    if (copy == NULL)
+        goto none;
+    *data = copy;
+    *data_len = (uint32_t)len;
+    return;
+none:
+    *data = NULL;
+    *data_len = 0;
+}
+
+/**
+ * \internal
+ * \brief move the window forward by 'slide'
+ *
+ * In regions mode the data stays in place and the regions that are
+ * now completely before the window are freed.
+ */
+static void DoSlide(StreamingBuffer *sb, uint32_t slide)
+{
+    uint32_t size = sb->buf_offset - slide;
+    SCLogDebug("sliding %u forward, size of original buffer left after slide %u", slide, size);
+    if (sb->cfg->flags & STREAMING_BUFFER_REGIONS) {
+        sb->stream_offset += slide;
+        sb->buf_offset = size;
+        RegionsRelease(sb);
+    } else {
+        memmove(sb->buf, sb->buf+slide, size);
+        sb->stream_offset += slide;
+        sb->buf_offset = size;
+    }
+    SBBPrune(sb);
+}
+
 /**
  * \internal
  * \brief move buffer forward by 'slide'
@@ -480,11 +777,7 @@ static void AutoSlide(StreamingBuffer *sb)
 {
     uint32_t size = sb->cfg->buf_slide;
     uint32_t slide = sb->buf_offset - size;
-    SCLogDebug("sliding %u forward, size of original buffer left after slide %u", slide, size);
-    memmove(sb->buf, sb->buf+slide, size);
-    sb->stream_offset += slide;
-    sb->buf_offset = size;
-    SBBPrune(sb);
+    DoSlide(sb, slide);
 }
 
 static int __attribute__((warn_unused_result))
@@ -551,37 +844,81 @@ static int __attribute__((warn_unused_result)) Grow(StreamingBuffer *sb)
  */
 void StreamingBufferSlideToOffset(StreamingBuffer *sb, uint64_t offset)
 {
+    if (sb->share != NULL) {
+        StreamingBufferSlideToOffsetUser(sb, 0, offset);
+        return;
+    }
+
     if (offset > sb->stream_offset &&
         offset <= sb->stream_offset + sb->buf_offset)
     {
         uint32_t slide = offset - sb->stream_offset;
-        uint32_t size = sb->buf_offset - slide;
-        SCLogDebug("sliding %u forward, size of original buffer left after slide %u", slide, size);
-        memmove(sb->buf, sb->buf+slide, size);
-        sb->stream_offset += slide;
-        sb->buf_offset = size;
-        SBBPrune(sb);
+        DoSlide(sb, slide);
+    }
+}
+
+/**
+ *  \brief a user of a shared buffer no longer needs the data before
+ *         'offset'. Slides to the lowest offset of all users.
+ */
+void StreamingBufferSlideToOffsetUser(StreamingBuffer *sb, uint8_t user, uint64_t offset)
+{
+    StreamingBufferShare *share = sb->share;
+    if (share == NULL) {
+        StreamingBufferSlideToOffset(sb, offset);
+        return;
+    }
+
+    if (offset > share->edge[user])
+        share->edge[user] = offset;
+
+    uint64_t left_edge = UINT64_MAX;
+    uint8_t u;
+    for (u = 0; u < STREAMING_BUFFER_USERS_MAX; u++) {
+        if ((share->users & BIT_U8(u)) && share->edge[u] < left_edge)
+            left_edge = share->edge[u];
+    }
+
+    if (left_edge > sb->stream_offset &&
+        left_edge <= sb->stream_offset + sb->buf_offset)
+    {
+        uint32_t slide = left_edge - sb->stream_offset;
+        DoSlide(sb, slide);
     }
 }
 
 void StreamingBufferSlide(StreamingBuffer *sb, uint32_t slide)
 {
-    uint32_t size = sb->buf_offset - slide;
-    SCLogDebug("sliding %u forward, size of original buffer left after slide %u", slide, size);
-    memmove(sb->buf, sb->buf+slide, size);
-    sb->stream_offset += slide;
-    sb->buf_offset = size;
-    SBBPrune(sb);
+    DoSlide(sb, slide);
 }
 
 #define DATA_FITS(sb, len) \
     ((sb)->buf_offset + (len) <= (sb)->buf_size)
 
-StreamingBufferSegment *StreamingBufferAppendRaw(StreamingBuffer *sb, const uint8_t *data, uint32_t data_len)
+/** \internal
+ *  \brief copy data to the end of the buffer, growing or sliding it
+ *         as needed. Doesn't update buf_offset.
+ *
+ *  In regions mode AUTOSLIDE keeps the window under buf_size, there
+ *  is no buffer to grow.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+static int __attribute__((warn_unused_result))
+AppendData(StreamingBuffer *sb, const uint8_t *data, uint32_t data_len)
 {
+    if (sb->cfg->flags & STREAMING_BUFFER_REGIONS) {
+        if ((sb->cfg->flags & STREAMING_BUFFER_AUTOSLIDE) &&
+            sb->buf_offset + data_len > sb->cfg->buf_size &&
+            sb->buf_offset > sb->cfg->buf_slide)
+            AutoSlide(sb);
+        return RegionsWrite(sb, sb->stream_offset + sb->buf_offset, data, data_len);
+    }
+
     if (sb->buf == NULL) {
         if (InitBuffer(sb) == -1)
-            return NULL;
+            return -1;
     }
 
     if (!DATA_FITS(sb, data_len)) {
@@ -589,33 +926,43 @@ StreamingBufferSegment *StreamingBufferAppendRaw(StreamingBuffer *sb, const uint
             AutoSlide(sb);
         if (sb->buf_size == 0) {
             if (GrowToSize(sb, data_len) != 0)
-                return NULL;
+                return -1;
         } else {
             while (!DATA_FITS(sb, data_len)) {
                 if (Grow(sb) != 0) {
-                    return NULL;
+                    return -1;
                 }
             }
         }
     }
     if (!DATA_FITS(sb, data_len)) {
-        return NULL;
+        return -1;
     }
 
+    memcpy(sb->buf + sb->buf_offset, data, data_len);
+    return 0;
+}
+
+StreamingBufferSegment *StreamingBufferAppendRaw(StreamingBuffer *sb, const uint8_t *data, uint32_t data_len)
+{
     StreamingBufferSegment *seg = CALLOC(sb->cfg, 1, sizeof(StreamingBufferSegment));
-    if (seg != NULL) {
-        memcpy(sb->buf + sb->buf_offset, data, data_len);
-        seg->stream_offset = sb->stream_offset + sb->buf_offset;
-        seg->segment_len = data_len;
-        uint32_t rel_offset = sb->buf_offset;
-        sb->buf_offset += data_len;
-
-        if (sb->block_list) {
-            SBBUpdate(sb, rel_offset, data_len);
-        }
-        return seg;
+    if (seg == NULL)
+        return NULL;
+
+    if (AppendData(sb, data, data_len) != 0) {
+        FREE(sb->cfg, seg, sizeof(StreamingBufferSegment));
+        return NULL;
     }
-    return NULL;
+
+    seg->stream_offset = sb->stream_offset + sb->buf_offset;
+    seg->segment_len = data_len;
+    uint32_t rel_offset = sb->buf_offset;
+    sb->buf_offset += data_len;
+
+    if (sb->block_list) {
+        SBBUpdate(sb, rel_offset, data_len);
+    }
+    return seg;
 }
 
 int StreamingBufferAppend(StreamingBuffer *sb, StreamingBufferSegment *seg,
@@ -623,30 +970,9 @@ int StreamingBufferAppend(StreamingBuffer *sb, StreamingBufferSegment *seg,
 {
     BUG_ON(seg == NULL);
 
-    if (sb->buf == NULL) {
-        if (InitBuffer(sb) == -1)
-            return -1;
-    }
-
-    if (!DATA_FITS(sb, data_len)) {
-        if (sb->cfg->flags & STREAMING_BUFFER_AUTOSLIDE)
-            AutoSlide(sb);
-        if (sb->buf_size == 0) {
-            if (GrowToSize(sb, data_len) != 0)
-                return -1;
-        } else {
-            while (!DATA_FITS(sb, data_len)) {
-                if (Grow(sb) != 0) {
-                    return -1;
-                }
-            }
-        }
-    }
-    if (!DATA_FITS(sb, data_len)) {
+    if (AppendData(sb, data, data_len) != 0)
         return -1;
-    }
 
-    memcpy(sb->buf + sb->buf_offset, data, data_len);
     seg->stream_offset = sb->stream_offset + sb->buf_offset;
     seg->segment_len = data_len;
     uint32_t rel_offset = sb->buf_offset;
@@ -664,30 +990,9 @@ int StreamingBufferAppend(StreamingBuffer *sb, StreamingBufferSegment *seg,
 int StreamingBufferAppendNoTrack(StreamingBuffer *sb,
                                  const uint8_t *data, uint32_t data_len)
 {
-    if (sb->buf == NULL) {
-        if (InitBuffer(sb) == -1)
-            return -1;
-    }
-
-    if (!DATA_FITS(sb, data_len)) {
-        if (sb->cfg->flags & STREAMING_BUFFER_AUTOSLIDE)
-            AutoSlide(sb);
-        if (sb->buf_size == 0) {
-            if (GrowToSize(sb, data_len) != 0)
-                return -1;
-        } else {
-            while (!DATA_FITS(sb, data_len)) {
-                if (Grow(sb) != 0) {
-                    return -1;
-                }
-            }
-        }
-    }
-    if (!DATA_FITS(sb, data_len)) {
+    if (AppendData(sb, data, data_len) != 0)
         return -1;
-    }
 
-    memcpy(sb->buf + sb->buf_offset, data, data_len);
     uint32_t rel_offset = sb->buf_offset;
     sb->buf_offset += data_len;
 
@@ -712,27 +1017,33 @@ int StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
     if (offset < sb->stream_offset)
         return -1;
 
-    if (sb->buf == NULL) {
-        if (InitBuffer(sb) == -1)
+    uint32_t rel_offset = offset - sb->stream_offset;
+    if (sb->cfg->flags & STREAMING_BUFFER_REGIONS) {
+        /* no need to slide or grow, the gap isn't allocated */
+        if (RegionsWrite(sb, offset, data, data_len) != 0)
             return -1;
-    }
+    } else {
+        if (sb->buf == NULL) {
+            if (InitBuffer(sb) == -1)
+                return -1;
+        }
 
-    uint32_t rel_offset = offset - sb->stream_offset;
-    if (!DATA_FITS_AT_OFFSET(sb, data_len, rel_offset)) {
-        if (sb->cfg->flags & STREAMING_BUFFER_AUTOSLIDE) {
-            AutoSlide(sb);
-            rel_offset = offset - sb->stream_offset;
+        if (!DATA_FITS_AT_OFFSET(sb, data_len, rel_offset)) {
+            if (sb->cfg->flags & STREAMING_BUFFER_AUTOSLIDE) {
+                AutoSlide(sb);
+                rel_offset = offset - sb->stream_offset;
+            }
+            if (!DATA_FITS_AT_OFFSET(sb, data_len, rel_offset)) {
+                if (GrowToSize(sb, (rel_offset + data_len)) != 0)
+                    return -1;
+            }
         }
         if (!DATA_FITS_AT_OFFSET(sb, data_len, rel_offset)) {
-            if (GrowToSize(sb, (rel_offset + data_len)) != 0)
-                return -1;
+            return -1;
         }
-    }
-    if (!DATA_FITS_AT_OFFSET(sb, data_len, rel_offset)) {
-        return -1;
-    }
 
-    memcpy(sb->buf + rel_offset, data, data_len);
+        memcpy(sb->buf + rel_offset, data, data_len);
+    }
     seg->stream_offset = offset;
     seg->segment_len = data_len;
 
@@ -789,6 +1100,11 @@ void StreamingBufferSBBGetData(const StreamingBuffer *sb,
                                const StreamingBufferBlock *sbb,
                                const uint8_t **data, uint32_t *data_len)
 {
+    if (sb->cfg->flags & STREAMING_BUFFER_REGIONS) {
+        RegionsGetData(sb, sbb->offset, sbb->len, data, data_len);
+        return;
+    }
+
     if (sbb->offset >= sb->stream_offset) {
         uint64_t offset = sbb->offset - sb->stream_offset;
         *data = sb->buf + offset;
@@ -819,6 +1135,11 @@ void StreamingBufferSBBGetDataAtOffset(const StreamingBuffer *sb,
     if (offset >= sbb->offset && offset < (sbb->offset + sbb->len)) {
         uint32_t sbblen = sbb->len - (offset - sbb->offset);
 
+        if (sb->cfg->flags & STREAMING_BUFFER_REGIONS) {
+            RegionsGetData(sb, offset, sbblen, data, data_len);
+            return;
+        }
+
         if (offset >= sb->stream_offset) {
             uint64_t data_offset = offset - sb->stream_offset;
             *data = sb->buf + data_offset;
@@ -848,6 +1169,11 @@ void StreamingBufferSegmentGetData(const StreamingBuffer *sb,
                                    const StreamingBufferSegment *seg,
                                    const uint8_t **data, uint32_t *data_len)
 {
+    if (sb->cfg->flags & STREAMING_BUFFER_REGIONS) {
+        RegionsGetData(sb, seg->stream_offset, seg->segment_len, data, data_len);
+        return;
+    }
+
     if (likely(sb->buf)) {
         if (seg->stream_offset >= sb->stream_offset) {
             uint64_t offset = seg->stream_offset - sb->stream_offset;
@@ -895,6 +1221,12 @@ int StreamingBufferGetData(const StreamingBuffer *sb,
         const uint8_t **data, uint32_t *data_len,
         uint64_t *stream_offset)
 {
+    if (sb != NULL && (sb->cfg->flags & STREAMING_BUFFER_REGIONS)) {
+        RegionsGetData(sb, sb->stream_offset, sb->buf_offset, data, data_len);
+        *stream_offset = sb->stream_offset;
+        return (*data != NULL);
+    }
+
     if (sb != NULL && sb->buf != NULL) {
         *data = sb->buf;
         *data_len = sb->buf_offset;
@@ -912,6 +1244,15 @@ int StreamingBufferGetDataAtOffset (const StreamingBuffer *sb,
         const uint8_t **data, uint32_t *data_len,
         uint64_t offset)
 {
+    if (sb != NULL && (sb->cfg->flags & STREAMING_BUFFER_REGIONS) &&
+            offset >= sb->stream_offset &&
+            offset < (sb->stream_offset + sb->buf_offset))
+    {
+        RegionsGetData(sb, offset, sb->stream_offset + sb->buf_offset - offset,
+                data, data_len);
+        return (*data != NULL);
+    }
+
     if (sb != NULL && sb->buf != NULL &&
             offset >= sb->stream_offset &&
             offset < (sb->stream_offset + sb->buf_offset))
@@ -956,7 +1297,12 @@ int StreamingBufferCompareRawData(const StreamingBuffer *sb,
 #ifdef UNITTESTS
 static void Dump(StreamingBuffer *sb)
 {
-    PrintRawDataFp(stdout, sb->buf, sb->buf_offset);
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    uint64_t offset = 0;
+    if (StreamingBufferGetData(sb, &data, &data_len, &offset)) {
+        PrintRawDataFp(stdout, data, data_len);
+    }
 }
 
 static void DumpSegment(StreamingBuffer *sb, StreamingBufferSegment *seg)
@@ -1459,6 +1805,225 @@ static int StreamingBufferTest10(void)
     PASS;
 }
 
+static uint32_t RegionsInUse(StreamingBuffer *sb)
+{
+    uint32_t i, cnt = 0;
+    for (i = 0; sb->regions != NULL && i < sb->regions->region_cnt; i++) {
+        if (sb->regions->region[i] != NULL)
+            cnt++;
+    }
+    return cnt;
+}
+
+/** \test regions: zero copy segments, a copy of just the range for data
+ *        spanning regions, sliding frees regions */
+static int StreamingBufferTest11(void)
+{
+    StreamingBufferConfig cfg = { STREAMING_BUFFER_REGIONS, 0, 8, NULL, NULL, NULL, NULL };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+    FAIL_IF(sb->buf != NULL);
+
+    StreamingBufferSegment seg1;
+    FAIL_IF(StreamingBufferAppend(sb, &seg1, (const uint8_t *)"ABCDEF", 6) != 0);
+    StreamingBufferSegment seg2;
+    FAIL_IF(StreamingBufferAppend(sb, &seg2, (const uint8_t *)"GHIJKL", 6) != 0);
+    StreamingBufferSegment seg3;
+    FAIL_IF(StreamingBufferAppend(sb, &seg3, (const uint8_t *)"0123", 4) != 0);
+    FAIL_IF(sb->stream_offset != 0);
+    FAIL_IF(sb->buf_offset != 16);
+    FAIL_IF(sb->buf != NULL);
+    FAIL_IF(RegionsInUse(sb) != 2);
+    FAIL_IF(!StreamingBufferCompareRawData(sb, (const uint8_t *)"ABCDEFGHIJKL0123", 16));
+
+    /* within one region: pointer to the region itself */
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    StreamingBufferSegmentGetData(sb, &seg1, &data, &data_len);
+    FAIL_IF(data != sb->regions->region[0]);
+    FAIL_IF(data_len != 6);
+    StreamingBufferSegmentGetData(sb, &seg3, &data, &data_len);
+    FAIL_IF(data != sb->regions->region[1] + 4);
+    /* spanning regions: only the range is copied */
+    StreamingBufferSegmentGetData(sb, &seg2, &data, &data_len);
+    FAIL_IF(data != sb->regions->scratch);
+    FAIL_IF(data_len != 6);
+    FAIL_IF(memcmp(data, "GHIJKL", 6) != 0);
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb, &seg2, (const uint8_t *)"GHIJKL", 6));
+
+    StreamingBufferSlide(sb, 10);
+    FAIL_IF(sb->stream_offset != 10);
+    FAIL_IF(sb->buf_offset != 6);
+    FAIL_IF(sb->regions->base != 1);
+    FAIL_IF(RegionsInUse(sb) != 1);
+    FAIL_IF(!StreamingBufferSegmentIsBeforeWindow(sb, &seg1));
+    uint64_t offset = 0;
+    FAIL_IF(StreamingBufferGetData(sb, &data, &data_len, &offset) == 0);
+    FAIL_IF(offset != 10);
+    FAIL_IF(data_len != 6);
+    FAIL_IF(memcmp(data, "KL0123", 6) != 0);
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb, &seg2, (const uint8_t *)"KL", 2));
+
+    StreamingBufferSlideToOffset(sb, 16);
+    FAIL_IF(sb->buf_offset != 0);
+    FAIL_IF(RegionsInUse(sb) != 0);
+    FAIL_IF(StreamingBufferGetData(sb, &data, &data_len, &offset) != 0);
+
+    StreamingBufferSegment seg4;
+    FAIL_IF(StreamingBufferAppend(sb, &seg4, (const uint8_t *)"abc", 3) != 0);
+    FAIL_IF(seg4.stream_offset != 16);
+    FAIL_IF(StreamingBufferGetDataAtOffset(sb, &data, &data_len, 17) == 0);
+    FAIL_IF(data_len != 2);
+    FAIL_IF(memcmp(data, "bc", 2) != 0);
+    FAIL_IF(StreamingBufferGetDataAtOffset(sb, &data, &data_len, 15) != 0);
+
+    StreamingBufferFree(sb);
+    PASS;
+}
+
+/** \test regions: gaps are not allocated and read as zeros */
+static int StreamingBufferTest12(void)
+{
+    StreamingBufferConfig cfg = { STREAMING_BUFFER_REGIONS, 0, 8, NULL, NULL, NULL, NULL };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+
+    StreamingBufferSegment seg1;
+    FAIL_IF(StreamingBufferInsertAt(sb, &seg1, (const uint8_t *)"A", 1, 0) != 0);
+    StreamingBufferSegment seg2;
+    FAIL_IF(StreamingBufferInsertAt(sb, &seg2, (const uint8_t *)"XYZ", 3, 1000) != 0);
+    FAIL_IF(sb->buf_offset != 1003);
+    FAIL_IF(RegionsInUse(sb) != 2);
+    FAIL_IF(sb->block_list == NULL);
+    FAIL_IF(sb->block_list->next == NULL);
+    FAIL_IF(sb->block_list->next->offset != 1000);
+
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    uint64_t offset = 0;
+    FAIL_IF(StreamingBufferGetData(sb, &data, &data_len, &offset) == 0);
+    FAIL_IF(data_len != 1003);
+    FAIL_IF(data[0] != 'A');
+    FAIL_IF(data[500] != 0);
+    FAIL_IF(memcmp(data + 1000, "XYZ", 3) != 0);
+
+    StreamingBufferSBBGetData(sb, sb->block_list->next, &data, &data_len);
+    FAIL_IF(data_len != 3);
+    FAIL_IF(memcmp(data, "XYZ", 3) != 0);
+
+    /* fill part of the gap, it spans 2 regions */
+    StreamingBufferSegment seg3;
+    FAIL_IF(StreamingBufferInsertAt(sb, &seg3, (const uint8_t *)"0123456789", 10, 4) != 0);
+    FAIL_IF(RegionsInUse(sb) != 3);
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb, &seg3, (const uint8_t *)"0123456789", 10));
+    FAIL_IF(StreamingBufferGetData(sb, &data, &data_len, &offset) == 0);
+    FAIL_IF(memcmp(data, "A\0\0\0" "0123456789", 14) != 0);
+
+    StreamingBufferSlideToOffset(sb, 1000);
+    FAIL_IF(RegionsInUse(sb) != 1);
+    FAIL_IF(!StreamingBufferSegmentIsBeforeWindow(sb, &seg3));
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb, &seg2, (const uint8_t *)"XYZ", 3));
+
+    StreamingBufferFree(sb);
+    PASS;
+}
+
+/** \test regions with autoslide, same offsets as StreamingBufferTest01 */
+static int StreamingBufferTest13(void)
+{
+    StreamingBufferConfig cfg = { STREAMING_BUFFER_AUTOSLIDE|STREAMING_BUFFER_REGIONS,
+                                  8, 16, NULL, NULL, NULL, NULL };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+
+    StreamingBufferSegment *seg1 = StreamingBufferAppendRaw(sb, (const uint8_t *)"ABCDEFGH", 8);
+    StreamingBufferSegment *seg2 = StreamingBufferAppendRaw(sb, (const uint8_t *)"01234567", 8);
+    FAIL_IF(seg1 == NULL || seg2 == NULL);
+    FAIL_IF(sb->stream_offset != 0);
+    FAIL_IF(sb->buf_offset != 16);
+
+    StreamingBufferSegment *seg3 = StreamingBufferAppendRaw(sb, (const uint8_t *)"QWERTY", 6);
+    FAIL_IF(seg3 == NULL);
+    FAIL_IF(sb->stream_offset != 8);
+    FAIL_IF(sb->buf_offset != 14);
+    FAIL_IF(seg3->stream_offset != 16);
+    FAIL_IF(!StreamingBufferSegmentIsBeforeWindow(sb,seg1));
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb,seg2,(const uint8_t *)"01234567", 8));
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb,seg3,(const uint8_t *)"QWERTY", 6));
+
+    StreamingBufferSegment *seg4 = StreamingBufferAppendRaw(sb, (const uint8_t *)"KLM", 3);
+    FAIL_IF(seg4 == NULL);
+    FAIL_IF(sb->stream_offset != 14);
+    FAIL_IF(sb->buf_offset != 11);
+    FAIL_IF(seg4->stream_offset != 22);
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb,seg4,(const uint8_t *)"KLM", 3));
+    FAIL_IF(RegionsInUse(sb) != 2);
+    Dump(sb);
+
+    SCFree(seg1);
+    SCFree(seg2);
+    SCFree(seg3);
+    SCFree(seg4);
+    StreamingBufferFree(sb);
+    PASS;
+}
+
+/** \test shared buffer slides to the user furthest behind and lives
+ *        until the last user is done */
+static int StreamingBufferTest14(void)
+{
+    StreamingBufferConfig cfg = { 0, 8, 24, NULL, NULL, NULL, NULL };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    uint64_t offset = 0;
+
+    StreamingBufferSegment seg;
+    FAIL_IF(StreamingBufferAppend(sb, &seg, (const uint8_t *)"ABCDEFGH", 8) != 0);
+
+    uint8_t user = 0;
+    FAIL_IF(StreamingBufferShareRef(sb, &user) != 0);
+    FAIL_IF(user != 1);
+    uint8_t user2 = 0;
+    FAIL_IF(StreamingBufferShareRef(sb, &user2) == 0);
+
+    FAIL_IF(StreamingBufferAppendNoTrack(sb, (const uint8_t *)"01234567", 8) != 0);
+
+    StreamingBufferSlideToOffsetUser(sb, user, 4);
+    FAIL_IF(sb->stream_offset != 0);
+    StreamingBufferSlideToOffset(sb, 6);
+    FAIL_IF(sb->stream_offset != 4);
+    StreamingBufferSlideToOffsetUser(sb, user, 12);
+    FAIL_IF(sb->stream_offset != 6);
+    StreamingBufferGetData(sb, &data, &data_len, &offset);
+    FAIL_IF(offset != 6 || data_len != 10 || memcmp(data, "GH01234567", 10) != 0);
+
+    /* creator is done, the user still has its data */
+    StreamingBufferFree(sb);
+    StreamingBufferGetData(sb, &data, &data_len, &offset);
+    FAIL_IF(offset != 6 || data_len != 10 || memcmp(data, "GH01234567", 10) != 0);
+    StreamingBufferSlideToOffsetUser(sb, user, 12);
+    StreamingBufferGetData(sb, &data, &data_len, &offset);
+    FAIL_IF(offset != 12 || data_len != 4 || memcmp(data, "4567", 4) != 0);
+
+    StreamingBufferFreeUser(sb, user);
+    PASS;
+}
+
+/** \test autoslide buffers can't be shared */
+static int StreamingBufferTest15(void)
+{
+    StreamingBufferConfig cfg = { STREAMING_BUFFER_AUTOSLIDE, 8, 16, NULL, NULL, NULL, NULL };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+    uint8_t user = 0;
+    FAIL_IF(StreamingBufferShareRef(sb, &user) == 0);
+    FAIL_IF(sb->share != NULL);
+    StreamingBufferFree(sb);
+    PASS;
+}
+
 #endif
 
 void StreamingBufferRegisterTests(void)
@@ -1474,5 +2039,10 @@ void StreamingBufferRegisterTests(void)
     UtRegisterTest("StreamingBufferTest08", StreamingBufferTest08);
     UtRegisterTest("StreamingBufferTest09", StreamingBufferTest09);
     UtRegisterTest("StreamingBufferTest10", StreamingBufferTest10);
+    UtRegisterTest("StreamingBufferTest11", StreamingBufferTest11);
+    UtRegisterTest("StreamingBufferTest12", StreamingBufferTest12);
+    UtRegisterTest("StreamingBufferTest13", StreamingBufferTest13);
+    UtRegisterTest("StreamingBufferTest14", StreamingBufferTest14);
+    UtRegisterTest("StreamingBufferTest15", StreamingBufferTest15);
 #endif
 }
@@ -53,6 +53,16 @@
  * +-----------+-----------+
  * | offset    | len       |
  * +-----------+-----------+
+ *
+ * With STREAMING_BUFFER_REGIONS the data is not kept in a single block,
+ * but in fixed size regions at absolute stream offsets. Sliding frees the
+ * regions before the new stream_offset instead of moving the data, and
+ * regions that only cover a gap are not allocated. Data that fits in one
+ * region is returned directly, for ranges spanning regions or gaps a
+ * copy of just that range is made on demand.
+ *
+ * Regions are opt-in per user of the buffer, through the flags of its
+ * StreamingBufferConfig.
  */
 
 
@@ -61,6 +71,10 @@
 
 #define STREAMING_BUFFER_NOFLAGS     0
 #define STREAMING_BUFFER_AUTOSLIDE  (1<<0)
+#define STREAMING_BUFFER_REGIONS    (1<<1)
+
+/** region size for STREAMING_BUFFER_REGIONS if the config's buf_size is 0 */
+#define STREAMING_BUFFER_REGION_SIZE_DEFAULT    4096
 
 typedef struct StreamingBufferConfig_ {
     uint32_t flags;
@@ -83,6 +97,33 @@ typedef struct StreamingBufferBlock_ {
     struct StreamingBufferBlock_ *next;
 } StreamingBufferBlock;
 
+/**
+ *  \brief data storage for STREAMING_BUFFER_REGIONS
+ *
+ *  region[i] holds the data of region number 'base + i', NULL if
+ *  nothing was added to that region.
+ */
+typedef struct StreamingBufferRegions_ {
+    uint8_t **region;
+    uint32_t region_cnt;    /**< size of the region array */
+    uint32_t region_size;
+    uint64_t base;          /**< region number of region[0] */
+
+    /** copy of the last range that spans regions or gaps */
+    uint8_t *scratch;
+    uint32_t scratch_size;
+} StreamingBufferRegions;
+
+/** max users of a shared buffer, the creator included */
+#define STREAMING_BUFFER_USERS_MAX  2
+
+/** users of a shared buffer and the lowest offset each one still needs.
+ *  The creator is user 0. */
+typedef struct StreamingBufferShare_ {
+    uint8_t users;          /**< bitmask of the users holding a reference */
+    uint64_t edge[STREAMING_BUFFER_USERS_MAX];
+} StreamingBufferShare;
+
 typedef struct StreamingBuffer_ {
     const StreamingBufferConfig *cfg;
     uint64_t stream_offset; /**< offset of the start of the memory block */
@@ -93,15 +134,18 @@ typedef struct StreamingBuffer_ {
 
     StreamingBufferBlock *block_list;
     StreamingBufferBlock *block_list_tail;
+
+    StreamingBufferRegions *regions;    /**< STREAMING_BUFFER_REGIONS only */
+    StreamingBufferShare *share;        /**< set if the buffer is shared */
 #ifdef DEBUG
     uint32_t buf_size_max;
 #endif
 } StreamingBuffer;
 
 #ifndef DEBUG
-#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, NULL, NULL};
+#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, NULL, NULL, NULL, NULL };
 #else
-#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, NULL, NULL, 0 };
+#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, NULL, NULL, NULL, NULL, 0 };
 #endif
 
 typedef struct StreamingBufferSegment_ {
@@ -116,6 +160,10 @@ void StreamingBufferFree(StreamingBuffer *sb);
 void StreamingBufferSlide(StreamingBuffer *sb, uint32_t slide);
 void StreamingBufferSlideToOffset(StreamingBuffer *sb, uint64_t offset);
 
+int StreamingBufferShareRef(StreamingBuffer *sb, uint8_t *user) __attribute__((warn_unused_result));
+void StreamingBufferSlideToOffsetUser(StreamingBuffer *sb, uint8_t user, uint64_t offset);
+void StreamingBufferFreeUser(StreamingBuffer *sb, uint8_t user);
+
 StreamingBufferSegment *StreamingBufferAppendRaw(StreamingBuffer *sb,
         const uint8_t *data, uint32_t data_len) __attribute__((warn_unused_result));
 int StreamingBufferAppend(StreamingBuffer *sb, StreamingBufferSegment *seg,
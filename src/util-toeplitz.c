@@ -0,0 +1,308 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Toeplitz hash as used by NICs for Receive Side Scaling (RSS).
+ *
+ * For every set bit of the input, MSB first, the 32 bits of the key
+ * starting at that bit position are XOR'd into the hash. The context
+ * keeps per input byte position a table of the hash of each of the
+ * 256 byte values, so the hash is one lookup per input byte.
+ *
+ * The input is laid out like the NICs do: source address, destination
+ * address, source port, destination port, all in network byte order.
+ */
+
+#include "suricata-common.h"
+#include "util-toeplitz.h"
+#include "util-unittest.h"
+
+/** \brief get the 32 bits of the key starting at bit 'bit' */
+static uint32_t ToeplitzKeyWindow(const uint8_t *key, uint16_t key_len, uint32_t bit)
+{
+    uint32_t v = 0;
+    uint32_t i;
+    for (i = 0; i < 32; i++) {
+        uint32_t b = bit + i;
+        v <<= 1;
+        if (b / 8 < key_len && (key[b / 8] & (0x80 >> (b % 8))))
+            v |= 1;
+    }
+    return v;
+}
+
+/** \brief bit by bit reference implementation */
+uint32_t ToeplitzHashSlow(const uint8_t *key, uint16_t key_len,
+        const uint8_t *data, uint16_t len)
+{
+    uint32_t hash = 0;
+    uint32_t i;
+    for (i = 0; i < (uint32_t)len * 8; i++) {
+        if (data[i / 8] & (0x80 >> (i % 8)))
+            hash ^= ToeplitzKeyWindow(key, key_len, i);
+    }
+    return hash;
+}
+
+/** \brief set up a Toeplitz hash context for a key
+ *
+ *  \param key_len key length, TOEPLITZ_KEY_MIN to TOEPLITZ_KEY_MAX
+ *
+ *  \retval ctx or NULL on error
+ */
+ToeplitzCtx *ToeplitzInit(const uint8_t *key, uint16_t key_len)
+{
+    if (key_len < TOEPLITZ_KEY_MIN || key_len > TOEPLITZ_KEY_MAX)
+        return NULL;
+
+    ToeplitzCtx *ctx = SCMalloc(sizeof(*ctx));
+    if (unlikely(ctx == NULL))
+        return NULL;
+    memset(ctx, 0, sizeof(*ctx));
+
+    memcpy(ctx->key, key, key_len);
+    ctx->key_len = key_len;
+
+    uint32_t i, b, j;
+    for (i = 0; i < TOEPLITZ_INPUT_MAX; i++) {
+        uint32_t w[8];
+        for (j = 0; j < 8; j++)
+            w[j] = ToeplitzKeyWindow(key, key_len, i * 8 + j);
+
+        for (b = 0; b < 256; b++) {
+            uint32_t h = 0;
+            for (j = 0; j < 8; j++) {
+                if (b & (0x80 >> j))
+                    h ^= w[j];
+            }
+            ctx->table[i][b] = h;
+        }
+    }
+    return ctx;
+}
+
+void ToeplitzFree(ToeplitzCtx *ctx)
+{
+    SCFree(ctx);
+}
+
+/** \brief parse a key in the "6d:5a:6d:5a:..." format
+ *
+ *  \param key buffer of TOEPLITZ_KEY_MAX bytes
+ *  \param key_len set to the key length
+ *
+ *  \retval 0 ok
+ *  \retval -1 invalid format or length
+ */
+int ToeplitzParseKey(const char *str, uint8_t *key, uint16_t *key_len)
+{
+    uint16_t len = 0;
+    const char *s = str;
+
+    while (*s != '\0') {
+        if (len == TOEPLITZ_KEY_MAX)
+            return -1;
+        if (!isxdigit((unsigned char)s[0]) || !isxdigit((unsigned char)s[1]))
+            return -1;
+
+        char byte[3] = { s[0], s[1], '\0' };
+        key[len++] = (uint8_t)strtoul(byte, NULL, 16);
+        s += 2;
+
+        if (*s == ':')
+            s++;
+        else if (*s != '\0')
+            return -1;
+    }
+
+    if (len < TOEPLITZ_KEY_MIN)
+        return -1;
+
+    *key_len = len;
+    return 0;
+}
+
+/** \brief check that swapping the addresses and ports gives the same hash
+ *
+ *  Only a symmetric key puts both directions of a flow in the same
+ *  bucket. Checked on a set of IPv4 and IPv6 tuples.
+ *
+ *  \retval 1 symmetric
+ *  \retval 0 not symmetric
+ */
+int ToeplitzIsSymmetric(const ToeplitzCtx *ctx)
+{
+    uint8_t fwd[TOEPLITZ_INPUT_MAX], rev[TOEPLITZ_INPUT_MAX];
+    uint32_t seed = 0x9e3779b9;
+    int t, i;
+
+    for (t = 0; t < 64; t++) {
+        /* 4 or 16 byte addresses */
+        const int alen = (t & 1) ? 16 : 4;
+
+        for (i = 0; i < alen * 2 + 4; i++) {
+            seed = seed * 1103515245 + 12345;
+            fwd[i] = (uint8_t)(seed >> 16);
+        }
+        memcpy(rev, fwd + alen, alen);
+        memcpy(rev + alen, fwd, alen);
+        memcpy(rev + alen * 2, fwd + alen * 2 + 2, 2);
+        memcpy(rev + alen * 2 + 2, fwd + alen * 2, 2);
+
+        if (ToeplitzHash(ctx, fwd, alen * 2 + 4) != ToeplitzHash(ctx, rev, alen * 2 + 4))
+            return 0;
+    }
+    return 1;
+}
+
+#ifdef UNITTESTS
+
+/* the key and vectors from the Microsoft RSS verification suite */
+static const uint8_t ms_key[40] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+typedef struct ToeplitzVector_ {
+    const char *src;
+    const char *dst;
+    uint16_t sp;
+    uint16_t dp;
+    uint32_t hash_ip;       /**< addresses only */
+    uint32_t hash_ip_ports; /**< addresses and ports */
+} ToeplitzVector;
+
+static const ToeplitzVector vectors4[] = {
+    { "66.9.149.187", "161.142.100.80", 2794, 1766, 0x323e8fc2, 0x51ccc178 },
+    { "199.92.111.2", "65.69.140.83", 14230, 4739, 0xd718262a, 0xc626b0ea },
+    { "24.19.198.95", "12.22.207.184", 12898, 38024, 0xd2d0a5de, 0x5c2b394a },
+    { "38.27.205.30", "209.142.163.6", 48228, 2217, 0x82989176, 0xafc7327f },
+    { "153.39.163.191", "202.188.127.2", 44251, 1303, 0x5d1809c5, 0x10e828a2 },
+};
+
+static const ToeplitzVector vectors6[] = {
+    { "3ffe:2501:200:1fff::7", "3ffe:2501:200:3::1", 2794, 1766,
+        0x2cc18cd5, 0x40207d3d },
+    { "3ffe:501:8::260:97ff:fe40:efab", "ff02::1", 14230, 4739,
+        0x0f0c461c, 0xdde51bbf },
+    { "3ffe:1900:4545:3:200:f8ff:fe21:67cf", "fe80::200:f8ff:fe21:67cf",
+        44251, 38024, 0x4b61e985, 0x02d1feef },
+};
+
+static int ToeplitzTestVector(const ToeplitzCtx *ctx, const ToeplitzVector *v,
+        int af, int alen)
+{
+    uint8_t in[TOEPLITZ_INPUT_MAX];
+
+    if (inet_pton(af, v->src, in) != 1 || inet_pton(af, v->dst, in + alen) != 1)
+        return 0;
+    in[alen * 2] = v->sp >> 8;
+    in[alen * 2 + 1] = v->sp & 0xff;
+    in[alen * 2 + 2] = v->dp >> 8;
+    in[alen * 2 + 3] = v->dp & 0xff;
+
+    if (ToeplitzHashSlow(ms_key, sizeof(ms_key), in, alen * 2) != v->hash_ip)
+        return 0;
+    if (ToeplitzHashSlow(ms_key, sizeof(ms_key), in, alen * 2 + 4) != v->hash_ip_ports)
+        return 0;
+    if (ToeplitzHash(ctx, in, alen * 2) != v->hash_ip)
+        return 0;
+    if (ToeplitzHash(ctx, in, alen * 2 + 4) != v->hash_ip_ports)
+        return 0;
+    return 1;
+}
+
+/** \test IPv4 verification suite vectors, slow and table driven */
+static int ToeplitzTest01(void)
+{
+    ToeplitzCtx *ctx = ToeplitzInit(ms_key, sizeof(ms_key));
+    FAIL_IF_NULL(ctx);
+
+    size_t i;
+    for (i = 0; i < sizeof(vectors4) / sizeof(vectors4[0]); i++) {
+        FAIL_IF_NOT(ToeplitzTestVector(ctx, &vectors4[i], AF_INET, 4));
+    }
+
+    ToeplitzFree(ctx);
+    PASS;
+}
+
+/** \test IPv6 verification suite vectors, slow and table driven */
+static int ToeplitzTest02(void)
+{
+    ToeplitzCtx *ctx = ToeplitzInit(ms_key, sizeof(ms_key));
+    FAIL_IF_NULL(ctx);
+
+    size_t i;
+    for (i = 0; i < sizeof(vectors6) / sizeof(vectors6[0]); i++) {
+        FAIL_IF_NOT(ToeplitzTestVector(ctx, &vectors6[i], AF_INET6, 16));
+    }
+
+    ToeplitzFree(ctx);
+    PASS;
+}
+
+/** \test key parsing and the symmetry check */
+static int ToeplitzTest03(void)
+{
+    uint8_t key[TOEPLITZ_KEY_MAX];
+    uint16_t key_len = 0;
+
+    /* 40 bytes of 6d:5a */
+    const char *sym = "6d:5a:6d:5a:6d:5a:6d:5a:6d:5a:6d:5a:6d:5a:6d:5a:"
+                      "6d:5a:6d:5a:6d:5a:6d:5a:6d:5a:6d:5a:6d:5a:6d:5a:"
+                      "6d:5a:6d:5a:6d:5a:6d:5a";
+    FAIL_IF(ToeplitzParseKey(sym, key, &key_len) != 0);
+    FAIL_IF(key_len != 40);
+    FAIL_IF(key[0] != 0x6d || key[39] != 0x5a);
+
+    ToeplitzCtx *ctx = ToeplitzInit(key, key_len);
+    FAIL_IF_NULL(ctx);
+    FAIL_IF_NOT(ToeplitzIsSymmetric(ctx));
+    ToeplitzFree(ctx);
+
+    ctx = ToeplitzInit(ms_key, sizeof(ms_key));
+    FAIL_IF_NULL(ctx);
+    FAIL_IF(ToeplitzIsSymmetric(ctx));
+    ToeplitzFree(ctx);
+
+    /* too short */
+    FAIL_IF(ToeplitzParseKey("6d:5a:6d:5a", key, &key_len) == 0);
+    /* not hex */
+    FAIL_IF(ToeplitzParseKey("6d:5g:6d:5a", key, &key_len) == 0);
+    /* bad separator */
+    FAIL_IF(ToeplitzParseKey("6d-5a", key, &key_len) == 0);
+    /* too short for the table */
+    FAIL_IF_NOT_NULL(ToeplitzInit(key, 16));
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void ToeplitzRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("ToeplitzTest01", ToeplitzTest01);
+    UtRegisterTest("ToeplitzTest02", ToeplitzTest02);
+    UtRegisterTest("ToeplitzTest03", ToeplitzTest03);
+#endif /* UNITTESTS */
+}
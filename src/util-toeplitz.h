@@ -0,0 +1,74 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Toeplitz hash as used by NICs for Receive Side Scaling (RSS).
+ */
+
+#ifndef __UTIL_TOEPLITZ_H__
+#define __UTIL_TOEPLITZ_H__
+
+/** max key size, 40 bytes is common, some NICs use 52 */
+#define TOEPLITZ_KEY_MAX        52
+/** max input size: IPv6 addresses and ports */
+#define TOEPLITZ_INPUT_MAX      36
+/** the hash input needs 4 bytes of key beyond the input */
+#define TOEPLITZ_KEY_MIN        (TOEPLITZ_INPUT_MAX + 4)
+
+/** entries in the RSS indirection table as most NICs set it up by default:
+ *  entry i points to rx queue i % queues. */
+#define TOEPLITZ_RETA_SIZE      128
+
+typedef struct ToeplitzCtx_ {
+    /** per input byte position the hash of each byte value */
+    uint32_t table[TOEPLITZ_INPUT_MAX][256];
+    uint8_t key[TOEPLITZ_KEY_MAX];
+    uint16_t key_len;
+} ToeplitzCtx;
+
+ToeplitzCtx *ToeplitzInit(const uint8_t *key, uint16_t key_len);
+void ToeplitzFree(ToeplitzCtx *ctx);
+int ToeplitzParseKey(const char *str, uint8_t *key, uint16_t *key_len);
+int ToeplitzIsSymmetric(const ToeplitzCtx *ctx);
+uint32_t ToeplitzHashSlow(const uint8_t *key, uint16_t key_len,
+        const uint8_t *data, uint16_t len);
+
+/** \brief table driven Toeplitz hash
+ *
+ *  \param len input length, max TOEPLITZ_INPUT_MAX
+ */
+static inline uint32_t ToeplitzHash(const ToeplitzCtx *ctx,
+        const uint8_t *data, uint16_t len)
+{
+    uint32_t hash = 0;
+    uint16_t i;
+    for (i = 0; i < len; i++)
+        hash ^= ctx->table[i][data[i]];
+    return hash;
+}
+
+/** \brief rx queue a NIC with the default indirection table would use */
+static inline uint32_t ToeplitzRetaQueue(uint32_t hash, uint32_t queues)
+{
+    return (hash & (TOEPLITZ_RETA_SIZE - 1)) % queues;
+}
+
+void ToeplitzRegisterTests(void);
+
+#endif /* __UTIL_TOEPLITZ_H__ */